@@ -25,12 +25,18 @@
 #define VR_DEF_OFLOW_ENTRIES        (8 * 1024)
 
 #define VR_FLOW_ENTRIES_PER_BUCKET  4U
+#define VR_OFLOW_ENTRIES_PER_BUCKET 4U
+#define VR_OFLOW_HASH_CHOICES       2U
 
 #define VR_MAX_FLOW_TABLE_HOLD_COUNT \
                                     4096
 
 unsigned int vr_flow_entries = VR_DEF_FLOW_ENTRIES;
 unsigned int vr_oflow_entries = VR_DEF_OFLOW_ENTRIES;
+unsigned int vr_flow_hold_queues = VR_DEF_FLOW_HOLD_QUEUES;
+unsigned int vr_flow_queue_limit = VR_DEF_FLOW_QUEUE_ENTRIES;
+/* flow misses per bulk trap. 0 or 1 traps every miss with its packet */
+unsigned int vr_flow_trap_batch;
 
 /*
  * host can provide its own btables. Point in case is the DPDK. In DPDK,
@@ -39,6 +45,7 @@ unsigned int vr_oflow_entries = VR_DEF_OFLOW_ENTRIES;
  */
 struct vr_btable *vr_flow_table;
 struct vr_btable *vr_oflow_table;
+struct vr_btable *vr_flow_journal_table;
 /*
  * The flow table memory can also be a file that could be mapped. The path
  * is set by somebody and passed to agent for it to map
@@ -57,8 +64,6 @@ static void vr_flush_entry(struct vrouter *, struct vr_flow_entry *,
 static void vr_flush_flow_queue(struct vrouter *, struct vr_flow_entry *,
         struct vr_forwarding_md *, struct vr_flow_queue *);
 
-struct vr_flow_entry *vr_find_flow(struct vrouter *, struct vr_flow *,
-        uint8_t, unsigned int *);
 unsigned int vr_trap_flow(struct vrouter *, struct vr_flow_entry *,
         struct vr_packet *, unsigned int);
 
@@ -212,6 +217,8 @@ vr_reset_flow_entry(struct vrouter *router, struct vr_flow_entry *fe,
     fe->fe_action = VR_FLOW_ACTION_DROP;
     fe->fe_flags = 0;
     fe->fe_udp_src_port = 0;
+    /* stats deltas of the old flow that were not folded yet are stale now */
+    fe->fe_gen++;
 
     return;
 }
@@ -248,19 +255,38 @@ vr_oflow_table_size(struct vrouter *router)
     return vr_btable_size(router->vr_oflow_table);
 }
 
+unsigned int
+vr_flow_journal_size(struct vrouter *router)
+{
+    if (!router->vr_flow_journal)
+        return 0;
+
+    return vr_btable_size(router->vr_flow_journal);
+}
+
 /*
  * this is used by the mmap code. mmap sees the whole flow table
  * (including the overflow table) as one large table. so, given
  * an offset into that large memory, we should return the correct
- * virtual address
+ * virtual address. the journal follows the tables, at an offset
+ * aligned to VR_FLOW_JOURNAL_ALIGN
  */
 void *
 vr_flow_get_va(struct vrouter *router, uint64_t offset)
 {
     struct vr_btable *table = router->vr_flow_table;
     unsigned int size = vr_flow_table_size(router);
+    unsigned int tables, journal;
+
+    tables = size + vr_oflow_table_size(router);
+    if (offset >= tables) {
+        journal = VR_FLOW_JOURNAL_OFFSET(tables);
+        if (!router->vr_flow_journal || offset < journal)
+            return NULL;
 
-    if (offset >= vr_flow_table_size(router)) {
+        table = router->vr_flow_journal;
+        offset -= journal;
+    } else if (offset >= size) {
         table = router->vr_oflow_table;
         offset -= size;
     }
@@ -268,6 +294,39 @@ vr_flow_get_va(struct vrouter *router, uint64_t offset)
     return vr_btable_get_address(table, offset);
 }
 
+/*
+ * log an event of the flow at 'index' in the journal ring of this cpu.
+ * the agent request path can be preempted by the packet path of the same
+ * cpu, and hence the position is claimed atomically
+ */
+static void
+vr_flow_journal_log(struct vrouter *router, unsigned int index,
+        unsigned short event)
+{
+    unsigned int cpu;
+    uint64_t pos;
+    struct vr_flow_journal_ring *ring;
+    struct vr_flow_journal_entry *fje;
+
+    cpu = vr_get_cpu();
+    if (!router->vr_flow_journal || cpu >= vr_num_cpus)
+        return;
+
+    ring = (struct vr_flow_journal_ring *)
+        vr_btable_get(router->vr_flow_journal, cpu);
+    if (!ring)
+        return;
+
+    pos = __sync_fetch_and_add(&ring->fjr_head, 1);
+    fje = &ring->fjr_entries[pos % VR_FLOW_JOURNAL_ENTRIES];
+    fje->fje_index = index;
+    fje->fje_event = event;
+    /* the stamp must not be seen before the entry it vouches for */
+    __atomic_store_n(&fje->fje_seq, pos + 1, __ATOMIC_RELEASE);
+
+    return;
+}
+
 struct vr_flow_entry *
 vr_get_flow_entry(struct vrouter *router, int index)
 {
@@ -288,6 +347,59 @@ vr_get_flow_entry(struct vrouter *router, int index)
     return (struct vr_flow_entry *)vr_btable_get(table, index);
 }
 
+static inline unsigned int
+vr_flow_queue_size(void)
+{
+    return sizeof(struct vr_flow_queue) +
+        (vr_flow_queue_limit * sizeof(struct vr_packet_node));
+}
+
+static struct vr_flow_queue *
+vr_flow_queue_alloc(struct vrouter *router, unsigned int index)
+{
+    unsigned int i, start, q_index;
+    struct vr_flow_queue *vfq;
+    struct vr_flow_queue_pool *pool = router->vr_flow_queue_pool;
+
+    if (pool) {
+        start = pool->vfqp_hint;
+        for (i = 0; i < VR_FLOW_QUEUE_POOL_PROBES; i++) {
+            q_index = (start + i) % pool->vfqp_entries;
+            vfq = vr_btable_get(pool->vfqp_queues, q_index);
+            if (vfq->vfq_busy ||
+                    !__sync_bool_compare_and_swap(&vfq->vfq_busy, 0, 1))
+                continue;
+
+            pool->vfqp_hint = q_index + 1;
+            vfq->vfq_index = index;
+            return vfq;
+        }
+    }
+
+    vfq = vr_zalloc(vr_flow_queue_size());
+    if (vfq)
+        vfq->vfq_index = index;
+
+    return vfq;
+}
+
+static void
+vr_flow_queue_release(struct vr_flow_queue *vfq)
+{
+    if (!(vfq->vfq_flags & VR_FLOW_QUEUE_FLAG_POOL)) {
+        vr_free(vfq);
+        return;
+    }
+
+    memset(vfq->vfq_pnodes, 0,
+            vr_flow_queue_limit * sizeof(struct vr_packet_node));
+    vfq->vfq_entries = 0;
+    __sync_synchronize();
+    vfq->vfq_busy = 0;
+
+    return;
+}
+
 static void
 vr_flow_queue_free(struct vrouter *router, void *arg)
 {
@@ -305,7 +417,7 @@ vr_flow_queue_free(struct vrouter *router, void *arg)
     vfq = (struct vr_flow_queue *)defer->vdd_data;
     fe = vr_get_flow_entry(router, vfq->vfq_index);
     vr_flush_flow_queue(router, fe, &fmd, vfq);
-    vr_free(vfq);
+    vr_flow_queue_release(vfq);
     return;
 }
 
@@ -315,7 +427,7 @@ vr_flow_queue_free_defer(struct vr_flow_md *flmd, struct vr_flow_queue *vfq)
     struct vr_defer_data *vdd = flmd->flmd_defer_data;
 
     if (!vdd) {
-        vr_free(vfq);
+        vr_flow_queue_release(vfq);
         return;
     }
 
@@ -325,57 +437,86 @@ vr_flow_queue_free_defer(struct vr_flow_md *flmd, struct vr_flow_queue *vfq)
     return;
 }
 
+/*
+ * The overflow table is carved into buckets of VR_OFLOW_ENTRIES_PER_BUCKET
+ * entries, and a key can live in one of VR_OFLOW_HASH_CHOICES such buckets,
+ * each picked by rehashing the primary hash. A lookup hence probes at most
+ * one main bucket and VR_OFLOW_HASH_CHOICES overflow buckets no matter how
+ * full the tables are, instead of walking the whole overflow table on a miss.
+ *
+ * Unlike cuckoo hashing, entries are never displaced once installed. The
+ * flow index is what agent (and the reverse flow) holds on to, and hence
+ * an entry can not be moved to make space for a new one.
+ */
+static inline void
+vr_flow_oflow_buckets(unsigned int hash, unsigned int *buckets)
+{
+    unsigned int i, num_buckets;
+
+    num_buckets = vr_oflow_entries / VR_OFLOW_ENTRIES_PER_BUCKET;
+    for (i = 0; i < VR_OFLOW_HASH_CHOICES; i++) {
+        buckets[i] = (vr_hash_1word(hash, i + 1) % num_buckets) *
+            VR_OFLOW_ENTRIES_PER_BUCKET;
+    }
+
+    return;
+}
+
+static struct vr_flow_entry *
+vr_flow_bucket_get_free(struct vr_btable *table, unsigned int start,
+        unsigned int bucket_size, unsigned int *fe_index)
+{
+    unsigned int i;
+    struct vr_flow_entry *fe;
+
+    for (i = 0; i < bucket_size; i++) {
+        fe = (struct vr_flow_entry *)vr_btable_get(table, start + i);
+        if (fe && !(fe->fe_flags & VR_FLOW_FLAG_ACTIVE)) {
+            if (vr_set_flow_active(fe)) {
+                vr_init_flow_entry(fe);
+                *fe_index = start + i;
+                return fe;
+            }
+        }
+    }
+
+    return NULL;
+}
+
 static struct vr_flow_entry *
 vr_find_free_entry(struct vrouter *router, struct vr_flow *key, uint8_t type,
         bool need_hold, unsigned int *fe_index)
 {
     unsigned int i, index, hash;
-    struct vr_flow_entry *tmp_fe, *fe = NULL;
+    unsigned int buckets[VR_OFLOW_HASH_CHOICES];
+    struct vr_flow_entry *fe = NULL;
 
     *fe_index = 0;
 
     hash = vr_hash(key, key->key_len, 0);
 
     index = (hash % vr_flow_entries) & ~(VR_FLOW_ENTRIES_PER_BUCKET - 1);
-    for (i = 0; i < VR_FLOW_ENTRIES_PER_BUCKET; i++) {
-        tmp_fe = vr_flow_table_entry_get(router, index);
-        if (tmp_fe && !(tmp_fe->fe_flags & VR_FLOW_FLAG_ACTIVE)) {
-            if (vr_set_flow_active(tmp_fe)) {
-                vr_init_flow_entry(tmp_fe);
-                fe = tmp_fe;
+    fe = vr_flow_bucket_get_free(router->vr_flow_table, index,
+            VR_FLOW_ENTRIES_PER_BUCKET, fe_index);
+
+    if (!fe && vr_oflow_entries) {
+        vr_flow_oflow_buckets(hash, buckets);
+        for (i = 0; i < VR_OFLOW_HASH_CHOICES; i++) {
+            fe = vr_flow_bucket_get_free(router->vr_oflow_table, buckets[i],
+                    VR_OFLOW_ENTRIES_PER_BUCKET, fe_index);
+            if (fe) {
+                *fe_index += vr_flow_entries;
                 break;
             }
         }
-        index++;
-    }
-
-    if (!fe) {
-        index = hash % vr_oflow_entries;
-        for (i = 0; i < vr_oflow_entries; i++) {
-            tmp_fe = vr_oflow_table_entry_get(router, index);
-            if (tmp_fe && !(tmp_fe->fe_flags & VR_FLOW_FLAG_ACTIVE)) {
-                if (vr_set_flow_active(tmp_fe)) {
-                    vr_init_flow_entry(tmp_fe);
-                    fe = tmp_fe;
-                    break;
-                }
-            }
-            index = (index + 1) % vr_oflow_entries;
-        }
-
-        if (fe)
-            *fe_index += vr_flow_entries;
     }
 
     if (fe) {
-        *fe_index += index;
         if (need_hold) {
-            fe->fe_hold_list = vr_zalloc(sizeof(struct vr_flow_queue));
+            fe->fe_hold_list = vr_flow_queue_alloc(router, *fe_index);
             if (!fe->fe_hold_list) {
                 vr_reset_flow_entry(router, fe, *fe_index);
                 fe = NULL;
-            } else {
-                fe->fe_hold_list->vfq_index = *fe_index;
             }
         }
 
@@ -383,6 +524,7 @@ vr_find_free_entry(struct vrouter *router, struct vr_flow *key, uint8_t type,
             fe->fe_type = type;
             fe->fe_key.key_len = key->key_len;
             memcpy(&fe->fe_key, key, key->key_len);
+            vr_flow_journal_log(router, *fe_index, VR_FLOW_JOURNAL_CREATE);
         }
     }
 
@@ -391,28 +533,19 @@ vr_find_free_entry(struct vrouter *router, struct vr_flow *key, uint8_t type,
 
 static inline struct vr_flow_entry *
 vr_flow_table_lookup(struct vr_flow *key, uint16_t type,
-        struct vr_btable *table, unsigned int table_size,
-        unsigned int bucket_size, unsigned int hash, unsigned int *fe_index)
+        struct vr_btable *table, unsigned int start,
+        unsigned int bucket_size, unsigned int *fe_index)
 {
     unsigned int i;
     struct vr_flow_entry *flow_e;
 
-    hash %= table_size;
-
-    if (!bucket_size) {
-        bucket_size = table_size;
-    } else {
-        hash &= ~(bucket_size - 1);
-    }
-
     for (i = 0; i < bucket_size; i++) {
-        flow_e = (struct vr_flow_entry *)vr_btable_get(table,
-                (hash + i) % table_size);
+        flow_e = (struct vr_flow_entry *)vr_btable_get(table, start + i);
         if (flow_e &&
                 (flow_e->fe_flags & VR_FLOW_FLAG_ACTIVE) &&
                 (flow_e->fe_type == type)) {
             if (!memcmp(&flow_e->fe_key, key, key->key_len)) {
-                *fe_index = (hash + i) % table_size;
+                *fe_index = start + i;
                 return flow_e;
             }
         }
@@ -422,26 +555,198 @@ vr_flow_table_lookup(struct vr_flow *key, uint16_t type,
 }
 
 
+static struct vr_flow_entry *
+__vr_find_flow(struct vrouter *router, struct vr_flow *key,
+        uint8_t type, unsigned int hash, unsigned int *fe_index)
+{
+    unsigned int i;
+    unsigned int buckets[VR_OFLOW_HASH_CHOICES];
+    struct vr_flow_entry *flow_e;
+
+    /* first look in the regular flow table */
+    flow_e = vr_flow_table_lookup(key, type, router->vr_flow_table,
+            (hash % vr_flow_entries) & ~(VR_FLOW_ENTRIES_PER_BUCKET - 1),
+            VR_FLOW_ENTRIES_PER_BUCKET, fe_index);
+    if (flow_e || !vr_oflow_entries)
+        return flow_e;
+
+    /* if not in the regular flow table, lookup the overflow buckets */
+    vr_flow_oflow_buckets(hash, buckets);
+    for (i = 0; i < VR_OFLOW_HASH_CHOICES; i++) {
+        flow_e = vr_flow_table_lookup(key, type, router->vr_oflow_table,
+                buckets[i], VR_OFLOW_ENTRIES_PER_BUCKET, fe_index);
+        if (flow_e) {
+            *fe_index += vr_flow_entries;
+            break;
+        }
+    }
+
+    return flow_e;
+}
+
+/*
+ * __vr_find_flow() for the packet path, that goes through the flow cache
+ * of the cpu first
+ */
+static struct vr_flow_entry *
+vr_find_flow_cached(struct vrouter *router, struct vr_flow *key,
+        uint8_t type, unsigned int hash, unsigned int *fe_index)
+{
+    unsigned int cpu;
+    struct vr_flow_cache_entry *fce;
+    struct vr_flow_entry *flow_e;
+
+    cpu = vr_get_cpu();
+    if (!router->vr_flow_cache || cpu >= vr_num_cpus)
+        return __vr_find_flow(router, key, type, hash, fe_index);
+
+    fce = &router->vr_flow_cache[cpu].fc_entries[hash &
+        (VR_FLOW_CACHE_ENTRIES - 1)];
+    if (fce->fce_hash == hash) {
+        flow_e = vr_get_flow_entry(router, fce->fce_index);
+        if (flow_e &&
+                (flow_e->fe_flags & VR_FLOW_FLAG_ACTIVE) &&
+                (flow_e->fe_type == type) &&
+                !memcmp(&flow_e->fe_key, key, key->key_len)) {
+            *fe_index = fce->fce_index;
+            return flow_e;
+        }
+    }
+
+    flow_e = __vr_find_flow(router, key, type, hash, fe_index);
+    if (flow_e) {
+        fce->fce_hash = hash;
+        fce->fce_index = *fe_index;
+    }
+
+    return flow_e;
+}
+
 struct vr_flow_entry *
 vr_find_flow(struct vrouter *router, struct vr_flow *key,
         uint8_t type, unsigned int *fe_index)
 {
     unsigned int hash;
-    struct vr_flow_entry *flow_e;
 
     hash = vr_hash(key, key->key_len, 0);
+    return __vr_find_flow(router, key, type, hash, fe_index);
+}
 
-    /* first look in the regular flow table */
-    flow_e = vr_flow_table_lookup(key, type, router->vr_flow_table,
-            vr_flow_entries, VR_FLOW_ENTRIES_PER_BUCKET, hash, fe_index);
-    /* if not in the regular flow table, lookup in the overflow flow table */
-    if (!flow_e) {
-        flow_e = vr_flow_table_lookup(key, type, router->vr_oflow_table,
-                vr_oflow_entries, 0, hash, fe_index);
-        *fe_index += vr_flow_entries;
+/*
+ * prefetch what the lookup of a flow with 'hash' will load first: the
+ * entry the flow cache of the cpu points to, or else the bucket
+ */
+static inline void
+vr_flow_prefetch(struct vrouter *router, unsigned int hash)
+{
+    unsigned int i, cpu, index;
+    struct vr_flow_cache_entry *fce;
+
+    cpu = vr_get_cpu();
+    if (router->vr_flow_cache && cpu < vr_num_cpus) {
+        fce = &router->vr_flow_cache[cpu].fc_entries[hash &
+            (VR_FLOW_CACHE_ENTRIES - 1)];
+        if (fce->fce_hash == hash) {
+            __builtin_prefetch(vr_get_flow_entry(router, fce->fce_index));
+            return;
+        }
     }
 
-    return flow_e;
+    index = (hash % vr_flow_entries) & ~(VR_FLOW_ENTRIES_PER_BUCKET - 1);
+    for (i = 0; i < VR_FLOW_ENTRIES_PER_BUCKET; i++)
+        __builtin_prefetch(vr_btable_get(router->vr_flow_table, index + i));
+
+    return;
+}
+
+/*
+ * Prefetches the flow entries of a burst of packets received on 'vif',
+ * before the packets take the regular receive path one by one. The keys
+ * of all packets are formed and hashed first, and the entries they map
+ * to are prefetched, so that the memory loads of the whole burst overlap
+ * instead of stalling each packet's flow lookup in turn.
+ *
+ * If 'hints' is not NULL, the key and hash of pkts[i] are left in
+ * hints[i], for the caller to hand to the lookup of the packet with
+ * vr_flow_hint(), which then does not hash the key again.
+ *
+ * Returns the number of packets whose key could be formed.
+ */
+unsigned int
+vr_flow_prefetch_burst(struct vrouter *router, struct vr_interface *vif,
+        struct vr_packet **pkts, unsigned int nb_pkts,
+        struct vr_flow_hint *hints)
+{
+    unsigned int i, hash, nb = 0;
+    struct vr_flow key, *key_p = &key;
+
+    if (hints) {
+        for (i = 0; i < nb_pkts; i++)
+            hints[i].fh_pkt = NULL;
+    }
+
+    if (!router || !router->vr_flow_table)
+        return 0;
+
+    for (i = 0; i < nb_pkts; i++) {
+        if (hints)
+            key_p = &hints[i].fh_key;
+
+        if (!vr_inet_flow_rx_key(vif, pkts[i], key_p))
+            continue;
+
+        hash = vr_hash(key_p, key_p->key_len, 0);
+        vr_flow_prefetch(router, hash);
+        if (hints) {
+            hints[i].fh_pkt = pkts[i];
+            hints[i].fh_hash = hash;
+        }
+        nb++;
+    }
+
+    return nb;
+}
+
+/*
+ * sets the hint that the flow lookups on this cpu use, until the next
+ * call. NULL clears it, and has to be set before the hint goes out of
+ * scope
+ */
+void
+vr_flow_hint(struct vrouter *router, struct vr_flow_hint *hint)
+{
+    unsigned int cpu;
+
+    cpu = vr_get_cpu();
+    if (!router || !router->vr_flow_cache || cpu >= vr_num_cpus)
+        return;
+
+    router->vr_flow_cache[cpu].fc_hint = hint;
+
+    return;
+}
+
+/*
+ * the hash of the flow key of 'pkt': the one of the hint of the cpu, if
+ * the hint is of this packet and has the same key
+ */
+static inline unsigned int
+vr_flow_hash(struct vrouter *router, struct vr_flow *key,
+        struct vr_packet *pkt)
+{
+    unsigned int cpu;
+    struct vr_flow_hint *hint;
+
+    cpu = vr_get_cpu();
+    if (router->vr_flow_cache && cpu < vr_num_cpus) {
+        hint = router->vr_flow_cache[cpu].fc_hint;
+        if (hint && (hint->fh_pkt == pkt) &&
+                (hint->fh_key.key_len == key->key_len) &&
+                !memcmp(&hint->fh_key, key, key->key_len))
+            return hint->fh_hash;
+    }
+
+    return vr_hash(key, key->key_len, 0);
 }
 
 static int
@@ -460,7 +765,7 @@ vr_enqueue_flow(struct vrouter *router, struct vr_flow_entry *fe,
     }
 
     i = __sync_fetch_and_add(&vfq->vfq_entries, 1);
-    if (i >= VR_MAX_FLOW_QUEUE_ENTRIES) {
+    if (i >= vr_flow_queue_limit) {
         drop_reason = VP_DROP_FLOW_QUEUE_LIMIT_EXCEEDED;
         goto drop;
     }
@@ -624,6 +929,91 @@ vr_flow_action(struct vrouter *router, struct vr_flow_entry *fe,
 }
 
 
+static void
+vr_flow_trap_batch_send(struct vrouter *router, struct vr_packet *pkt)
+{
+    unsigned int count;
+
+    pkt->vp_if = router->vr_agent_if;
+    if (!pkt->vp_if) {
+        vr_pfree(pkt, VP_DROP_TRAP_NO_IF);
+        return;
+    }
+
+    count = pkt_len(pkt) / sizeof(struct agent_flow_miss);
+    vr_trap(pkt, 0, AGENT_TRAP_FLOW_MISS_BULK, &count);
+
+    return;
+}
+
+static struct vr_packet *
+vr_flow_trap_batch_alloc(struct vrouter *router, unsigned int cpu)
+{
+    unsigned int head_space;
+    struct vr_packet *pkt;
+
+    if (!router->vr_agent_if)
+        return NULL;
+
+    head_space = (2 * sizeof(struct vr_eth)) + sizeof(struct agent_hdr);
+    pkt = vr_palloc(head_space +
+            (vr_flow_trap_batch * sizeof(struct agent_flow_miss)));
+    if (!pkt)
+        return NULL;
+
+    pkt->vp_data += head_space;
+    pkt->vp_tail += head_space;
+    pkt->vp_if = router->vr_agent_if;
+    pkt->vp_cpu = cpu;
+    pkt->vp_network_h = 0;
+
+    return pkt;
+}
+
+/*
+ * the message of a cpu is owned by whoever swapped it out of the slot,
+ * the cpu itself or the timer. only the cpu puts it back
+ */
+static int
+vr_flow_trap_batch_add(struct vrouter *router, struct vr_flow_entry *fe,
+        struct vr_packet *pkt, unsigned int index)
+{
+    unsigned int cpu;
+    struct vr_flow_trap_slot *fts;
+    struct vr_packet *bpkt;
+    struct agent_flow_miss *afm;
+
+    cpu = vr_get_cpu();
+    if (cpu >= vr_num_cpus)
+        return -EINVAL;
+
+    fts = &router->vr_flow_trap_batch->ftb_slots[cpu];
+    bpkt = __sync_lock_test_and_set(&fts->fts_pkt, NULL);
+    if (!bpkt) {
+        bpkt = vr_flow_trap_batch_alloc(router, cpu);
+        if (!bpkt)
+            return -ENOMEM;
+    }
+
+    afm = (struct agent_flow_miss *)(pkt_data(bpkt) + pkt_len(bpkt));
+    afm->afm_index = htonl(index);
+    afm->afm_nh_index = 0;
+    if (fe->fe_type == VP_TYPE_IP)
+        afm->afm_nh_index = htonl(fe->fe_key.flow4_nh_id);
+    afm->afm_ifindex = htons(pkt->vp_if->vif_idx);
+    afm->afm_vrf = htons(fe->fe_vrf);
+    pkt_pull_tail(bpkt, sizeof(*afm));
+
+    if (pkt_len(bpkt) >= vr_flow_trap_batch * sizeof(*afm)) {
+        vr_flow_trap_batch_send(router, bpkt);
+    } else {
+        __sync_synchronize();
+        fts->fts_pkt = bpkt;
+    }
+
+    return 0;
+}
+
 unsigned int
 vr_trap_flow(struct vrouter *router, struct vr_flow_entry *fe,
         struct vr_packet *pkt, unsigned int index)
@@ -632,6 +1022,12 @@ vr_trap_flow(struct vrouter *router, struct vr_flow_entry *fe,
     struct vr_packet *npkt;
     struct vr_flow_trap_arg ta;
 
+    if (router->vr_flow_trap_batch &&
+            !(fe->fe_flags & VR_FLOW_FLAG_TRAP_MASK)) {
+        if (!vr_flow_trap_batch_add(router, fe, pkt, index))
+            return 0;
+    }
+
     npkt = vr_pclone(pkt);
     if (!npkt)
         return -ENOMEM;
@@ -651,21 +1047,124 @@ vr_trap_flow(struct vrouter *router, struct vr_flow_entry *fe,
     return vr_trap(npkt, fe->fe_vrf, trap_reason, &ta);
 }
 
-static flow_result_t
-vr_do_flow_action(struct vrouter *router, struct vr_flow_entry *fe,
-        unsigned int index, struct vr_packet *pkt,
-        struct vr_forwarding_md *fmd)
+static void
+vr_flow_stats_add(struct vrouter *router, struct vr_flow_entry *fe,
+        unsigned int index, uint64_t bytes, uint32_t packets)
 {
     uint32_t new_stats;
 
-    new_stats = __sync_add_and_fetch(&fe->fe_stats.flow_bytes, pkt_len(pkt));
-    if (new_stats < pkt_len(pkt))
+    new_stats = __sync_add_and_fetch(&fe->fe_stats.flow_bytes,
+            (uint32_t)bytes);
+    if (new_stats < (uint32_t)bytes)
         fe->fe_stats.flow_bytes_oflow++;
+    fe->fe_stats.flow_bytes_oflow += (bytes >> 32);
 
-    new_stats = __sync_add_and_fetch(&fe->fe_stats.flow_packets, 1);
-    if (!new_stats)
+    new_stats = __sync_add_and_fetch(&fe->fe_stats.flow_packets, packets);
+    if (new_stats < packets)
         fe->fe_stats.flow_packets_oflow++;
 
+    if (((new_stats - packets) ^ new_stats) >> VR_FLOW_JOURNAL_STATS_SHIFT)
+        vr_flow_journal_log(router, index, VR_FLOW_JOURNAL_STATS);
+
+    return;
+}
+
+/*
+ * account the packet in the stats shard of the cpu. the flow entry itself
+ * is updated only if the slot of the flow is taken by another flow, or by
+ * an earlier flow of the same index
+ */
+static void
+vr_flow_stats_update(struct vrouter *router, struct vr_flow_entry *fe,
+        unsigned int index, unsigned int len)
+{
+    unsigned int cpu;
+    struct vr_flow_stats_delta *fsd = router->vr_flow_stats_delta;
+    struct vr_flow_stats_shard *fsh;
+    struct vr_flow_stats_slot *fss;
+
+    cpu = vr_get_cpu();
+    if (fsd && cpu < vr_num_cpus) {
+        fsh = fsd->fsd_cpu[cpu].fsc_active;
+        fss = &fsh->fsh_slots[index & (VR_FLOW_STATS_SLOTS - 1)];
+        if (!fss->fss_index) {
+            fss->fss_index = index + 1;
+            fss->fss_gen = fe->fe_gen;
+        }
+
+        if ((fss->fss_index == index + 1) && (fss->fss_gen == fe->fe_gen)) {
+            fss->fss_bytes += len;
+            fss->fss_packets++;
+            return;
+        }
+    }
+
+    vr_flow_stats_add(router, fe, index, len, 1);
+    return;
+}
+
+/*
+ * take the deltas out of a claimed slot. the swaps pair with the ones of
+ * whoever else claims it, so a fold freeing the slot can not leave a
+ * delete reading zeros
+ */
+static void
+vr_flow_stats_slot_take(struct vr_flow_stats_slot *fss, uint64_t *bytes,
+        uint32_t *packets)
+{
+    *bytes = __sync_lock_test_and_set(&fss->fss_bytes, 0);
+    *packets = __sync_lock_test_and_set(&fss->fss_packets, 0);
+
+    return;
+}
+
+/*
+ * fold the deltas of a flow that agent deletes into the entry, which would
+ * otherwise lose up to a fold interval of stats to the generation bump of
+ * the reset. the generation is bumped first, so that packets from now on
+ * update the entry directly. a cpu that was updating its slot right then
+ * may still lose that one packet
+ */
+static void
+vr_flow_stats_flush(struct vrouter *router, struct vr_flow_entry *fe,
+        unsigned int index)
+{
+    unsigned int cpu, i;
+    uint8_t gen;
+    uint32_t packets;
+    uint64_t bytes;
+    struct vr_flow_stats_delta *fsd = router->vr_flow_stats_delta;
+    struct vr_flow_stats_shard *shards[2];
+    struct vr_flow_stats_slot *fss;
+
+    if (!fsd)
+        return;
+
+    gen = __sync_fetch_and_add(&fe->fe_gen, 1);
+    for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+        shards[0] = fsd->fsd_cpu[cpu].fsc_active;
+        shards[1] = fsd->fsd_cpu[cpu].fsc_spare;
+        for (i = 0; i < 2; i++) {
+            fss = &shards[i]->fsh_slots[index & (VR_FLOW_STATS_SLOTS - 1)];
+            if ((fss->fss_index == index + 1) &&
+                    __sync_bool_compare_and_swap(&fss->fss_gen, gen,
+                        VR_FLOW_STATS_GEN_CLAIMED)) {
+                vr_flow_stats_slot_take(fss, &bytes, &packets);
+                vr_flow_stats_add(router, fe, index, bytes, packets);
+            }
+        }
+    }
+
+    return;
+}
+
+static flow_result_t
+vr_do_flow_action(struct vrouter *router, struct vr_flow_entry *fe,
+        unsigned int index, struct vr_packet *pkt,
+        struct vr_forwarding_md *fmd)
+{
+    vr_flow_stats_update(router, fe, index, pkt_len(pkt));
+
     if (fe->fe_action == VR_FLOW_ACTION_HOLD) {
         vr_enqueue_flow(router, fe, pkt, index, fmd);
         return FLOW_HELD;
@@ -693,7 +1192,8 @@ vr_flow_table_hold_count(struct vrouter *router)
 }
 
 static void
-vr_flow_entry_set_hold(struct vrouter *router, struct vr_flow_entry *flow_e)
+vr_flow_entry_set_hold(struct vrouter *router, struct vr_flow_entry *flow_e,
+        unsigned int index)
 {
     unsigned int cpu;
     uint64_t act_count;
@@ -716,6 +1216,7 @@ vr_flow_entry_set_hold(struct vrouter *router, struct vr_flow_entry *flow_e)
     }
 
     infop->vfti_hold_count[cpu]++;
+    vr_flow_journal_log(router, index, VR_FLOW_JOURNAL_HOLD);
 
     return;
 }
@@ -729,7 +1230,8 @@ vr_flow_lookup(struct vrouter *router, struct vr_flow *key,
 
     pkt->vp_flags |= VP_FLAG_FLOW_SET;
 
-    flow_e = vr_find_flow(router, key, pkt->vp_type,  &fe_index);
+    flow_e = vr_find_flow_cached(router, key, pkt->vp_type,
+            vr_flow_hash(router, key, pkt), &fe_index);
     if (!flow_e) {
         if (pkt->vp_nh &&
             (pkt->vp_nh->nh_flags & NH_FLAG_RELAXED_POLICY))
@@ -749,7 +1251,7 @@ vr_flow_lookup(struct vrouter *router, struct vr_flow *key,
 
         flow_e->fe_vrf = fmd->fmd_dvrf;
         /* mark as hold */
-        vr_flow_entry_set_hold(router, flow_e);
+        vr_flow_entry_set_hold(router, flow_e, fe_index);
     }
 
     return vr_do_flow_action(router, flow_e, fe_index, pkt, fmd);
@@ -812,7 +1314,7 @@ vr_flush_flow_queue(struct vrouter *router, struct vr_flow_entry *fe,
 
     flow_result_t result;
 
-    for (i = 0; i < VR_MAX_FLOW_QUEUE_ENTRIES; i++) {
+    for (i = 0; i < vr_flow_queue_limit; i++) {
         pnode = &vfq->vfq_pnodes[i];
         if (fmd) {
             memset(fmd, 0, sizeof(*fmd));
@@ -900,6 +1402,7 @@ vr_flow_flush(void *arg)
 
     if (!(flmd->flmd_flags & VR_FLOW_FLAG_ACTIVE)) {
         vr_reset_flow_entry(router, fe, flmd->flmd_index);
+        vr_flow_journal_log(router, flmd->flmd_index, VR_FLOW_JOURNAL_DELETE);
     }
 
 exit_flush:
@@ -1091,6 +1594,7 @@ vr_flow_delete(struct vrouter *router, vr_flow_req *req,
 
     fe->fe_action = VR_FLOW_ACTION_DROP;
     vr_flow_reset_mirror(router, fe, req->fr_index);
+    vr_flow_stats_flush(router, fe, req->fr_index);
 
     return vr_flow_schedule_transition(router, req, fe);
 }
@@ -1174,7 +1678,7 @@ vr_flow_set(struct vrouter *router, vr_flow_req *req)
         if ((req->fr_action == VR_FLOW_ACTION_HOLD) &&
                 (fe->fe_action != req->fr_action)) {
             if (!fe->fe_hold_list) {
-                fe->fe_hold_list = vr_zalloc(sizeof(struct vr_flow_queue));
+                fe->fe_hold_list = vr_flow_queue_alloc(router, req->fr_index);
                 if (!fe->fe_hold_list)
                     return -ENOMEM;
             }
@@ -1215,6 +1719,9 @@ vr_flow_set(struct vrouter *router, vr_flow_req *req)
         fe->fe_drop_reason = (uint8_t)req->fr_drop_reason;
     fe->fe_flags = req->fr_flags;
     vr_flow_udp_src_port(router, fe);
+    vr_flow_journal_log(router, req->fr_index,
+            (fe->fe_action == VR_FLOW_ACTION_HOLD) ?
+            VR_FLOW_JOURNAL_HOLD : VR_FLOW_JOURNAL_ACTION);
 
     return vr_flow_schedule_transition(router, req, fe);
 }
@@ -1286,6 +1793,7 @@ vr_flow_req_process(void *s_req)
         resp->fr_op = req->fr_op;
         resp->fr_ftable_size = vr_flow_table_size(router) +
             vr_oflow_table_size(router);
+        resp->fr_journal_size = vr_flow_journal_size(router);
 #if defined(__linux__) && defined(__KERNEL__)
         resp->fr_ftable_dev = vr_flow_major;
 #endif
@@ -1356,9 +1864,471 @@ vr_flow_table_info_init(struct vrouter *router)
     return 0;
 }
 
+static void
+vr_flow_cache_destroy(struct vrouter *router)
+{
+    if (!router->vr_flow_cache)
+        return;
+
+    vr_free(router->vr_flow_cache);
+    router->vr_flow_cache = NULL;
+
+    return;
+}
+
+static void
+vr_flow_cache_reset(struct vrouter *router)
+{
+    if (!router->vr_flow_cache)
+        return;
+
+    memset(router->vr_flow_cache, 0,
+            sizeof(struct vr_flow_cache) * vr_num_cpus);
+    return;
+}
+
+static int
+vr_flow_cache_init(struct vrouter *router)
+{
+    unsigned int size;
+
+    if (router->vr_flow_cache)
+        return 0;
+
+    size = sizeof(struct vr_flow_cache) * vr_num_cpus;
+    router->vr_flow_cache = vr_zalloc(size);
+    if (!router->vr_flow_cache)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, size);
+
+    return 0;
+}
+
+static void
+vr_flow_stats_delta_free(struct vr_flow_stats_delta *fsd)
+{
+    unsigned int i;
+
+    for (i = 0; i < vr_num_cpus; i++) {
+        if (fsd->fsd_cpu[i].fsc_active)
+            vr_free(fsd->fsd_cpu[i].fsc_active);
+        if (fsd->fsd_cpu[i].fsc_spare)
+            vr_free(fsd->fsd_cpu[i].fsc_spare);
+    }
+
+    if (fsd->fsd_timer)
+        vr_free(fsd->fsd_timer);
+    vr_free(fsd);
+
+    return;
+}
+
+/*
+ * runs a grace period after the shards were swapped, when no cpu writes to
+ * the spare shards anymore. a slot that a delete has claimed is left to
+ * the delete to take the deltas of, and only freed here
+ */
+static void
+vr_flow_stats_fold(struct vrouter *router, void *arg)
+{
+    unsigned int i, j;
+    uint32_t gen, packets;
+    uint64_t bytes;
+    struct vr_defer_data *vdd = (struct vr_defer_data *)arg;
+    struct vr_flow_stats_delta *fsd;
+    struct vr_flow_stats_shard *fsh;
+    struct vr_flow_stats_slot *fss;
+    struct vr_flow_entry *fe;
+
+    if (!vdd)
+        return;
+
+    fsd = (struct vr_flow_stats_delta *)vdd->vdd_data;
+    if (!(fsd->fsd_state & VR_FLOW_STATS_DEAD)) {
+        for (i = 0; i < vr_num_cpus; i++) {
+            fsh = fsd->fsd_cpu[i].fsc_spare;
+            for (j = 0; j < VR_FLOW_STATS_SLOTS; j++) {
+                fss = &fsh->fsh_slots[j];
+                if (!fss->fss_index)
+                    continue;
+
+                /* a delete of the flow may be folding the slot as well */
+                gen = __sync_lock_test_and_set(&fss->fss_gen,
+                        VR_FLOW_STATS_GEN_CLAIMED);
+                if (gen != VR_FLOW_STATS_GEN_CLAIMED) {
+                    vr_flow_stats_slot_take(fss, &bytes, &packets);
+                    fe = vr_get_flow_entry(router, fss->fss_index - 1);
+                    if (fe && (fe->fe_flags & VR_FLOW_FLAG_ACTIVE) &&
+                            (fe->fe_gen == gen))
+                        vr_flow_stats_add(router, fe, fss->fss_index - 1,
+                                bytes, packets);
+                }
+
+                fss->fss_index = 0;
+                fss->fss_gen = 0;
+            }
+        }
+    }
+
+    /* the table went away while we were waiting, and left the free to us */
+    if (__sync_fetch_and_and(&fsd->fsd_state, ~VR_FLOW_STATS_FOLD_PENDING) &
+            VR_FLOW_STATS_DEAD)
+        vr_flow_stats_delta_free(fsd);
+
+    return;
+}
+
+static void
+vr_flow_stats_fold_timer(void *arg)
+{
+    unsigned int i;
+    struct vr_flow_stats_delta *fsd = (struct vr_flow_stats_delta *)arg;
+    struct vr_flow_stats_shard *fsh;
+    struct vr_defer_data *vdd;
+
+    if (vr_not_ready)
+        return;
+
+    /* the last fold has not run yet, and the spare shards are busy */
+    if (fsd->fsd_state & VR_FLOW_STATS_FOLD_PENDING)
+        return;
+
+    vdd = vr_get_defer_data(sizeof(*vdd));
+    if (!vdd)
+        return;
+
+    for (i = 0; i < vr_num_cpus; i++) {
+        fsh = fsd->fsd_cpu[i].fsc_active;
+        fsd->fsd_cpu[i].fsc_active = fsd->fsd_cpu[i].fsc_spare;
+        fsd->fsd_cpu[i].fsc_spare = fsh;
+    }
+
+    (void)__sync_fetch_and_or(&fsd->fsd_state, VR_FLOW_STATS_FOLD_PENDING);
+    vdd->vdd_data = (void *)fsd;
+    vr_defer(fsd->fsd_router, vr_flow_stats_fold, (void *)vdd);
+
+    return;
+}
+
+static void
+vr_flow_stats_delta_destroy(struct vrouter *router)
+{
+    struct vr_flow_stats_delta *fsd = router->vr_flow_stats_delta;
+
+    if (!fsd)
+        return;
+
+    router->vr_flow_stats_delta = NULL;
+    vr_delete_timer(fsd->fsd_timer);
+
+    /* a fold is in flight. it will free the shards once done */
+    if (__sync_fetch_and_or(&fsd->fsd_state, VR_FLOW_STATS_DEAD) &
+            VR_FLOW_STATS_FOLD_PENDING)
+        return;
+
+    vr_flow_stats_delta_free(fsd);
+    return;
+}
+
+static void
+vr_flow_stats_delta_reset(struct vrouter *router)
+{
+    unsigned int i;
+    struct vr_flow_stats_delta *fsd = router->vr_flow_stats_delta;
+
+    if (!fsd)
+        return;
+
+    /* deltas of the flushed flows should not land in their successors */
+    for (i = 0; i < vr_num_cpus; i++) {
+        memset(fsd->fsd_cpu[i].fsc_active, 0,
+                sizeof(struct vr_flow_stats_shard));
+        memset(fsd->fsd_cpu[i].fsc_spare, 0,
+                sizeof(struct vr_flow_stats_shard));
+    }
+
+    return;
+}
+
+static int
+vr_flow_stats_delta_init(struct vrouter *router)
+{
+    int ret = -ENOMEM;
+    unsigned int i, size;
+    struct vr_flow_stats_delta *fsd;
+    struct vr_timer *vtimer;
+
+    if (router->vr_flow_stats_delta)
+        return 0;
+
+    size = sizeof(*fsd) + sizeof(struct vr_flow_stats_cpu) * vr_num_cpus;
+    fsd = vr_zalloc(size);
+    if (!fsd)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, size);
+
+    fsd->fsd_router = router;
+    for (i = 0; i < vr_num_cpus; i++) {
+        fsd->fsd_cpu[i].fsc_active =
+            vr_zalloc(sizeof(struct vr_flow_stats_shard));
+        fsd->fsd_cpu[i].fsc_spare =
+            vr_zalloc(sizeof(struct vr_flow_stats_shard));
+        if (!fsd->fsd_cpu[i].fsc_active || !fsd->fsd_cpu[i].fsc_spare) {
+            vr_module_error(ret, __FUNCTION__, __LINE__, i);
+            goto fail_init;
+        }
+    }
+
+    vtimer = vr_zalloc(sizeof(*vtimer));
+    if (!vtimer) {
+        vr_module_error(ret, __FUNCTION__, __LINE__, sizeof(*vtimer));
+        goto fail_init;
+    }
+
+    vtimer->vt_timer = vr_flow_stats_fold_timer;
+    vtimer->vt_vr_arg = fsd;
+    vtimer->vt_msecs = VR_FLOW_STATS_FOLD_MSECS;
+    fsd->fsd_timer = vtimer;
+
+    if ((ret = vr_create_timer(vtimer))) {
+        vr_module_error(ret, __FUNCTION__, __LINE__, 0);
+        goto fail_init;
+    }
+
+    router->vr_flow_stats_delta = fsd;
+    return 0;
+
+fail_init:
+    vr_flow_stats_delta_free(fsd);
+    return ret;
+}
+
+static void
+vr_flow_queue_pool_destroy(struct vrouter *router)
+{
+    struct vr_flow_queue_pool *pool = router->vr_flow_queue_pool;
+
+    if (!pool)
+        return;
+
+    router->vr_flow_queue_pool = NULL;
+    if (pool->vfqp_queues)
+        vr_btable_free(pool->vfqp_queues);
+    vr_free(pool);
+
+    return;
+}
+
+static int
+vr_flow_queue_pool_init(struct vrouter *router)
+{
+    unsigned int i;
+    struct vr_flow_queue *vfq;
+    struct vr_flow_queue_pool *pool;
+
+    if (router->vr_flow_queue_pool)
+        return 0;
+
+    if (!vr_flow_queue_limit ||
+            (vr_flow_queue_limit > VR_MAX_FLOW_QUEUE_ENTRIES))
+        return vr_module_error(-EINVAL, __FUNCTION__, __LINE__,
+                vr_flow_queue_limit);
+
+    /* no pool, all hold queues come from the heap */
+    if (!vr_flow_hold_queues)
+        return 0;
+
+    pool = vr_zalloc(sizeof(*pool));
+    if (!pool)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
+                sizeof(*pool));
+
+    pool->vfqp_queues = vr_btable_alloc(vr_flow_hold_queues,
+            vr_flow_queue_size());
+    if (!pool->vfqp_queues) {
+        vr_free(pool);
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
+                vr_flow_hold_queues);
+    }
+
+    pool->vfqp_entries = vr_flow_hold_queues;
+    for (i = 0; i < pool->vfqp_entries; i++) {
+        vfq = vr_btable_get(pool->vfqp_queues, i);
+        vfq->vfq_flags = VR_FLOW_QUEUE_FLAG_POOL;
+    }
+
+    router->vr_flow_queue_pool = pool;
+    return 0;
+}
+
+static void
+vr_flow_trap_batch_timer(void *arg)
+{
+    unsigned int i;
+    struct vr_flow_trap_batch *ftb = (struct vr_flow_trap_batch *)arg;
+    struct vr_packet *pkt;
+
+    for (i = 0; i < vr_num_cpus; i++) {
+        if (!ftb->ftb_slots[i].fts_pkt)
+            continue;
+
+        pkt = __sync_lock_test_and_set(&ftb->ftb_slots[i].fts_pkt, NULL);
+        if (pkt)
+            vr_flow_trap_batch_send(ftb->ftb_router, pkt);
+    }
+
+    return;
+}
+
+static void
+vr_flow_trap_batch_reset(struct vrouter *router)
+{
+    unsigned int i;
+    struct vr_flow_trap_batch *ftb = router->vr_flow_trap_batch;
+    struct vr_packet *pkt;
+
+    if (!ftb)
+        return;
+
+    /* the flows these misses are for are gone */
+    for (i = 0; i < vr_num_cpus; i++) {
+        pkt = __sync_lock_test_and_set(&ftb->ftb_slots[i].fts_pkt, NULL);
+        if (pkt)
+            vr_pfree(pkt, VP_DROP_FLOW_UNUSABLE);
+    }
+
+    return;
+}
+
+static void
+vr_flow_trap_batch_destroy(struct vrouter *router)
+{
+    struct vr_flow_trap_batch *ftb = router->vr_flow_trap_batch;
+
+    if (!ftb)
+        return;
+
+    vr_delete_timer(ftb->ftb_timer);
+    vr_flow_trap_batch_reset(router);
+    router->vr_flow_trap_batch = NULL;
+
+    vr_free(ftb->ftb_timer);
+    vr_free(ftb);
+
+    return;
+}
+
+static int
+vr_flow_trap_batch_init(struct vrouter *router)
+{
+    int ret = -ENOMEM;
+    unsigned int size;
+    struct vr_flow_trap_batch *ftb;
+    struct vr_timer *vtimer;
+
+    if (router->vr_flow_trap_batch || (vr_flow_trap_batch <= 1))
+        return 0;
+
+    if (vr_flow_trap_batch > VR_FLOW_TRAP_BATCH_MAX)
+        vr_flow_trap_batch = VR_FLOW_TRAP_BATCH_MAX;
+
+    size = sizeof(*ftb) + sizeof(struct vr_flow_trap_slot) * vr_num_cpus;
+    ftb = vr_zalloc(size);
+    if (!ftb)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, size);
+
+    vtimer = vr_zalloc(sizeof(*vtimer));
+    if (!vtimer) {
+        vr_module_error(ret, __FUNCTION__, __LINE__, sizeof(*vtimer));
+        goto fail_init;
+    }
+
+    ftb->ftb_router = router;
+    ftb->ftb_timer = vtimer;
+    vtimer->vt_timer = vr_flow_trap_batch_timer;
+    vtimer->vt_vr_arg = ftb;
+    vtimer->vt_msecs = VR_FLOW_TRAP_BATCH_MSECS;
+
+    if ((ret = vr_create_timer(vtimer))) {
+        vr_module_error(ret, __FUNCTION__, __LINE__, 0);
+        goto fail_init;
+    }
+
+    router->vr_flow_trap_batch = ftb;
+    return 0;
+
+fail_init:
+    if (vtimer)
+        vr_free(vtimer);
+    vr_free(ftb);
+
+    return ret;
+}
+
+static void
+vr_flow_journal_destroy(struct vrouter *router)
+{
+    if (!router->vr_flow_journal)
+        return;
+
+    vr_btable_free(router->vr_flow_journal);
+    router->vr_flow_journal = NULL;
+
+    return;
+}
+
+/*
+ * the flows the reset cleared are not logged. readers see the generation
+ * of the rings change instead, and sweep the tables once
+ */
+static void
+vr_flow_journal_reset(struct vrouter *router)
+{
+    unsigned int i;
+    struct vr_flow_journal_ring *ring;
+
+    if (!router->vr_flow_journal)
+        return;
+
+    for (i = 0; i < vr_num_cpus; i++) {
+        ring = (struct vr_flow_journal_ring *)
+            vr_btable_get(router->vr_flow_journal, i);
+        if (!ring)
+            continue;
+
+        /* odd while the ring is being cleared */
+        (void)__sync_add_and_fetch(&ring->fjr_gen, 1);
+        ring->fjr_head = 0;
+        memset(ring->fjr_entries, 0, sizeof(ring->fjr_entries));
+        (void)__sync_add_and_fetch(&ring->fjr_gen, 1);
+    }
+
+    return;
+}
+
+static int
+vr_flow_journal_init(struct vrouter *router)
+{
+    if (router->vr_flow_journal)
+        return 0;
+
+    if (vr_flow_journal_table) {
+        router->vr_flow_journal = vr_flow_journal_table;
+    } else {
+        router->vr_flow_journal = vr_btable_alloc(vr_num_cpus,
+                sizeof(struct vr_flow_journal_ring));
+    }
+
+    if (!router->vr_flow_journal)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, vr_num_cpus);
+
+    return 0;
+}
+
 static void
 vr_flow_table_destroy(struct vrouter *router)
 {
+    vr_flow_trap_batch_destroy(router);
+    vr_flow_stats_delta_destroy(router);
+
     if (router->vr_flow_table) {
         vr_btable_free(router->vr_flow_table);
         router->vr_flow_table = NULL;
@@ -1370,6 +2340,9 @@ vr_flow_table_destroy(struct vrouter *router)
     }
 
     vr_flow_table_info_destroy(router);
+    vr_flow_cache_destroy(router);
+    vr_flow_queue_pool_destroy(router);
+    vr_flow_journal_destroy(router);
 
     return;
 }
@@ -1408,6 +2381,10 @@ vr_flow_table_reset(struct vrouter *router)
     }
 
     vr_flow_table_info_reset(router);
+    vr_flow_cache_reset(router);
+    vr_flow_stats_delta_reset(router);
+    vr_flow_trap_batch_reset(router);
+    vr_flow_journal_reset(router);
 
     return;
 }
@@ -1416,6 +2393,8 @@ vr_flow_table_reset(struct vrouter *router)
 static int
 vr_flow_table_init(struct vrouter *router)
 {
+    int ret;
+
     if (!router->vr_flow_table) {
         if (vr_flow_entries % VR_FLOW_ENTRIES_PER_BUCKET)
             return vr_module_error(-EINVAL, __FUNCTION__,
@@ -1435,6 +2414,10 @@ vr_flow_table_init(struct vrouter *router)
     }
 
     if (!router->vr_oflow_table) {
+        if (vr_oflow_entries % VR_OFLOW_ENTRIES_PER_BUCKET)
+            return vr_module_error(-EINVAL, __FUNCTION__,
+                    __LINE__, vr_oflow_entries);
+
         if (vr_oflow_table) {
             router->vr_oflow_table = vr_oflow_table;
         } else {
@@ -1448,7 +2431,27 @@ vr_flow_table_init(struct vrouter *router)
         }
     }
 
-    return vr_flow_table_info_init(router);
+    ret = vr_flow_table_info_init(router);
+    if (ret)
+        return ret;
+
+    ret = vr_flow_cache_init(router);
+    if (ret)
+        return ret;
+
+    ret = vr_flow_queue_pool_init(router);
+    if (ret)
+        return ret;
+
+    ret = vr_flow_stats_delta_init(router);
+    if (ret)
+        return ret;
+
+    ret = vr_flow_journal_init(router);
+    if (ret)
+        return ret;
+
+    return vr_flow_trap_batch_init(router);
 }
 
 static void
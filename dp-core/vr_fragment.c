@@ -6,13 +6,29 @@
  */
 #include <vr_os.h>
 #include <vr_packet.h>
+#include <vrouter.h>
+#include "vr_interface.h"
 #include "vr_btable.h"
 #include "vr_fragment.h"
 #include "vr_hash.h"
+#include "vr_mpls.h"
 
-#define FRAG_TABLE_ENTRIES  1024
-#define FRAG_TABLE_BUCKETS  4
-#define FRAG_OTABLE_ENTRIES 512
+#define FRAG_TABLE_ENTRIES          1024
+#define FRAG_TABLE_BUCKETS          4
+#define FRAG_OTABLE_ENTRIES         512
+#define FRAG_OTABLE_BUCKETS         8
+#define FRAG_OTABLE_HASH_CHOICES    4
+
+#define FRAG_TABLE_SIZE             (FRAG_TABLE_ENTRIES * FRAG_TABLE_BUCKETS)
+
+static inline uint64_t
+fragment_time(void)
+{
+    unsigned int sec, nsec;
+
+    vr_get_mono_time(&sec, &nsec);
+    return ((uint64_t)sec * 1000) + (nsec / 1000000);
+}
 
 static inline void
 fragment_key(struct vr_fragment_key *key, unsigned short vrf,
@@ -30,16 +46,13 @@ static inline void
 fragment_entry_set(struct vr_fragment *fe, unsigned short vrf, struct vr_ip *iph,
         unsigned short sport, unsigned short dport)
 {
-    unsigned int sec, nsec;
-
     fe->f_sip = iph->ip_saddr;
     fe->f_dip = iph->ip_daddr;
     fe->f_id = iph->ip_id;
     fe->f_vrf = vrf;
     fe->f_sport = sport;
     fe->f_dport = dport;
-    vr_get_mono_time(&sec, &nsec);
-    fe->f_time = sec;
+    fe->f_time = fragment_time();
 
     return;
 }
@@ -56,12 +69,113 @@ fragment_entry_get(struct vrouter *router, unsigned int index)
     return (struct vr_fragment *)vr_btable_get(router->vr_fragment_table, index);
 }
 
+/* the overflow table entries are indexed after those of the main table */
+static inline struct vr_fragment *
+fragment_entry_index_get(struct vrouter *router, unsigned int index)
+{
+    if (index < FRAG_TABLE_SIZE)
+        return fragment_entry_get(router, index);
+
+    return fragment_oentry_get(router, index - FRAG_TABLE_SIZE);
+}
+
 static inline bool
 fragment_entry_alloc(struct vr_fragment *fe)
 {
     return __sync_bool_compare_and_swap(&fe->f_dip, 0, 1);
 }
 
+/*
+ * as with the flow table, a key can live in one of FRAG_OTABLE_HASH_CHOICES
+ * buckets of the overflow table, so that a miss does not have to walk the
+ * whole overflow table
+ */
+static inline void
+fragment_oflow_buckets(unsigned int hash, unsigned int *buckets)
+{
+    unsigned int i, num_buckets;
+
+    num_buckets = FRAG_OTABLE_ENTRIES / FRAG_OTABLE_BUCKETS;
+    for (i = 0; i < FRAG_OTABLE_HASH_CHOICES; i++) {
+        buckets[i] = (vr_hash_1word(hash, i + 1) % num_buckets) *
+            FRAG_OTABLE_BUCKETS;
+    }
+
+    return;
+}
+
+static struct vr_fragment *
+fragment_bucket_get_free(struct vr_btable *table, unsigned int start,
+        unsigned int bucket_size, unsigned int *index)
+{
+    unsigned int i;
+    struct vr_fragment *fe;
+
+    for (i = 0; i < bucket_size; i++) {
+        fe = (struct vr_fragment *)vr_btable_get(table, start + i);
+        if (fe && !fe->f_dip && fragment_entry_alloc(fe)) {
+            *index = start + i;
+            return fe;
+        }
+    }
+
+    return NULL;
+}
+
+static struct vr_fragment *
+fragment_bucket_find(struct vr_btable *table, unsigned int start,
+        unsigned int bucket_size, struct vr_fragment_key *key)
+{
+    unsigned int i;
+    struct vr_fragment *fe;
+
+    for (i = 0; i < bucket_size; i++) {
+        fe = (struct vr_fragment *)vr_btable_get(table, start + i);
+        if (fe && !memcmp((const void *)key, (const void *)&(fe->f_key),
+                    sizeof(*key)))
+            return fe;
+    }
+
+    return NULL;
+}
+
+/*
+ * fragment_wheel_link - link an entry into the slot of the tick in which it
+ * expires. an entry is linked at most once. if it is already linked, the
+ * reaper will find it when the (earlier) slot it sits in comes due, and
+ * will link it again for the new expiry
+ */
+static void
+fragment_wheel_link(struct vrouter *router, unsigned int cpu,
+        struct vr_fragment *fe, unsigned int index)
+{
+    unsigned int head, *slot;
+    uint64_t tick;
+
+    if (!router->vr_fragment_wheel)
+        return;
+
+    if (!__sync_bool_compare_and_swap(&fe->f_linked, 0, 1))
+        return;
+
+    tick = (fe->f_time + VR_FRAG_TIMEOUT_MSECS + VR_FRAG_WHEEL_TICK_MSECS - 1) /
+        VR_FRAG_WHEEL_TICK_MSECS;
+    if (tick <= router->vr_fragment_wheel_tick)
+        tick = router->vr_fragment_wheel_tick + 1;
+
+    if (cpu >= vr_num_cpus)
+        cpu = 0;
+
+    slot = &router->vr_fragment_wheel[cpu].fw_slots[tick %
+        VR_FRAG_WHEEL_SLOTS];
+    do {
+        head = *slot;
+        fe->f_next = head;
+    } while (!__sync_bool_compare_and_swap(slot, head, index));
+
+    return;
+}
+
 void
 vr_fragment_del(struct vr_fragment *fe)
 {
@@ -73,33 +187,23 @@ vr_fragment_add(struct vrouter *router, unsigned short vrf, struct vr_ip *iph,
         unsigned short sport, unsigned short dport)
 {
     unsigned int hash, index, i;
+    unsigned int buckets[FRAG_OTABLE_HASH_CHOICES];
     struct vr_fragment_key key;
     struct vr_fragment *fe;
 
     fragment_key(&key, vrf, iph);
     hash = vr_hash(&key, sizeof(key), 0);
     index = (hash % FRAG_TABLE_ENTRIES) * FRAG_TABLE_BUCKETS;
-    for (i = 0; i < FRAG_TABLE_BUCKETS; i++) {
-        fe = fragment_entry_get(router, index + i);
-        if (fe && !fe->f_dip && fragment_entry_alloc(fe)) {
-            fragment_entry_set(fe, vrf, iph, sport, dport);
-            break;
-        } else {
-            fe = NULL;
-            continue;
-        }
-    }
-
+    fe = fragment_bucket_get_free(router->vr_fragment_table, index,
+            FRAG_TABLE_BUCKETS, &index);
     if (!fe) {
-        index = (hash % FRAG_OTABLE_ENTRIES);
-        for (i = 0; i < FRAG_OTABLE_ENTRIES; i++) {
-            fe = fragment_oentry_get(router, (index + i) % FRAG_OTABLE_ENTRIES);
-            if (fe && !fe->f_dip && fragment_entry_alloc(fe)) {
-                fragment_entry_set(fe, vrf, iph, sport, dport);
+        fragment_oflow_buckets(hash, buckets);
+        for (i = 0; i < FRAG_OTABLE_HASH_CHOICES; i++) {
+            fe = fragment_bucket_get_free(router->vr_fragment_otable,
+                    buckets[i], FRAG_OTABLE_BUCKETS, &index);
+            if (fe) {
+                index += FRAG_TABLE_SIZE;
                 break;
-            } else {
-                fe = NULL;
-                continue;
             }
         }
     }
@@ -107,6 +211,9 @@ vr_fragment_add(struct vrouter *router, unsigned short vrf, struct vr_ip *iph,
     if (!fe)
         return -ENOMEM;
 
+    fragment_entry_set(fe, vrf, iph, sport, dport);
+    fragment_wheel_link(router, vr_get_cpu(), fe, index);
+
     return 0;
 }
 
@@ -114,193 +221,453 @@ struct vr_fragment *
 vr_fragment_get(struct vrouter *router, unsigned short vrf, struct vr_ip *iph)
 {
     unsigned int hash, index, i;
+    unsigned int buckets[FRAG_OTABLE_HASH_CHOICES];
     struct vr_fragment_key key;
     struct vr_fragment *fe;
-    unsigned int sec, nsec;
 
     fragment_key(&key, vrf, iph);
     hash = vr_hash(&key, sizeof(key), 0);
     index = (hash % FRAG_TABLE_ENTRIES) * FRAG_TABLE_BUCKETS;
-    for (i = 0; i < FRAG_TABLE_BUCKETS; i++) {
-        fe = fragment_entry_get(router, index + i);
-        if (fe && !memcmp((const void *)&key, (const void *)&(fe->f_key),
-                    sizeof(key)))
-            break;
-    }
-
-    if (i == FRAG_TABLE_BUCKETS) {
-        index = (hash % FRAG_OTABLE_ENTRIES);
-        for (i = 0; i < FRAG_OTABLE_ENTRIES; i++) {
-            fe = fragment_oentry_get(router, (index + i) % FRAG_OTABLE_ENTRIES);
-            if (fe && !memcmp((const void *)&key, (const void *)&(fe->f_key),
-                        sizeof(key)))
+    fe = fragment_bucket_find(router->vr_fragment_table, index,
+            FRAG_TABLE_BUCKETS, &key);
+    if (!fe) {
+        fragment_oflow_buckets(hash, buckets);
+        for (i = 0; i < FRAG_OTABLE_HASH_CHOICES; i++) {
+            fe = fragment_bucket_find(router->vr_fragment_otable,
+                    buckets[i], FRAG_OTABLE_BUCKETS, &key);
+            if (fe)
                 break;
         }
+    }
+
+    /* the reaper picks the new expiry up, when the entry comes due */
+    if (fe)
+        fe->f_time = fragment_time();
+
+    return fe;
+}
+
+static void
+fragment_queue_element_free(struct vrouter *router,
+        struct vr_fragment_queue *vfq, struct vr_fragment_queue_element *fqe)
+{
+    __sync_fetch_and_sub(&router->vr_fragment_queue_bytes, fqe->fqe_len);
+    memset(&fqe->fqe_pnode, 0, sizeof(fqe->fqe_pnode));
+    fqe->fqe_len = 0;
+    __sync_synchronize();
+    fqe->fqe_state = VR_FRAG_QUEUE_ELEMENT_FREE;
+    __sync_fetch_and_sub(&vfq->vfq_held, 1);
+
+    return;
+}
 
-        if (i == FRAG_OTABLE_ENTRIES)
-            fe = NULL;
+/*
+ * vr_fragment_enqueue - park a fragment for which there is no fragment
+ * entry yet, in the hope that the head fragment is only running late.
+ * the packet is dropped if the queue of this cpu is full, or if the
+ * parked fragments of all cpus already take up VR_FRAG_QUEUE_MAX_BYTES.
+ * Returns 0 if the fragment was parked, and -ENOSPC if it was dropped
+ */
+int
+vr_fragment_enqueue(struct vrouter *router, unsigned short vrf,
+        struct vr_packet *pkt, struct vr_forwarding_md *fmd)
+{
+    unsigned int cpu, i, index, len;
+    struct vr_ip *iph = (struct vr_ip *)pkt_network_header(pkt);
+    struct vr_fragment_queue *vfq;
+    struct vr_fragment_queue_element *fqe = NULL;
+    struct vr_packet_node *pnode;
+
+    cpu = vr_get_cpu();
+    if (!router->vr_fragment_queue || (cpu >= vr_num_cpus))
+        goto drop;
+
+    vfq = &router->vr_fragment_queue[cpu];
+    if (vfq->vfq_held >= VR_FRAG_QUEUE_ENTRIES)
+        goto drop;
+
+    len = pkt_len(pkt);
+    if (__sync_add_and_fetch(&router->vr_fragment_queue_bytes, len) >
+            VR_FRAG_QUEUE_MAX_BYTES) {
+        __sync_fetch_and_sub(&router->vr_fragment_queue_bytes, len);
+        goto drop;
     }
 
-    if (fe) {
-        vr_get_mono_time(&sec, &nsec);
-        fe->f_time = sec;
+    for (i = 0; i < VR_FRAG_QUEUE_ENTRIES; i++) {
+        index = (vfq->vfq_hint + i) % VR_FRAG_QUEUE_ENTRIES;
+        fqe = &vfq->vfq_elements[index];
+        if ((fqe->fqe_state == VR_FRAG_QUEUE_ELEMENT_FREE) &&
+                __sync_bool_compare_and_swap(&fqe->fqe_state,
+                    VR_FRAG_QUEUE_ELEMENT_FREE, VR_FRAG_QUEUE_ELEMENT_BUSY))
+            break;
+        fqe = NULL;
     }
 
-    return fe;;
-}
+    if (!fqe) {
+        __sync_fetch_and_sub(&router->vr_fragment_queue_bytes, len);
+        goto drop;
+    }
 
-#define ENTRIES_PER_SCAN    64
+    __sync_fetch_and_add(&vfq->vfq_held, 1);
+    vfq->vfq_hint = index + 1;
+
+    fragment_key(&fqe->fqe_key, vrf, iph);
+    fqe->fqe_len = len;
+    fqe->fqe_vlan = fmd->fmd_vlan;
+    fqe->fqe_time = fragment_time();
+
+    /*
+     * as with the flow hold queue, the nexthop can not be cached without
+     * holding a reference to it. cache the label instead, and look it up
+     * again when the fragment is released
+     */
+    pnode = &fqe->fqe_pnode;
+    if (pkt->vp_nh &&
+            (pkt->vp_nh->nh_type == NH_VRF_TRANSLATE) &&
+            (pkt->vp_nh->nh_flags & NH_FLAG_VNID))
+        pnode->pl_flags |= PN_FLAG_LABEL_IS_VNID;
+    pkt->vp_nh = NULL;
+
+    pnode->pl_vif_idx = pkt->vp_if->vif_idx;
+    pnode->pl_outer_src_ip = fmd->fmd_outer_src_ip;
+    pnode->pl_label = fmd->fmd_label;
+    if (fmd->fmd_to_me)
+        pnode->pl_flags |= PN_FLAG_TO_ME;
+    pnode->pl_packet = pkt;
+
+    __sync_synchronize();
+    fqe->fqe_state = VR_FRAG_QUEUE_ELEMENT_HELD;
 
-struct scanner_params {
-    struct vrouter *sp_router;
-    struct vr_btable *sp_fragment_table;
-    unsigned int sp_num_entries;
-    int sp_last_scanned_entry;
-};
+    return 0;
+
+drop:
+    vr_pfree(pkt, VP_DROP_FRAGMENTS);
+    return -ENOSPC;
+}
 
 static void
-fragment_reap(struct vr_btable *table, int start,
-        unsigned int num_entries)
+fragment_queue_element_forward(struct vrouter *router,
+        struct vr_fragment_queue_element *fqe)
 {
-    unsigned int i;
-    struct vr_fragment *fe;
-    unsigned int sec, nsec;
+    struct vr_interface *vif;
+    struct vr_packet *pkt;
+    struct vr_packet_node *pnode = &fqe->fqe_pnode;
+    struct vr_forwarding_md fmd;
+
+    pkt = pnode->pl_packet;
+    pnode->pl_packet = NULL;
+
+    vr_init_forwarding_md(&fmd);
+    fmd.fmd_dvrf = fqe->fqe_key.fk_vrf;
+    fmd.fmd_vlan = fqe->fqe_vlan;
+    fmd.fmd_outer_src_ip = pnode->pl_outer_src_ip;
+    fmd.fmd_label = pnode->pl_label;
+    if (pnode->pl_flags & PN_FLAG_TO_ME)
+        fmd.fmd_to_me = 1;
+
+    /* the interface could have gone away while the fragment was parked */
+    vif = __vrouter_get_interface(router, pnode->pl_vif_idx);
+    if (!vif || (pkt->vp_if != vif)) {
+        vr_pfree(pkt, VP_DROP_INVALID_IF);
+        return;
+    }
 
-    vr_get_mono_time(&sec, &nsec);
+    if (vif_is_fabric(vif) && (fmd.fmd_label >= 0) &&
+            !(pnode->pl_flags & PN_FLAG_LABEL_IS_VNID))
+        pkt->vp_nh = __vrouter_get_label(router, fmd.fmd_label);
 
-    for (i = 0; i < ENTRIES_PER_SCAN; i++) {
-        fe = vr_btable_get(table, (start + i) % num_entries);
-        if (fe && fe->f_dip) {
-            if (sec > fe->f_time + 1)
-                vr_fragment_del(fe);
+    if (vr_flow_forward(router, pkt, &fmd))
+        vr_reinject_packet(pkt, &fmd);
+
+    return;
+}
+
+/*
+ * vr_fragment_queue_flush - called once the fragment entry for the head
+ * fragment 'iph' is in place, to push the fragments of the same datagram
+ * that were parked by any cpu through the flow path in one go. the tail
+ * fragment deletes the fragment entry, and hence is released last
+ */
+void
+vr_fragment_queue_flush(struct vrouter *router, unsigned short vrf,
+        struct vr_ip *iph)
+{
+    bool tail;
+    unsigned int cpu, i, pass;
+    struct vr_fragment_key key;
+    struct vr_fragment_queue *vfq;
+    struct vr_fragment_queue_element *fqe;
+    struct vr_ip *fiph;
+
+    if (!router->vr_fragment_queue || !router->vr_fragment_queue_bytes)
+        return;
+
+    fragment_key(&key, vrf, iph);
+    for (pass = 0; pass < 2; pass++) {
+        for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+            vfq = &router->vr_fragment_queue[cpu];
+            if (!vfq->vfq_held)
+                continue;
+
+            for (i = 0; i < VR_FRAG_QUEUE_ENTRIES; i++) {
+                fqe = &vfq->vfq_elements[i];
+                if ((fqe->fqe_state != VR_FRAG_QUEUE_ELEMENT_HELD) ||
+                        memcmp(&fqe->fqe_key, &key, sizeof(key)))
+                    continue;
+
+                if (!__sync_bool_compare_and_swap(&fqe->fqe_state,
+                            VR_FRAG_QUEUE_ELEMENT_HELD,
+                            VR_FRAG_QUEUE_ELEMENT_BUSY))
+                    continue;
+
+                fiph = (struct vr_ip *)
+                    pkt_network_header(fqe->fqe_pnode.pl_packet);
+                tail = vr_ip_fragment_tail(fiph);
+                if (tail != (pass == 1)) {
+                    fqe->fqe_state = VR_FRAG_QUEUE_ELEMENT_HELD;
+                    continue;
+                }
+
+                fragment_queue_element_forward(router, fqe);
+                fragment_queue_element_free(router, vfq, fqe);
+            }
         }
     }
 
-
     return;
 }
 
 static void
-fragment_table_scanner(void *arg)
+fragment_queue_reap(struct vrouter *router, bool all)
 {
-    struct scanner_params *sp = (struct scanner_params *)arg;
+    unsigned int cpu, i;
+    uint64_t now;
+    struct vr_fragment_queue *vfq;
+    struct vr_fragment_queue_element *fqe;
+
+    now = fragment_time();
+    for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+        vfq = &router->vr_fragment_queue[cpu];
+        if (!vfq->vfq_held)
+            continue;
+
+        for (i = 0; i < VR_FRAG_QUEUE_ENTRIES; i++) {
+            fqe = &vfq->vfq_elements[i];
+            if (fqe->fqe_state != VR_FRAG_QUEUE_ELEMENT_HELD)
+                continue;
 
-    fragment_reap(sp->sp_fragment_table, sp->sp_last_scanned_entry + 1,
-            sp->sp_num_entries);
+            if (!all && (now < fqe->fqe_time + VR_FRAG_QUEUE_TIMEOUT_MSECS))
+                continue;
 
-    sp->sp_last_scanned_entry += ENTRIES_PER_SCAN;
-    sp->sp_last_scanned_entry %= sp->sp_num_entries;
+            if (!__sync_bool_compare_and_swap(&fqe->fqe_state,
+                        VR_FRAG_QUEUE_ELEMENT_HELD,
+                        VR_FRAG_QUEUE_ELEMENT_BUSY))
+                continue;
+
+            vr_pfree(fqe->fqe_pnode.pl_packet, VP_DROP_FRAGMENTS);
+            fragment_queue_element_free(router, vfq, fqe);
+        }
+    }
 
     return;
 }
 
-static struct vr_timer *
-fragment_table_scanner_init(struct vrouter *router, struct vr_btable *table)
+static void
+fragment_queue_scanner(void *arg)
 {
-    unsigned int num_entries;
-    struct vr_timer *vtimer;
-    struct scanner_params *scanner;
+    struct vrouter *router = (struct vrouter *)arg;
 
-    if (!table)
-        return NULL;
+    if (router->vr_fragment_queue_bytes)
+        fragment_queue_reap(router, false);
 
-    num_entries = vr_btable_entries(table);
+    return;
+}
 
-    scanner = vr_zalloc(sizeof(*scanner));
-    if (!scanner) {
-        vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, num_entries);
-        return NULL;
+static void
+vr_fragment_queue_exit(struct vrouter *router)
+{
+    if (router->vr_fragment_queue_scanner) {
+        vr_delete_timer(router->vr_fragment_queue_scanner);
+        vr_free(router->vr_fragment_queue_scanner);
+        router->vr_fragment_queue_scanner = NULL;
     }
 
-    scanner->sp_router = router;
-    scanner->sp_fragment_table = table;
-    scanner->sp_num_entries = num_entries;
-    scanner->sp_last_scanned_entry = -1;
-
-    vtimer = vr_malloc(sizeof(*vtimer));
-    if (!vtimer) {
-        vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, num_entries);
-        goto fail_init;
+    if (router->vr_fragment_queue) {
+        fragment_queue_reap(router, true);
+        vr_free(router->vr_fragment_queue);
+        router->vr_fragment_queue = NULL;
     }
 
-    vtimer->vt_timer = fragment_table_scanner;
-    vtimer->vt_vr_arg = scanner;
-    vtimer->vt_msecs = 1000;
+    return;
+}
 
-    if (vr_create_timer(vtimer)) {
-        vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, num_entries);
-        goto fail_init;
+static int
+vr_fragment_queue_init(struct vrouter *router)
+{
+    unsigned int size;
+    struct vr_timer *vtimer;
+
+    if (!router->vr_fragment_queue) {
+        size = sizeof(struct vr_fragment_queue) * vr_num_cpus;
+        router->vr_fragment_queue = vr_zalloc(size);
+        if (!router->vr_fragment_queue)
+            return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, size);
+        router->vr_fragment_queue_bytes = 0;
     }
 
-    return vtimer;
+    if (!router->vr_fragment_queue_scanner) {
+        vtimer = vr_malloc(sizeof(*vtimer));
+        if (!vtimer)
+            return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, 0);
+
+        vtimer->vt_timer = fragment_queue_scanner;
+        vtimer->vt_vr_arg = router;
+        vtimer->vt_msecs = VR_FRAG_QUEUE_SCAN_MSECS;
+        if (vr_create_timer(vtimer)) {
+            vr_free(vtimer);
+            return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, 0);
+        }
 
-fail_init:
-    if (scanner)
-        vr_free(scanner);
+        router->vr_fragment_queue_scanner = vtimer;
+    }
 
-    return NULL;
+    return 0;
 }
 
 static void
-vr_fragment_table_scanner_exit(struct vrouter *router)
+fragment_wheel_expire(struct vrouter *router, unsigned int cpu,
+        unsigned int slot, uint64_t now)
 {
-    if (router->vr_fragment_table_scanner) {
-        vr_delete_timer(router->vr_fragment_table_scanner);
-        vr_free(router->vr_fragment_table_scanner->vt_vr_arg);
-        vr_free(router->vr_fragment_table_scanner);
-        router->vr_fragment_table_scanner = NULL;
+    unsigned int index, next;
+    struct vr_fragment *fe;
+
+    index = __sync_lock_test_and_set(
+            &router->vr_fragment_wheel[cpu].fw_slots[slot],
+            VR_FRAG_INDEX_INVALID);
+    while (index != VR_FRAG_INDEX_INVALID) {
+        fe = fragment_entry_index_get(router, index);
+        if (!fe)
+            break;
+
+        next = fe->f_next;
+        __sync_synchronize();
+        fe->f_linked = 0;
+
+        if (fe->f_dip) {
+            if (now >= fe->f_time + VR_FRAG_TIMEOUT_MSECS)
+                vr_fragment_del(fe);
+            else
+                fragment_wheel_link(router, cpu, fe, index);
+        }
+
+        index = next;
     }
 
-    if (router->vr_fragment_otable_scanner) {
-        vr_delete_timer(router->vr_fragment_otable_scanner);
-        vr_free(router->vr_fragment_otable_scanner->vt_vr_arg);
-        vr_free(router->vr_fragment_otable_scanner);
-        router->vr_fragment_otable_scanner = NULL;
+    return;
+}
+
+static void
+fragment_wheel_timer(void *arg)
+{
+    unsigned int cpu;
+    uint64_t now, now_tick, tick;
+    struct vrouter *router = (struct vrouter *)arg;
+
+    now = fragment_time();
+    now_tick = now / VR_FRAG_WHEEL_TICK_MSECS;
+
+    /* if we fell behind by more than a turn, one turn covers all slots */
+    tick = router->vr_fragment_wheel_tick;
+    if (now_tick > tick + VR_FRAG_WHEEL_SLOTS)
+        tick = now_tick - VR_FRAG_WHEEL_SLOTS;
+
+    while (tick < now_tick) {
+        tick++;
+        /* entries that are linked again go past the slot being expired */
+        router->vr_fragment_wheel_tick = tick;
+        for (cpu = 0; cpu < vr_num_cpus; cpu++)
+            fragment_wheel_expire(router, cpu, tick % VR_FRAG_WHEEL_SLOTS,
+                    now);
     }
 
     return;
 }
 
-void
-vr_fragment_table_exit(struct vrouter *router)
+static void
+vr_fragment_wheel_exit(struct vrouter *router)
 {
-    vr_fragment_table_scanner_exit(router);
+    if (router->vr_fragment_wheel_timer) {
+        vr_delete_timer(router->vr_fragment_wheel_timer);
+        vr_free(router->vr_fragment_wheel_timer);
+        router->vr_fragment_wheel_timer = NULL;
+    }
 
-    if (router->vr_fragment_table)
-        vr_btable_free(router->vr_fragment_table);
-    if (router->vr_fragment_otable)
-        vr_btable_free(router->vr_fragment_otable);
+    if (router->vr_fragment_wheel) {
+        vr_free(router->vr_fragment_wheel);
+        router->vr_fragment_wheel = NULL;
+    }
 
     return;
 }
 
 static int
-vr_fragment_table_scanner_init(struct vrouter *router)
+vr_fragment_wheel_init(struct vrouter *router)
 {
-    if (!router->vr_fragment_table_scanner) {
-        router->vr_fragment_table_scanner =
-            fragment_table_scanner_init(router, router->vr_fragment_table);
-        if (!router->vr_fragment_table_scanner)
-            return -ENOMEM;
+    unsigned int size;
+    struct vr_timer *vtimer;
+
+    if (!router->vr_fragment_wheel) {
+        size = sizeof(struct vr_fragment_wheel) * vr_num_cpus;
+        router->vr_fragment_wheel = vr_malloc(size);
+        if (!router->vr_fragment_wheel)
+            return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, size);
+
+        /* all slots start out empty, ie: VR_FRAG_INDEX_INVALID */
+        memset(router->vr_fragment_wheel, 0xff, size);
+        router->vr_fragment_wheel_tick =
+            fragment_time() / VR_FRAG_WHEEL_TICK_MSECS;
     }
 
-    if (!router->vr_fragment_otable_scanner) {
-        router->vr_fragment_otable_scanner =
-            fragment_table_scanner_init(router, router->vr_fragment_otable);
-        if (!router->vr_fragment_otable_scanner)
-            return -ENOMEM;
+    if (!router->vr_fragment_wheel_timer) {
+        vtimer = vr_malloc(sizeof(*vtimer));
+        if (!vtimer)
+            return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, 0);
+
+        vtimer->vt_timer = fragment_wheel_timer;
+        vtimer->vt_vr_arg = router;
+        vtimer->vt_msecs = VR_FRAG_WHEEL_TICK_MSECS;
+        if (vr_create_timer(vtimer)) {
+            vr_free(vtimer);
+            return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, 0);
+        }
+
+        router->vr_fragment_wheel_timer = vtimer;
     }
 
     return 0;
 }
 
+void
+vr_fragment_table_exit(struct vrouter *router)
+{
+    vr_fragment_wheel_exit(router);
+    vr_fragment_queue_exit(router);
+
+    if (router->vr_fragment_table)
+        vr_btable_free(router->vr_fragment_table);
+    if (router->vr_fragment_otable)
+        vr_btable_free(router->vr_fragment_otable);
+
+    return;
+}
+
 int
 vr_fragment_table_init(struct vrouter *router)
 {
     int num_entries, ret;
 
     if (!router->vr_fragment_table) {
-        num_entries = FRAG_TABLE_ENTRIES * FRAG_TABLE_BUCKETS;
+        num_entries = FRAG_TABLE_SIZE;
         router->vr_fragment_table = vr_btable_alloc(num_entries,
                 sizeof(struct vr_fragment));
         if (!router->vr_fragment_table)
@@ -317,9 +684,11 @@ vr_fragment_table_init(struct vrouter *router)
                     __LINE__, num_entries);
     }
 
-    if ((ret = vr_fragment_table_scanner_init(router)))
+    if ((ret = vr_fragment_wheel_init(router)))
+        return ret;
+
+    if ((ret = vr_fragment_queue_init(router)))
         return ret;
 
     return 0;
 }
-
@@ -411,7 +411,9 @@ agent_send(struct vr_interface *vif, struct vr_packet *pkt,
     bool truncate = false;
 
 
-    vr_preset(pkt);
+    /* bulk flow misses are built by us, and have no original to go back to */
+    if (params->trap_reason != AGENT_TRAP_FLOW_MISS_BULK)
+        vr_preset(pkt);
 
     if ((params->trap_reason == AGENT_TRAP_HANDLE_DF) ||
             (params->trap_reason == AGENT_TRAP_ZERO_TTL)) {
@@ -478,6 +480,7 @@ agent_send(struct vr_interface *vif, struct vr_packet *pkt,
 
     case AGENT_TRAP_ECMP_RESOLVE:
     case AGENT_TRAP_SOURCE_MISMATCH:
+    case AGENT_TRAP_FLOW_MISS_BULK:
         if (params->trap_param)
             hdr->hdr_cmd_param = htonl(*(unsigned int *)(params->trap_param));
         break;
@@ -1673,6 +1676,9 @@ vr_interface_change(struct vr_interface *vif, vr_interface_req *req)
     if (req->vifr_mtu)
         vif->vif_mtu = req->vifr_mtu;
 
+    vif->vif_irq_coalesce_pkts = req->vifr_irq_coalesce_pkts;
+    vif->vif_irq_coalesce_usecs = req->vifr_irq_coalesce_usecs;
+
     vif->vif_nh_id = (unsigned short)req->vifr_nh_id;
 
     return 0;
@@ -1695,6 +1701,12 @@ vif_transport_valid(vr_interface_req *req)
     return false;
 }
 
+static bool
+vif_irq_coalesce_valid(int value)
+{
+    return (value >= VIF_IRQ_COALESCE_OFF) && (value <= VIF_IRQ_COALESCE_MAX);
+}
+
 int
 vr_interface_add(vr_interface_req *req, bool need_response)
 {
@@ -1713,6 +1725,12 @@ vr_interface_add(vr_interface_req *req, bool need_response)
     if (!vif_transport_valid(req))
         goto generate_resp;
 
+    if (!vif_irq_coalesce_valid(req->vifr_irq_coalesce_pkts) ||
+            !vif_irq_coalesce_valid(req->vifr_irq_coalesce_usecs)) {
+        ret = -EINVAL;
+        goto generate_resp;
+    }
+
     vif = __vrouter_get_interface(router, req->vifr_idx);
     if (vif) {
         ret = vr_interface_change(vif, req);
@@ -1747,6 +1765,8 @@ vr_interface_add(vr_interface_req *req, bool need_response)
     vif->vif_mtu = req->vifr_mtu;
     vif->vif_idx = req->vifr_idx;
     vif->vif_transport = req->vifr_transport;
+    vif->vif_irq_coalesce_pkts = req->vifr_irq_coalesce_pkts;
+    vif->vif_irq_coalesce_usecs = req->vifr_irq_coalesce_usecs;
     vif->vif_os_idx = req->vifr_os_idx;
     if (req->vifr_os_idx == -1)
         vif->vif_os_idx = 0;
@@ -1815,6 +1835,8 @@ vr_interface_make_req(vr_interface_req *req, struct vr_interface *intf)
     req->vifr_transport = intf->vif_transport;
     req->vifr_os_idx = intf->vif_os_idx;
     req->vifr_mtu = intf->vif_mtu;
+    req->vifr_irq_coalesce_pkts = intf->vif_irq_coalesce_pkts;
+    req->vifr_irq_coalesce_usecs = intf->vif_irq_coalesce_usecs;
     if (req->vifr_mac_size && req->vifr_mac)
         memcpy(req->vifr_mac, intf->vif_mac,
                 MINIMUM(req->vifr_mac_size, sizeof(intf->vif_mac)));
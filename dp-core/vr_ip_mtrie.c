@@ -19,40 +19,90 @@ static struct vr_vrf_stats **mtrie_vrf_stats;
 static struct vr_vrf_stats *invalid_vrf_stats;
 
 struct vr_nexthop *(*vr_inet_route_lookup)(unsigned int, struct vr_route_req *);
+unsigned int (*vr_inet_route_lookup_burst)(unsigned int, struct vr_route_req **,
+        unsigned int);
+void (*vr_inet_route_hint)(struct vr_route_req *);
 struct vr_vrf_stats *(*vr_inet_vrf_stats)(unsigned short, unsigned int);
 
 static struct ip_mtrie *mtrie_alloc_vrf(unsigned int, unsigned int);
 
+/* flat buckets bigger than this come from vr_page_alloc */
+#define IP_BUCKET_PAGE_ALLOC_MEM    (64 * 1024)
+
 /* mtrie specific, bucket_info for v4 and v6 */
-#define IP4_BKT_LEVELS  (IP4_PREFIX_LEN / IPBUCKET_LEVEL_BITS) 
-#define IP6_BKT_LEVELS  (IP6_PREFIX_LEN / IPBUCKET_LEVEL_BITS) 
+struct mtrie_bkt_info ip4_bkt_info[IP4_BKT_MAX_LEVELS];
+struct mtrie_bkt_info ip6_bkt_info[IP6_BKT_MAX_LEVELS];
+static unsigned int ip4_bkt_levels, ip6_bkt_levels;
 
-struct mtrie_bkt_info ip4_bkt_info[IP4_BKT_LEVELS];
-struct mtrie_bkt_info ip6_bkt_info[IP6_BKT_LEVELS];
+unsigned int vr_inet_mtrie_strides[IP4_BKT_MAX_LEVELS] = {
+    [0 ... IP4_BKT_MAX_LEVELS - 1] = IPBUCKET_LEVEL_BITS,
+};
+unsigned int vr_inet6_mtrie_strides[IP6_BKT_MAX_LEVELS] = {
+    [0 ... IP6_BKT_MAX_LEVELS - 1] = IPBUCKET_LEVEL_BITS,
+};
 
 struct ip_mtrie **vn_rtable[2];
 static int algo_init_done = 0;
 static vr_route_req dump_resp;
 
-static void
-mtrie_ip_bkt_info_init(struct mtrie_bkt_info *ip_bkt_info, int pfx_len)
+/*
+ * a batch of updates to a table is applied to a shadow of it. a bucket
+ * the batch modifies is copied first, and the live buckets are left alone
+ * till the shadow root is published in a single store. the buckets that
+ * the shadow replaced are released only then.
+ */
+#define MTRIE_BATCH_RETIRED_INIT    64
+
+struct mtrie_batch {
+    struct ip_mtrie *mb_mtrie;
+    struct ip_bucket_entry mb_root;
+    struct ip_bucket **mb_retired;
+    unsigned int mb_nretired;
+    unsigned int mb_retired_size;
+    int mb_error;
+};
+
+/* the batch being built, if any. updates are serialized by the caller */
+static struct mtrie_batch *mtrie_batch;
+
+/*
+ * per cpu, the result of a burst lookup that the lookups of the packet
+ * being processed on the cpu take instead of walking the tree again. the
+ * lookups check for a hint only once some cpu was given one
+ */
+static struct vr_route_req **mtrie_hints;
+static bool mtrie_hints_used;
+
+/*
+ * lay out the levels of a table from the configured strides. returns the
+ * number of levels, or -EINVAL if the strides are not whole bytes or do
+ * not add up to the address length
+ */
+static int
+mtrie_ip_bkt_info_init(struct mtrie_bkt_info *ip_bkt_info, int pfx_len,
+        unsigned int *strides, unsigned int max_levels)
 {
     int level;
-
-    ip_bkt_info[0].bi_bits = IPBUCKET_LEVEL_BITS;
-    ip_bkt_info[0].bi_pfx_len = IPBUCKET_LEVEL_BITS;
-    ip_bkt_info[0].bi_shift = pfx_len - IPBUCKET_LEVEL_BITS;
-    ip_bkt_info[0].bi_size = IPBUCKET_LEVEL_SIZE;
-    ip_bkt_info[0].bi_mask = IPBUCKET_LEVEL_MASK;
-
-    for (level = 1; level < (pfx_len/IPBUCKET_LEVEL_BITS); level++) {
-        ip_bkt_info[level].bi_bits = IPBUCKET_LEVEL_BITS;
-        ip_bkt_info[level].bi_pfx_len = ip_bkt_info[level-1].bi_pfx_len 
-                                              + IPBUCKET_LEVEL_BITS;
-        ip_bkt_info[level].bi_shift =  ip_bkt_info[level-1].bi_shift - IPBUCKET_LEVEL_BITS;
-        ip_bkt_info[level].bi_size = IPBUCKET_LEVEL_SIZE;
-        ip_bkt_info[level].bi_mask = IPBUCKET_LEVEL_MASK;
+    unsigned int bits = 0;
+
+    for (level = 0; (level < max_levels) && (bits < pfx_len); level++) {
+        if (!strides[level] || (strides[level] % IPBUCKET_LEVEL_BITS) ||
+                (strides[level] > IPBUCKET_MAX_LEVEL_BITS))
+            return -EINVAL;
+
+        ip_bkt_info[level].bi_bits = strides[level];
+        ip_bkt_info[level].bi_byte = bits / 8;
+        bits += strides[level];
+        ip_bkt_info[level].bi_pfx_len = bits;
+        ip_bkt_info[level].bi_shift = pfx_len - bits;
+        ip_bkt_info[level].bi_size = 1 << strides[level];
+        ip_bkt_info[level].bi_mask = ip_bkt_info[level].bi_size - 1;
     }
+
+    if (bits != pfx_len)
+        return -EINVAL;
+
+    return level;
 }
 
 /*
@@ -73,15 +123,23 @@ vrfid_to_mtrie(unsigned int vrf_id, unsigned int family)
     return mtrie_table[vrf_id];
 }
 
-#define PREFIX_TO_INDEX(prefix, level) (prefix[level]) 
+/* the root updates to 'mtrie' go to: the shadow root of a batch, if any */
+static inline struct ip_bucket_entry *
+mtrie_root(struct ip_mtrie *mtrie)
+{
+    if (mtrie_batch && (mtrie_batch->mb_mtrie == mtrie))
+        return &mtrie_batch->mb_root;
+
+    return &mtrie->root;
+}
 
 static inline unsigned int
 ip_bkt_get_max_level(int family)
 {
     if (family == AF_INET6)
-        return(IP6_BKT_LEVELS);
+        return(ip6_bkt_levels);
     else
-        return(IP4_BKT_LEVELS);
+        return(ip4_bkt_levels);
 }
 
 static struct mtrie_bkt_info * 
@@ -93,20 +151,75 @@ ip_bkt_info_get(unsigned int family)
         return ip4_bkt_info;
 }
     
+/* the bits of 'prefix' that index the bucket of a level */
+static inline unsigned int
+prefix_to_index(unsigned char *prefix, struct mtrie_bkt_info *bi)
+{
+    unsigned int i, index = prefix[bi->bi_byte];
+
+    for (i = 1; i < bi->bi_bits / 8; i++)
+        index = (index << 8) | prefix[bi->bi_byte + i];
+
+    return index;
+}
+
+/* the inverse of prefix_to_index */
+static inline void
+index_to_prefix(unsigned char *prefix, struct mtrie_bkt_info *bi,
+        unsigned int index)
+{
+    int i;
+
+    for (i = bi->bi_bits / 8 - 1; i >= 0; i--) {
+        prefix[bi->bi_byte + i] = index & 0xff;
+        index >>= 8;
+    }
+
+    return;
+}
+
 /*
  * we have to be careful about 'level' here. assumption is that level
  * will be passed sane from whomever is calling
  */
-static inline unsigned char
+static inline unsigned int
 rt_to_index(struct vr_route_req *rt, unsigned int level)
 {
-    return PREFIX_TO_INDEX(rt->rtr_req.rtr_prefix, level);
+    return prefix_to_index(rt->rtr_req.rtr_prefix,
+            &ip_bkt_info_get(rt->rtr_req.rtr_family)[level]);
 }
 
 static inline struct ip_bucket_entry *
-index_to_entry(struct ip_bucket *bkt, int index)
+index_to_entry(struct ip_bucket *bkt, unsigned int index)
 {
-    return &bkt->bkt_data[index];
+    unsigned int r, *starts;
+
+    if (!bkt->bkt_ranges)
+        return &bkt->bkt_data[index];
+
+    starts = IP_BUCKET_RANGE_STARTS(bkt);
+    for (r = 1; (r < bkt->bkt_ranges) && (starts[r] <= index); r++)
+        ;
+
+    return &bkt->bkt_data[r - 1];
+}
+
+/* the first index past the run of entries that 'index' is part of */
+static inline unsigned int
+index_to_next(struct ip_bucket *bkt, struct mtrie_bkt_info *bi,
+        unsigned int index)
+{
+    unsigned int r, *starts;
+
+    if (!bkt->bkt_ranges)
+        return index + 1;
+
+    starts = IP_BUCKET_RANGE_STARTS(bkt);
+    for (r = 0; r < bkt->bkt_ranges; r++)
+        if (starts[r] > index)
+            return starts[r];
+
+    return bi->bi_size;
 }
 
 static void
@@ -169,11 +282,365 @@ entry_to_bucket(struct ip_bucket_entry *ent)
     unsigned long long_i = ent->entry_long_i;
 
     if (PTR_IS_BUCKET(long_i))
-        return (struct ip_bucket *)(long_i & ~0x1UL);
+        return PTR_TO_BUCKET(long_i);
 
     return NULL;
 }
 
+static inline bool
+entry_same(struct ip_bucket_entry *a, struct ip_bucket_entry *b)
+{
+    return ((a->entry_long_i == b->entry_long_i) &&
+            (a->entry_prefix_len == b->entry_prefix_len) &&
+            (a->entry_label_flags == b->entry_label_flags) &&
+            (a->entry_label == b->entry_label) &&
+            (a->entry_bridge_index == b->entry_bridge_index));
+}
+
+/*
+ * copy an entry to an unused one. a nexthop gets a reference of its own,
+ * while a child bucket is handed over to the copy
+ */
+static void
+copy_entry(struct ip_bucket_entry *dst, struct ip_bucket_entry *src)
+{
+    if (ENTRY_IS_BUCKET(src))
+        dst->entry_long_i = src->entry_long_i;
+    else if (src->entry_nh_p)
+        set_entry_to_nh(dst, src->entry_nh_p);
+
+    dst->entry_prefix_len = src->entry_prefix_len;
+    dst->entry_label_flags = src->entry_label_flags;
+    dst->entry_label = src->entry_label;
+    dst->entry_bridge_index = src->entry_bridge_index;
+
+    return;
+}
+
+static inline unsigned int
+mtrie_bucket_mem(unsigned int size, unsigned int ranges)
+{
+    return sizeof(struct ip_bucket) + sizeof(struct ip_bucket_entry) * size +
+        sizeof(unsigned int) * ranges;
+}
+
+static struct ip_bucket *
+mtrie_bucket_alloc(unsigned int size, unsigned int ranges)
+{
+    unsigned int mem = mtrie_bucket_mem(size, ranges);
+    struct ip_bucket *bkt;
+
+    /*
+     * the root bucket of a wide stride is too big for vr_zalloc. pages do
+     * not come zeroed on all platforms
+     */
+    if (mem > IP_BUCKET_PAGE_ALLOC_MEM) {
+        bkt = vr_page_alloc(mem);
+        if (bkt)
+            memset(bkt, 0, mem);
+    } else {
+        bkt = vr_zalloc(mem);
+    }
+    if (!bkt)
+        return NULL;
+
+    bkt->bkt_size = size;
+    bkt->bkt_ranges = ranges;
+    if (mtrie_batch)
+        bkt->bkt_flags |= IP_BUCKET_FLAG_SHADOW;
+
+    return bkt;
+}
+
+/* whether the bucket can be modified without lookups seeing it */
+static inline bool
+mtrie_bucket_private(struct ip_bucket *bkt)
+{
+    return !mtrie_batch || (bkt->bkt_flags & IP_BUCKET_FLAG_SHADOW);
+}
+
+static void
+mtrie_bucket_free(struct ip_bucket *bkt)
+{
+    unsigned int mem = mtrie_bucket_mem(bkt->bkt_size, bkt->bkt_ranges);
+
+    if (mem > IP_BUCKET_PAGE_ALLOC_MEM)
+        vr_page_free(bkt, mem);
+    else
+        vr_free(bkt);
+
+    return;
+}
+
+static void
+mtrie_bucket_free_cb(struct vrouter *router, void *arg)
+{
+    struct vr_defer_data *defer = (struct vr_defer_data *)arg;
+
+    if (!defer)
+        return;
+
+    mtrie_bucket_free((struct ip_bucket *)defer->vdd_data);
+    return;
+}
+
+static void
+mtrie_bucket_put_nexthops(struct ip_bucket *bkt)
+{
+    unsigned int i;
+    struct ip_bucket_entry *ent;
+
+    for (i = 0; i < bkt->bkt_size; i++) {
+        ent = &bkt->bkt_data[i];
+        if (ENTRY_IS_NEXTHOP(ent) && ent->entry_nh_p)
+            vrouter_put_nexthop(ent->entry_nh_p);
+    }
+
+    return;
+}
+
+/* a live bucket was replaced in the shadow. hold on to it till publish */
+static void
+mtrie_batch_retire(struct mtrie_batch *batch, struct ip_bucket *bkt)
+{
+    unsigned int size;
+    struct ip_bucket **retired;
+
+    if (batch->mb_nretired == batch->mb_retired_size) {
+        size = batch->mb_retired_size ? 2 * batch->mb_retired_size :
+            MTRIE_BATCH_RETIRED_INIT;
+        retired = vr_zalloc(size * sizeof(*retired));
+        if (!retired) {
+            /* the batch can not be published any more */
+            batch->mb_error = -ENOMEM;
+            return;
+        }
+
+        if (batch->mb_retired) {
+            memcpy(retired, batch->mb_retired,
+                    batch->mb_nretired * sizeof(*retired));
+            vr_free(batch->mb_retired);
+        }
+
+        batch->mb_retired = retired;
+        batch->mb_retired_size = size;
+    }
+
+    batch->mb_retired[batch->mb_nretired++] = bkt;
+    return;
+}
+
+/*
+ * release a bucket that is no more linked to the tree. the references it
+ * holds on nexthops are dropped right away (whatever replaced the bucket
+ * holds references of its own), while the memory is freed only once the
+ * lookups that might still be walking the bucket are done
+ */
+static void
+mtrie_bucket_retire(struct ip_bucket *bkt)
+{
+    struct vr_defer_data *defer;
+
+    if (!mtrie_bucket_private(bkt)) {
+        mtrie_batch_retire(mtrie_batch, bkt);
+        return;
+    }
+
+    mtrie_bucket_put_nexthops(bkt);
+
+    /* a shadow bucket was never seen by lookups */
+    if (vr_not_ready || mtrie_batch) {
+        mtrie_bucket_free(bkt);
+        return;
+    }
+
+    defer = vr_get_defer_data(sizeof(*defer));
+    if (!defer) {
+        vr_delay_op();
+        mtrie_bucket_free(bkt);
+        return;
+    }
+
+    defer->vdd_data = (void *)bkt;
+    vr_defer(vrouter_get(0), mtrie_bucket_free_cb, (void *)defer);
+
+    return;
+}
+
+/* link an equivalent bucket in place of the one hanging off 'ent' */
+static void
+mtrie_bucket_replace(struct ip_bucket_entry *ent, struct ip_bucket *bkt)
+{
+    struct ip_bucket *old_bkt = entry_to_bucket(ent);
+
+    /* the bucket has to be complete before lookups can see it */
+    __sync_synchronize();
+    ent->entry_long_i = (unsigned long)bkt | 0x1ul |
+        (bkt->bkt_ranges ? 0x2ul : 0);
+
+    if (old_bkt)
+        mtrie_bucket_retire(old_bkt);
+
+    return;
+}
+
+/*
+ * the bucket hanging off 'ent' is about to be modified in place. that is
+ * done only on buckets private to the batch being built, if any, and
+ * only on flat buckets if 'flat' is set (a compressed bucket can take
+ * only updates that treat all its entries alike). else, the bucket is
+ * swapped for a suitable copy. returns the bucket to modify, or NULL if
+ * there is no memory
+ */
+static struct ip_bucket *
+mtrie_bucket_writable(struct ip_bucket_entry *ent, struct mtrie_bkt_info *bi,
+        bool flat)
+{
+    unsigned int i, r, end, *starts;
+    struct ip_bucket *bkt, *new_bkt;
+
+    bkt = entry_to_bucket(ent);
+    if (!bkt)
+        return NULL;
+
+    if (mtrie_bucket_private(bkt) && (!bkt->bkt_ranges || !flat))
+        return bkt;
+
+    if (!bkt->bkt_ranges || flat)
+        new_bkt = mtrie_bucket_alloc(bi->bi_size, 0);
+    else
+        new_bkt = mtrie_bucket_alloc(bkt->bkt_size, bkt->bkt_ranges);
+    if (!new_bkt)
+        return NULL;
+
+    if (!bkt->bkt_ranges || !flat) {
+        for (i = 0; i < bkt->bkt_size; i++)
+            copy_entry(&new_bkt->bkt_data[i], &bkt->bkt_data[i]);
+        memcpy(IP_BUCKET_RANGE_STARTS(new_bkt), IP_BUCKET_RANGE_STARTS(bkt),
+                bkt->bkt_ranges * sizeof(unsigned int));
+    } else {
+        starts = IP_BUCKET_RANGE_STARTS(bkt);
+        for (r = 0; r < bkt->bkt_ranges; r++) {
+            end = (r + 1 < bkt->bkt_ranges) ? starts[r + 1] : bi->bi_size;
+            for (i = starts[r]; i < end; i++)
+                copy_entry(&new_bkt->bkt_data[i], &bkt->bkt_data[r]);
+        }
+    }
+
+    mtrie_bucket_replace(ent, new_bkt);
+
+    return new_bkt;
+}
+
+/*
+ * swap the bucket hanging off 'ent' for a compressed copy, if its entries
+ * fall in few enough runs and that takes fewer runs than it has now. failing
+ * to do so is harmless
+ */
+static void
+mtrie_bucket_compress(struct ip_bucket_entry *ent)
+{
+    unsigned int i, r, ranges = 1, *starts, *old_starts = NULL;
+    struct ip_bucket *bkt, *cbkt;
+
+    bkt = entry_to_bucket(ent);
+    if (!bkt)
+        return;
+
+    for (i = 1; i < bkt->bkt_size; i++) {
+        if (!entry_same(&bkt->bkt_data[i], &bkt->bkt_data[i - 1]) &&
+                (++ranges > IP_BUCKET_MAX_RANGES))
+            return;
+    }
+
+    /* the runs of a compressed bucket are merged only if some are alike */
+    if (bkt->bkt_ranges) {
+        if (ranges == bkt->bkt_ranges)
+            return;
+        old_starts = IP_BUCKET_RANGE_STARTS(bkt);
+    }
+
+    cbkt = mtrie_bucket_alloc(ranges, ranges);
+    if (!cbkt)
+        return;
+
+    starts = IP_BUCKET_RANGE_STARTS(cbkt);
+    for (i = 0, r = 0; i < bkt->bkt_size; i++) {
+        if (i && entry_same(&bkt->bkt_data[i], &bkt->bkt_data[i - 1]))
+            continue;
+
+        starts[r] = old_starts ? old_starts[i] : i;
+        copy_entry(&cbkt->bkt_data[r++], &bkt->bkt_data[i]);
+    }
+
+    mtrie_bucket_replace(ent, cbkt);
+
+    return;
+}
+
+/*
+ * the indices [start, end) of the bucket hanging off 'ent' are about to be
+ * updated, each of them alike. a compressed bucket is kept compressed, with
+ * its runs split at 'start' and 'end', unless that takes more runs than a
+ * compressed bucket can have. a run that holds a child bucket is a single
+ * index, and is never split. returns the bucket to modify, or NULL if there
+ * is no memory
+ */
+static struct ip_bucket *
+mtrie_bucket_split(struct ip_bucket_entry *ent, struct mtrie_bkt_info *bi,
+        unsigned int start, unsigned int end)
+{
+    unsigned int r, n, ranges, run_end, *starts, *new_starts;
+    struct ip_bucket *bkt, *new_bkt;
+
+    bkt = entry_to_bucket(ent);
+    if (!bkt)
+        return NULL;
+
+    if (!bkt->bkt_ranges)
+        return mtrie_bucket_writable(ent, bi, false);
+
+    starts = IP_BUCKET_RANGE_STARTS(bkt);
+    ranges = bkt->bkt_ranges;
+    for (r = 0; r < bkt->bkt_ranges; r++) {
+        run_end = (r + 1 < bkt->bkt_ranges) ? starts[r + 1] : bi->bi_size;
+        if ((starts[r] < start) && (start < run_end))
+            ranges++;
+        if ((starts[r] < end) && (end < run_end))
+            ranges++;
+    }
+
+    if (ranges == bkt->bkt_ranges)
+        return mtrie_bucket_writable(ent, bi, false);
+
+    if (ranges > IP_BUCKET_MAX_RANGES)
+        return mtrie_bucket_writable(ent, bi, true);
+
+    new_bkt = mtrie_bucket_alloc(ranges, ranges);
+    if (!new_bkt)
+        return NULL;
+
+    new_starts = IP_BUCKET_RANGE_STARTS(new_bkt);
+    for (r = 0, n = 0; r < bkt->bkt_ranges; r++) {
+        run_end = (r + 1 < bkt->bkt_ranges) ? starts[r + 1] : bi->bi_size;
+        new_starts[n] = starts[r];
+        copy_entry(&new_bkt->bkt_data[n++], &bkt->bkt_data[r]);
+
+        if ((starts[r] < start) && (start < run_end)) {
+            new_starts[n] = start;
+            copy_entry(&new_bkt->bkt_data[n++], &bkt->bkt_data[r]);
+        }
+        if ((starts[r] < end) && (end < run_end)) {
+            new_starts[n] = end;
+            copy_entry(&new_bkt->bkt_data[n++], &bkt->bkt_data[r]);
+        }
+    }
+
+    mtrie_bucket_replace(ent, new_bkt);
+
+    return new_bkt;
+}
+
 /*
  * alloc a mtrie bucket
  */
@@ -186,8 +653,7 @@ mtrie_alloc_bucket(struct mtrie_bkt_info *ip_bkt_info, unsigned char level, stru
     struct ip_bucket_entry     *ent;
 
     bkt_size = ip_bkt_info[level].bi_size;
-    bkt = vr_zalloc(sizeof(struct ip_bucket) 
-                    + sizeof(struct ip_bucket_entry) * bkt_size);
+    bkt = mtrie_bucket_alloc(bkt_size, 0);
     if (!bkt)
         return NULL;
 
@@ -203,28 +669,37 @@ mtrie_alloc_bucket(struct mtrie_bkt_info *ip_bkt_info, unsigned char level, stru
     return bkt;
 }
 
-static void
+/*
+ * the entries of the bucket are all updated alike, so there is no need
+ * to expand a compressed bucket here
+ */
+static int
 add_to_tree(struct ip_bucket_entry *ent, int level, struct vr_route_req *rt)
 {
+    int ret;
     unsigned int i;
     struct ip_bucket      *bkt;
     struct mtrie_bkt_info *ip_bkt_info;
 
     if (level >= (ip_bkt_get_max_level(rt->rtr_req.rtr_family) - 1))
         /* assert here ? */
-        return;
+        return 0;
 
     ip_bkt_info = ip_bkt_info_get(rt->rtr_req.rtr_family);
+    level++;
 
     /* assured that the first one is a bucket */
-    bkt = entry_to_bucket(ent);
-    level++;
+    bkt = mtrie_bucket_writable(ent, &ip_bkt_info[level], false);
+    if (!bkt)
+        return -ENOMEM;
 
-    for (i = 0; i < ip_bkt_info[level].bi_size; i++) {
-        ent = index_to_entry(bkt, i);
-        if (!ENTRY_IS_NEXTHOP(ent))
-            add_to_tree(ent, level, rt);
-        else if (ent->entry_prefix_len <= rt->rtr_req.rtr_prefix_len) {
+    for (i = 0; i < bkt->bkt_size; i++) {
+        ent = &bkt->bkt_data[i];
+        if (!ENTRY_IS_NEXTHOP(ent)) {
+            ret = add_to_tree(ent, level, rt);
+            if (ret)
+                return ret;
+        } else if (ent->entry_prefix_len <= rt->rtr_req.rtr_prefix_len) {
             /* a less specific entry, which needs to be replaced */
             set_entry_to_nh(ent, rt->rtr_nh);
             ent->entry_prefix_len = rt->rtr_req.rtr_prefix_len;
@@ -234,7 +709,7 @@ add_to_tree(struct ip_bucket_entry *ent, int level, struct vr_route_req *rt)
         }
     }
 
-    return;
+    return 0;
 }
 
 static void
@@ -252,7 +727,7 @@ mtrie_free_entry(struct ip_bucket_entry *entry, unsigned int level)
     if (!bkt)
         return;
 
-    for (i = 0; i < IPBUCKET_LEVEL_SIZE; i++)
+    for (i = 0; i < bkt->bkt_size; i++)
         if (ENTRY_IS_BUCKET(&bkt->bkt_data[i])) {
             mtrie_free_entry(&bkt->bkt_data[i], level + 1);
         } else {
@@ -262,7 +737,7 @@ mtrie_free_entry(struct ip_bucket_entry *entry, unsigned int level)
         }
 
     entry->entry_bkt_p = NULL;
-    vr_free(bkt);
+    mtrie_bucket_free(bkt);
 
     return;
 }
@@ -279,8 +754,8 @@ mtrie_reset_entry(struct ip_bucket_entry *ent, int level,
     if (nh)
         set_entry_to_nh(ent, nh);
 
-    /* wait for all cores to see it */
-    if (!vr_not_ready)
+    /* wait for all cores to see it. nothing to wait for in a shadow */
+    if (!vr_not_ready && !mtrie_batch)
         vr_delay_op();
 
     /* ...and then work with the copy */
@@ -289,6 +764,17 @@ mtrie_reset_entry(struct ip_bucket_entry *ent, int level,
     return;
 }
 
+/* the first index of a bucket past the indices a route covers */
+static inline unsigned int
+mtrie_route_end(struct vr_route_req *rt, struct mtrie_bkt_info *bi,
+        unsigned int index)
+{
+    if (rt->rtr_req.rtr_prefix_len > (bi->bi_pfx_len - bi->bi_bits))
+        return index + (1 << (bi->bi_pfx_len - rt->rtr_req.rtr_prefix_len));
+
+    return bi->bi_size;
+}
+
 /*
  * When adding a route:
  * - descend the tree to the bucket at which the route is significant.
@@ -299,18 +785,23 @@ mtrie_reset_entry(struct ip_bucket_entry *ent, int level,
  * themselfs do not have more specific routes.
  * - when a bucket is created, initialize any entries with the parent that
  * covers them.
+ * - the runs of the compressed buckets on the way down are split where
+ * the route starts and ends, and merged back on the way out where they can
+ * be. a run is updated as a whole.
  */
 static int
-__mtrie_add(struct ip_mtrie *mtrie, struct vr_route_req *rt)
+__mtrie_add(struct ip_bucket_entry *root, struct vr_route_req *rt)
 {
-    int                         ret, index = 0, level, err_level = 0;
-    unsigned char                i, fin = 0;
+    int                         ret, level, err_level = 0;
+    bool                        descend;
+    unsigned int                i, index, fin;
     struct ip_bucket          *bkt;
     struct ip_bucket_entry    *ent, *err_ent = NULL;
+    struct ip_bucket_entry    *path[IP6_BKT_MAX_LEVELS];
     struct vr_nexthop          *nh, *err_nh = NULL;
     struct mtrie_bkt_info *ip_bkt_info = ip_bkt_info_get(rt->rtr_req.rtr_family);
 
-    ent = &mtrie->root;
+    ent = root;
 
     nh = ent->entry_nh_p;
     for (level = 0; level < ip_bkt_get_max_level(rt->rtr_req.rtr_family); level++) {
@@ -324,16 +815,23 @@ __mtrie_add(struct ip_mtrie *mtrie, struct vr_route_req *rt)
             }
         }
 
-        bkt = entry_to_bucket(ent);
+        path[level] = ent;
+        index = rt_to_index(rt, level);
+        descend = (rt->rtr_req.rtr_prefix_len > ip_bkt_info[level].bi_pfx_len);
+        if (descend)
+            fin = index + 1;
+        else
+            fin = mtrie_route_end(rt, &ip_bkt_info[level], index);
+
+        bkt = mtrie_bucket_split(ent, &ip_bkt_info[level], index, fin);
         if (!bkt) {
             ret = -ENOMEM;
             goto exit_ret;
         }
 
-        index = rt_to_index(rt, level);
         ent = index_to_entry(bkt, index);
 
-        if (rt->rtr_req.rtr_prefix_len > ip_bkt_info[level].bi_pfx_len) {
+        if (descend) {
             if (ENTRY_IS_NEXTHOP(ent)) {
                 nh = ent->entry_nh_p;
             }
@@ -345,23 +843,15 @@ __mtrie_add(struct ip_mtrie *mtrie, struct vr_route_req *rt)
              * cover all the indices for which this route is the best
              * prefix match
              */
-            if ((rt->rtr_req.rtr_prefix_len >
-                        (ip_bkt_info[level].bi_pfx_len - ip_bkt_info[level].bi_bits)) &&
-                    (rt->rtr_req.rtr_prefix_len <= ip_bkt_info[level].bi_pfx_len)) {
-                fin = 1 << (ip_bkt_info[level].bi_pfx_len - rt->rtr_req.rtr_prefix_len); 
-            }
-
-
-             /* 
-              * Run through the loop 'fin' times only
-              * If fin is 0, it actually means 256 ('char' overflow), so run the
-              * loop 256 times
-              */
-             for (i = index; i <= (ip_bkt_info[level].bi_size-1); i++) {
+            for (i = index; i < fin;
+                    i = index_to_next(bkt, &ip_bkt_info[level], i)) {
                 ent = index_to_entry(bkt, i);
-                if (ENTRY_IS_BUCKET(ent))
-                    add_to_tree(ent, level, rt);
-                else if (ent->entry_prefix_len <= rt->rtr_req.rtr_prefix_len) {
+                if (ENTRY_IS_BUCKET(ent)) {
+                    ret = add_to_tree(ent, level, rt);
+                    if (ret)
+                        goto exit_ret;
+                    mtrie_bucket_compress(ent);
+                } else if (ent->entry_prefix_len <= rt->rtr_req.rtr_prefix_len) {
                     /* a less specific entry, which needs to be replaced */
                     set_entry_to_nh(ent, rt->rtr_nh);
                     ent->entry_prefix_len = rt->rtr_req.rtr_prefix_len;
@@ -369,50 +859,28 @@ __mtrie_add(struct ip_mtrie *mtrie, struct vr_route_req *rt)
                     ent->entry_label = rt->rtr_req.rtr_label;
                     ent->entry_bridge_index = rt->rtr_req.rtr_index;
                 }
-                if (fin) {
-                    /* Repeat the loop 'fin' times only */
-                    fin--;
-                    if (fin == 0)
-                        break;
-                } 
-                /* 
-                 * Bailout at the last index, 
-                 * the below check takes care of overflow 
-                 */
-                if (i == (ip_bkt_info[level].bi_size-1))
-                    break;
-             }
-
-             break;
+            }
+
+            break;
         }
     }
 
+    for (; level >= 0; level--)
+        mtrie_bucket_compress(path[level]);
+
     return 0;
 
 exit_ret:
-    if (err_ent)
+    if (err_ent) {
         mtrie_reset_entry(err_ent, err_level, err_nh);
+        /* whatever was below err_ent is gone */
+        level = err_level;
+    }
 
-    return ret;
-}
-
-
-static void
-ip_bucket_sched_for_free(struct ip_bucket *bkt, int level)
-{
-    unsigned int i;
-    struct ip_bucket_entry *tmp_ent;
-
-    if (!vr_not_ready)
-        vr_delay_op();
+    while (--level >= 0)
+        mtrie_bucket_compress(path[level]);
 
-    for (i = 0; i < IPBUCKET_LEVEL_SIZE; i++) {
-        tmp_ent = &bkt->bkt_data[i];
-        if (tmp_ent->entry_nh_p) {
-            vrouter_put_nexthop(tmp_ent->entry_nh_p);
-        }
-    }
-    vr_free(bkt);
+    return ret;
 }
 
 static void
@@ -424,19 +892,23 @@ free_bucket(struct ip_bucket_entry *ent, int level, struct vr_route_req *rt)
         return;
     }
 
+    /* all the entries of the bucket are the same. fold them in 'ent' */
     bkt = entry_to_bucket(ent);
-    set_entry_to_nh(ent, rt->rtr_nh);
-    ent->entry_label_flags = rt->rtr_req.rtr_label_flags;
-    ent->entry_label = rt->rtr_req.rtr_label;
-    ent->entry_bridge_index = rt->rtr_req.rtr_index;
+    set_entry_to_nh(ent, bkt->bkt_data[0].entry_nh_p);
+    ent->entry_prefix_len = bkt->bkt_data[0].entry_prefix_len;
+    ent->entry_label_flags = bkt->bkt_data[0].entry_label_flags;
+    ent->entry_label = bkt->bkt_data[0].entry_label;
+    ent->entry_bridge_index = bkt->bkt_data[0].entry_bridge_index;
 
-    ip_bucket_sched_for_free(bkt, level);
+    mtrie_bucket_retire(bkt);
 }
 
 static int
 __mtrie_delete(struct vr_route_req *rt, struct ip_bucket_entry *ent,
                 unsigned char level)
 {
+    int                 ret;
+    bool                descend;
     unsigned int        index, i, fin;
     struct ip_bucket    *bkt;
     struct ip_bucket_entry *tmp_ent;
@@ -445,26 +917,30 @@ __mtrie_delete(struct vr_route_req *rt, struct ip_bucket_entry *ent,
     if (ENTRY_IS_NEXTHOP(ent))
         return -ENOENT;
 
-    bkt = entry_to_bucket(ent);
     index = rt_to_index(rt, level);
+    descend = (rt->rtr_req.rtr_prefix_len > ip_bkt_info[level].bi_pfx_len);
+    /* nothing to delete further down */
+    if (descend && ENTRY_IS_NEXTHOP(index_to_entry(entry_to_bucket(ent), index)))
+        return -ENOENT;
 
-    if (rt->rtr_req.rtr_prefix_len > ip_bkt_info[level].bi_pfx_len) {
-        tmp_ent = index_to_entry(bkt, index);
-        __mtrie_delete(rt, tmp_ent, level + 1);
+    /* the route might cover part of a run of a compressed bucket */
+    if (descend) {
+        bkt = mtrie_bucket_writable(ent, &ip_bkt_info[level], false);
     } else {
-        if ((rt->rtr_req.rtr_prefix_len >
-                (ip_bkt_info[level].bi_pfx_len - ip_bkt_info[level].bi_bits)) &&
-                (rt->rtr_req.rtr_prefix_len <= ip_bkt_info[level].bi_pfx_len)) {
-            fin = 1 << (ip_bkt_info[level].bi_pfx_len - rt->rtr_req.rtr_prefix_len); 
-        } else {
-            fin = ip_bkt_info[level].bi_size;
-        }
-
-         fin += index;
-         if (fin > ip_bkt_info[level].bi_size)
-             fin = ip_bkt_info[level].bi_size;
+        fin = mtrie_route_end(rt, &ip_bkt_info[level], index);
+        bkt = mtrie_bucket_split(ent, &ip_bkt_info[level], index, fin);
+    }
+    if (!bkt)
+        return -ENOMEM;
 
-         for (i = index; i < fin; i++) {
+    if (descend) {
+        tmp_ent = index_to_entry(bkt, index);
+        ret = __mtrie_delete(rt, tmp_ent, level + 1);
+        if (ret == -ENOMEM)
+            return ret;
+    } else {
+        for (i = index; i < fin;
+                i = index_to_next(bkt, &ip_bkt_info[level], i)) {
             tmp_ent = index_to_entry(bkt, i);
             if (ENTRY_IS_NEXTHOP(tmp_ent) &&
                             (tmp_ent->entry_prefix_len == rt->rtr_req.rtr_prefix_len)) {
@@ -473,23 +949,20 @@ __mtrie_delete(struct vr_route_req *rt, struct ip_bucket_entry *ent,
                 tmp_ent->entry_label = rt->rtr_req.rtr_label;
                 tmp_ent->entry_prefix_len = rt->rtr_req.rtr_replace_plen;
                 tmp_ent->entry_bridge_index = rt->rtr_req.rtr_index;
-            } else
-                __mtrie_delete(rt, tmp_ent, level + 1);
+            } else {
+                ret = __mtrie_delete(rt, tmp_ent, level + 1);
+                if (ret == -ENOMEM)
+                    return ret;
+            }
         }
     }
 
     /* check if current bucket neds to be deleted */
-    for (i = 1; i < ip_bkt_info[level].bi_size; i++) {
-        if ((bkt->bkt_data[i].entry_long_i == bkt->bkt_data[0].entry_long_i) &&
-                (bkt->bkt_data[i].entry_label_flags ==
-                    bkt->bkt_data[0].entry_label_flags) &&
-                (bkt->bkt_data[i].entry_label ==
-                    bkt->bkt_data[0].entry_label) &&
-                (bkt->bkt_data[i].entry_prefix_len ==
-                    bkt->bkt_data[0].entry_prefix_len)) {
-            continue;
-        } else
+    for (i = 1; i < bkt->bkt_size; i++) {
+        if (!entry_same(&bkt->bkt_data[i], &bkt->bkt_data[0])) {
+            mtrie_bucket_compress(ent);
             return 0;
+        }
     }
 
     free_bucket(ent, level, rt);
@@ -517,7 +990,7 @@ mtrie_dumper_make_response(struct vr_message_dumper *dumper, vr_route_req *resp,
 
     resp->rtr_vrf_id = req->rtr_vrf_id;
     resp->rtr_family = req->rtr_family;
-    memcpy(resp->rtr_prefix, prefix, prefix_len / IPBUCKET_LEVEL_BITS);
+    memcpy(resp->rtr_prefix, prefix, prefix_len / 8);
     resp->rtr_prefix_size = req->rtr_prefix_size;
     resp->rtr_marker_size = 0;
     resp->rtr_marker = NULL;
@@ -547,8 +1020,7 @@ static int
 mtrie_dump_entry(struct vr_message_dumper *dumper, struct ip_bucket_entry *ent,
         int8_t *prefix, int level)
 {
-    unsigned char i = 0;
-    unsigned int j;
+    unsigned int i = 0, j;
     int ret;
     struct ip_bucket *bkt;
     struct ip_bucket_entry *ent_p = ent;
@@ -561,12 +1033,12 @@ mtrie_dump_entry(struct vr_message_dumper *dumper, struct ip_bucket_entry *ent,
 
     ip_bkt_info = ip_bkt_info_get(req->rtr_family);
     if (!dumper->dump_been_to_marker) {
-        i = PREFIX_TO_INDEX(req->rtr_marker, level);
+        i = prefix_to_index(req->rtr_marker, &ip_bkt_info[level]);
         bkt = entry_to_bucket(ent);
         ent = index_to_entry(bkt, i);
 
-        prefix[level] = i;
-        
+        index_to_prefix((unsigned char *)prefix, &ip_bkt_info[level], i);
+
         if ((!memcmp(prefix, req->rtr_marker, ip_bkt_info[level].bi_pfx_len/8)) &&
               (ip_bkt_info[level].bi_pfx_len == req->rtr_marker_plen)) {
             dumper->dump_been_to_marker = 1;
@@ -593,8 +1065,8 @@ mtrie_dump_entry(struct vr_message_dumper *dumper, struct ip_bucket_entry *ent,
         j = ip_bkt_info[level].bi_size - i;
         bkt = entry_to_bucket(ent_p);
         for (; j > 0; j--, i++) {
-            ent = &bkt->bkt_data[i];
-            prefix[level] = i;
+            ent = index_to_entry(bkt, i);
+            index_to_prefix((unsigned char *)prefix, &ip_bkt_info[level], i);
             if (mtrie_dump_entry(dumper, ent, prefix, level + 1) < 0)
                 return -1;
         }
@@ -680,7 +1152,7 @@ generate_response:
 static int
 mtrie_delete(struct vr_rtable * _unused, struct vr_route_req *rt)
 {
-    int vrf_id = rt->rtr_req.rtr_vrf_id;
+    int ret, vrf_id = rt->rtr_req.rtr_vrf_id;
     struct ip_mtrie *rtable;
     struct vr_route_req lreq;
 
@@ -705,9 +1177,13 @@ mtrie_delete(struct vr_rtable * _unused, struct vr_route_req *rt)
         rt->rtr_req.rtr_index = lreq.rtr_req.rtr_index;
     }
 
-    __mtrie_delete(rt, &rtable->root, 0);
+    ret = __mtrie_delete(rt, mtrie_root(rtable), 0);
     vrouter_put_nexthop(rt->rtr_nh);
 
+    /* deleting a route that is not there is not an error */
+    if (ret == -ENOMEM)
+        return ret;
+
    return 0;
 }
 
@@ -820,6 +1296,113 @@ generate_response:
 
     return 0;
 }
+
+/*
+ * the entry for 'index' of the bucket 'ptr' points to. unlike
+ * index_to_entry(), a flat bucket is indexed without reading its header
+ */
+static inline struct ip_bucket_entry *
+ptr_to_entry(unsigned long ptr, unsigned int index)
+{
+    if (!PTR_IS_COMPRESSED(ptr))
+        return &PTR_TO_BUCKET(ptr)->bkt_data[index];
+
+    return index_to_entry(PTR_TO_BUCKET(ptr), index);
+}
+
+static inline void
+ptr_prefetch_entry(unsigned long ptr, unsigned int index)
+{
+    if (!PTR_IS_COMPRESSED(ptr))
+        __builtin_prefetch(&PTR_TO_BUCKET(ptr)->bkt_data[index]);
+    else
+        __builtin_prefetch(PTR_TO_BUCKET(ptr));
+
+    return;
+}
+
+static inline void
+mtrie_lookup_fill(struct vr_route_req *rt, struct ip_bucket_entry *ent)
+{
+    rt->rtr_req.rtr_label_flags = ent->entry_label_flags;
+    rt->rtr_req.rtr_label = ent->entry_label;
+    rt->rtr_req.rtr_prefix_len = ent->entry_prefix_len;
+    rt->rtr_req.rtr_index = ent->entry_bridge_index;
+    rt->rtr_nh = PTR_TO_NEXTHOP(ent->entry_long_i);
+
+    return;
+}
+
+/* we do not support any thing other than host route lookups */
+static inline bool
+mtrie_lookup_valid(struct vr_route_req *rt)
+{
+    if ((rt->rtr_req.rtr_family == AF_INET) &&
+        (rt->rtr_req.rtr_prefix_len != IP4_PREFIX_LEN))
+        return false;
+
+    if ((rt->rtr_req.rtr_family == AF_INET6) &&
+        (rt->rtr_req.rtr_prefix_len != IP6_PREFIX_LEN))
+        return false;
+
+    return true;
+}
+
+/*
+ * take the result of the hint of the cpu, if it is for the same address in
+ * the same vrf and was resolved through the table
+ */
+static inline bool
+mtrie_lookup_hinted(unsigned int vrf_id, struct vr_route_req *rt)
+{
+    unsigned int cpu, len;
+    struct vr_route_req *hint;
+
+    cpu = vr_get_cpu();
+    if (!mtrie_hints || cpu >= vr_num_cpus)
+        return false;
+
+    hint = mtrie_hints[cpu];
+    if (!hint || !hint->rtr_nh || (hint->rtr_nh == ip4_default_nh) ||
+            (hint->rtr_req.rtr_vrf_id != vrf_id) ||
+            (hint->rtr_req.rtr_family != rt->rtr_req.rtr_family))
+        return false;
+
+    len = (rt->rtr_req.rtr_family == AF_INET6) ? IP6_PREFIX_LEN / 8 :
+        IP4_PREFIX_LEN / 8;
+    if (memcmp(hint->rtr_req.rtr_prefix, rt->rtr_req.rtr_prefix, len))
+        return false;
+
+    rt->rtr_req.rtr_label_flags = hint->rtr_req.rtr_label_flags;
+    rt->rtr_req.rtr_label = hint->rtr_req.rtr_label;
+    rt->rtr_req.rtr_prefix_len = hint->rtr_req.rtr_prefix_len;
+    rt->rtr_req.rtr_index = hint->rtr_req.rtr_index;
+    rt->rtr_nh = hint->rtr_nh;
+
+    return true;
+}
+
+/*
+ * the lookups on this cpu may take the result of 'rt', a request resolved
+ * by mtrie_lookup_burst(), till the next hint. the request has to stay
+ * around till then, and NULL clears the hint
+ */
+static void
+mtrie_hint(struct vr_route_req *rt)
+{
+    unsigned int cpu;
+
+    cpu = vr_get_cpu();
+    if (!mtrie_hints || cpu >= vr_num_cpus)
+        return;
+
+    mtrie_hints[cpu] = rt;
+    if (rt)
+        mtrie_hints_used = true;
+
+    return;
+}
+
 /*
  * longest prefix match. go down the tree till you encounter a next-hop.
  * if no nexthop, there is something wrong with the tree which was built.
@@ -832,20 +1415,17 @@ mtrie_lookup(unsigned int vrf_id, struct vr_route_req *rt)
     unsigned int        level, index;
     unsigned long       ptr;
     struct ip_mtrie   *table;
-    struct ip_bucket  *bkt;
     struct ip_bucket_entry *ent;
+    struct mtrie_bkt_info *ip_bkt_info;
     struct vr_nexthop *default_nh, *ret_nh;
 
       default_nh = ip4_default_nh;
 
-    /* we do not support any thing other than /32 route lookup */
-    if ((rt->rtr_req.rtr_family == AF_INET) && 
-        (rt->rtr_req.rtr_prefix_len != IP4_PREFIX_LEN))
+    if (!mtrie_lookup_valid(rt))
         return default_nh;
 
-    if ((rt->rtr_req.rtr_family == AF_INET6) && 
-        (rt->rtr_req.rtr_prefix_len != IP6_PREFIX_LEN))
-        return default_nh;
+    if (mtrie_hints_used && mtrie_lookup_hinted(vrf_id, rt))
+        return rt->rtr_nh;
 
     table = vrfid_to_mtrie(vrf_id, rt->rtr_req.rtr_family);
     if (!table)
@@ -860,41 +1440,114 @@ mtrie_lookup(unsigned int vrf_id, struct vr_route_req *rt)
     }
 
     if (PTR_IS_NEXTHOP(ptr)) {
-        rt->rtr_req.rtr_label_flags = ent->entry_label_flags;
-        rt->rtr_req.rtr_label = ent->entry_label;
-        rt->rtr_req.rtr_prefix_len = ent->entry_prefix_len;
-        rt->rtr_req.rtr_index = ent->entry_bridge_index;
-        ret_nh = PTR_TO_NEXTHOP(ptr);
-        rt->rtr_nh = ret_nh;
-        return ret_nh;
+        mtrie_lookup_fill(rt, ent);
+        return rt->rtr_nh;
     }
 
-    bkt = PTR_TO_BUCKET(ptr);
-    if (!bkt)
+    if (!PTR_TO_BUCKET(ptr))
         return default_nh;
 
+    ip_bkt_info = ip_bkt_info_get(rt->rtr_req.rtr_family);
     for (level = 0; level < ip_bkt_get_max_level(rt->rtr_req.rtr_family); level++) {
-        index = rt_to_index(rt, level);
-        ent = index_to_entry(bkt, index);
+        index = prefix_to_index(rt->rtr_req.rtr_prefix, &ip_bkt_info[level]);
+        ent = ptr_to_entry(ptr, index);
         ptr = ent->entry_long_i;
         if (PTR_IS_NEXTHOP(ptr)) {
-            rt->rtr_req.rtr_label_flags = ent->entry_label_flags;
-            rt->rtr_req.rtr_label = ent->entry_label;
-            rt->rtr_req.rtr_prefix_len = ent->entry_prefix_len;
-            rt->rtr_req.rtr_index = ent->entry_bridge_index;
-            ret_nh = PTR_TO_NEXTHOP(ptr);
-            rt->rtr_nh = ret_nh;
-            return ret_nh;
+            mtrie_lookup_fill(rt, ent);
+            return rt->rtr_nh;
         }
-
-        bkt = PTR_TO_BUCKET(ptr);
     }
 
     /* no nexthop; assert */
     ASSERT(0);
 
-    rt->rtr_nh = ret_nh;
-    return NULL;
+    rt->rtr_nh = ret_nh = NULL;
+    return ret_nh;
+}
+
+/*
+ * longest prefix match for a burst of host route requests in the same vrf.
+ * instead of walking the tree of one request after the other, the walks
+ * are interleaved level by level: at every level the entries of all the
+ * requests still in progress are read one after the other and the entry
+ * of the next level is prefetched, so that the bucket loads of different
+ * requests overlap rather than each request paying for its dependent
+ * loads serially.
+ *
+ * the result of each request is left in rtr_nh (along with the label and
+ * the prefix length, as in mtrie_lookup), and requests that mtrie_lookup
+ * would not resolve get the default nexthop. returns the number of
+ * requests resolved through the table.
+ */
+static unsigned int
+mtrie_lookup_burst(unsigned int vrf_id, struct vr_route_req **rts,
+        unsigned int nb_rts)
+{
+    unsigned int i, j, base, count, level, nb_pending, nb_next;
+    unsigned int resolved = 0;
+    unsigned long ptr;
+    unsigned char pending[VR_ROUTE_LOOKUP_BURST_SIZE];
+    unsigned long ptrs[VR_ROUTE_LOOKUP_BURST_SIZE];
+    struct ip_bucket_entry *ent;
+    struct ip_mtrie *table;
+    struct vr_route_req *rt;
+
+    for (base = 0; base < nb_rts; base += count) {
+        count = nb_rts - base;
+        if (count > VR_ROUTE_LOOKUP_BURST_SIZE)
+            count = VR_ROUTE_LOOKUP_BURST_SIZE;
+
+        nb_pending = 0;
+        for (i = 0; i < count; i++) {
+            rt = rts[base + i];
+            rt->rtr_nh = ip4_default_nh;
+            if (!mtrie_lookup_valid(rt))
+                continue;
+
+            table = vrfid_to_mtrie(vrf_id, rt->rtr_req.rtr_family);
+            if (!table || !(ptr = table->root.entry_long_i))
+                continue;
+
+            if (PTR_IS_NEXTHOP(ptr)) {
+                mtrie_lookup_fill(rt, &table->root);
+                resolved++;
+                continue;
+            }
+
+            ptrs[i] = ptr;
+            ptr_prefetch_entry(ptr, rt_to_index(rt, 0));
+            pending[nb_pending++] = i;
+        }
+
+        for (level = 0; nb_pending; level++) {
+            nb_next = 0;
+            for (j = 0; j < nb_pending; j++) {
+                i = pending[j];
+                rt = rts[base + i];
+                ent = ptr_to_entry(ptrs[i], rt_to_index(rt, level));
+                ptr = ent->entry_long_i;
+                if (PTR_IS_NEXTHOP(ptr)) {
+                    mtrie_lookup_fill(rt, ent);
+                    resolved++;
+                    continue;
+                }
+
+                if (level + 1 >= ip_bkt_get_max_level(rt->rtr_req.rtr_family)) {
+                    /* no nexthop; assert */
+                    ASSERT(0);
+                    rt->rtr_nh = NULL;
+                    continue;
+                }
+
+                ptrs[i] = ptr;
+                ptr_prefetch_entry(ptr, rt_to_index(rt, level + 1));
+                pending[nb_next++] = i;
+            }
+            nb_pending = nb_next;
+        }
+    }
+
+    return resolved;
 }
 
 /*
@@ -937,7 +1590,7 @@ mtrie_add(struct vr_rtable * _unused, struct vr_route_req *rt)
         rt->rtr_req.rtr_index = tmp_req.rtr_req.rtr_index;
     }
 
-    ret = __mtrie_add(mtrie, rt);
+    ret = __mtrie_add(mtrie_root(mtrie), rt);
     vrouter_put_nexthop(rt->rtr_nh);
     return ret;
 }
@@ -980,6 +1633,182 @@ mtrie_alloc_vrf(unsigned int vrf_id, unsigned int family)
     return mtrie;
 }
 
+/* clear the shadow marks of the buckets a batch allocated */
+static void
+mtrie_batch_seal(struct ip_bucket_entry *ent)
+{
+    unsigned int i;
+    struct ip_bucket *bkt = entry_to_bucket(ent);
+
+    if (!bkt || !(bkt->bkt_flags & IP_BUCKET_FLAG_SHADOW))
+        return;
+
+    bkt->bkt_flags &= ~IP_BUCKET_FLAG_SHADOW;
+    for (i = 0; i < bkt->bkt_size; i++)
+        mtrie_batch_seal(&bkt->bkt_data[i]);
+
+    return;
+}
+
+/* free the buckets a batch allocated. the live buckets are left alone */
+static void
+mtrie_batch_discard(struct ip_bucket_entry *ent)
+{
+    unsigned int i;
+    struct ip_bucket *bkt = entry_to_bucket(ent);
+
+    if (!bkt) {
+        if (ent->entry_nh_p)
+            vrouter_put_nexthop(ent->entry_nh_p);
+        return;
+    }
+
+    if (!(bkt->bkt_flags & IP_BUCKET_FLAG_SHADOW))
+        return;
+
+    for (i = 0; i < bkt->bkt_size; i++)
+        mtrie_batch_discard(&bkt->bkt_data[i]);
+    mtrie_bucket_free(bkt);
+
+    return;
+}
+
+static void
+mtrie_batch_free(struct mtrie_batch *batch)
+{
+    unsigned int i;
+
+    for (i = 0; i < batch->mb_nretired; i++)
+        mtrie_bucket_free(batch->mb_retired[i]);
+
+    if (batch->mb_retired)
+        vr_free(batch->mb_retired);
+    vr_free(batch);
+
+    return;
+}
+
+static void
+mtrie_batch_free_cb(struct vrouter *router, void *arg)
+{
+    struct vr_defer_data *defer = (struct vr_defer_data *)arg;
+
+    if (!defer)
+        return;
+
+    mtrie_batch_free((struct mtrie_batch *)defer->vdd_data);
+    return;
+}
+
+static void
+mtrie_batch_publish(struct mtrie_batch *batch)
+{
+    unsigned int i;
+    struct ip_bucket_entry *root = &batch->mb_mtrie->root;
+    struct vr_nexthop *old_nh = NULL;
+    struct vr_defer_data *defer;
+
+    mtrie_batch_seal(&batch->mb_root);
+
+    if (ENTRY_IS_NEXTHOP(root))
+        old_nh = root->entry_nh_p;
+
+    root->entry_prefix_len = batch->mb_root.entry_prefix_len;
+    root->entry_label_flags = batch->mb_root.entry_label_flags;
+    root->entry_label = batch->mb_root.entry_label;
+    root->entry_bridge_index = batch->mb_root.entry_bridge_index;
+    /* the shadow has to be complete before lookups can see it */
+    __sync_synchronize();
+    root->entry_long_i = batch->mb_root.entry_long_i;
+
+    /* the reference the shadow root held passes on to the table */
+    if (old_nh)
+        vrouter_put_nexthop(old_nh);
+
+    for (i = 0; i < batch->mb_nretired; i++)
+        mtrie_bucket_put_nexthops(batch->mb_retired[i]);
+
+    if (vr_not_ready) {
+        mtrie_batch_free(batch);
+        return;
+    }
+
+    defer = vr_get_defer_data(sizeof(*defer));
+    if (!defer) {
+        vr_delay_op();
+        mtrie_batch_free(batch);
+        return;
+    }
+
+    defer->vdd_data = (void *)batch;
+    vr_defer(vrouter_get(0), mtrie_batch_free_cb, (void *)defer);
+
+    return;
+}
+
+/*
+ * start a batch of updates to a table. till the batch ends, the routes
+ * added to and deleted from the table are applied to a shadow of it
+ */
+static int
+mtrie_batch_begin(struct vr_rtable *_unused, unsigned int vrf_id,
+        unsigned int family)
+{
+    struct ip_mtrie *mtrie;
+    struct mtrie_batch *batch;
+
+    if (mtrie_batch)
+        return -EBUSY;
+
+    if (vrf_id >= VR_MAX_VRFS)
+        return -EINVAL;
+
+    mtrie = vrfid_to_mtrie(vrf_id, family);
+    mtrie = (mtrie ? : mtrie_alloc_vrf(vrf_id, family));
+    if (!mtrie)
+        return -ENOMEM;
+
+    batch = vr_zalloc(sizeof(*batch));
+    if (!batch)
+        return -ENOMEM;
+
+    batch->mb_mtrie = mtrie;
+    copy_entry(&batch->mb_root, &mtrie->root);
+    mtrie_batch = batch;
+
+    return 0;
+}
+
+/*
+ * end the batch, publishing all its updates at once if 'commit' is set,
+ * or dropping them all otherwise. returns an error if the batch could not
+ * be published
+ */
+static int
+mtrie_batch_end(struct vr_rtable *_unused, bool commit)
+{
+    int ret;
+    struct mtrie_batch *batch = mtrie_batch;
+
+    if (!batch)
+        return -EINVAL;
+
+    mtrie_batch = NULL;
+
+    ret = batch->mb_error;
+    if (commit && !ret) {
+        mtrie_batch_publish(batch);
+        return 0;
+    }
+
+    mtrie_batch_discard(&batch->mb_root);
+    /* the replaced buckets are still live */
+    batch->mb_nretired = 0;
+    mtrie_batch_free(batch);
+
+    return ret;
+}
+
 static void
 mtrie_free_vrf(struct vr_rtable *rtable, unsigned int vrf_id)
 {
@@ -1035,6 +1864,12 @@ mtrie_algo_deinit(struct vr_rtable *rtable, struct rtable_fspec *fs, bool soft_r
 
     mtrie_stats_cleanup(rtable);
 
+    mtrie_hints_used = false;
+    if (mtrie_hints) {
+        vr_free(mtrie_hints);
+        mtrie_hints = NULL;
+    }
+
     for (i = 0; i < fs->rtb_max_vrfs; i++)
         mtrie_free_vrf(rtable, i);
 
@@ -1108,6 +1943,19 @@ mtrie_algo_init(struct vr_rtable *rtable, struct rtable_fspec *fs)
     if (algo_init_done)
         return 0;
 
+    ret = mtrie_ip_bkt_info_init(ip4_bkt_info, IP4_PREFIX_LEN,
+            vr_inet_mtrie_strides, IP4_BKT_MAX_LEVELS);
+    if (ret < 0)
+        return vr_module_error(ret, __FUNCTION__, __LINE__, AF_INET);
+    ip4_bkt_levels = ret;
+
+    ret = mtrie_ip_bkt_info_init(ip6_bkt_info, IP6_PREFIX_LEN,
+            vr_inet6_mtrie_strides, IP6_BKT_MAX_LEVELS);
+    if (ret < 0)
+        return vr_module_error(ret, __FUNCTION__, __LINE__, AF_INET6);
+    ip6_bkt_levels = ret;
+    ret = 0;
+
     table_memory = 2 * sizeof(void *) * fs->rtb_max_vrfs;
     rtable->algo_data = vr_zalloc(table_memory);
     if (!rtable->algo_data)
@@ -1119,6 +1967,9 @@ mtrie_algo_init(struct vr_rtable *rtable, struct rtable_fspec *fs)
         goto init_fail;
     }
 
+    /* without hints, the lookups of a burst just walk the tree again */
+    mtrie_hints = vr_zalloc(sizeof(struct vr_route_req *) * vr_num_cpus);
+
     rtable->algo_add = mtrie_add;
     rtable->algo_del = mtrie_delete;
     rtable->algo_lookup = mtrie_lookup;
@@ -1126,17 +1977,18 @@ mtrie_algo_init(struct vr_rtable *rtable, struct rtable_fspec *fs)
     rtable->algo_dump = mtrie_dump;
     rtable->algo_stats_get = mtrie_stats_get;
     rtable->algo_stats_dump = mtrie_stats_dump;
+    rtable->algo_batch_begin = mtrie_batch_begin;
+    rtable->algo_batch_end = mtrie_batch_end;
 
     vr_inet_route_lookup = mtrie_lookup;
+    vr_inet_route_lookup_burst = mtrie_lookup_burst;
+    vr_inet_route_hint = mtrie_hint;
     vr_inet_vrf_stats = mtrie_stats;
     /* local cache */
     vn_rtable[0] = (struct ip_mtrie **)rtable->algo_data; // V4 table
     vn_rtable[1] = (struct ip_mtrie **)((char*)rtable->algo_data 
                                                  + fs->rtb_max_vrfs); // V6 table
 
-    mtrie_ip_bkt_info_init(ip4_bkt_info, IP4_PREFIX_LEN);
-    mtrie_ip_bkt_info_init(ip6_bkt_info, IP6_PREFIX_LEN);
-
     algo_init_done = 1;
     return 0;
 
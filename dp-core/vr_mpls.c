@@ -16,7 +16,7 @@
 struct vr_nexthop *
 __vrouter_get_label(struct vrouter *router, unsigned int label)
 {
-    if (!router || label > router->vr_max_labels)
+    if (!router || label >= router->vr_max_labels)
         return NULL;
 
     return router->vr_ilm[label];
@@ -266,10 +266,10 @@ vr_mpls_input(struct vrouter *router, struct vr_packet *pkt,
         fmd = &c_fmd;
     }
 
-    label = ntohl(*(unsigned int *)pkt_data(pkt));
-    ttl = label & 0xFF;
-    label >>= VR_MPLS_LABEL_SHIFT;
-    if (label >= router->vr_max_labels) {
+    label = vr_mpls_label(*(unsigned int *)pkt_data(pkt));
+    ttl = ntohl(*(unsigned int *)pkt_data(pkt)) & 0xFF;
+    nh = __vrouter_get_label(router, label);
+    if (!nh) {
         drop_reason = VP_DROP_INVALID_LABEL;
         goto dropit;
     }
@@ -292,12 +292,6 @@ vr_mpls_input(struct vrouter *router, struct vr_packet *pkt,
         goto dropit;
     }
 
-    nh = router->vr_ilm[label];
-    if (!nh) {
-        drop_reason = VP_DROP_INVALID_LABEL;
-        goto dropit;
-    }
-
     /*
      * Mark it for GRO. Diag, L2 and multicast nexthops unmark if
      * required
@@ -76,6 +76,8 @@ vrouter_put_nexthop(struct vr_nexthop *nh)
             }
 
             vr_free(nh->nh_component_nh);
+            if (nh->nh_component_buckets)
+                vr_free(nh->nh_component_buckets);
         }
         if (nh->nh_dev) {
             vrouter_put_interface(nh->nh_dev);
@@ -433,11 +435,123 @@ nh_composite_ecmp_validate_src(struct vr_packet *pkt, struct vr_nexthop *nh,
     return NH_SOURCE_VALID;
 }
 
+/*
+ * the udp source port that the host computes for an ipv6 packet covers
+ * only the first bytes of the header, payload length included, and hence
+ * is not the same for all packets of a flow. hash the addresses, the next
+ * header and the ports instead
+ */
+static uint16_t
+nh_composite_ecmp_hash6(struct vr_packet *pkt, struct vr_ip6 *ip6,
+        struct vr_forwarding_md *fmd)
+{
+    uint32_t hash, ports = 0;
+    unsigned char *l4 = (unsigned char *)(ip6 + 1);
+
+    if (((ip6->ip6_nxt == VR_IP_PROTO_TCP) ||
+                (ip6->ip6_nxt == VR_IP_PROTO_UDP)) &&
+            (l4 + sizeof(ports) <= pkt->vp_head + pkt->vp_tail))
+        memcpy(&ports, l4, sizeof(ports));
+
+    hash = vr_hash(ip6->ip6_src, 2 * VR_IP6_ADDRESS_LEN, fmd->fmd_dvrf);
+    hash = vr_hash_2words(hash, ports, ip6->ip6_nxt);
+
+    /* 0 stands for no hash */
+    return (hash & 0xFFFF) ? (hash & 0xFFFF) : 1;
+}
+
+/*
+ * the hash that ecmp member selection is based on is the outer udp source
+ * port, which for a packet with a flow is the one that the flow carries,
+ * and otherwise is a hash of the inner headers. either way, all packets of
+ * a flow hash the same. Returns 0 if there is no hash to be had
+ */
+static uint16_t
+nh_composite_ecmp_hash(struct vr_packet *pkt, struct vr_forwarding_md *fmd)
+{
+    uint16_t udp_src_port = fmd->fmd_udp_src_port;
+    struct vr_ip *ip;
+
+    if (udp_src_port)
+        return udp_src_port;
+
+    /*
+     * the tunnel nexthops use the standard port for ipv6, so the hash is
+     * not kept in fmd_udp_src_port for them
+     */
+    ip = (struct vr_ip *)pkt_network_header(pkt);
+    if (ip && vr_ip_is_ip6(ip))
+        return nh_composite_ecmp_hash6(pkt, (struct vr_ip6 *)ip, fmd);
+
+    if (vr_get_udp_src_port) {
+        udp_src_port = vr_get_udp_src_port(pkt, fmd, fmd->fmd_dvrf);
+        /* the tunnel nexthop would have computed the same */
+        fmd->fmd_udp_src_port = udp_src_port;
+    }
+
+    return udp_src_port;
+}
+
+static inline bool
+nh_composite_ecmp_member_valid(struct vr_nexthop *nh, unsigned int index)
+{
+    struct vr_nexthop *cnh;
+
+    if (index >= nh->nh_component_cnt)
+        return false;
+
+    cnh = nh->nh_component_nh[index].cnh;
+    return cnh && (cnh->nh_flags & NH_FLAG_VALID);
+}
+
+/*
+ * nh_composite_ecmp_select - pick the member for the packet by its hash,
+ * from the ecmp buckets if the composite has them, or else straight from
+ * the member list. if the member picked is not usable, the hash is mixed
+ * again with the probe count, so that the flows of a failed member do not
+ * all land on its neighbour. Returns the index of the member, or -1 if
+ * there is no usable member
+ */
+static int
+nh_composite_ecmp_select(struct vr_packet *pkt, struct vr_nexthop *nh,
+        struct vr_forwarding_md *fmd)
+{
+    unsigned int i, start, slots;
+    uint16_t hash, index;
+
+    if (!nh->nh_component_cnt)
+        return -1;
+
+    hash = nh_composite_ecmp_hash(pkt, fmd);
+    if (!hash)
+        return -1;
+
+    slots = nh->nh_component_buckets ? NH_ECMP_BUCKETS : nh->nh_component_cnt;
+    for (i = 0; i < NH_ECMP_PROBES; i++) {
+        /* seed with the nexthop id, so that composites do not polarize */
+        index = vr_hash_2words(hash, i, nh->nh_id) % slots;
+        if (nh->nh_component_buckets)
+            index = nh->nh_component_buckets[index];
+        if (nh_composite_ecmp_member_valid(nh, index))
+            return index;
+    }
+
+    /* most of the members are down. take the first one that is not */
+    start = hash % nh->nh_component_cnt;
+    for (i = 0; i < nh->nh_component_cnt; i++) {
+        index = (start + i) % nh->nh_component_cnt;
+        if (nh_composite_ecmp_member_valid(nh, index))
+            return index;
+    }
+
+    return -1;
+}
+
 static int
 nh_composite_ecmp(struct vr_packet *pkt, struct vr_nexthop *nh,
                   struct vr_forwarding_md *fmd)
 {
-    int ret = 0;
+    int ret = 0, index;
     struct vr_nexthop *member_nh = NULL;
     struct vr_vrf_stats *stats;
 
@@ -452,6 +566,31 @@ nh_composite_ecmp(struct vr_packet *pkt, struct vr_nexthop *nh,
     if (fmd->fmd_ecmp_nh_index >= 0)
         member_nh = nh->nh_component_nh[fmd->fmd_ecmp_nh_index].cnh;
 
+    /*
+     * a member that is present but not valid (say, a tunnel whose arp is
+     * not yet resolved) would only have the packet dropped. with buckets,
+     * treat it as missing and rehash past it, as for a deleted member
+     */
+    if (member_nh && !(member_nh->nh_flags & NH_FLAG_VALID) &&
+            nh->nh_component_buckets)
+        member_nh = NULL;
+
+    /*
+     * in a relaxed policy vn, a flow miss is forwarded without a flow, and
+     * hence without a member picked by agent. such packets are spread by
+     * their hash, rather than being trapped one by one to agent
+     */
+    if (!member_nh && (nh->nh_component_buckets ||
+                ((nh->nh_flags & NH_FLAG_RELAXED_POLICY) &&
+                 (fmd->fmd_flow_index < 0) &&
+                 (fmd->fmd_ecmp_nh_index < 0)))) {
+        index = nh_composite_ecmp_select(pkt, nh, fmd);
+        if (index >= 0) {
+            fmd->fmd_ecmp_nh_index = index;
+            member_nh = nh->nh_component_nh[index].cnh;
+        }
+    }
+
     if (!member_nh) {
         vr_trap(pkt, fmd->fmd_dvrf, AGENT_TRAP_ECMP_RESOLVE, &fmd->fmd_flow_index);
         return 0;
@@ -1922,51 +2061,215 @@ nh_composite_mcast_validate(struct vr_nexthop *nh, vr_nexthop_req *req)
     return 0;
 }
 
+/*
+ * nh_composite_ecmp_buckets - build the ecmp buckets of 'nh' from the
+ * member weights. a bucket keeps pointing to the member it pointed to in
+ * 'old_buckets' as long as that member (nexthop and label) is still
+ * around and has not got all its buckets yet. the rest of the buckets are
+ * handed to the members that are short of their share. Returns 0 on
+ * success, with no buckets if none of the members has a weight
+ */
 static int
-nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
+nh_composite_ecmp_buckets(struct vr_nexthop *nh,
+        struct vr_component_nh *old_component, unsigned int old_cnt,
+        uint16_t *old_buckets)
 {
-    unsigned int i;
-    struct vr_nexthop *tmp_nh;
+    int ret = 0, *old_to_new = NULL;
+    unsigned int i, j, total = 0, assigned = 0;
+    unsigned int *quota = NULL, *used = NULL;
+    uint16_t *buckets;
+    struct vr_nexthop *cnh;
 
-    nh->nh_validate_src = NULL;
-    /* Delete the old nexthops first */
-    if (nh->nh_component_cnt && nh->nh_component_nh) {
-        for (i = 0; i < nh->nh_component_cnt; i++) {
-            if (nh->nh_component_nh[i].cnh)
-                vrouter_put_nexthop(nh->nh_component_nh[i].cnh);
+    for (i = 0; i < nh->nh_component_cnt; i++) {
+        if (nh->nh_component_nh[i].cnh)
+            total += nh->nh_component_nh[i].cnh_weight;
+    }
+
+    if (!total)
+        return 0;
+
+    buckets = vr_malloc(NH_ECMP_BUCKETS * sizeof(*buckets));
+    quota = vr_zalloc(nh->nh_component_cnt * sizeof(*quota));
+    used = vr_zalloc(nh->nh_component_cnt * sizeof(*used));
+    if (!buckets || !quota || !used) {
+        ret = -ENOMEM;
+        goto exit_buckets;
+    }
+
+    for (i = 0; i < nh->nh_component_cnt; i++) {
+        if (!nh->nh_component_nh[i].cnh)
+            continue;
+
+        quota[i] = ((uint64_t)NH_ECMP_BUCKETS *
+                nh->nh_component_nh[i].cnh_weight) / total;
+        assigned += quota[i];
+    }
+
+    /* what the rounding left over goes to the members in order */
+    i = 0;
+    while (assigned < NH_ECMP_BUCKETS) {
+        if (nh->nh_component_nh[i].cnh &&
+                nh->nh_component_nh[i].cnh_weight) {
+            quota[i]++;
+            assigned++;
         }
-        vr_free(nh->nh_component_nh);
-        nh->nh_component_nh = NULL;
-        nh->nh_component_cnt = 0;
+
+        i = (i + 1) % nh->nh_component_cnt;
     }
 
-    if (req->nhr_nh_list_size != req->nhr_label_list_size)
-        return -EINVAL;
+    for (i = 0; i < NH_ECMP_BUCKETS; i++)
+        buckets[i] = NH_ECMP_BUCKET_INVALID;
+
+    if (old_buckets && old_cnt) {
+        old_to_new = vr_malloc(old_cnt * sizeof(*old_to_new));
+        if (!old_to_new) {
+            ret = -ENOMEM;
+            goto exit_buckets;
+        }
+
+        for (i = 0; i < old_cnt; i++) {
+            old_to_new[i] = -1;
+            cnh = old_component[i].cnh;
+            if (!cnh)
+                continue;
+
+            /*
+             * members are told apart by the label too, since the same
+             * tunnel nexthop can be a member for different labels
+             */
+            for (j = 0; j < nh->nh_component_cnt; j++) {
+                if (nh->nh_component_nh[j].cnh &&
+                        (nh->nh_component_nh[j].cnh->nh_id == cnh->nh_id) &&
+                        (nh->nh_component_nh[j].cnh_label ==
+                         old_component[i].cnh_label)) {
+                    old_to_new[i] = j;
+                    break;
+                }
+            }
+        }
+
+        for (i = 0; i < NH_ECMP_BUCKETS; i++) {
+            if ((old_buckets[i] >= old_cnt) ||
+                    (old_to_new[old_buckets[i]] < 0))
+                continue;
+
+            j = old_to_new[old_buckets[i]];
+            if (used[j] >= quota[j])
+                continue;
+
+            buckets[i] = j;
+            used[j]++;
+        }
+    }
+
+    /*
+     * the free buckets are handed out to the members in turn rather than
+     * in runs, so that the buckets of a member are spread over the table
+     */
+    for (i = 0, j = 0; i < NH_ECMP_BUCKETS; i++) {
+        if (buckets[i] != NH_ECMP_BUCKET_INVALID)
+            continue;
+
+        while (used[j] >= quota[j])
+            j = (j + 1) % nh->nh_component_cnt;
+
+        buckets[i] = j;
+        used[j]++;
+        j = (j + 1) % nh->nh_component_cnt;
+    }
+
+    nh->nh_component_buckets = buckets;
+    buckets = NULL;
+
+exit_buckets:
+    if (buckets)
+        vr_free(buckets);
+    if (quota)
+        vr_free(quota);
+    if (used)
+        vr_free(used);
+    if (old_to_new)
+        vr_free(old_to_new);
+
+    return ret;
+}
+
+static void
+nh_composite_components_free(struct vr_component_nh *component,
+        unsigned int cnt)
+{
+    unsigned int i;
+
+    for (i = 0; i < cnt; i++) {
+        if (component[i].cnh)
+            vrouter_put_nexthop(component[i].cnh);
+    }
+
+    vr_free(component);
+    return;
+}
+
+static int
+nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
+{
+    int ret = 0;
+    unsigned int i, old_cnt;
+    uint16_t *old_buckets;
+    struct vr_component_nh *old_component;
+
+    nh->nh_validate_src = NULL;
+    /*
+     * the old nexthops are let go only after the new ones are in place,
+     * so that the ecmp buckets of the members that stay can be retained
+     */
+    old_component = nh->nh_component_nh;
+    old_cnt = nh->nh_component_cnt;
+    old_buckets = nh->nh_component_buckets;
+    nh->nh_component_nh = NULL;
+    nh->nh_component_cnt = 0;
+    nh->nh_component_buckets = NULL;
+
+    if ((req->nhr_nh_list_size != req->nhr_label_list_size) ||
+            (req->nhr_weight_list_size &&
+             (req->nhr_weight_list_size != req->nhr_nh_list_size))) {
+        ret = -EINVAL;
+        goto exit_add;
+    }
 
     /* Nh list of size 0 is valid */
     if (req->nhr_nh_list_size == 0)
-        return 0;
+        goto exit_add;
 
     nh->nh_component_nh = vr_zalloc(req->nhr_nh_list_size *
             sizeof(struct vr_component_nh));
     if (!nh->nh_component_nh) {
-        return -ENOMEM;
+        ret = -ENOMEM;
+        goto exit_add;
     }
     for (i = 0; i < req->nhr_nh_list_size; i++) {
         nh->nh_component_nh[i].cnh = vrouter_get_nexthop(req->nhr_rid,
                                                     req->nhr_nh_list[i]);
         nh->nh_component_nh[i].cnh_label = req->nhr_label_list[i];
+        if (req->nhr_weight_list_size && (req->nhr_weight_list[i] > 0))
+            nh->nh_component_nh[i].cnh_weight = req->nhr_weight_list[i];
     }
     nh->nh_component_cnt = req->nhr_nh_list_size;
 
-    if (nh_composite_mcast_validate(nh, req))
+    if (nh_composite_mcast_validate(nh, req)) {
+        ret = -EINVAL;
         goto error;
+    }
 
     /* This needs to be the last */
     if (req->nhr_flags & NH_FLAG_COMPOSITE_L2) {
         nh->nh_reach_nh = nh_composite_mcast_l2;
         nh->nh_validate_src = nh_composite_mcast_validate_src;
     } else if (req->nhr_flags & NH_FLAG_COMPOSITE_ECMP) {
+        ret = nh_composite_ecmp_buckets(nh, old_component, old_cnt,
+                old_buckets);
+        if (ret)
+            goto error;
+
         nh->nh_reach_nh = nh_composite_ecmp;
         nh->nh_validate_src = nh_composite_ecmp_validate_src;
     } else if (req->nhr_flags & NH_FLAG_COMPOSITE_FABRIC) {
@@ -1980,21 +2283,23 @@ nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
         nh->nh_reach_nh = nh_composite_tor;
     }
 
-    return 0;
+    goto exit_add;
 
 error:
     if (nh->nh_component_nh) {
-        for (i = 0; i < req->nhr_nh_list_size; i++) {
-             tmp_nh = nh->nh_component_nh[i].cnh;
-             if (tmp_nh)
-                vrouter_put_nexthop(tmp_nh);
-        }
-
-        vr_free(nh->nh_component_nh);
+        nh_composite_components_free(nh->nh_component_nh,
+                req->nhr_nh_list_size);
         nh->nh_component_nh = NULL;
         nh->nh_component_cnt = 0;
     }
-    return -EINVAL;
+
+exit_add:
+    if (old_component)
+        nh_composite_components_free(old_component, old_cnt);
+    if (old_buckets)
+        vr_free(old_buckets);
+
+    return ret;
 }
 
 static int
@@ -2340,6 +2645,18 @@ vr_nexthop_make_req(vr_nexthop_req *req, struct vr_nexthop *nh)
 
                 req->nhr_label_list[i] = nh->nh_component_nh[i].cnh_label;
             }
+
+            if (nh->nh_component_buckets) {
+                req->nhr_weight_list_size = nh->nh_component_cnt;
+                req->nhr_weight_list = vr_zalloc(req->nhr_weight_list_size *
+                        sizeof(unsigned int));
+                if (!req->nhr_weight_list)
+                    return -ENOMEM;
+
+                for (i = 0; i < req->nhr_weight_list_size; i++)
+                    req->nhr_weight_list[i] =
+                        nh->nh_component_nh[i].cnh_weight;
+            }
         }
 
         break;
@@ -2429,6 +2746,12 @@ vr_nexthop_req_destroy(vr_nexthop_req *req)
         req->nhr_label_list_size = 0;
     }
 
+    if (req->nhr_weight_list_size && req->nhr_weight_list) {
+        vr_free(req->nhr_weight_list);
+        req->nhr_weight_list = NULL;
+        req->nhr_weight_list_size = 0;
+    }
+
     vr_free(req);
     return;
 }
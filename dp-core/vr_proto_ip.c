@@ -371,6 +371,50 @@ vr_icmp_input(struct vrouter *router, struct vr_packet *pkt,
     return unhandled;
 }
 
+/*
+ * the encapsulation that a UDP packet to our destination port carries,
+ * or -1 if the port is not one of ours
+ */
+static int
+vr_udp_encap_type(struct vr_udp *udph)
+{
+    if (ntohs(udph->udp_dport) == VR_MPLS_OVER_UDP_DST_PORT)
+        return PKT_ENCAP_MPLS;
+    else if (ntohs(udph->udp_dport) == VR_VXLAN_UDP_DST_PORT)
+        return PKT_ENCAP_VXLAN;
+
+    return -1;
+}
+
+/*
+ * the length of a GRE header that carries MPLS, or 0 if it carries
+ * something else or is not one we understand
+ */
+static unsigned short
+vr_gre_mpls_hdr_len(unsigned short *gre_hdr)
+{
+    unsigned short hdr_len = VR_GRE_BASIC_HDR_LEN;
+
+    if (*gre_hdr & VR_GRE_FLAG_CSUM)
+            hdr_len += 4;
+
+    if (*gre_hdr & VR_GRE_FLAG_KEY)
+            hdr_len += 4;
+
+    /* we are not RFC 1701 compliant receiver */
+    if (*gre_hdr & (~(VR_GRE_FLAG_CSUM | VR_GRE_FLAG_KEY)))
+            return 0;
+
+    /*
+     * ... and we do not deal with any other protocol other than MPLS
+     * for now
+     */
+    if (ntohs(*(gre_hdr + 1)) != VR_GRE_PROTO_MPLS)
+            return 0;
+
+    return hdr_len;
+}
+
 /*
  * vr_udp_input - handle incoming UDP packets. If the UDP destination
  * port is for MPLS over UDP or VXLAN, decap the packet and forward the inner
@@ -412,13 +456,9 @@ vr_udp_input(struct vrouter *router, struct vr_packet *pkt,
         return 0;
     }
 
-    if (ntohs(udph->udp_dport) == VR_MPLS_OVER_UDP_DST_PORT) {
-        encap_type = PKT_ENCAP_MPLS;
-    } else if (ntohs(udph->udp_dport) == VR_VXLAN_UDP_DST_PORT) {
-        encap_type = PKT_ENCAP_VXLAN;
-    } else {
+    encap_type = vr_udp_encap_type(udph);
+    if (encap_type < 0)
         return 1;
-    }
 
     /*
      * We are going to handle this packet. Pull as much of the inner packet
@@ -447,7 +487,7 @@ unsigned int
 vr_gre_input(struct vrouter *router, struct vr_packet *pkt,
         struct vr_forwarding_md *fmd)
 {
-    unsigned short *gre_hdr, gre_proto, hdr_len, reason;
+    unsigned short *gre_hdr, hdr_len, reason;
     char buf[4];
     int handled = 0, ret = PKT_RET_FAST_PATH;
     int encap_type;
@@ -473,29 +513,15 @@ vr_gre_input(struct vrouter *router, struct vr_packet *pkt,
     }
 
     /* start with basic GRE header */
-    hdr_len = 4;
-    gre_hdr = (unsigned short *) vr_pheader_pointer(pkt, hdr_len, buf);
+    gre_hdr = (unsigned short *) vr_pheader_pointer(pkt,
+            VR_GRE_BASIC_HDR_LEN, buf);
     if (gre_hdr == NULL) {
         vr_pfree(pkt, VP_DROP_MISC);
         return 0;
     }
 
-    if (*gre_hdr & VR_GRE_FLAG_CSUM)
-            hdr_len += 4;
-
-    if (*gre_hdr & VR_GRE_FLAG_KEY)
-            hdr_len += 4;
-
-    /* we are not RFC 1701 compliant receiver */
-    if (*gre_hdr & (~(VR_GRE_FLAG_CSUM | VR_GRE_FLAG_KEY)))
-            goto unhandled;
-
-    /*
-     * ... and we do not deal with any other protocol other than MPLS
-     * for now
-     */
-    gre_proto = ntohs(*(gre_hdr + 1));
-    if (gre_proto != VR_GRE_PROTO_MPLS)
+    hdr_len = vr_gre_mpls_hdr_len(gre_hdr);
+    if (!hdr_len)
             goto unhandled;
 
     /*
@@ -763,18 +789,27 @@ vr_inet_flow_swap(struct vr_flow *key_p)
     return;
 }
 
+/*
+ * the nexthop that a flow of a packet decapped to the nexthop of a label
+ * is keyed with
+ */
+static unsigned short
+vr_inet_flow_label_nexthop(struct vr_nexthop *nh)
+{
+    /* this is more a requirement from agent */
+    if (nh->nh_type == NH_ENCAP)
+        return nh->nh_dev->vif_nh_id;
+
+    return nh->nh_id;
+}
+
 static unsigned short
 vr_inet_flow_nexthop(struct vr_packet *pkt, unsigned short vlan)
 {
     unsigned short nh_id;
 
     if (vif_is_fabric(pkt->vp_if) && pkt->vp_nh) {
-        /* this is more a requirement from agent */
-        if ((pkt->vp_nh->nh_type == NH_ENCAP)) {
-            nh_id = pkt->vp_nh->nh_dev->vif_nh_id;
-        } else {
-            nh_id = pkt->vp_nh->nh_id;
-        }
+        nh_id = vr_inet_flow_label_nexthop(pkt->vp_nh);
     } else if (vif_is_service(pkt->vp_if)) {
         nh_id = vif_vrf_table_get_nh(pkt->vp_if, vlan);
     } else {
@@ -870,23 +905,169 @@ vr_inet_proto_flow(struct vrouter *router, unsigned short vrf,
 }
 
 static int
-vr_inet_form_flow(struct vrouter *router, unsigned short vrf, 
-        struct vr_packet *pkt, uint16_t vlan, struct vr_flow *flow_p)
+vr_inet_form_flow(struct vrouter *router, struct vr_forwarding_md *fmd,
+        struct vr_packet *pkt, struct vr_flow *flow_p)
 {
     int ret;
+    unsigned short vrf = fmd->fmd_dvrf;
+    uint16_t vlan = fmd->fmd_vlan;
     struct vr_ip *ip = (struct vr_ip *)pkt_network_header(pkt);
 
     if (vr_ip_transport_header_valid(ip)) {
         ret = vr_inet_proto_flow(router, vrf, pkt, vlan, ip, flow_p);
     } else {
         ret = vr_inet_fragment_flow(router, vrf, pkt, vlan, flow_p);
+        /* the head fragment might still be on its way. hold on for it */
         if (ret < 0)
-            vr_pfree(pkt, VP_DROP_FRAGMENTS);
+            vr_fragment_enqueue(router, vrf, pkt, fmd);
     }
 
     return ret;
 }
 
+/*
+ * checks that the 'len' bytes at 'ip' hold an ipv4 header and enough of
+ * the transport header to form a flow key with, for a unicast packet that
+ * is not an icmp error
+ */
+static bool
+vr_inet_flow_rx_ip(struct vr_ip *ip, unsigned int len)
+{
+    unsigned int hlen;
+    struct vr_icmp *icmph;
+
+    if (len < sizeof(*ip))
+        return false;
+
+    hlen = ip->ip_hl * 4;
+    if ((ip->ip_version != 4) || (hlen < sizeof(*ip)) ||
+            (len < hlen + sizeof(*icmph)))
+        return false;
+
+    if (!vr_ip_transport_header_valid(ip) || IS_BMCAST_IP(ip->ip_daddr))
+        return false;
+
+    if (ip->ip_proto == VR_IP_PROTO_ICMP) {
+        icmph = (struct vr_icmp *)((unsigned char *)ip + hlen);
+        if (vr_icmp_error(icmph))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * the key of an MPLSoGRE or MPLSoUDP packet from the fabric, as the flow
+ * lookup after decap forms it: the inner header, with the nexthop of the
+ * label
+ */
+static bool
+vr_inet_flow_fabric_key(struct vr_interface *vif, struct vr_packet *pkt,
+        struct vr_ip *ip, unsigned int len, struct vr_flow *flow_p)
+{
+    unsigned int hlen;
+    unsigned short gre_len;
+    struct vr_udp *udph;
+    struct vr_nexthop *nh;
+    struct vrouter *router = vif->vif_router;
+
+    if ((len < sizeof(*ip)) || (ip->ip_version != 4) ||
+            !vr_ip_transport_header_valid(ip))
+        return false;
+
+    hlen = ip->ip_hl * 4;
+    if (ip->ip_proto == VR_IP_PROTO_GRE) {
+        if (len < hlen + VR_GRE_BASIC_HDR_LEN)
+            return false;
+
+        gre_len = vr_gre_mpls_hdr_len((unsigned short *)
+                ((unsigned char *)ip + hlen));
+        if (!gre_len)
+            return false;
+
+        hlen += gre_len;
+    } else if (ip->ip_proto == VR_IP_PROTO_UDP) {
+        if (len < hlen + sizeof(*udph))
+            return false;
+
+        udph = (struct vr_udp *)((unsigned char *)ip + hlen);
+        if (vr_udp_encap_type(udph) != PKT_ENCAP_MPLS)
+            return false;
+
+        hlen += sizeof(*udph);
+    } else {
+        return false;
+    }
+
+    if (len < hlen + VR_MPLS_HDR_LEN)
+        return false;
+
+    nh = __vrouter_get_label(router,
+            vr_mpls_label(*(unsigned int *)((unsigned char *)ip + hlen)));
+
+    /* only l3 labels whose nexthop looks the flow up */
+    if (!nh || (nh->nh_family != AF_INET) ||
+            !(nh->nh_flags & NH_FLAG_POLICY_ENABLED))
+        return false;
+
+    if ((nh->nh_type == NH_ENCAP) && !nh->nh_dev)
+        return false;
+
+    hlen += VR_MPLS_HDR_LEN;
+    ip = (struct vr_ip *)((unsigned char *)ip + hlen);
+    if (!vr_inet_flow_rx_ip(ip, len - hlen))
+        return false;
+
+    if (vr_inet_proto_flow(router, vif->vif_vrf, pkt, VLAN_ID_INVALID,
+                ip, flow_p))
+        return false;
+
+    flow_p->flow4_nh_id = vr_inet_flow_label_nexthop(nh);
+
+    return true;
+}
+
+/*
+ * forms the flow key of a received packet, ahead of the regular receive
+ * processing, so that the flow table loads of a burst can be overlapped.
+ * only the common cases are handled: untagged, unicast ipv4 from a policy
+ * enabled VM, and MPLS over GRE or UDP from the fabric. for the rest, the
+ * key depends on state that is known only further down the receive path,
+ * and false is returned. the key is a hint; the outer destination of a
+ * fabric packet, for one, is not checked to be ours
+ */
+bool
+vr_inet_flow_rx_key(struct vr_interface *vif, struct vr_packet *pkt,
+        struct vr_flow *flow_p)
+{
+    unsigned int len;
+    struct vr_eth *eth;
+    struct vr_ip *ip;
+
+    if ((pkt->vp_if != vif) || (pkt_head_len(pkt) < sizeof(*eth)))
+        return false;
+
+    eth = (struct vr_eth *)pkt_data(pkt);
+    if (eth->eth_proto != htons(VR_ETH_PROTO_IP))
+        return false;
+
+    ip = (struct vr_ip *)(eth + 1);
+    len = pkt_head_len(pkt) - sizeof(*eth);
+
+    if (vif_is_fabric(vif))
+        return vr_inet_flow_fabric_key(vif, pkt, ip, len, flow_p);
+
+    if (!vif_is_virtual(vif) || vif_is_service(vif) ||
+            !(vif->vif_flags & VIF_FLAG_POLICY_ENABLED))
+        return false;
+
+    if (!vr_inet_flow_rx_ip(ip, len))
+        return false;
+
+    return !vr_inet_proto_flow(vif->vif_router, vif->vif_vrf, pkt,
+            VLAN_ID_INVALID, ip, flow_p);
+}
+
 static bool
 vr_inet_should_trap(struct vr_packet *pkt, struct vr_flow *flow_p)
 {
@@ -915,9 +1096,11 @@ vr_inet_flow_lookup(struct vrouter *router, struct vr_packet *pkt,
                     struct vr_forwarding_md *fmd)
 {
     int ret;
-    bool lookup = false;
+    bool lookup = false, head = false;
+    unsigned short vrf = fmd->fmd_dvrf;
     struct vr_flow flow, *flow_p = &flow;
-    struct vr_ip *ip = (struct vr_ip *)pkt_network_header(pkt);
+    struct vr_ip head_ip, *ip = (struct vr_ip *)pkt_network_header(pkt);
+    flow_result_t result;
 
     /*
      * if the packet has already done one round of flow lookup, there
@@ -926,7 +1109,7 @@ vr_inet_flow_lookup(struct vrouter *router, struct vr_packet *pkt,
     if (pkt->vp_flags & VP_FLAG_FLOW_SET)
         return FLOW_FORWARD;
 
-    ret = vr_inet_form_flow(router, fmd->fmd_dvrf, pkt, fmd->fmd_vlan, flow_p);
+    ret = vr_inet_form_flow(router, fmd, pkt, flow_p);
     if (ret < 0)
         return FLOW_CONSUMED;
 
@@ -950,11 +1133,25 @@ vr_inet_flow_lookup(struct vrouter *router, struct vr_packet *pkt,
 
     if (lookup) {
         if (vr_ip_fragment_head(ip)) {
-            vr_fragment_add(router, fmd->fmd_dvrf, ip, flow_p->flow4_sport,
-                    flow_p->flow4_dport);
+            if (!vr_fragment_add(router, vrf, ip,
+                        flow_p->flow4_sport, flow_p->flow4_dport)) {
+                head = true;
+                head_ip = *ip;
+            }
         }
 
-        return vr_flow_lookup(router, flow_p, pkt, fmd);
+        /*
+         * the head goes for the lookup first, so that it is the head that
+         * is trapped for a new flow. once the lookup is done, the packet
+         * could have been held (and freed by another cpu), and fmd could
+         * have been rewritten. hence, the fragments that overtook the head
+         * are released using the copies taken before the lookup
+         */
+        result = vr_flow_lookup(router, flow_p, pkt, fmd);
+        if (head)
+            vr_fragment_queue_flush(router, vrf, &head_ip);
+
+        return result;
     }
 
     return FLOW_FORWARD;
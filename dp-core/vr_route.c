@@ -234,6 +234,133 @@ vr_route_req_process(void *s_req)
     return;
 }
 
+static int
+vr_route_batch_validate(vr_route_batch_req *req)
+{
+    unsigned int nroutes = req->rbr_ops_size;
+
+    if (req->rbr_family != AF_INET && req->rbr_family != AF_INET6)
+        return -EINVAL;
+
+    if ((unsigned int)req->rbr_vrf_id >= VR_MAX_VRFS)
+        return -EINVAL;
+
+    if ((req->rbr_prefixes_size != nroutes * RT_IP_ADDR_SIZE(req->rbr_family)) ||
+            (req->rbr_prefix_lens_size != nroutes) ||
+            (req->rbr_nh_ids_size != nroutes) ||
+            (req->rbr_labels_size != nroutes) ||
+            (req->rbr_label_flags_size != nroutes) ||
+            (req->rbr_replace_plens_size != nroutes))
+        return -EINVAL;
+
+    return 0;
+}
+
+/*
+ * apply a batch of route updates to a vrf. either all of them make it to
+ * the table, in one go, or none does
+ */
+static int
+vr_route_batch(vr_route_batch_req *req)
+{
+    int ret;
+    unsigned int i, addr_size;
+    struct rtable_fspec *fs;
+    struct vrouter *router;
+    struct vr_rtable *rtable;
+    struct vr_route_req vr_req;
+    uint32_t rt_prefix[4];
+
+    ret = vr_route_batch_validate(req);
+    if (ret)
+        goto generate_response;
+
+    fs = vr_get_family(req->rbr_family);
+    router = vrouter_get(req->rbr_rid);
+    if (!fs || !router) {
+        ret = -ENOENT;
+        goto generate_response;
+    }
+
+    rtable = router->vr_inet_rtable;
+    if (!rtable) {
+        ret = -ENOENT;
+        goto generate_response;
+    }
+
+    if (!rtable->algo_batch_begin) {
+        ret = -EOPNOTSUPP;
+        goto generate_response;
+    }
+
+    ret = rtable->algo_batch_begin(rtable, req->rbr_vrf_id, req->rbr_family);
+    if (ret)
+        goto generate_response;
+
+    addr_size = RT_IP_ADDR_SIZE(req->rbr_family);
+    for (i = 0; i < req->rbr_ops_size; i++) {
+        memset(&vr_req, 0, sizeof(vr_req));
+        vr_req.rtr_req.h_op = req->rbr_ops[i];
+        vr_req.rtr_req.rtr_rid = req->rbr_rid;
+        vr_req.rtr_req.rtr_vrf_id = req->rbr_vrf_id;
+        vr_req.rtr_req.rtr_family = req->rbr_family;
+        vr_req.rtr_req.rtr_prefix = (uint8_t *)&rt_prefix;
+        vr_req.rtr_req.rtr_prefix_size = addr_size;
+        memcpy(vr_req.rtr_req.rtr_prefix, req->rbr_prefixes + i * addr_size,
+                addr_size);
+        vr_req.rtr_req.rtr_prefix_len = (uint8_t)req->rbr_prefix_lens[i];
+        vr_req.rtr_req.rtr_nh_id = req->rbr_nh_ids[i];
+        vr_req.rtr_req.rtr_label = req->rbr_labels[i];
+        vr_req.rtr_req.rtr_label_flags = (uint8_t)req->rbr_label_flags[i];
+        vr_req.rtr_req.rtr_replace_plen = (uint8_t)req->rbr_replace_plens[i];
+
+        switch (req->rbr_ops[i]) {
+        case SANDESH_OP_ADD:
+            ret = fs->route_add(fs, &vr_req);
+            break;
+
+        case SANDESH_OP_DELETE:
+            ret = fs->route_del(fs, &vr_req);
+            break;
+
+        default:
+            ret = -EINVAL;
+            break;
+        }
+
+        if (ret)
+            break;
+    }
+
+    if (ret)
+        rtable->algo_batch_end(rtable, false);
+    else
+        ret = rtable->algo_batch_end(rtable, true);
+
+generate_response:
+    vr_send_response(ret);
+
+    return ret;
+}
+
+void
+vr_route_batch_req_process(void *s_req)
+{
+    vr_route_batch_req *req = (vr_route_batch_req *)s_req;
+
+    switch (req->h_op) {
+    case SANDESH_OP_ADD:
+        vr_route_batch(req);
+        break;
+
+    default:
+        vr_send_response(-EOPNOTSUPP);
+        break;
+    }
+
+    return;
+}
+
 static void
 vr_inet_vrf_stats_dump(struct vrouter *router, vr_vrf_stats_req *req)
 {
@@ -57,6 +57,14 @@ struct sandesh_object_md sandesh_md[] = {
         .obj_len                =       4 * sizeof(vr_vxlan_req),
         .obj_type_string        =       "vr_vxlan_req",
     },
+    [VR_ROUTE_BATCH_OBJECT_ID]  =   {
+        .obj_len                =       4 * sizeof(vr_route_batch_req),
+        .obj_type_string        =       "vr_route_batch_req",
+    },
+    [VR_LCORE_STATS_OBJECT_ID]  =   {
+        .obj_len                =       4 * sizeof(vr_lcore_stats_req),
+        .obj_type_string        =       "vr_lcore_stats_req",
+    },
 };
 
 static unsigned int
@@ -171,6 +171,62 @@ vr_drop_stats_req_process(void *s_req)
     return;
 }
 
+/*
+ * the stats of the packet processing threads, for platforms that have them
+ * (dpdk lcores). the host fills in the first lcore at or after the one
+ * asked for, and returns -ENOENT past the last
+ */
+static void
+vr_lcore_stats_dump(vr_lcore_stats_req *req)
+{
+    int ret = 0, len;
+    unsigned int lcore;
+    struct vr_message_dumper *dumper;
+    vr_lcore_stats_req response;
+
+    dumper = vr_message_dump_init(req);
+    if (!dumper) {
+        ret = -ENOMEM;
+        goto generate_response;
+    }
+
+    lcore = req->vlsr_marker + 1;
+    while (1) {
+        memset(&response, 0, sizeof(response));
+        if (vrouter_host->hos_get_lcore_stats(lcore, &response))
+            break;
+
+        len = vr_message_dump_object(dumper, VR_LCORE_STATS_OBJECT_ID,
+                &response);
+        if (len <= 0)
+            break;
+        lcore = response.vlsr_lcore + 1;
+    }
+
+generate_response:
+    vr_message_dump_exit(dumper, ret);
+    return;
+}
+
+void
+vr_lcore_stats_req_process(void *s_req)
+{
+    vr_lcore_stats_req *req = (vr_lcore_stats_req *)s_req;
+
+    if (req->h_op != SANDESH_OP_DUMP) {
+        vr_send_response(-EOPNOTSUPP);
+        return;
+    }
+
+    if (!vrouter_host->hos_get_lcore_stats) {
+        vr_send_response(-EOPNOTSUPP);
+        return;
+    }
+
+    vr_lcore_stats_dump(req);
+    return;
+}
+
 static void
 vr_pkt_drop_stats_exit(struct vrouter *router)
 {
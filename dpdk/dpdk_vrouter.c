@@ -28,8 +28,10 @@
 #include "vr_uvhost.h"
 #include "qemu_uvhost.h"
 #include "vr_dpdk_virtio.h"
+#include "vr_ip_mtrie.h"
 
 static int no_daemon_set;
+static int adaptive_idle_set;
 extern char *ContrailBuildInfo;
 
 /* Global vRouter/DPDK structure */
@@ -52,14 +54,15 @@ vr_dpdk_pktmbuf_init(struct rte_mempool *mp, void *opaque_arg, void *_m, unsigne
     struct vr_packet *pkt;
     rte_pktmbuf_init(mp, opaque_arg, _m, i);
 
-    /* decrease rte packet size to fit vr_packet struct */
-    m->buf_len -= sizeof(struct vr_packet);
+    /* decrease rte packet size to fit vr_packet struct and metadata */
+    m->buf_len -= sizeof(struct vr_packet) + sizeof(struct vr_dpdk_pkt_md);
     RTE_VERIFY(0 < m->buf_len);
 
     /* basic vr_packet initialization */
     pkt = vr_dpdk_mbuf_to_pkt(m);
     pkt->vp_head = (unsigned char *)m->buf_addr;
     pkt->vp_end = m->buf_len;
+    memset(vr_dpdk_pkt_to_md(pkt), 0, sizeof(struct vr_dpdk_pkt_md));
 }
 
 /* Create memory pools */
@@ -231,6 +234,8 @@ dpdk_init(void)
         RTE_LOG(INFO, VROUTER, "Using %i forwarding lcore(s)\n", vr_dpdk.nb_fwd_lcores);
         RTE_LOG(INFO, VROUTER, "Using %i service lcore(s)\n",
             rte_lcore_count() - vr_dpdk.nb_fwd_lcores);
+        RTE_LOG(INFO, VROUTER, "Adaptive idle of forwarding lcores is %s\n",
+            vr_dpdk.adaptive_idle ? "enabled" : "disabled");
     } else {
         RTE_LOG(CRIT, VROUTER, "Please enable at least 2 lcores\n");
         return -ENODEV;
@@ -308,6 +313,25 @@ dpdk_kni_loop(__attribute__((unused)) void *dummy)
     return NULL;
 }
 
+/* RX queues rebalancing loop */
+static void *
+dpdk_rebalance_loop(__attribute__((unused)) void *dummy)
+{
+    while (1) {
+        usleep(VR_DPDK_REBALANCE_US);
+
+        /* check for the global stop flag */
+        if (unlikely(vr_dpdk_is_stop_flag_set()))
+            break;
+
+        /* do not get cancelled with the interface lock held */
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        vr_dpdk_lcore_rebalance();
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    };
+    return NULL;
+}
+
 /* Set stop flag for all lcores */
 static void
 dpdk_stop_flag_set(void)
@@ -384,6 +408,8 @@ dpdk_threads_cancel(void)
         pthread_cancel(vr_dpdk.kni_thread);
     if (vr_dpdk.timer_thread)
         pthread_cancel(vr_dpdk.timer_thread);
+    if (vr_dpdk.rebalance_thread)
+        pthread_cancel(vr_dpdk.rebalance_thread);
 }
 
 /* Wait for other threads to join */
@@ -394,6 +420,8 @@ dpdk_threads_join(void)
         pthread_join(vr_dpdk.kni_thread, NULL);
     if (vr_dpdk.timer_thread)
         pthread_join(vr_dpdk.timer_thread, NULL);
+    if (vr_dpdk.rebalance_thread)
+        pthread_join(vr_dpdk.rebalance_thread, NULL);
 }
 
 
@@ -420,22 +448,73 @@ dpdk_threads_create(void)
 
         return ret;
     }
+#if VR_DPDK_REBALANCE_US > 0
+    /* thread to move RX queues between the forwarding lcores */
+    if (vr_dpdk.nb_fwd_lcores > 1) {
+        ret = pthread_create(&vr_dpdk.rebalance_thread, NULL,
+                &dpdk_rebalance_loop, NULL);
+        if (ret != 0) {
+            RTE_LOG(CRIT, VROUTER, "Error creating rebalancing thread: %s (%d)\n",
+                rte_strerror(ret), ret);
+            return ret;
+        }
+    }
+#endif
 
     return 0;
 }
 
 enum vr_opt_index {
     DAEMON_OPT_INDEX,
+    ADAPTIVE_IDLE_OPT_INDEX,
+    INET_MTRIE_STRIDES_OPT_INDEX,
+    INET6_MTRIE_STRIDES_OPT_INDEX,
     MAX_OPT_INDEX
 };
 
 static struct option long_options[] = {
     [DAEMON_OPT_INDEX]              =   {"no-daemon",           no_argument,
                                                     &no_daemon_set,         1},
+    [ADAPTIVE_IDLE_OPT_INDEX]       =   {"adaptive-idle",       no_argument,
+                                                    &adaptive_idle_set,     1},
+    [INET_MTRIE_STRIDES_OPT_INDEX]  =   {"inet-mtrie-strides",  required_argument,
+                                                    NULL,                   0},
+    [INET6_MTRIE_STRIDES_OPT_INDEX] =   {"inet6-mtrie-strides", required_argument,
+                                                    NULL,                   0},
     [MAX_OPT_INDEX]                 =   {NULL,                  0,
                                                     NULL,                   0},
 };
 
+/*
+ * dpdk_mtrie_strides_parse - parse a comma separated list of mtrie level
+ * strides, e.g. 16,8,8, into 'strides'. levels not in the list keep their
+ * defaults, and the strides are validated when the tables are set up.
+ *
+ * Returns 0 on success, -EINVAL otherwise.
+ */
+static int
+dpdk_mtrie_strides_parse(const char *arg, unsigned int *strides,
+        unsigned int max_levels)
+{
+    unsigned int level = 0;
+    unsigned long stride;
+    char *end;
+
+    do {
+        if (level >= max_levels)
+            return -EINVAL;
+
+        stride = strtoul(arg, &end, 10);
+        if (end == arg || (*end && *end != ',') || !stride)
+            return -EINVAL;
+
+        strides[level++] = stride;
+        arg = end + 1;
+    } while (*end);
+
+    return 0;
+}
+
 /*
  * vr_dpdk_exit_trigger - function that is called by user space vhost server
  * to cause all DPDK threads to exit.
@@ -463,6 +542,20 @@ main(int argc, char *argv[])
             >= 0) {
         switch (opt) {
         case 0:
+            if (option_index == INET_MTRIE_STRIDES_OPT_INDEX)
+                ret = dpdk_mtrie_strides_parse(optarg, vr_inet_mtrie_strides,
+                        IP4_BKT_MAX_LEVELS);
+            else if (option_index == INET6_MTRIE_STRIDES_OPT_INDEX)
+                ret = dpdk_mtrie_strides_parse(optarg, vr_inet6_mtrie_strides,
+                        IP6_BKT_MAX_LEVELS);
+            else
+                ret = 0;
+
+            if (ret) {
+                fprintf(stderr, "Invalid strides %s for option --%s\n",
+                        optarg, long_options[option_index].name);
+                exit(-EINVAL);
+            }
             break;
 
         case '?':
@@ -475,6 +568,8 @@ main(int argc, char *argv[])
     /* for other getopts in dpdk */
     optind = 0;
 
+    vr_dpdk.adaptive_idle = adaptive_idle_set;
+
     if (!no_daemon_set) {
         if (daemon(0, 0) < 0)
             return -1;
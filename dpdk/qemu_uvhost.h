@@ -1,6 +1,6 @@
 /*
  * qemu_uvhost.h - header for structure and message definitions copied from
- * qemu 2.1.
+ * qemu 2.1, with the multiple queue extensions of qemu 2.5.
  *
  * Copyright (c) 2014 Juniper Networks, Inc. All rights reserved.
  */
@@ -9,7 +9,15 @@
 #define __QEMU_UVHOST_H__
 
 #define VHOST_MEMORY_MAX_NREGIONS    8
-#define VHOST_CLIENT_MAX_VRINGS      2
+/* a pair of vrings per queue, up to VR_DPDK_VIRTIO_MAX_QUEUES */
+#define VHOST_CLIENT_MAX_VRINGS      16
+
+/*
+ * The vhost client may ask for protocol features if the server offers this
+ * feature bit.
+ */
+#define VHOST_USER_F_PROTOCOL_FEATURES  30
+#define VHOST_USER_PROTOCOL_F_MQ        0
 
 typedef enum VhostUserRequest {
     VHOST_USER_NONE = 0,
@@ -27,6 +35,10 @@ typedef enum VhostUserRequest {
     VHOST_USER_SET_VRING_KICK = 12,
     VHOST_USER_SET_VRING_CALL = 13,
     VHOST_USER_SET_VRING_ERR = 14,
+    VHOST_USER_GET_PROTOCOL_FEATURES = 15,
+    VHOST_USER_SET_PROTOCOL_FEATURES = 16,
+    VHOST_USER_GET_QUEUE_NUM = 17,
+    VHOST_USER_SET_VRING_ENABLE = 18,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -99,11 +99,8 @@ static const struct rte_eth_txconf tx_queue_conf = {
     .tx_free_thresh = 0,    /* Use PMD default values */
     .tx_rs_thresh = 0,      /* Use PMD default values */
     .txq_flags =            /* Set flags for the Tx queue */
-        ETH_TXQ_FLAGS_NOMULTSEGS
-        | ETH_TXQ_FLAGS_NOREFCOUNT
-        | ETH_TXQ_FLAGS_NOVLANOFFL
+        ETH_TXQ_FLAGS_NOVLANOFFL
         | ETH_TXQ_FLAGS_NOXSUMSCTP
-        | ETH_TXQ_FLAGS_NOXSUMTCP
 };
 
 /* Add hardware filter */
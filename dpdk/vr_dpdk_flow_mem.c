@@ -32,6 +32,7 @@ struct vr_hugepage_info {
 
 extern struct vr_btable *vr_flow_table;
 extern struct vr_btable *vr_oflow_table;
+extern struct vr_btable *vr_flow_journal_table;
 extern unsigned char *vr_flow_path;
 
 static int
@@ -155,7 +156,9 @@ vr_dpdk_flow_mem_init(void)
         return ret;
     }
 
-    flow_table_size = VR_FLOW_TABLE_SIZE + VR_OFLOW_TABLE_SIZE;
+    /* the journal follows the tables in the file, as in the flow device */
+    flow_table_size = VR_FLOW_JOURNAL_OFFSET(VR_FLOW_TABLE_SIZE +
+            VR_OFLOW_TABLE_SIZE) + VR_FLOW_JOURNAL_SIZE;
 
     for (i = 0; i < HPI_MAX; i++) {
         hpi = &vr_hugepage_md[i];
@@ -221,5 +224,13 @@ vr_dpdk_flow_init(void)
     if (!vr_oflow_table)
         return -1;
 
+    iov.iov_base = ((unsigned char *)vr_dpdk.flow_table +
+            VR_FLOW_JOURNAL_OFFSET(VR_FLOW_TABLE_SIZE + VR_OFLOW_TABLE_SIZE));
+    iov.iov_len = VR_FLOW_JOURNAL_SIZE;
+    vr_flow_journal_table = vr_btable_attach(&iov, 1,
+            sizeof(struct vr_flow_journal_ring));
+    if (!vr_flow_journal_table)
+        return -1;
+
     return 0;
 }
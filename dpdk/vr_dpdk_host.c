@@ -292,6 +292,7 @@ dpdk_pclone(struct vr_packet *pkt)
     /* copy vr_packet data */
     pkt_copy = vr_dpdk_mbuf_to_pkt(m_copy);
     *pkt_copy = *pkt;
+    *vr_dpdk_pkt_to_md(pkt_copy) = *vr_dpdk_pkt_to_md(pkt);
     /* set head pointer to a copy */
     pkt_copy->vp_head = m_copy->buf_addr;
 
@@ -682,9 +683,9 @@ dpdk_pcow(struct vr_packet *pkt, unsigned short head_room)
 {
     struct rte_mbuf *mbuf = vr_dpdk_pkt_to_mbuf(pkt);
 
-    /* Store the right values to mbuf */
+    /* Store the right values to mbuf, keeping the rest of the chain */
     mbuf->pkt.data = pkt_data(pkt);
-    mbuf->pkt.pkt_len = pkt_len(pkt);
+    mbuf->pkt.pkt_len = pkt_head_len(pkt) + dpdk_pfrag_len(pkt);
     mbuf->pkt.data_len = pkt_head_len(pkt);
 
     if (head_room > rte_pktmbuf_headroom(mbuf)) {
@@ -949,8 +950,7 @@ out:
 static unsigned int
 dpdk_pgso_size(struct vr_packet *pkt)
 {
-    /* TODO: not implemented */
-    return 0;
+    return vr_dpdk_pkt_to_md(pkt)->md_gso_size;
 }
 
 static void
@@ -1017,7 +1017,7 @@ struct host_os dpdk_host = {
     .hos_pfrag_len                  =    dpdk_pfrag_len,
     .hos_phead_len                  =    dpdk_phead_len,
     .hos_pset_data                  =    dpdk_pset_data,
-    .hos_pgso_size                  =    dpdk_pgso_size, /* not implemented, returns 0 */
+    .hos_pgso_size                  =    dpdk_pgso_size,
 
     .hos_get_cpu                    =    dpdk_get_cpu,
     .hos_schedule_work              =    dpdk_schedule_work,
@@ -1045,6 +1045,7 @@ struct host_os dpdk_host = {
 
     .hos_add_mpls                   =    dpdk_add_mpls,
     .hos_del_mpls                   =    dpdk_del_mpls, /* not implemented */
+    .hos_get_lcore_stats            =    vr_dpdk_lcore_stats_get,
 };
 
 struct host_os *
@@ -1114,9 +1115,13 @@ vr_dpdk_packet_get(struct rte_mbuf *m, struct vr_interface *vif)
     pkt->vp_network_h = pkt->vp_inner_network_h = 0;
     pkt->vp_nh = NULL;
     pkt->vp_flags = 0;
-    if (likely(m->ol_flags & PKT_TX_IP_CKSUM))
+    if (likely(m->ol_flags & (PKT_TX_IP_CKSUM | PKT_TX_L4_MASK)))
         pkt->vp_flags |= VP_FLAG_CSUM_PARTIAL;
 
+    /* only packets from VMs carry the metadata */
+    if (m->pool != vr_dpdk.virtio_mempool)
+        vr_dpdk_pkt_to_md(pkt)->md_gso_size = 0;
+
     pkt->vp_ttl = 64;
     pkt->vp_type = VP_TYPE_NULL;
 
@@ -1150,7 +1155,8 @@ vr_dpdk_host_init(void)
     }
 
     /*
-     * Turn off GRO/GSO as they are not implemented with DPDK.
+     * Turn off GRO/GSO as they are not implemented with DPDK. TSO packets
+     * from VMs are segmented on TX by the DPDK interface layer instead.
      */
     vr_perfr = vr_perfs = 0;
 
@@ -18,7 +18,9 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <net/if.h>
+#include <netinet/tcp.h>
 #include <linux/vhost.h>
+#include <linux/virtio_net.h>
 
 #include "vr_queue.h"
 #include "vr_dpdk.h"
@@ -609,6 +611,61 @@ dpdk_if_add_tap(struct vr_interface *vif)
     return 0;
 }
 
+/*
+ * dpdk_l4_csum - returns the TCP/UDP checksum of the IP packet at offset
+ * ip_off of a (possibly chained) mbuf, computed in software.
+ */
+static uint16_t
+dpdk_l4_csum(struct rte_mbuf *m, unsigned ip_off, struct vr_ip *iph)
+{
+    unsigned off = ip_off + iph->ip_hl * 4, len, odd = 0;
+    uint32_t sum;
+    uint8_t *p;
+    uint16_t *csump;
+
+    if (iph->ip_proto == VR_IP_PROTO_TCP)
+        csump = &((struct vr_tcp *)((char *)iph + iph->ip_hl * 4))->tcp_csum;
+    else
+        csump = &((struct vr_udp *)((char *)iph + iph->ip_hl * 4))->udp_csum;
+    *csump = 0;
+
+    /* the pseudo header sum is in network byte order */
+    sum = rte_be_to_cpu_16(vr_ip_partial_csum(iph));
+
+    for (; m != NULL; m = m->pkt.next) {
+        if (off >= rte_pktmbuf_data_len(m)) {
+            off -= rte_pktmbuf_data_len(m);
+            continue;
+        }
+
+        p = rte_pktmbuf_mtod(m, uint8_t *) + off;
+        len = rte_pktmbuf_data_len(m) - off;
+        off = 0;
+
+        /* the previous segment ended in the middle of a 16 bit word */
+        if (odd && len) {
+            sum += *p++;
+            len--;
+            odd = 0;
+        }
+        for (; len > 1; len -= 2, p += 2)
+            sum += (p[0] << 8) | p[1];
+        if (len) {
+            sum += p[0] << 8;
+            odd = 1;
+        }
+    }
+
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    sum = ~sum & 0xffff;
+    if ((sum == 0) && (iph->ip_proto == VR_IP_PROTO_UDP))
+        sum = 0xffff;
+
+    return rte_cpu_to_be_16(sum);
+}
+
 static inline void
 dpdk_hw_checksum_at_offset(struct vr_packet *pkt, unsigned offset)
 {
@@ -655,17 +712,53 @@ dpdk_sw_checksum_at_offset(struct vr_packet *pkt, unsigned offset)
     struct vr_ip *iph = (struct vr_ip *)pkt_data_at_offset(pkt, offset);
     unsigned iph_len = iph->ip_hl * 4;
     struct vr_udp *udph;
+    struct vr_tcp *tcph;
 
     RTE_VERIFY(0 < offset);
 
     /* calculate IP checksum */
     iph->ip_csum = vr_ip_csum(iph);
 
-    /* TODO: TCP checksums */
     if (iph->ip_proto == VR_IP_PROTO_UDP) {
         udph = (struct vr_udp *)pkt_data_at_offset(pkt, offset + iph_len);
         /* disable UDP checksum */
         udph->udp_csum = 0;
+    } else if (iph->ip_proto == VR_IP_PROTO_TCP) {
+        tcph = (struct vr_tcp *)pkt_data_at_offset(pkt, offset + iph_len);
+        tcph->tcp_csum = dpdk_l4_csum(vr_dpdk_pkt_to_mbuf(pkt),
+                offset - pkt->vp_data, iph);
+    }
+}
+
+/*
+ * dpdk_guest_checksum_at_offset - leaves the TCP/UDP checksum of a packet to
+ * a VM which negotiated VIRTIO_NET_F_GUEST_CSUM. The offsets are passed in
+ * the mbuf the same way as for the NIC, and end up in the virtio header.
+ * Virtio does not offload the IP checksum, so it is calculated here.
+ */
+static inline void
+dpdk_guest_checksum_at_offset(struct vr_packet *pkt, unsigned offset)
+{
+    struct rte_mbuf *m = vr_dpdk_pkt_to_mbuf(pkt);
+    struct vr_ip *iph = (struct vr_ip *)pkt_data_at_offset(pkt, offset);
+    unsigned iph_len = iph->ip_hl * 4;
+    struct vr_tcp *tcph;
+    struct vr_udp *udph;
+
+    RTE_VERIFY(0 < offset);
+
+    iph->ip_csum = vr_ip_csum(iph);
+    m->pkt.vlan_macip.f.l2_len = offset - rte_pktmbuf_headroom(m);
+    m->pkt.vlan_macip.f.l3_len = iph_len;
+
+    if (iph->ip_proto == VR_IP_PROTO_TCP) {
+        m->ol_flags |= PKT_TX_TCP_CKSUM;
+        tcph = (struct vr_tcp *)((char *)iph + iph_len);
+        tcph->tcp_csum = vr_ip_partial_csum(iph);
+    } else if (iph->ip_proto == VR_IP_PROTO_UDP) {
+        m->ol_flags |= PKT_TX_UDP_CKSUM;
+        udph = (struct vr_udp *)((char *)iph + iph_len);
+        udph->udp_csum = vr_ip_partial_csum(iph);
     }
 }
 
@@ -710,6 +803,282 @@ dpdk_sw_checksum(struct vr_packet *pkt)
     }
 }
 
+/*
+ * dpdk_if_guest_features - returns the virtio features negotiated by the VM
+ * behind a virtual interface, 0 for other interfaces.
+ *
+ * The features are taken from the interface rather than from the TX queue,
+ * since on the packet lcore and on forwarding lcores without a virtio queue
+ * of their own the TX queue is a ring writer.
+ */
+static inline uint64_t
+dpdk_if_guest_features(struct vr_interface *vif)
+{
+    if (!vif_is_virtual(vif))
+        return 0;
+
+    return vr_dpdk_virtio_features(vif->vif_idx);
+}
+
+/*
+ * dpdk_if_tx_burst - adds a packet to the burst of the TX queue of the
+ * interface on a forwarding lcore. The burst is sent to the queue in bulk
+ * once full, or by the lcore loop once the packets it read are routed.
+ *
+ * Returns false if all the bursts of the lcore are taken by other queues,
+ * in which case the packet has to be sent on its own.
+ */
+static inline bool
+dpdk_if_tx_burst(struct vr_dpdk_lcore *lcore, unsigned vif_idx,
+        struct rte_mbuf *m)
+{
+    unsigned burst_idx = lcore->lcore_tx_burst_idx[vif_idx];
+    struct vr_dpdk_tx_burst *burst;
+
+    if (unlikely(burst_idx == 0)) {
+        if (unlikely(lcore->lcore_nb_tx_bursts == VR_DPDK_MAX_TX_BURSTS))
+            return false;
+
+        burst_idx = ++lcore->lcore_nb_tx_bursts;
+        lcore->lcore_tx_burst_idx[vif_idx] = burst_idx;
+        lcore->lcore_tx_bursts[burst_idx - 1].txb_vif_idx = vif_idx;
+    }
+
+    burst = &lcore->lcore_tx_bursts[burst_idx - 1];
+    burst->txb_pkts[burst->txb_nb_pkts++] = m;
+    if (unlikely(burst->txb_nb_pkts == VR_DPDK_MAX_BURST_SZ)) {
+        vr_dpdk_tx_queue_bulk(&lcore->lcore_tx_queues[vif_idx],
+            burst->txb_pkts, burst->txb_nb_pkts);
+        burst->txb_nb_pkts = 0;
+    }
+
+    return true;
+}
+
+/* Send a packet to the TX queue of the interface */
+static inline int
+dpdk_if_tx_queue(struct vr_interface *vif, struct vr_dpdk_queue *tx_queue,
+        struct rte_mbuf *m, unsigned lcore_id)
+{
+    struct vr_dpdk_lcore *lcore = vr_dpdk.lcores[lcore_id];
+
+#ifdef VR_DPDK_TX_PKT_DUMP
+#ifdef VR_DPDK_PKT_DUMP_VIF_FILTER
+    if (VR_DPDK_PKT_DUMP_VIF_FILTER(vif))
+#endif
+    rte_pktmbuf_dump(stdout, m, 0x60);
+#endif
+
+    if (likely(tx_queue->txq_ops.f_tx != NULL)) {
+        if (likely(lcore->lcore_tx_burst) &&
+                likely(dpdk_if_tx_burst(lcore,
+                        tx_queue - lcore->lcore_tx_queues, m)))
+            return 0;
+
+        tx_queue->txq_ops.f_tx(tx_queue->q_queue_h, m);
+        if (lcore_id == vr_dpdk.packet_lcore_id)
+            tx_queue->txq_ops.f_flush(tx_queue->q_queue_h);
+    } else {
+        RTE_LOG(DEBUG, VROUTER,"%s: error TXing to interface %s: no queue for lcore %u\n",
+                __func__, vif->vif_name, lcore_id);
+        vif_drop_pkt(vif, vr_dpdk_mbuf_to_pkt(m), 0);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * dpdk_pktmbuf_copy_tail - appends len bytes at offset off of the (possibly
+ * chained) mbuf src to the mbuf dst, chaining more segments as needed.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+static int
+dpdk_pktmbuf_copy_tail(struct rte_mbuf *dst, struct rte_mbuf *src,
+        unsigned off, unsigned len)
+{
+    struct rte_mbuf *tail = rte_pktmbuf_lastseg(dst), *new_seg;
+    unsigned copy;
+
+    while (src && off >= rte_pktmbuf_data_len(src)) {
+        off -= rte_pktmbuf_data_len(src);
+        src = src->pkt.next;
+    }
+
+    while (len) {
+        if (src == NULL)
+            return -1;
+
+        if (rte_pktmbuf_tailroom(tail) == 0) {
+            new_seg = rte_pktmbuf_alloc(dst->pool);
+            if (new_seg == NULL)
+                return -1;
+
+            tail->pkt.next = new_seg;
+            dst->pkt.nb_segs++;
+            tail = new_seg;
+        }
+
+        copy = RTE_MIN(len, rte_pktmbuf_tailroom(tail));
+        copy = RTE_MIN(copy, rte_pktmbuf_data_len(src) - off);
+        rte_memcpy(rte_pktmbuf_mtod(tail, char *) + tail->pkt.data_len,
+                rte_pktmbuf_mtod(src, char *) + off, copy);
+        tail->pkt.data_len += copy;
+        dst->pkt.pkt_len += copy;
+        off += copy;
+        len -= copy;
+
+        if (off == rte_pktmbuf_data_len(src)) {
+            src = src->pkt.next;
+            off = 0;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * dpdk_l3_offset - returns the offset of the network header of a packet,
+ * past the VLAN tag if the packet has one, and its ethertype in 'proto'.
+ */
+static inline unsigned
+dpdk_l3_offset(struct vr_packet *pkt, unsigned short *proto)
+{
+    struct vr_eth *eth = (struct vr_eth *)pkt_data(pkt);
+    struct vr_vlan_hdr *vlan;
+    unsigned off = pkt->vp_data + sizeof(struct ether_hdr);
+
+    *proto = rte_be_to_cpu_16(eth->eth_proto);
+    if (*proto == VR_ETH_PROTO_VLAN) {
+        vlan = (struct vr_vlan_hdr *)pkt_data_at_offset(pkt, off);
+        *proto = rte_be_to_cpu_16(vlan->vlan_proto);
+        off += VR_VLAN_HLEN;
+    }
+
+    return off;
+}
+
+/*
+ * dpdk_gso_tx - segments a TCP packet from a VM to its GSO size and sends
+ * the segments to an interface which can not take the packet as a whole.
+ * The headers, including any tunnel headers vrouter pushed, are copied to
+ * every segment and fixed up. DPDK has no TSO support, so the segmentation
+ * is done in software, and only the checksums are left to the NIC if it
+ * can do them.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+static int
+dpdk_gso_tx(struct vr_interface *vif, struct vr_dpdk_queue *tx_queue,
+        struct vr_packet *pkt, unsigned lcore_id)
+{
+    struct rte_mbuf *m = vr_dpdk_pkt_to_mbuf(pkt), *seg;
+    struct vr_packet *seg_pkt;
+    struct vr_ip *iph, *outer_iph;
+    struct vr_udp *udph;
+    struct tcphdr *tcph;
+    unsigned inner_off, outer_off = 0, l3_off, hdr_len, off, len, i;
+    unsigned short proto;
+    uint16_t gso_size = vr_dpdk_pkt_to_md(pkt)->md_gso_size;
+    uint16_t ip_id, outer_ip_id = 0;
+    uint32_t seq;
+
+    l3_off = dpdk_l3_offset(pkt, &proto);
+    inner_off = pkt_get_inner_network_header_off(pkt);
+    if (!inner_off)
+        inner_off = l3_off;
+
+    if ((inner_off != l3_off) && (proto == VR_ETH_PROTO_IP))
+        outer_off = l3_off;
+
+    iph = (struct vr_ip *)pkt_data_at_offset(pkt, inner_off);
+    if ((iph->ip_version != 4) || (iph->ip_proto != VR_IP_PROTO_TCP))
+        goto drop;
+
+    tcph = (struct tcphdr *)((char *)iph + iph->ip_hl * 4);
+    hdr_len = inner_off - pkt->vp_data + iph->ip_hl * 4 + tcph->doff * 4;
+    if (hdr_len > pkt_head_len(pkt))
+        goto drop;
+
+    ip_id = rte_be_to_cpu_16(iph->ip_id);
+    seq = rte_be_to_cpu_32(tcph->seq);
+    if (outer_off) {
+        outer_iph = (struct vr_ip *)pkt_data_at_offset(pkt, outer_off);
+        outer_ip_id = rte_be_to_cpu_16(outer_iph->ip_id);
+    }
+
+    for (off = hdr_len, i = 0; off < rte_pktmbuf_pkt_len(m); off += len, i++) {
+        len = RTE_MIN(gso_size, rte_pktmbuf_pkt_len(m) - off);
+
+        seg = rte_pktmbuf_alloc(vr_dpdk.rss_mempool);
+        if (seg == NULL)
+            goto drop;
+
+        /* keep the headers at the same offsets as in the packet */
+        seg->pkt.data = (char *)seg->buf_addr + pkt->vp_data;
+        rte_memcpy(seg->pkt.data, pkt_data(pkt), hdr_len);
+        seg->pkt.data_len = hdr_len;
+        seg->pkt.pkt_len = hdr_len;
+        if (dpdk_pktmbuf_copy_tail(seg, m, off, len)) {
+            rte_pktmbuf_free(seg);
+            goto drop;
+        }
+
+        seg_pkt = vr_dpdk_mbuf_to_pkt(seg);
+        *seg_pkt = *pkt;
+        seg_pkt->vp_head = seg->buf_addr;
+        seg_pkt->vp_tail = seg_pkt->vp_data + rte_pktmbuf_data_len(seg);
+        seg_pkt->vp_len = rte_pktmbuf_data_len(seg);
+        seg_pkt->vp_flags &= ~VP_FLAG_CSUM_PARTIAL;
+        vr_dpdk_pkt_to_md(seg_pkt)->md_gso_size = 0;
+
+        iph = (struct vr_ip *)pkt_data_at_offset(seg_pkt, inner_off);
+        iph->ip_len = rte_cpu_to_be_16(rte_pktmbuf_pkt_len(seg) -
+                (inner_off - pkt->vp_data));
+        iph->ip_id = rte_cpu_to_be_16(ip_id + i);
+
+        tcph = (struct tcphdr *)((char *)iph + iph->ip_hl * 4);
+        tcph->seq = rte_cpu_to_be_32(seq + (off - hdr_len));
+        if (i)
+            tcph->cwr = 0;
+        if (off + len < rte_pktmbuf_pkt_len(m))
+            tcph->fin = tcph->psh = 0;
+
+        if (outer_off) {
+            outer_iph = (struct vr_ip *)pkt_data_at_offset(seg_pkt, outer_off);
+            outer_iph->ip_len = rte_cpu_to_be_16(rte_pktmbuf_pkt_len(seg) -
+                    (outer_off - pkt->vp_data));
+            outer_iph->ip_id = rte_cpu_to_be_16(outer_ip_id + i);
+            if (outer_iph->ip_proto == VR_IP_PROTO_UDP) {
+                udph = (struct vr_udp *)((char *)outer_iph +
+                        outer_iph->ip_hl * 4);
+                udph->udp_length = rte_cpu_to_be_16(
+                        rte_be_to_cpu_16(outer_iph->ip_len) -
+                        outer_iph->ip_hl * 4);
+                udph->udp_csum = 0;
+            }
+            outer_iph->ip_csum = vr_ip_csum(outer_iph);
+        }
+
+        if (vif->vif_flags & VIF_FLAG_TX_CSUM_OFFLOAD) {
+            dpdk_hw_checksum_at_offset(seg_pkt, inner_off);
+        } else {
+            iph->ip_csum = vr_ip_csum(iph);
+            tcph->check = dpdk_l4_csum(seg, inner_off - pkt->vp_data, iph);
+        }
+
+        dpdk_if_tx_queue(vif, tx_queue, seg, lcore_id);
+    }
+
+    rte_pktmbuf_free(m);
+    return 0;
+
+drop:
+    vif_drop_pkt(vif, pkt, 0);
+    return -1;
+}
+
 /* TX packet callback */
 static int
 dpdk_if_tx(struct vr_interface *vif, struct vr_packet *pkt)
@@ -721,16 +1090,22 @@ dpdk_if_tx(struct vr_interface *vif, struct vr_packet *pkt)
     struct vr_dpdk_queue *tx_queue = &lcore->lcore_tx_queues[vif_idx];
     struct vr_dpdk_queue *monitoring_tx_queue;
     struct vr_packet *p_clone;
+    uint64_t guest_features;
+    unsigned short proto;
+    unsigned l3_off;
     int ret;
 
     RTE_LOG(DEBUG, VROUTER,"%s: TX packet to interface %s\n", __func__,
         vif->vif_name);
 
-    /* reset mbuf data pointer and length */
+    /*
+     * reset mbuf data pointer and length. vrouter only touches the first
+     * segment, so the length of the rest of the chain stays the same
+     */
+    m->pkt.pkt_len = pkt_head_len(pkt) +
+        (rte_pktmbuf_pkt_len(m) - rte_pktmbuf_data_len(m));
     m->pkt.data = pkt_data(pkt);
     m->pkt.data_len = pkt_head_len(pkt);
-    /* TODO: use pkt_len instead? */
-    m->pkt.pkt_len = pkt_head_len(pkt);
 
     if (unlikely(vif->vif_flags & VIF_FLAG_MONITORED)) {
         monitoring_tx_queue = &lcore->lcore_tx_queues[vr_dpdk.monitorings[vif_idx]];
@@ -760,6 +1135,16 @@ dpdk_if_tx(struct vr_interface *vif, struct vr_packet *pkt)
         return 0;
     }
 
+    /*
+     * TSO packets from VMs are passed as they are only to VMs that can take
+     * them, and segmented for all the other interfaces
+     */
+    guest_features = dpdk_if_guest_features(vif);
+    if (unlikely(vr_dpdk_pkt_to_md(pkt)->md_gso_size) &&
+            ((guest_features & VR_DPDK_VIRTIO_GUEST_TSO) !=
+             VR_DPDK_VIRTIO_GUEST_TSO))
+        return dpdk_gso_tx(vif, tx_queue, pkt, lcore_id);
+
     /* TODO: Checksums
      * With DPDK pktmbufs we don't know if the checksum is incomplete,
      * i.e. there is no direct equivalent of skb->ip_summed field.
@@ -772,11 +1157,23 @@ dpdk_if_tx(struct vr_interface *vif, struct vr_packet *pkt)
      * See dpdk/app/test-pmd/csumonly.c for more checksum examples
      */
     if (unlikely(pkt->vp_flags & VP_FLAG_CSUM_PARTIAL)) {
+        m->ol_flags &= ~(PKT_TX_IP_CKSUM | PKT_TX_L4_MASK);
         /* if NIC supports checksum offload */
-        if (likely(vif->vif_flags & VIF_FLAG_TX_CSUM_OFFLOAD))
+        if (likely(vif->vif_flags & VIF_FLAG_TX_CSUM_OFFLOAD)) {
             dpdk_hw_checksum(pkt);
-        else
+        } else if (guest_features & (1ULL << VIRTIO_NET_F_GUEST_CSUM)) {
+            /*
+             * the VM takes partial checksums. the l2_len passed to it
+             * covers the VLAN tag, if any
+             */
+            l3_off = dpdk_l3_offset(pkt, &proto);
+            if (proto == VR_ETH_PROTO_IP)
+                dpdk_guest_checksum_at_offset(pkt, l3_off);
+            else
+                dpdk_sw_checksum(pkt);
+        } else {
             dpdk_sw_checksum(pkt);
+        }
     }
     /* TODO: checksums */
 //     else if (likely(VP_TYPE_IPOIP == pkt->vp_type)) {
@@ -793,25 +1190,7 @@ dpdk_if_tx(struct vr_interface *vif, struct vr_packet *pkt)
 //        }
 //    }
 
-#ifdef VR_DPDK_TX_PKT_DUMP
-#ifdef VR_DPDK_PKT_DUMP_VIF_FILTER
-    if (VR_DPDK_PKT_DUMP_VIF_FILTER(vif))
-#endif
-    rte_pktmbuf_dump(stdout, m, 0x60);
-#endif
-
-    if (likely(tx_queue->txq_ops.f_tx != NULL)) {
-        tx_queue->txq_ops.f_tx(tx_queue->q_queue_h, m);
-        if (lcore_id == vr_dpdk.packet_lcore_id)
-            tx_queue->txq_ops.f_flush(tx_queue->q_queue_h);
-    } else {
-        RTE_LOG(DEBUG, VROUTER,"%s: error TXing to interface %s: no queue for lcore %u\n",
-                __func__, vif->vif_name, lcore_id);
-        vif_drop_pkt(vif, vr_dpdk_mbuf_to_pkt(m), 0);
-        return -1;
-    }
-
-    return 0;
+    return dpdk_if_tx_queue(vif, tx_queue, m, lcore_id);
 }
 
 static int
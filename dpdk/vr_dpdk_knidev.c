@@ -158,6 +158,43 @@ dpdk_knidev_writer_tx(void *port, struct rte_mbuf *pkt)
     return 0;
 }
 
+static int
+dpdk_knidev_writer_tx_bulk(void *port, struct rte_mbuf **pkts,
+    uint64_t pkts_mask)
+{
+    struct dpdk_knidev_writer *p = (struct dpdk_knidev_writer *) port;
+    uint64_t bsz_mask = p->bsz_mask;
+    uint32_t tx_buf_count = p->tx_buf_count;
+    uint64_t expr = (pkts_mask & (pkts_mask + 1)) |
+            ((pkts_mask & bsz_mask) ^ bsz_mask);
+    uint32_t n_pkts, n_pkts_ok, pkt_index;
+
+    /* a full burst from the first packet on goes straight to the KNI */
+    if (expr == 0) {
+        n_pkts = __builtin_popcountll(pkts_mask);
+
+        if (tx_buf_count)
+            send_burst(p);
+
+        n_pkts_ok = rte_kni_tx_burst(p->kni, pkts, n_pkts);
+        for ( ; n_pkts_ok < n_pkts; n_pkts_ok++)
+            /* TODO: a separate counter for this drop */
+            vr_dpdk_pfree(pkts[n_pkts_ok], VP_DROP_INTERFACE_DROP);
+    } else {
+        while (pkts_mask) {
+            pkt_index = __builtin_ctzll(pkts_mask);
+            pkts_mask &= ~(1LLU << pkt_index);
+            p->tx_buf[tx_buf_count++] = pkts[pkt_index];
+        }
+
+        p->tx_buf_count = tx_buf_count;
+        if (tx_buf_count >= p->tx_burst_sz)
+            send_burst(p);
+    }
+
+    return 0;
+}
+
 static int
 dpdk_knidev_writer_flush(void *port)
 {
@@ -196,7 +233,7 @@ struct rte_port_out_ops dpdk_knidev_writer_ops = {
     .f_create = dpdk_knidev_writer_create,
     .f_free = dpdk_knidev_writer_free,
     .f_tx = dpdk_knidev_writer_tx,
-    .f_tx_bulk = NULL, /* TODO: not implemented */
+    .f_tx_bulk = dpdk_knidev_writer_tx_bulk,
     .f_flush = dpdk_knidev_writer_flush,
 };
 
@@ -243,6 +280,8 @@ vr_dpdk_kni_rx_queue_init(unsigned lcore_id, struct vr_interface *vif,
     rx_queue->rxq_ops = dpdk_knidev_reader_ops;
     rx_queue->q_queue_h = NULL;
     rx_queue->rxq_burst_size = VR_DPDK_KNI_RX_BURST_SZ;
+    /* KNI RX is expensive, so poll it less often while idle */
+    rx_queue->rxq_max_skip = VR_DPDK_KNI_RX_MAX_SKIP;
     rx_queue->q_vif = vrouter_get_interface(vif->vif_rid, vif_idx);
 
     /* create the queue */
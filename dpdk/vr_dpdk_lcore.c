@@ -14,7 +14,11 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <sched.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <rte_malloc.h>
 #include <urcu-qsbr.h>
 #include <linux/vhost.h>
@@ -22,6 +26,7 @@
 #include "vr_dpdk.h"
 #include "vr_dpdk_usocket.h"
 #include "vr_dpdk_virtio.h"
+#include "vr_ip_mtrie.h"
 
 /*
  * vr_dpdk_phys_lcore_least_used_get - returns the least used lcore among the
@@ -311,6 +316,7 @@ vr_dpdk_lcore_cmd_post(struct vr_dpdk_lcore *lcore, uint16_t cmd,
     rte_atomic16_set(&lcore->lcore_cmd, cmd);
 
     vr_dpdk_packet_wakeup(lcore);
+    vr_dpdk_lcore_wakeup(lcore);
 }
 
 /* Release RX and TX queues
@@ -382,6 +388,290 @@ vr_dpdk_lcore_if_unschedule(struct vr_interface *vif)
     }
 }
 
+/* Wait for a command posted by the rebalancer to complete
+ * Returns -1 if the lcores are stopping
+ */
+static int
+dpdk_lcore_rebalance_cmd_wait(struct vr_dpdk_lcore *lcore)
+{
+    while (rte_atomic16_read(&lcore->lcore_cmd) != VR_DPDK_LCORE_NO_CMD) {
+        if (unlikely(vr_dpdk_is_stop_flag_set()))
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Exchange the RX queues of an interface between two forwarding lcores
+ * Either of the queues may be empty, so the other one is just moved.
+ * The function is called by the rebalancing thread with the interface
+ * lock held.
+ */
+static int
+dpdk_lcore_rx_queue_swap(unsigned src_id, unsigned dst_id, unsigned vif_idx)
+{
+    struct vr_dpdk_lcore *src = vr_dpdk.lcores[src_id];
+    struct vr_dpdk_lcore *dst = vr_dpdk.lcores[dst_id];
+    struct vr_dpdk_queue src_queue, dst_queue;
+    struct vr_dpdk_queue_params src_params;
+    rte_port_in_op_rx src_rx = src->lcore_rx_queues[vif_idx].rxq_ops.f_rx;
+    rte_port_in_op_rx dst_rx = dst->lcore_rx_queues[vif_idx].rxq_ops.f_rx;
+
+    /* stop polling the queues */
+    vr_dpdk_lcore_cmd_post(src, VR_DPDK_LCORE_RX_RM_CMD, vif_idx);
+    if (dpdk_lcore_rebalance_cmd_wait(src))
+        return -1;
+    vr_dpdk_lcore_cmd_post(dst, VR_DPDK_LCORE_RX_RM_CMD, vif_idx);
+    if (dpdk_lcore_rebalance_cmd_wait(dst))
+        return -1;
+
+    /* exchange the queues along with their params */
+    src_queue = src->lcore_rx_queues[vif_idx];
+    src_queue.rxq_ops.f_rx = src_rx;
+    dst_queue = dst->lcore_rx_queues[vif_idx];
+    dst_queue.rxq_ops.f_rx = dst_rx;
+    src_params = src->lcore_rx_queue_params[vif_idx];
+
+    src->lcore_rx_queues[vif_idx] = dst_queue;
+    src->lcore_rx_queue_params[vif_idx] = dst->lcore_rx_queue_params[vif_idx];
+    dst->lcore_rx_queues[vif_idx] = src_queue;
+    dst->lcore_rx_queue_params[vif_idx] = src_params;
+
+    /* resume polling */
+    dpdk_lcore_queue_add(dst_id, &dst->lcore_rx_head,
+        &dst->lcore_rx_queues[vif_idx]);
+    dst->lcore_nb_rx_queues_in++;
+    src->lcore_nb_rx_queues_out++;
+    if (src->lcore_rx_queues[vif_idx].q_queue_h != NULL) {
+        dpdk_lcore_queue_add(src_id, &src->lcore_rx_head,
+            &src->lcore_rx_queues[vif_idx]);
+        src->lcore_nb_rx_queues_in++;
+        dst->lcore_nb_rx_queues_out++;
+    }
+
+    return 0;
+}
+
+/* Returns the load percentage of the busy cycles since the previous sample
+ * and takes a new sample.
+ */
+static inline unsigned
+dpdk_lcore_load_sample(uint64_t busy_cycles, uint64_t *last_cycles,
+    uint64_t period_cycles)
+{
+    uint64_t diff = busy_cycles - *last_cycles;
+
+    *last_cycles = busy_cycles;
+    if (diff >= period_cycles)
+        return 100;
+
+    return diff * 100 / period_cycles;
+}
+
+/* Move an RX queue from the busiest forwarding lcore to the idlest one
+ *
+ * The load of the lcores and their RX queues is sampled every period. If
+ * the busiest lcore stays loaded above VR_DPDK_REBALANCE_HIGH_LOAD and the
+ * idlest one stays behind it by VR_DPDK_REBALANCE_LOAD_DIFF for
+ * VR_DPDK_REBALANCE_PERIODS in a row, the queue which evens out their
+ * loads best is moved, or exchanged with the idler queue of the same
+ * interface the idlest lcore polls. A move restarts the count of periods,
+ * so that queues do not bounce between lcores.
+ *
+ * The function is called by the rebalancing thread.
+ */
+void
+vr_dpdk_lcore_rebalance(void)
+{
+    static uint64_t last_tsc;
+    static unsigned nb_periods;
+    unsigned lcore_id, vif_idx, best_vif_idx = VR_MAX_INTERFACES;
+    unsigned max_id = RTE_MAX_LCORE, min_id = RTE_MAX_LCORE;
+    unsigned src_load, dst_load, diff, shift, best_shift = 0;
+    static uint16_t rxq_loads[RTE_MAX_LCORE][VR_MAX_INTERFACES];
+    uint64_t tsc = rte_rdtsc(), period_cycles = tsc - last_tsc;
+    struct vr_dpdk_lcore *lcore;
+    struct vr_dpdk_queue *rx_queue;
+
+    last_tsc = tsc;
+
+    vr_dpdk_if_lock();
+    if (unlikely(vr_dpdk_is_stop_flag_set()))
+        goto unlock;
+
+    /* sample the loads of the forwarding lcores and their RX queues */
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        lcore = vr_dpdk.lcores[lcore_id];
+        /* never use service lcores */
+        if (lcore == NULL || lcore_id == vr_dpdk.packet_lcore_id
+                || lcore->lcore_nb_rx_queues >= VR_MAX_INTERFACES)
+            continue;
+
+        lcore->lcore_load = dpdk_lcore_load_sample(lcore->lcore_busy_cycles,
+            &lcore->lcore_busy_cycles_last, period_cycles);
+        for (vif_idx = 0; vif_idx < VR_MAX_INTERFACES; vif_idx++) {
+            rx_queue = &lcore->lcore_rx_queues[vif_idx];
+            rxq_loads[lcore_id][vif_idx] = 0;
+            if (rx_queue->q_queue_h == NULL)
+                continue;
+            rxq_loads[lcore_id][vif_idx] = dpdk_lcore_load_sample(
+                rx_queue->rxq_busy_cycles, &rx_queue->rxq_busy_cycles_last,
+                period_cycles);
+        }
+
+        if (max_id == RTE_MAX_LCORE
+                || lcore->lcore_load > vr_dpdk.lcores[max_id]->lcore_load)
+            max_id = lcore_id;
+        if (min_id == RTE_MAX_LCORE
+                || lcore->lcore_load < vr_dpdk.lcores[min_id]->lcore_load)
+            min_id = lcore_id;
+    }
+
+    if (max_id == min_id)
+        goto unlock;
+
+    src_load = vr_dpdk.lcores[max_id]->lcore_load;
+    dst_load = vr_dpdk.lcores[min_id]->lcore_load;
+    diff = src_load - dst_load;
+    if (src_load < VR_DPDK_REBALANCE_HIGH_LOAD
+            || diff < VR_DPDK_REBALANCE_LOAD_DIFF) {
+        nb_periods = 0;
+        goto unlock;
+    }
+    if (++nb_periods < VR_DPDK_REBALANCE_PERIODS)
+        goto unlock;
+
+    /* find the move to shift the load closest to the half of the diff */
+    for (vif_idx = 0; vif_idx < VR_MAX_INTERFACES; vif_idx++) {
+        if (rxq_loads[max_id][vif_idx] <= rxq_loads[min_id][vif_idx])
+            continue;
+
+        shift = rxq_loads[max_id][vif_idx] - rxq_loads[min_id][vif_idx];
+        if (shift < VR_DPDK_REBALANCE_MIN_SHIFT || shift >= diff)
+            continue;
+
+        if (best_vif_idx == VR_MAX_INTERFACES
+                || abs((int)shift - (int)diff / 2)
+                    < abs((int)best_shift - (int)diff / 2)) {
+            best_vif_idx = vif_idx;
+            best_shift = shift;
+        }
+    }
+
+    if (best_vif_idx == VR_MAX_INTERFACES)
+        goto unlock;
+
+    nb_periods = 0;
+    RTE_LOG(INFO, VROUTER, "Rebalancing RX queue of vif %u from lcore %u"
+        " (load %u%%) to lcore %u (load %u%%), shifting %u%%\n",
+        best_vif_idx, max_id, src_load, min_id, dst_load, best_shift);
+    if (dpdk_lcore_rx_queue_swap(max_id, min_id, best_vif_idx))
+        goto unlock;
+
+    RTE_LOG(INFO, VROUTER, "\tlcore %u RX queues moved in %u out %u,"
+        " lcore %u RX queues moved in %u out %u\n",
+        max_id, vr_dpdk.lcores[max_id]->lcore_nb_rx_queues_in,
+        vr_dpdk.lcores[max_id]->lcore_nb_rx_queues_out,
+        min_id, vr_dpdk.lcores[min_id]->lcore_nb_rx_queues_in,
+        vr_dpdk.lcores[min_id]->lcore_nb_rx_queues_out);
+
+unlock:
+    vr_dpdk_if_unlock();
+}
+
+/* Fill in the stats of the first lcore at or after lcore_id
+ *
+ * Returns 0 on success, -ENOENT if there are no lcores past lcore_id.
+ */
+int
+vr_dpdk_lcore_stats_get(unsigned lcore_id, vr_lcore_stats_req *resp)
+{
+    struct vr_dpdk_lcore *lcore;
+
+    for (; lcore_id < RTE_MAX_LCORE; lcore_id++) {
+        lcore = vr_dpdk.lcores[lcore_id];
+        if (lcore == NULL)
+            continue;
+
+        resp->vlsr_lcore = lcore_id;
+        resp->vlsr_nb_rx_queues = lcore->lcore_nb_rx_queues;
+        resp->vlsr_load = lcore->lcore_load;
+        resp->vlsr_rx_queues_in = lcore->lcore_nb_rx_queues_in;
+        resp->vlsr_rx_queues_out = lcore->lcore_nb_rx_queues_out;
+        resp->vlsr_idle_usecs = lcore->lcore_idle_cycles * US_PER_S
+            / rte_get_tsc_hz();
+        resp->vlsr_sleeps = lcore->lcore_nb_sleeps;
+        return 0;
+    }
+
+    return -ENOENT;
+}
+
+/* Route lookup results of a burst of packets */
+struct dpdk_route_burst {
+    /* The request of each packet, NULL if the packet has none */
+    struct vr_route_req *rb_pkt_rts[VR_DPDK_MAX_BURST_SZ];
+    /* The requests */
+    struct vr_route_req rb_rts[VR_DPDK_MAX_BURST_SZ];
+    /* Destinations, copied out of the headers as NAT may rewrite them */
+    uint8_t rb_prefixes[VR_DPDK_MAX_BURST_SZ][VR_IP6_ADDRESS_LEN];
+};
+
+/*
+ * dpdk_route_lookup_burst - look up the IPv4/IPv6 destinations of a burst
+ * in the vrf of the interface in one pass, which interleaves the walks of
+ * the mtrie. Each packet then takes its result through vr_inet_route_hint()
+ * rather than walking the mtrie again. A lookup in another vrf or for
+ * another address misses the hint and walks the mtrie as usual.
+ */
+static inline void
+dpdk_route_lookup_burst(struct vr_interface *vif,
+    struct vr_packet *pkts[VR_DPDK_MAX_BURST_SZ], uint32_t nb_pkts,
+    struct dpdk_route_burst *rb)
+{
+    unsigned i, nb_rts = 0;
+    struct vr_eth *eth;
+    struct vr_ip *ip;
+    struct vr_ip6 *ip6;
+    struct vr_route_req *rt;
+    struct vr_route_req *rts_p[VR_DPDK_MAX_BURST_SZ];
+
+    for (i = 0; i < nb_pkts; i++) {
+        rb->rb_pkt_rts[i] = NULL;
+        if (pkt_head_len(pkts[i]) < sizeof(*eth) + sizeof(*ip))
+            continue;
+
+        eth = (struct vr_eth *)pkt_data(pkts[i]);
+        rt = &rb->rb_rts[nb_rts];
+        if (eth->eth_proto == htons(VR_ETH_PROTO_IP)) {
+            ip = (struct vr_ip *)(eth + 1);
+            memcpy(rb->rb_prefixes[nb_rts], &ip->ip_daddr,
+                sizeof(ip->ip_daddr));
+            rt->rtr_req.rtr_family = AF_INET;
+            rt->rtr_req.rtr_prefix_len = IP4_PREFIX_LEN;
+        } else if (eth->eth_proto == htons(VR_ETH_PROTO_IP6) &&
+                pkt_head_len(pkts[i]) >= sizeof(*eth) + sizeof(*ip6)) {
+            ip6 = (struct vr_ip6 *)(eth + 1);
+            memcpy(rb->rb_prefixes[nb_rts], ip6->ip6_dst,
+                VR_IP6_ADDRESS_LEN);
+            rt->rtr_req.rtr_family = AF_INET6;
+            rt->rtr_req.rtr_prefix_len = IP6_PREFIX_LEN;
+        } else {
+            continue;
+        }
+
+        rt->rtr_req.rtr_vrf_id = vif->vif_vrf;
+        rt->rtr_req.rtr_prefix = rb->rb_prefixes[nb_rts];
+        rt->rtr_nh = NULL;
+        rts_p[nb_rts] = rt;
+        rb->rb_pkt_rts[i] = rt;
+        nb_rts++;
+    }
+
+    if (nb_rts)
+        vr_inet_route_lookup_burst(vif->vif_vrf, rts_p, nb_rts);
+}
+
 /* Send a burst of packets to vRouter */
 static inline void
 dpdk_vroute(struct vr_interface *vif, struct rte_mbuf *pkts[VR_DPDK_MAX_BURST_SZ],
@@ -394,6 +684,8 @@ dpdk_vroute(struct vr_interface *vif, struct rte_mbuf *pkts[VR_DPDK_MAX_BURST_SZ
     struct vr_dpdk_lcore * lcore;
     struct vr_dpdk_queue *monitoring_tx_queue;
     struct vr_packet *p_clone;
+    struct vr_packet *pkt_arr[VR_DPDK_MAX_BURST_SZ];
+    struct vr_flow_hint flow_hints[VR_DPDK_MAX_BURST_SZ];
 
     RTE_LOG(DEBUG, VROUTER, "%s: RX %" PRIu32 " packet(s) from interface %s\n",
          __func__, nb_pkts, vif->vif_name);
@@ -419,22 +711,33 @@ dpdk_vroute(struct vr_interface *vif, struct rte_mbuf *pkts[VR_DPDK_MAX_BURST_SZ
         }
     }
 
+    /* convert the whole burst first, to prefetch its flow entries */
     for (i = 0; i < nb_pkts; i++) {
         mbuf = pkts[i];
+        rte_prefetch0(vr_dpdk_mbuf_to_pkt(mbuf));
+        rte_prefetch0(rte_pktmbuf_mtod(mbuf, void *));
+
+        /* convert mbuf to vr_packet */
+        pkt_arr[i] = vr_dpdk_packet_get(mbuf, vif);
+    }
+
+    vr_flow_prefetch_burst(vif->vif_router, vif, pkt_arr, nb_pkts,
+            flow_hints);
+
+    for (i = 0; i < nb_pkts; i++) {
 #ifdef VR_DPDK_RX_PKT_DUMP
 #ifdef VR_DPDK_PKT_DUMP_VIF_FILTER
         if (VR_DPDK_PKT_DUMP_VIF_FILTER(vif))
 #endif
-        rte_pktmbuf_dump(stdout, mbuf, 0x60);
+        rte_pktmbuf_dump(stdout, pkts[i], 0x60);
 #endif
-        rte_prefetch0(vr_dpdk_mbuf_to_pkt(mbuf));
-        rte_prefetch0(rte_pktmbuf_mtod(mbuf, void *));
+        vr_flow_hint(vif->vif_router, &flow_hints[i]);
 
-        /* convert mbuf to vr_packet */
-        pkt = vr_dpdk_packet_get(mbuf, vif);
         /* send the packet to vRouter */
-        vif->vif_rx(vif, pkt, VLAN_ID_INVALID);
+        vif->vif_rx(vif, pkt_arr[i], VLAN_ID_INVALID);
     }
+
+    vr_flow_hint(vif->vif_router, NULL);
 }
 
 /* Send a burst of vr_packets to vRouter */
@@ -447,6 +750,9 @@ vr_dpdk_packets_vroute(struct vr_interface *vif, struct vr_packet *pkts[VR_DPDK_
     struct vr_dpdk_lcore * lcore;
     struct vr_dpdk_queue *monitoring_tx_queue;
     struct vr_packet *p_clone;
+    struct dpdk_route_burst rb;
+    struct vr_flow_hint flow_hints[VR_DPDK_MAX_BURST_SZ];
+    bool route_hints = false;
 
     RTE_LOG(DEBUG, VROUTER, "%s: RX %" PRIu32 " packet(s) from interface %s\n",
          __func__, nb_pkts, vif->vif_name);
@@ -468,6 +774,20 @@ vr_dpdk_packets_vroute(struct vr_interface *vif, struct vr_packet *pkts[VR_DPDK_
         }
     }
 
+    /* overlap the flow table loads of the whole burst */
+    vr_flow_prefetch_burst(vif->vif_router, vif, pkts, nb_pkts, flow_hints);
+
+    /*
+     * Look up the routes of bursts from VMs in the vrf of the vif. Other
+     * bursts (pkt0, rings from fabric lcores) skip the lookup, as the vrf
+     * of a packet from the fabric is known only after decap.
+     */
+    if (vif_is_virtual(vif) && vr_inet_route_lookup_burst &&
+            vr_inet_route_hint) {
+        dpdk_route_lookup_burst(vif, pkts, nb_pkts, &rb);
+        route_hints = true;
+    }
+
     for (i = 0; i < nb_pkts; i++) {
         pkt = pkts[i];
         rte_prefetch0(pkt);
@@ -478,10 +798,36 @@ vr_dpdk_packets_vroute(struct vr_interface *vif, struct vr_packet *pkts[VR_DPDK_
 #endif
         rte_pktmbuf_dump(stdout, vr_dpdk_pkt_to_mbuf(pkt), 0x60);
 #endif
+        if (route_hints)
+            vr_inet_route_hint(rb.rb_pkt_rts[i]);
+        vr_flow_hint(vif->vif_router, &flow_hints[i]);
 
         /* send the packet to vRouter */
         vif->vif_rx(vif, pkt, VLAN_ID_INVALID);
     }
+
+    if (route_hints)
+        vr_inet_route_hint(NULL);
+    vr_flow_hint(vif->vif_router, NULL);
+}
+
+/* Back off polling an RX queue which keeps returning no packets
+ * After VR_DPDK_RX_SKIP_EMPTY_POLLS empty polls in a row, the queue is
+ * skipped for a number of lcore loops doubling with every further empty
+ * poll, up to the max skip of the queue. The first packets reset it.
+ */
+static inline void
+dpdk_lcore_rx_queue_backoff(struct vr_dpdk_queue *rx_queue)
+{
+    unsigned nb_skip;
+
+    if (rx_queue->rxq_nb_empty < VR_DPDK_RX_SKIP_EMPTY_POLLS + 16)
+        rx_queue->rxq_nb_empty++;
+    if (rx_queue->rxq_nb_empty <= VR_DPDK_RX_SKIP_EMPTY_POLLS)
+        return;
+
+    nb_skip = 1U << (rx_queue->rxq_nb_empty - VR_DPDK_RX_SKIP_EMPTY_POLLS - 1);
+    rx_queue->rxq_nb_skip = RTE_MIN(nb_skip, rx_queue->rxq_max_skip);
 }
 
 /* Forwarding lcore RX */
@@ -494,14 +840,23 @@ dpdk_lcore_fwd_rx(struct vr_dpdk_lcore *lcore)
     uint32_t nb_pkts;
     struct vr_packet *pkt_arr[VR_DPDK_MAX_BURST_SZ];
     int pkti;
+    uint64_t cycles, last_cycles;
 
     /* for all RX queues */
     SLIST_FOREACH(rx_queue, &lcore->lcore_rx_head, q_next) {
-        /* burst RX */
+        /* skip the queues idle for a while */
+        if (unlikely(rx_queue->rxq_nb_skip != 0)) {
+            rx_queue->rxq_nb_skip--;
+            continue;
+        }
+
+        /* burst RX, timed from the poll of this queue on */
+        last_cycles = rte_rdtsc();
         nb_pkts = rx_queue->rxq_ops.f_rx(rx_queue->q_queue_h, pkts,
                 rx_queue->rxq_burst_size);
         if (likely(nb_pkts > 0)) {
             total_pkts += nb_pkts;
+            rx_queue->rxq_nb_empty = 0;
             /* transmit packets to vrouter */
             if (vif_is_virtual(rx_queue->q_vif)) {
                 for (pkti = 0; pkti < nb_pkts; pkti++) {
@@ -513,11 +868,77 @@ dpdk_lcore_fwd_rx(struct vr_dpdk_lcore *lcore)
             } else {
                 dpdk_vroute(rx_queue->q_vif, pkts, nb_pkts);
             }
+
+            /*
+             * account the burst to the queue for the rebalancer. empty
+             * polls are not charged to any queue
+             */
+            cycles = rte_rdtsc();
+            rx_queue->rxq_busy_cycles += cycles - last_cycles;
+            lcore->lcore_busy_cycles += cycles - last_cycles;
+        } else if (rx_queue->rxq_max_skip != 0) {
+            dpdk_lcore_rx_queue_backoff(rx_queue);
         }
     }
     return total_pkts;
 }
 
+/* Idle forwarding lcore (--adaptive-idle)
+ * Spin for a few empty loops, so there is no latency added while traffic
+ * is present, then back off exponentially with rte_pause(). Once idle for
+ * VR_DPDK_IDLE_SLEEP_AFTER_US, sleep on the lcore eventfd till woken up by
+ * a command or packets pushed from other lcores, or for at most
+ * VR_DPDK_IDLE_SLEEP_US, as there are no RX interrupts from the NICs.
+ */
+static inline void
+dpdk_lcore_idle(struct vr_dpdk_lcore *lcore)
+{
+    uint64_t cycles = rte_rdtsc();
+    uint64_t event;
+    uint32_t i;
+    struct pollfd pfd;
+    const struct timespec timeout = {
+        .tv_sec = 0,
+        .tv_nsec = VR_DPDK_IDLE_SLEEP_US * 1000,
+    };
+    const uint64_t sleep_after_cycles = (rte_get_tsc_hz() + US_PER_S - 1)
+        * VR_DPDK_IDLE_SLEEP_AFTER_US / US_PER_S;
+
+    if (lcore->lcore_idle_loops++ == 0) {
+        lcore->lcore_idle_since = cycles;
+        lcore->lcore_idle_pauses = 1;
+    }
+    if (lcore->lcore_idle_loops < VR_DPDK_IDLE_SPIN_LOOPS)
+        return;
+
+    if (cycles - lcore->lcore_idle_since < sleep_after_cycles) {
+        /* back off */
+        for (i = 0; i < lcore->lcore_idle_pauses; i++)
+            rte_pause();
+        if (lcore->lcore_idle_pauses < VR_DPDK_IDLE_MAX_PAUSES)
+            lcore->lcore_idle_pauses <<= 1;
+    } else if (lcore->lcore_wakeup_fd >= 0) {
+        /* sleep */
+        lcore->lcore_sleeping = true;
+        rte_mb();
+        pfd.fd = lcore->lcore_wakeup_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (ppoll(&pfd, 1, &timeout, NULL) > 0 && (pfd.revents & POLLIN)) {
+            if (read(lcore->lcore_wakeup_fd, &event, sizeof(event)) < 0) {
+                /* the eventfd is non-blocking, nothing to read */
+            }
+        }
+        lcore->lcore_sleeping = false;
+        lcore->lcore_nb_sleeps++;
+    } else {
+        usleep(VR_DPDK_IDLE_SLEEP_US);
+        lcore->lcore_nb_sleeps++;
+    }
+
+    lcore->lcore_idle_cycles += rte_rdtsc() - cycles;
+}
+
 /* Forwarding lcore IO */
 static inline void
 dpdk_lcore_fwd_io(struct vr_dpdk_lcore *lcore)
@@ -525,17 +946,12 @@ dpdk_lcore_fwd_io(struct vr_dpdk_lcore *lcore)
     uint64_t total_pkts = 0;
     struct rte_mbuf *pkts[VR_DPDK_MAX_BURST_SZ];
     uint32_t nb_pkts;
-    int i;
     struct vr_dpdk_ring_to_push *rtp;
     uint16_t nb_rtp;
     struct rte_ring *ring;
+    uint64_t cycles;
 
-    /* TODO: skip RX queues with no packets to read
-     * RX operation for KNIs is quite expensive. We used rx_queue_mask to
-     * mask out the ports with no packets to read (i.e. read them less
-     * frequently). We need to implement the same functionality for the
-     * list of RX queues now.
-     */
+    /* RX queues with no packets to read are polled less frequently */
     total_pkts += dpdk_lcore_fwd_rx(lcore);
 
     /* for all TX rings to push */
@@ -553,24 +969,33 @@ dpdk_lcore_fwd_io(struct vr_dpdk_lcore *lcore)
             VR_DPDK_MAX_BURST_SZ-1);
         if (likely(nb_pkts != 0)) {
             total_pkts += nb_pkts;
+            cycles = rte_rdtsc();
 
             if (likely(rtp->rtp_tx_queue && rtp->rtp_tx_queue->txq_ops.f_tx)) {
                 /* push packets to the TX queue */
-                /* TODO: use f_tx_bulk instead */
-                for (i = 0; i < nb_pkts; i++) {
-                    rtp->rtp_tx_queue->txq_ops.f_tx(
-                        rtp->rtp_tx_queue->q_queue_h, pkts[i]);
-                }
+                vr_dpdk_tx_queue_bulk(rtp->rtp_tx_queue, pkts, nb_pkts);
             } else {
                 vr_dpdk_packets_vroute(((struct vr_packet*)pkts[0])->vp_if,
                     (struct vr_packet**)pkts, nb_pkts);
             }
+            lcore->lcore_busy_cycles += rte_rdtsc() - cycles;
         }
         rtp++;
     }
 
+    /* send the packets buffered by vif_tx() while routing the bursts */
+    vr_dpdk_lcore_tx_bursts_flush(lcore);
+
     rcu_quiescent_state();
 
+    if (vr_dpdk.adaptive_idle) {
+        if (likely(total_pkts != 0))
+            lcore->lcore_idle_loops = 0;
+        else
+            dpdk_lcore_idle(lcore);
+        return;
+    }
+
 #if VR_DPDK_SLEEP_NO_PACKETS_US > 0
     /* sleep if no single packet received */
     if (unlikely(total_pkts == 0)) {
@@ -602,6 +1027,13 @@ dpdk_lcore_init(unsigned lcore_id)
     /* init lcore lists */
     SLIST_INIT(&lcore->lcore_tx_head);
 
+    /* eventfd to wake the lcore up when it sleeps idle */
+    lcore->lcore_wakeup_fd = eventfd(0, EFD_NONBLOCK);
+    if (lcore->lcore_wakeup_fd < 0) {
+        RTE_LOG(ERR, VROUTER, "Error creating lcore %u eventfd, the lcore"
+            " will sleep idle till the timeout\n", lcore_id);
+    }
+
     vr_dpdk.lcores[lcore_id] = lcore;
 
     rcu_register_thread();
@@ -621,6 +1053,9 @@ dpdk_lcore_exit(unsigned lcore_id)
     vr_dpdk_if_lock();
     vr_dpdk_if_unlock();
 
+    if (lcore->lcore_wakeup_fd >= 0)
+        close(lcore->lcore_wakeup_fd);
+
     /* free lcore context */
     vr_dpdk.lcores[lcore_id] = NULL;
     rte_free(lcore);
@@ -688,6 +1123,9 @@ dpdk_lcore_fwd_loop(struct vr_dpdk_lcore *lcore)
 
     RTE_LOG(DEBUG, VROUTER, "Hello from forwarding lcore %u\n", rte_lcore_id());
 
+    /* the TX bursts are flushed every loop */
+    lcore->lcore_tx_burst = true;
+
     while (1) {
         rte_prefetch0(lcore);
 
@@ -21,6 +21,113 @@
 #include <rte_port_ring.h>
 #include <rte_malloc.h>
 
+/* Ring writer, which wakes up the lcore pushing the ring once it sends */
+struct dpdk_ring_writer {
+    /* rte_port ring writer */
+    void *rw_port;
+    /* Lcore which pushes the ring to the TX queue */
+    struct vr_dpdk_lcore *rw_host_lcore;
+};
+
+struct dpdk_ring_writer_params {
+    /* rte_port ring writer params */
+    struct rte_port_ring_writer_params rwp_writer;
+    /* Lcore which pushes the ring to the TX queue */
+    unsigned rwp_host_lcore_id;
+};
+
+static void *
+dpdk_ring_writer_create(void *params, int socket_id)
+{
+    struct dpdk_ring_writer_params *conf =
+            (struct dpdk_ring_writer_params *) params;
+    struct dpdk_ring_writer *port;
+
+    port = rte_zmalloc_socket("PORT", sizeof(*port), CACHE_LINE_SIZE,
+        socket_id);
+    if (port == NULL) {
+        RTE_LOG(ERR, PORT, "%s: Failed to allocate port\n", __func__);
+        return NULL;
+    }
+
+    port->rw_port = rte_port_ring_writer_ops.f_create(&conf->rwp_writer,
+        socket_id);
+    if (port->rw_port == NULL) {
+        rte_free(port);
+        return NULL;
+    }
+    port->rw_host_lcore = vr_dpdk.lcores[conf->rwp_host_lcore_id];
+
+    return port;
+}
+
+/*
+ * The writer sends to the ring once a burst is full, or on flush. The
+ * lcore pushing the ring might be sleeping idle, so wake it up in all the
+ * cases (which costs a load if it is not).
+ */
+static int
+dpdk_ring_writer_tx(void *port, struct rte_mbuf *pkt)
+{
+    struct dpdk_ring_writer *p = (struct dpdk_ring_writer *) port;
+    int ret;
+
+    ret = rte_port_ring_writer_ops.f_tx(p->rw_port, pkt);
+    vr_dpdk_lcore_wakeup(p->rw_host_lcore);
+
+    return ret;
+}
+
+static int
+dpdk_ring_writer_tx_bulk(void *port, struct rte_mbuf **pkts,
+    uint64_t pkts_mask)
+{
+    struct dpdk_ring_writer *p = (struct dpdk_ring_writer *) port;
+    int ret;
+
+    ret = rte_port_ring_writer_ops.f_tx_bulk(p->rw_port, pkts, pkts_mask);
+    vr_dpdk_lcore_wakeup(p->rw_host_lcore);
+
+    return ret;
+}
+
+static int
+dpdk_ring_writer_flush(void *port)
+{
+    struct dpdk_ring_writer *p = (struct dpdk_ring_writer *) port;
+    int ret;
+
+    ret = rte_port_ring_writer_ops.f_flush(p->rw_port);
+    vr_dpdk_lcore_wakeup(p->rw_host_lcore);
+
+    return ret;
+}
+
+static int
+dpdk_ring_writer_free(void *port)
+{
+    struct dpdk_ring_writer *p = (struct dpdk_ring_writer *) port;
+    int ret;
+
+    if (port == NULL) {
+        RTE_LOG(ERR, PORT, "%s: Port is NULL\n", __func__);
+        return -EINVAL;
+    }
+
+    ret = rte_port_ring_writer_ops.f_free(p->rw_port);
+    rte_free(p);
+
+    return ret;
+}
+
+static struct rte_port_out_ops dpdk_ring_writer_ops = {
+    .f_create = dpdk_ring_writer_create,
+    .f_free = dpdk_ring_writer_free,
+    .f_tx = dpdk_ring_writer_tx,
+    .f_tx_bulk = dpdk_ring_writer_tx_bulk,
+    .f_flush = dpdk_ring_writer_flush,
+};
+
 /* Allocates a new ring */
 struct rte_ring *
 vr_dpdk_ring_allocate(unsigned host_lcore_id, char *ring_name,
@@ -151,7 +258,7 @@ vr_dpdk_ring_tx_queue_init(unsigned lcore_id, struct vr_interface *vif,
     }
 
     /* init queue */
-    tx_queue->txq_ops = rte_port_ring_writer_ops;
+    tx_queue->txq_ops = dpdk_ring_writer_ops;
     tx_queue->q_queue_h = NULL;
     tx_queue->q_vif = vrouter_get_interface(vif->vif_rid, vif_idx);
 
@@ -169,9 +276,12 @@ vr_dpdk_ring_tx_queue_init(unsigned lcore_id, struct vr_interface *vif,
     dpdk_ring_to_push_add(host_lcore_id, tx_ring, host_tx_queue);
 
     /* create the queue */
-    struct rte_port_ring_writer_params writer_params = {
-        .ring = tx_ring,
-        .tx_burst_sz = VR_DPDK_RING_TX_BURST_SZ,
+    struct dpdk_ring_writer_params writer_params = {
+        .rwp_writer = {
+            .ring = tx_ring,
+            .tx_burst_sz = VR_DPDK_RING_TX_BURST_SZ,
+        },
+        .rwp_host_lcore_id = host_lcore_id,
     };
     tx_queue->q_queue_h = tx_queue->txq_ops.f_create(&writer_params,
                                                         socket_id);
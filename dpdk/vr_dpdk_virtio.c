@@ -16,6 +16,7 @@
 #include "qemu_uvhost.h"
 #include "vr_uvhost_client.h"
 
+#include <rte_cycles.h>
 #include <rte_malloc.h>
 
 void *vr_dpdk_vif_clients[VR_MAX_INTERFACES];
@@ -25,6 +26,8 @@ vr_dpdk_virtioq_t vr_dpdk_virtio_txqs[VR_MAX_INTERFACES][RTE_MAX_LCORE];
 static int dpdk_virtio_from_vm_rx(void *arg, struct rte_mbuf **pkts,
                                   uint32_t max_pkts);
 static int dpdk_virtio_to_vm_tx(void *arg, struct rte_mbuf *pkt);
+static int dpdk_virtio_to_vm_tx_bulk(void *arg, struct rte_mbuf **pkts,
+                                     uint64_t pkts_mask);
 static int dpdk_virtio_to_vm_flush(void *arg);
 
 struct rte_port_in_ops dpdk_virtio_reader_ops = {
@@ -37,28 +40,31 @@ struct rte_port_out_ops dpdk_virtio_writer_ops = {
     .f_create = NULL,
     .f_free = NULL,
     .f_tx = dpdk_virtio_to_vm_tx,
-    .f_tx_bulk = NULL, /* TODO: not implemented */
+    .f_tx_bulk = dpdk_virtio_to_vm_tx_bulk,
     .f_flush = dpdk_virtio_to_vm_flush,
 };
 
 /*
  * vr_dpdk_virtio_nrxqs - returns the number of receives queues for a virtio
- * interface.
+ * interface. There is a queue for each forwarding lcore, so that a VM using
+ * multiple queues can spread its load over the lcores. The queues the VM
+ * does not use are not ready and cost little to poll.
  */
 uint16_t
 vr_dpdk_virtio_nrxqs(struct vr_interface *vif)
 {
-    return 1;
+    return RTE_MAX(RTE_MIN(vr_dpdk.nb_fwd_lcores, VR_DPDK_VIRTIO_MAX_QUEUES),
+                   1);
 }
 
 /*
  * vr_dpdk_virtio_ntxqs - returns the number of transmit queues for a virtio
- * interface.
+ * interface, which is the same as the number of receive queues.
  */
 uint16_t
 vr_dpdk_virtio_ntxqs(struct vr_interface *vif)
 {
-    return 1;
+    return vr_dpdk_virtio_nrxqs(vif);
 }
 
 /*
@@ -73,10 +79,11 @@ dpdk_virtio_rx_queue_release(unsigned lcore_id, struct vr_interface *vif)
     struct vr_dpdk_queue *rx_queue = &lcore->lcore_rx_queues[vif->vif_idx];
     struct vr_dpdk_queue_params *rx_queue_params
                         = &lcore->lcore_rx_queue_params[vif->vif_idx];
+    vr_dpdk_virtioq_t *vq = (vr_dpdk_virtioq_t *)rx_queue->q_queue_h;
     int fd;
 
     /* close call FD */
-    fd = ((vr_dpdk_virtioq_t *)rx_queue->q_queue_h)->vdv_callfd;
+    fd = vq->vdv_callfd;
     if (fd > 0) {
         close(fd);
     }
@@ -139,12 +146,13 @@ vr_dpdk_virtio_rx_queue_init(unsigned int lcore_id, struct vr_interface *vif,
 
     rx_queue->rxq_ops = dpdk_virtio_reader_ops;
     vr_dpdk_virtio_rxqs[vif_idx][queue_id].vdv_ready_state = VQ_NOT_READY;
-    vr_dpdk_virtio_rxqs[vif_idx][queue_id].vdv_zero_copy = 0;
+    vr_dpdk_virtio_rxqs[vif_idx][queue_id].vdv_enabled_state = 1;
     vr_dpdk_virtio_rxqs[vif_idx][queue_id].vdv_soft_avail_idx = 0;
     vr_dpdk_virtio_rxqs[vif_idx][queue_id].vdv_soft_used_idx = 0;
     vr_dpdk_virtio_rxqs[vif_idx][queue_id].vdv_vif_idx = vif->vif_idx;
     rx_queue->q_queue_h = (void *) &vr_dpdk_virtio_rxqs[vif_idx][queue_id];
     rx_queue->rxq_burst_size = VR_DPDK_VIRTIO_RX_BURST_SZ;
+    rx_queue->rxq_max_skip = VR_DPDK_VIRTIO_RX_MAX_SKIP;
     rx_queue->q_vif = vif;
 
     /* store queue params */
@@ -216,11 +224,15 @@ vr_dpdk_virtio_tx_queue_init(unsigned int lcore_id, struct vr_interface *vif,
 
     tx_queue->txq_ops = dpdk_virtio_writer_ops;
     vr_dpdk_virtio_txqs[vif_idx][queue_id].vdv_ready_state = VQ_NOT_READY;
-    vr_dpdk_virtio_txqs[vif_idx][queue_id].vdv_zero_copy = 0;
+    vr_dpdk_virtio_txqs[vif_idx][queue_id].vdv_enabled_state = 1;
     vr_dpdk_virtio_txqs[vif_idx][queue_id].vdv_soft_avail_idx = 0;
     vr_dpdk_virtio_txqs[vif_idx][queue_id].vdv_soft_used_idx = 0;
     vr_dpdk_virtio_txqs[vif_idx][queue_id].vdv_vif_idx = vif->vif_idx;
     vr_dpdk_virtio_txqs[vif_idx][queue_id].vdv_tx_mbuf_count = 0;
+    vr_dpdk_virtio_txqs[vif_idx][queue_id].vdv_vif = vif;
+    vr_dpdk_virtio_txqs[vif_idx][queue_id].vdv_irq_used_idx = 0;
+    vr_dpdk_virtio_txqs[vif_idx][queue_id].vdv_irq_cycles = 0;
+    rte_spinlock_init(&vr_dpdk_virtio_txqs[vif_idx][queue_id].vdv_lock);
     tx_queue->q_queue_h = (void *) &vr_dpdk_virtio_txqs[vif_idx][queue_id];
     tx_queue->q_vif = vif;
 
@@ -230,36 +242,76 @@ vr_dpdk_virtio_tx_queue_init(unsigned int lcore_id, struct vr_interface *vif,
     return tx_queue;
 }
 
+/*
+ * dpdk_virtio_mem_region_holds - tells whether the len bytes at guest
+ * physical address paddr are all within the region. Unsigned subtraction
+ * checks the start against both bounds at once, and the end can not wrap.
+ */
+static inline bool
+dpdk_virtio_mem_region_holds(vr_dpdk_virtio_mem_region_t *reg, uint64_t paddr,
+                             uint32_t len)
+{
+    return (paddr - reg->vdm_phys_addr < reg->vdm_size) &&
+        (len <= reg->vdm_size - (paddr - reg->vdm_phys_addr));
+}
+
+/*
+ * dpdk_virtio_mem_region - finds the guest memory region of the queue which
+ * holds the len bytes at guest physical address paddr. The region of the
+ * previous lookup is tried first, as the buffers of a queue are mostly in
+ * the same region.
+ *
+ * Returns the region on success, NULL if no region holds the whole buffer.
+ */
+static inline vr_dpdk_virtio_mem_region_t *
+dpdk_virtio_mem_region(vr_dpdk_virtioq_t *vq, uint64_t paddr, uint32_t len)
+{
+    unsigned int lo = 0, hi = vq->vdv_nmem, mid;
+    vr_dpdk_virtio_mem_region_t *reg = &vq->vdv_mem[vq->vdv_mem_last];
+
+    if (likely(dpdk_virtio_mem_region_holds(reg, paddr, len)))
+        return reg;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        reg = &vq->vdv_mem[mid];
+        if (paddr < reg->vdm_phys_addr) {
+            hi = mid;
+        } else if (paddr - reg->vdm_phys_addr < reg->vdm_size) {
+            /* regions do not overlap, so no other one can hold the buffer */
+            if (!dpdk_virtio_mem_region_holds(reg, paddr, len))
+                return NULL;
+
+            vq->vdv_mem_last = mid;
+            return reg;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    return NULL;
+}
+
 /*
  * vr_dpdk_guest_phys_to_host_virt - convert a guest physical address
- * to a host virtual address. Uses the guest memory map stored in the
- * vhost client for the guest interface.
+ * to a host virtual address. Uses the guest memory map set in the queue
+ * by the vhost client for the guest interface. The len bytes at paddr
+ * have to be within one region, as the guest may pass any buffer.
  *
  * Returns address on success, NULL otherwise.
  */
-static char *
-vr_dpdk_guest_phys_to_host_virt(vr_dpdk_virtioq_t *vq, uint64_t paddr)
+static inline char *
+vr_dpdk_guest_phys_to_host_virt(vr_dpdk_virtioq_t *vq, uint64_t paddr,
+                                uint32_t len)
 {
-    int i;
-    vr_uvh_client_t *vru_cl;
-    vr_uvh_client_mem_region_t *reg;
+    vr_dpdk_virtio_mem_region_t *reg;
 
-    vru_cl = vr_dpdk_virtio_get_vif_client(vq->vdv_vif_idx);
-    if (vru_cl == NULL) {
+    reg = dpdk_virtio_mem_region(vq, paddr, len);
+    if (reg == NULL) {
         return NULL;
     }
 
-    for (i = 0; i < vru_cl->vruc_num_mem_regions; i++) {
-        reg = &vru_cl->vruc_mem_regions[i];
-
-        if ((paddr >= reg->vrucmr_phys_addr) &&
-                (paddr <= (reg->vrucmr_phys_addr + reg->vrucmr_size))) {
-            return ((char *) reg->vrucmr_mmap_addr) +
-                        (paddr - reg->vrucmr_phys_addr);
-        }
-    }
-
-    return NULL;
+    return (char *)reg->vdm_host_addr + (paddr - reg->vdm_phys_addr);
 }
 
 /*
@@ -272,6 +324,281 @@ vr_dpdk_virtio_get_mempool(void)
     return vr_dpdk.virtio_mempool;
 }
 
+/*
+ * dpdk_virtio_rx_used - moves a descriptor chain of the VM's TX ring to the
+ * used list. The used index is only updated at the end of the burst.
+ *
+ * Returns nothing.
+ */
+static inline void
+dpdk_virtio_rx_used(vr_dpdk_virtioq_t *vq, uint16_t desc_idx)
+{
+    uint16_t used_idx = vq->vdv_soft_used_idx++ & (vq->vdv_vvs.num - 1);
+
+    vq->vdv_used->ring[used_idx].id = desc_idx;
+    vq->vdv_used->ring[used_idx].len = 0;
+
+    return;
+}
+
+/*
+ * dpdk_virtio_hdr_len - returns the length of the virtio net header that
+ * precedes every packet on the queue, which depends on whether the vhost
+ * client negotiated mergeable receive buffers.
+ */
+static inline uint32_t
+dpdk_virtio_hdr_len(vr_dpdk_virtioq_t *vq)
+{
+    if (vq->vdv_features & (1ULL << VIRTIO_NET_F_MRG_RXBUF))
+        return sizeof(struct virtio_net_hdr_mrg_rxbuf);
+
+    return sizeof(struct virtio_net_hdr);
+}
+
+/*
+ * dpdk_virtio_next_desc - returns the descriptor chained to desc, or NULL
+ * at the end of the chain. *ndescp counts the descriptors walked so far, so
+ * that a looping chain set up by a broken guest is cut at the ring size.
+ */
+static inline struct vring_desc *
+dpdk_virtio_next_desc(vr_dpdk_virtioq_t *vq, struct vring_desc *desc,
+                      uint32_t *ndescp)
+{
+    if (!(desc->flags & VRING_DESC_F_NEXT))
+        return NULL;
+
+    if ((desc->next >= vq->vdv_vvs.num) || (++*ndescp >= vq->vdv_vvs.num)) {
+        DPDK_UDEBUG(VROUTER, &vq->vdv_hash, "%s: queue %p bad desc next %u\n",
+                __func__, vq, desc->next);
+        return NULL;
+    }
+
+    return &vq->vdv_desc[desc->next];
+}
+
+/*
+ * dpdk_virtio_rx_csum_is_ipv4 - returns true if the checksum a VM left to
+ * the host is the TCP/UDP checksum of an IPv4 packet right after the
+ * Ethernet header, the only case the TX checksum helpers can finish.
+ */
+static inline bool
+dpdk_virtio_rx_csum_is_ipv4(struct virtio_net_hdr *vhdr, struct rte_mbuf *mbuf)
+{
+    struct vr_eth *eth = rte_pktmbuf_mtod(mbuf, struct vr_eth *);
+    struct vr_ip *iph = (struct vr_ip *)(eth + 1);
+
+    if (rte_pktmbuf_data_len(mbuf) < sizeof(*eth) + sizeof(*iph))
+        return false;
+
+    if (eth->eth_proto != rte_cpu_to_be_16(VR_ETH_PROTO_IP) ||
+            iph->ip_version != 4 || iph->ip_hl < 5)
+        return false;
+
+    if (vhdr->csum_start != sizeof(*eth) + iph->ip_hl * 4)
+        return false;
+
+    if (iph->ip_proto == VR_IP_PROTO_TCP)
+        return vhdr->csum_offset == offsetof(struct vr_tcp, tcp_csum);
+    if (iph->ip_proto == VR_IP_PROTO_UDP)
+        return vhdr->csum_offset == offsetof(struct vr_udp, udp_csum);
+
+    return false;
+}
+
+/*
+ * dpdk_virtio_rx_sw_csum - finishes a checksum the VM left to the host in
+ * software: sums the (possibly chained) mbuf from csum_start to the end,
+ * on top of the pseudo header sum already in the checksum field, and stores
+ * the result at csum_start + csum_offset.
+ *
+ * Returns 0 on success, -1 if the offsets are outside of the packet.
+ */
+static int
+dpdk_virtio_rx_sw_csum(struct virtio_net_hdr *vhdr, struct rte_mbuf *mbuf)
+{
+    unsigned off = vhdr->csum_start, csum_off, len, odd = 0;
+    uint32_t sum = 0;
+    uint8_t *p, *csump = NULL;
+    struct rte_mbuf *m;
+
+    csum_off = vhdr->csum_start + vhdr->csum_offset;
+    if (csum_off + sizeof(uint16_t) > rte_pktmbuf_pkt_len(mbuf))
+        return -1;
+
+    /* the checksum field must not span two segments */
+    for (m = mbuf; m != NULL; m = m->pkt.next) {
+        if (csum_off < rte_pktmbuf_data_len(m)) {
+            if (csum_off + sizeof(uint16_t) > rte_pktmbuf_data_len(m))
+                return -1;
+            csump = rte_pktmbuf_mtod(m, uint8_t *) + csum_off;
+            break;
+        }
+        csum_off -= rte_pktmbuf_data_len(m);
+    }
+    if (csump == NULL)
+        return -1;
+
+    for (m = mbuf; m != NULL; m = m->pkt.next) {
+        if (off >= rte_pktmbuf_data_len(m)) {
+            off -= rte_pktmbuf_data_len(m);
+            continue;
+        }
+
+        p = rte_pktmbuf_mtod(m, uint8_t *) + off;
+        len = rte_pktmbuf_data_len(m) - off;
+        off = 0;
+
+        /* the previous segment ended in the middle of a 16 bit word */
+        if (odd && len) {
+            sum += *p++;
+            len--;
+            odd = 0;
+        }
+        for (; len > 1; len -= 2, p += 2)
+            sum += (p[0] << 8) | p[1];
+        if (len) {
+            sum += p[0] << 8;
+            odd = 1;
+        }
+    }
+
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    /* as in Linux, a zero sum is sent as 0xffff not to read as no UDP sum */
+    sum = ~sum & 0xffff;
+    if (sum == 0)
+        sum = 0xffff;
+    csump[0] = sum >> 8;
+    csump[1] = sum & 0xff;
+
+    return 0;
+}
+
+/*
+ * dpdk_virtio_rx_offload - sets up the mbuf of a packet from the VM for the
+ * checksum and segmentation offloads asked for in its virtio header. The
+ * checksum field of a packet which needs a checksum holds the sum of the
+ * pseudo header, which is what vrouter expects for partial checksums.
+ * The TX checksum helpers only know about IPv4, so any other checksum (IPv6,
+ * VLAN tagged, ...) is finished here in software instead.
+ *
+ * Returns 0 on success, -1 if the VM asked for an offload that was not
+ * negotiated or is not supported.
+ */
+static inline int
+dpdk_virtio_rx_offload(vr_dpdk_virtioq_t *vq, struct virtio_net_hdr *vhdr,
+                       struct rte_mbuf *mbuf)
+{
+    struct vr_dpdk_pkt_md *md = vr_dpdk_pkt_to_md(vr_dpdk_mbuf_to_pkt(mbuf));
+
+    md->md_gso_size = 0;
+
+    if (vhdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+        if (!(vq->vdv_features & (1ULL << VIRTIO_NET_F_CSUM)))
+            return -1;
+
+        if (!dpdk_virtio_rx_csum_is_ipv4(vhdr, mbuf)) {
+            if (dpdk_virtio_rx_sw_csum(vhdr, mbuf))
+                return -1;
+        } else if (vhdr->csum_offset == offsetof(struct vr_tcp, tcp_csum)) {
+            mbuf->ol_flags |= PKT_TX_TCP_CKSUM;
+        } else {
+            mbuf->ol_flags |= PKT_TX_UDP_CKSUM;
+        }
+    }
+
+    switch (vhdr->gso_type) {
+    case VIRTIO_NET_HDR_GSO_NONE:
+        break;
+
+    case VIRTIO_NET_HDR_GSO_TCPV4:
+        if (!(vq->vdv_features & (1ULL << VIRTIO_NET_F_HOST_TSO4)) ||
+                !(mbuf->ol_flags & PKT_TX_TCP_CKSUM) || !vhdr->gso_size)
+            return -1;
+
+        md->md_gso_size = vhdr->gso_size;
+        break;
+
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * dpdk_virtio_desc_to_mbuf - copies the packet in the descriptor chain
+ * starting at desc_idx to an mbuf, apart from the virtio header, which is
+ * used to set up the offloads. The header may have a descriptor of its own
+ * or precede the data in the first one. Packets larger than an mbuf are
+ * copied to a chain of mbufs.
+ *
+ * Returns the mbuf on success, NULL otherwise.
+ */
+static struct rte_mbuf *
+dpdk_virtio_desc_to_mbuf(vr_dpdk_virtioq_t *vq, uint16_t desc_idx)
+{
+    struct vring_desc *desc;
+    struct rte_mbuf *head = NULL, *mbuf = NULL, *new_mbuf;
+    struct virtio_net_hdr_mrg_rxbuf vhdr;
+    char *addr;
+    uint32_t len, copy, hdr_len, skip, ndesc = 0;
+
+    if (desc_idx >= vq->vdv_vvs.num)
+        return NULL;
+
+    hdr_len = skip = dpdk_virtio_hdr_len(vq);
+    desc = &vq->vdv_desc[desc_idx];
+    do {
+        addr = vr_dpdk_guest_phys_to_host_virt(vq, desc->addr, desc->len);
+        if (addr == NULL)
+            goto fail;
+
+        len = desc->len;
+        copy = RTE_MIN(skip, len);
+        rte_memcpy((char *)&vhdr + hdr_len - skip, addr, copy);
+        addr += copy;
+        len -= copy;
+        skip -= copy;
+
+        while (len) {
+            if ((mbuf == NULL) || (rte_pktmbuf_tailroom(mbuf) == 0)) {
+                new_mbuf = rte_pktmbuf_alloc(vr_dpdk_virtio_get_mempool());
+                if (new_mbuf == NULL)
+                    goto fail;
+
+                if (head == NULL) {
+                    head = new_mbuf;
+                } else {
+                    mbuf->pkt.next = new_mbuf;
+                    head->pkt.nb_segs++;
+                }
+                mbuf = new_mbuf;
+            }
+
+            copy = RTE_MIN(len, rte_pktmbuf_tailroom(mbuf));
+            rte_memcpy(rte_pktmbuf_mtod(mbuf, char *) + mbuf->pkt.data_len,
+                       addr, copy);
+            mbuf->pkt.data_len += copy;
+            head->pkt.pkt_len += copy;
+            addr += copy;
+            len -= copy;
+        }
+    } while ((desc = dpdk_virtio_next_desc(vq, desc, &ndesc)) != NULL);
+
+    if (head && (skip || dpdk_virtio_rx_offload(vq, &vhdr.hdr, head)))
+        goto fail;
+
+    return head;
+
+fail:
+    if (head)
+        rte_pktmbuf_free(head);
+
+    return NULL;
+}
+
 /*
  * dpdk_virtio_from_vm_rx - receive packets from a virtio client so that
  * the packets can be handed to vrouter for forwarding. the virtio client is
@@ -286,10 +613,7 @@ dpdk_virtio_from_vm_rx(void *arg, struct rte_mbuf **pkts, uint32_t max_pkts)
     vr_dpdk_virtioq_t *vq = (vr_dpdk_virtioq_t *) arg;
     uint16_t vq_hard_avail_idx, vq_hard_used_idx, i;
     uint16_t num_pkts, next_desc_idx, next_avail_idx, pkts_sent = 0;
-    struct vring_desc *desc;
-    char *pkt_addr;
     struct rte_mbuf *mbuf;
-    uint32_t pkt_len;
 
     if (vq->vdv_ready_state == VQ_NOT_READY) {
         DPDK_UDEBUG(VROUTER, &vq->vdv_hash, "%s: queue %p is not ready\n",
@@ -297,6 +621,9 @@ dpdk_virtio_from_vm_rx(void *arg, struct rte_mbuf **pkts, uint32_t max_pkts)
         return 0;
     }
 
+    if (!vq->vdv_enabled_state)
+        return 0;
+
     vq_hard_avail_idx = (*((volatile uint16_t *)&vq->vdv_avail->idx));
 
     /*
@@ -319,59 +646,32 @@ dpdk_virtio_from_vm_rx(void *arg, struct rte_mbuf **pkts, uint32_t max_pkts)
         next_avail_idx = (vq->vdv_soft_avail_idx + i) &
                              (vq->vdv_vvs.num - 1);
         next_desc_idx = vq->vdv_avail->ring[next_avail_idx];
-        desc = &vq->vdv_desc[next_desc_idx];
 
         /*
-         * Ignore virtio header in first descriptor as we don't support
-         * mergeable receive buffers yet. Before that, move the descriptors
-         * (chain of 2) to the used list. The used index will, however, only
-         * be updated at the end of the loop.
+         * Move the descriptor chain to the used list, even if the packet
+         * can not be received. The used index will, however, only be
+         * updated at the end of the loop.
          */
-        vq->vdv_used->ring[next_avail_idx].id = next_desc_idx;
-        vq->vdv_used->ring[next_avail_idx].len = 0;
-        if (desc->flags & VRING_DESC_F_NEXT) {
-            /*
-             * TODO - make sure desc->next is sane
-             */
-            DPDK_UDEBUG(VROUTER, &vq->vdv_hash, "%s: queue %p pkt %u F_NEXT\n",
-                __func__, vq, i);
-            desc = &vq->vdv_desc[desc->next];
-            pkt_addr = vr_dpdk_guest_phys_to_host_virt(vq, desc->addr);
-            pkt_len = desc->len;
-        } else {
-            DPDK_UDEBUG(VROUTER, &vq->vdv_hash, "%s: queue %p pkt %u no F_NEXT\n",
-                __func__, vq, i);
-            pkt_addr = vr_dpdk_guest_phys_to_host_virt(vq, desc->addr);
-            if (pkt_addr) {
-                pkt_addr += sizeof(struct virtio_net_hdr);
-                pkt_len = desc->len - sizeof(struct virtio_net_hdr);
-            }
-        }
-
-        if (pkt_addr) {
-            DPDK_UDEBUG(VROUTER, &vq->vdv_hash, "%s: queue %p pkt %u addr %p\n",
-                __func__, vq, i, pkt_addr);
-            mbuf = rte_pktmbuf_alloc(vr_dpdk_virtio_get_mempool());
-            DPDK_UDEBUG(VROUTER, &vq->vdv_hash, "%s: queue %p pkt %u mbuf %p\n",
-                __func__, vq, i, mbuf);
-            if (mbuf != NULL) {
-                mbuf->pkt.data_len = pkt_len;
-                mbuf->pkt.pkt_len = pkt_len;
-
-                rte_memcpy(mbuf->pkt.data, pkt_addr, pkt_len);
-                pkts[pkts_sent] = mbuf;
-                pkts_sent++;
-            }
+        mbuf = dpdk_virtio_desc_to_mbuf(vq, next_desc_idx);
+        dpdk_virtio_rx_used(vq, next_desc_idx);
+
+        DPDK_UDEBUG(VROUTER, &vq->vdv_hash, "%s: queue %p pkt %u mbuf %p\n",
+            __func__, vq, i, mbuf);
+        if (mbuf != NULL) {
+            pkts[pkts_sent] = mbuf;
+            pkts_sent++;
         }
     }
+    vq->vdv_soft_avail_idx += num_pkts;
 
     /*
      * TODO - might need to kick guest.
      */
-    rte_wmb();
-    vq->vdv_soft_avail_idx += num_pkts;
     vq_hard_used_idx = (*((volatile uint16_t *)&vq->vdv_used->idx));
-    *((volatile uint16_t *) &vq->vdv_used->idx) = vq_hard_used_idx + num_pkts;
+    if (vq_hard_used_idx != vq->vdv_soft_used_idx) {
+        rte_wmb();
+        *((volatile uint16_t *) &vq->vdv_used->idx) = vq->vdv_soft_used_idx;
+    }
 
     DPDK_UDEBUG(VROUTER, &vq->vdv_hash, "%s: queue %p pkts_sent %u\n",
             __func__, vq, pkts_sent);
@@ -389,11 +689,7 @@ dpdk_virtio_to_vm_tx(void *arg, struct rte_mbuf *mbuf)
 {
     vr_dpdk_virtioq_t *vq = (vr_dpdk_virtioq_t *) arg;
 
-    if (vq->vdv_ready_state == VQ_NOT_READY) {
-        vr_dpdk_pfree(mbuf, VP_DROP_INTERFACE_DROP);
-        return -1;
-    }
-
+    /* the packet may go to another queue of the VM if this one is not used */
     vq->vdv_tx_mbuf[vq->vdv_tx_mbuf_count++] = mbuf;
     if (vq->vdv_tx_mbuf_count >= VR_DPDK_VIRTIO_TX_BURST_SZ) {
         dpdk_virtio_to_vm_flush(vq);
@@ -403,103 +699,314 @@ dpdk_virtio_to_vm_tx(void *arg, struct rte_mbuf *mbuf)
 }
 
 /*
- * dpdk_virtio_to_vm_flush - flushes packets from vrouter to a virtio client.
- * The virtio client is usually a VM.
+ * dpdk_virtio_to_vm_tx_bulk - buffers the packets of pkts_mask to be sent
+ * to the VM.
  *
- * Returns nothing.
+ * Returns 0.
  */
 static int
-dpdk_virtio_to_vm_flush(void *arg)
+dpdk_virtio_to_vm_tx_bulk(void *arg, struct rte_mbuf **pkts,
+                          uint64_t pkts_mask)
 {
     vr_dpdk_virtioq_t *vq = (vr_dpdk_virtioq_t *) arg;
-    uint16_t i;
-    uint16_t num_buf_posted, vq_hard_avail_idx, vq_hard_used_idx, num_pkts;
-    uint16_t next_desc_idx, next_avail_idx, size;
-    struct vring_desc *desc;
-    char *buf_addr;
-    struct virtio_net_hdr vhdr = {0, 0, 0, 0, 0, 0};
+    uint32_t pkt_index;
 
-    if (vq->vdv_ready_state == VQ_NOT_READY) {
-        return 0;
+    while (pkts_mask) {
+        pkt_index = __builtin_ctzll(pkts_mask);
+        pkts_mask &= ~(1ULL << pkt_index);
+
+        vq->vdv_tx_mbuf[vq->vdv_tx_mbuf_count++] = pkts[pkt_index];
+        if (vq->vdv_tx_mbuf_count >= VR_DPDK_VIRTIO_TX_BURST_SZ) {
+            dpdk_virtio_to_vm_flush(vq);
+        }
     }
 
-    if (vq->vdv_tx_mbuf_count == 0) {
-        return 0;
+    return 0;
+}
+
+/*
+ * dpdk_virtio_tx_offload - fills the virtio header of a packet to the VM
+ * with the checksum and segmentation offloads left to the VM. The offsets
+ * were set in the mbuf when the partial checksum was prepared on TX.
+ */
+static inline void
+dpdk_virtio_tx_offload(vr_dpdk_virtioq_t *vq, struct rte_mbuf *mbuf,
+                       struct virtio_net_hdr *vhdr)
+{
+    uint16_t l4_off, gso_size;
+    uint8_t *tcp_off;
+
+    if (!(vq->vdv_features & (1ULL << VIRTIO_NET_F_GUEST_CSUM)) ||
+            !(mbuf->ol_flags & PKT_TX_L4_MASK))
+        return;
+
+    l4_off = mbuf->pkt.vlan_macip.f.l2_len + mbuf->pkt.vlan_macip.f.l3_len;
+    vhdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    vhdr->csum_start = l4_off;
+    if ((mbuf->ol_flags & PKT_TX_L4_MASK) == PKT_TX_UDP_CKSUM) {
+        vhdr->csum_offset = offsetof(struct vr_udp, udp_csum);
+        return;
     }
 
-    vq_hard_avail_idx = (*((volatile uint16_t *)&vq->vdv_avail->idx));
+    vhdr->csum_offset = offsetof(struct vr_tcp, tcp_csum);
 
-    /*
-     * Unsigned subtraction gives the right result even with wrap around.
-     */
-    num_buf_posted = vq_hard_avail_idx - vq->vdv_soft_avail_idx;
-    if (num_buf_posted < vq->vdv_tx_mbuf_count) {
-        num_pkts = num_buf_posted;
+    gso_size = vr_dpdk_pkt_to_md(vr_dpdk_mbuf_to_pkt(mbuf))->md_gso_size;
+    if (gso_size && (vq->vdv_features & (1ULL << VIRTIO_NET_F_GUEST_TSO4))) {
+        /* the data offset is the high nibble of the 13th byte */
+        tcp_off = rte_pktmbuf_mtod(mbuf, uint8_t *) + l4_off + 12;
+        vhdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+        vhdr->gso_size = gso_size;
+        vhdr->hdr_len = l4_off + ((*tcp_off >> 4) * 4);
+    }
+
+    return;
+}
+
+/*
+ * dpdk_virtio_mbuf_to_desc - copies a (possibly chained) mbuf to the receive
+ * buffers posted by the guest, starting at avail ring index *avail_idxp. A
+ * buffer is a chain of descriptors, the first of which holds the virtio
+ * header. If mergeable receive buffers were negotiated, a packet that does
+ * not fit in a buffer spills over to the next ones, and the number of
+ * buffers used is reported in the header of the first.
+ *
+ * Returns 0 on success with *avail_idxp moved past the buffers used, and
+ * -ENOBUFS if the guest did not post enough buffers, in which case nothing
+ * is consumed. On other errors (-EINVAL) the buffers walked are consumed with
+ * a length of 0.
+ */
+static int
+dpdk_virtio_mbuf_to_desc(vr_dpdk_virtioq_t *vq, struct rte_mbuf *mbuf,
+                         uint16_t *avail_idxp, uint16_t vq_hard_avail_idx)
+{
+    uint16_t avail_idx = *avail_idxp, ring_idx, desc_idx, num_buffers = 0;
+    uint16_t first_avail_idx = *avail_idxp;
+    uint32_t hdr_len, room, copy, seg_off = 0, used_len, ndesc;
+    bool mrg_rxbuf;
+    char *addr;
+    struct vring_desc *desc;
+    struct virtio_net_hdr_mrg_rxbuf *vhdr = NULL;
+    struct rte_mbuf *seg = mbuf;
+
+    hdr_len = dpdk_virtio_hdr_len(vq);
+    mrg_rxbuf = hdr_len == sizeof(struct virtio_net_hdr_mrg_rxbuf);
+
+    do {
+        if (avail_idx == vq_hard_avail_idx)
+            return -ENOBUFS;
+
+        ring_idx = avail_idx & (vq->vdv_vvs.num - 1);
+        desc_idx = vq->vdv_avail->ring[ring_idx];
+        vq->vdv_used->ring[ring_idx].id = desc_idx;
+        vq->vdv_used->ring[ring_idx].len = 0;
+        avail_idx++;
+        num_buffers++;
+
+        if (desc_idx >= vq->vdv_vvs.num)
+            goto fail;
+
+        desc = &vq->vdv_desc[desc_idx];
+        used_len = 0;
+        ndesc = 0;
+        do {
+            addr = vr_dpdk_guest_phys_to_host_virt(vq, desc->addr,
+                                                   desc->len);
+            if (addr == NULL)
+                goto fail;
+
+            room = desc->len;
+            if (vhdr == NULL) {
+                if (room < hdr_len)
+                    goto fail;
+
+                vhdr = (struct virtio_net_hdr_mrg_rxbuf *)addr;
+                memset(vhdr, 0, hdr_len);
+                dpdk_virtio_tx_offload(vq, mbuf, &vhdr->hdr);
+                addr += hdr_len;
+                room -= hdr_len;
+                used_len += hdr_len;
+            }
+
+            while (room && seg) {
+                copy = RTE_MIN(room, rte_pktmbuf_data_len(seg) - seg_off);
+                rte_memcpy(addr, rte_pktmbuf_mtod(seg, char *) + seg_off, copy);
+                addr += copy;
+                room -= copy;
+                used_len += copy;
+                seg_off += copy;
+                if (seg_off == rte_pktmbuf_data_len(seg)) {
+                    seg = seg->pkt.next;
+                    seg_off = 0;
+                }
+            }
+        } while (seg && (desc = dpdk_virtio_next_desc(vq, desc, &ndesc)));
+
+        vq->vdv_used->ring[ring_idx].len = used_len;
+
+        /* without mergeable buffers, the packet has to fit in one buffer */
+        if (seg && !mrg_rxbuf)
+            goto fail;
+    } while (seg);
+
+    if (mrg_rxbuf)
+        vhdr->num_buffers = num_buffers;
+
+    *avail_idxp = avail_idx;
+
+    return 0;
+
+fail:
+    for (; first_avail_idx != avail_idx; first_avail_idx++) {
+        ring_idx = first_avail_idx & (vq->vdv_vvs.num - 1);
+        vq->vdv_used->ring[ring_idx].len = 0;
+    }
+    *avail_idxp = avail_idx;
+
+    return -EINVAL;
+}
+
+/*
+ * dpdk_virtio_to_vm_kick - raises an interrupt in the guest for the buffers
+ * used since the last one, if the guest wants to be interrupted for them:
+ * with VIRTIO_RING_F_EVENT_IDX, once the used index moves past the used
+ * event index set by the guest, otherwise unless the guest set
+ * VRING_AVAIL_F_NO_INTERRUPT. Interrupts are coalesced per the policy of the
+ * vif, so this is also called on idle flushes to raise the late ones.
+ *
+ * Returns nothing.
+ */
+static void
+dpdk_virtio_to_vm_kick(vr_dpdk_virtioq_t *vq)
+{
+    uint16_t used_idx, used_event, pending;
+    int max_pkts, max_usecs;
+    uint64_t cur_cycles;
+    bool want_irq;
+
+    used_idx = *((volatile uint16_t *)&vq->vdv_used->idx);
+    pending = used_idx - vq->vdv_irq_used_idx;
+    if (pending == 0)
+        return;
+
+    if (vq->vdv_features & (1ULL << VIRTIO_RING_F_EVENT_IDX)) {
+        /* the used event index follows the avail ring */
+        used_event = *((volatile uint16_t *)
+                        &vq->vdv_avail->ring[vq->vdv_vvs.num]);
+        want_irq = vring_need_event(used_event, used_idx,
+                        vq->vdv_irq_used_idx);
     } else {
-        num_pkts = vq->vdv_tx_mbuf_count;
+        want_irq = !(vq->vdv_avail->flags & VRING_AVAIL_F_NO_INTERRUPT);
     }
 
-    for (i = 0; i < num_pkts; i++) {
-        next_avail_idx = (vq->vdv_soft_avail_idx + i) &
-                             (vq->vdv_vvs.num - 1);
-        next_desc_idx = vq->vdv_avail->ring[next_avail_idx];
+    if (!want_irq) {
+        vq->vdv_irq_used_idx = used_idx;
+        vq->vdv_irq_cycles = 0;
+        return;
+    }
 
-        /*
-         * Move the descriptor (single or chain of 2) to the used list. The
-         * used index will, however, only be updated at the end of the loop.
-         * This needs to be done even if any failures occur below in the loop.
-         * Set the descriptor length to 0 for now and update it at the end
-         * of the loop if there were no errors.
-         */
-        vq->vdv_used->ring[next_avail_idx].id = next_desc_idx;
-        vq->vdv_used->ring[next_avail_idx].len = 0;
+    max_pkts = vq->vdv_vif->vif_irq_coalesce_pkts;
+    max_usecs = vq->vdv_vif->vif_irq_coalesce_usecs;
+    if ((max_pkts == VIF_IRQ_COALESCE_OFF) ||
+            (max_usecs == VIF_IRQ_COALESCE_OFF))
+        goto kick;
 
-        desc = &vq->vdv_desc[next_desc_idx];
-        buf_addr = vr_dpdk_guest_phys_to_host_virt(vq, desc->addr);
-        if (buf_addr == NULL) {
-            vr_dpdk_pfree(vq->vdv_tx_mbuf[i], VP_DROP_INTERFACE_DROP);
-            continue;
-        }
+    if (max_pkts == VIF_IRQ_COALESCE_DEFAULT)
+        max_pkts = VR_DPDK_VIRTIO_IRQ_COALESCE_PKTS;
+    if (max_usecs == VIF_IRQ_COALESCE_DEFAULT)
+        max_usecs = VR_DPDK_VIRTIO_IRQ_COALESCE_US;
 
-        /*
-         * No support for checksum offload or GSO at the moment, so zero
-         * out the virtio header.
-         */
-        size = sizeof(vhdr);
-        rte_memcpy(buf_addr, &vhdr, size);
-        buf_addr += sizeof(vhdr);
+    cur_cycles = rte_get_timer_cycles();
+    if (vq->vdv_irq_cycles == 0)
+        vq->vdv_irq_cycles = cur_cycles;
 
-        /*
-         * If the descriptor has VRING_DESC_F_NEXT set, the virtio_net header
-         * and packet data use separate descriptors.
-         */
-        if (desc->flags & VRING_DESC_F_NEXT) {
-            desc->len = sizeof(struct virtio_net_hdr);
-            /*
-             * TODO: verify that desc->next is sane below.
-             */
-            desc = &vq->vdv_desc[desc->next];
-
-            buf_addr = vr_dpdk_guest_phys_to_host_virt(vq, desc->addr);
-            if (buf_addr == NULL) {
-                vr_dpdk_pfree(vq->vdv_tx_mbuf[i], VP_DROP_INTERFACE_DROP);
-                continue;
-            }
+    if ((pending < max_pkts) && ((cur_cycles - vq->vdv_irq_cycles) * US_PER_S <
+                max_usecs * rte_get_timer_hz()))
+        return;
 
-            desc->len = rte_pktmbuf_data_len(vq->vdv_tx_mbuf[i]);
-        } else {
-            desc->len = sizeof(struct virtio_net_hdr) +
-                            rte_pktmbuf_data_len(vq->vdv_tx_mbuf[i]);
+kick:
+    eventfd_write(vq->vdv_callfd, 1);
+    vq->vdv_irq_used_idx = used_idx;
+    vq->vdv_irq_cycles = 0;
+
+    return;
+}
+
+/*
+ * dpdk_virtio_to_vm_queue - returns the VM receive queue the packets queued
+ * on vq by this lcore go to: vq itself if the VM uses it, otherwise the
+ * first queue the VM uses, e.g. if it did not negotiate multiple queues or
+ * did not enable them all.
+ *
+ * Returns the queue, NULL if the VM uses none.
+ */
+static inline vr_dpdk_virtioq_t *
+dpdk_virtio_to_vm_queue(vr_dpdk_virtioq_t *vq)
+{
+    unsigned int i, ntxqs;
+    vr_dpdk_virtioq_t *tx_vq;
+
+    if (likely((vq->vdv_ready_state == VQ_READY) && vq->vdv_enabled_state))
+        return vq;
+
+    ntxqs = vr_dpdk_virtio_ntxqs(vq->vdv_vif);
+    for (i = 0; i < ntxqs; i++) {
+        tx_vq = &vr_dpdk_virtio_txqs[vq->vdv_vif_idx][i];
+        if ((tx_vq->vdv_ready_state == VQ_READY) && tx_vq->vdv_enabled_state)
+            return tx_vq;
+    }
+
+    return NULL;
+}
+
+/*
+ * dpdk_virtio_to_vm_flush - flushes packets from vrouter to a virtio client.
+ * The virtio client is usually a VM. The vring is locked, as the lcores
+ * whose queues the VM does not use share the ones it does.
+ *
+ * Returns nothing.
+ */
+static int
+dpdk_virtio_to_vm_flush(void *arg)
+{
+    vr_dpdk_virtioq_t *vq = (vr_dpdk_virtioq_t *) arg, *tx_vq;
+    uint16_t i;
+    uint16_t vq_hard_avail_idx, vq_hard_used_idx, avail_idx, num_bufs;
+    int ret;
+
+    tx_vq = dpdk_virtio_to_vm_queue(vq);
+    if (tx_vq == NULL) {
+        for (i = 0; i < vq->vdv_tx_mbuf_count; i++) {
+            vr_dpdk_pfree(vq->vdv_tx_mbuf[i], VP_DROP_INTERFACE_DROP);
         }
+        vq->vdv_tx_mbuf_count = 0;
+        return 0;
+    }
 
-        rte_memcpy(buf_addr, vq->vdv_tx_mbuf[i]->pkt.data,
-                   rte_pktmbuf_data_len(vq->vdv_tx_mbuf[i]));
+    rte_spinlock_lock(&tx_vq->vdv_lock);
 
-        vq->vdv_used->ring[next_avail_idx].len =
-            sizeof(struct virtio_net_hdr) +
-            rte_pktmbuf_data_len(vq->vdv_tx_mbuf[i]);
+    if (vq->vdv_tx_mbuf_count == 0) {
+        dpdk_virtio_to_vm_kick(tx_vq);
+        rte_spinlock_unlock(&tx_vq->vdv_lock);
+        return 0;
+    }
 
-        rte_pktmbuf_free(vq->vdv_tx_mbuf[i]);
+    vq_hard_avail_idx = (*((volatile uint16_t *)&tx_vq->vdv_avail->idx));
+
+    /*
+     * Every buffer consumed is moved to the used list at the same position
+     * it had in the avail list, so both indices advance together.
+     */
+    avail_idx = tx_vq->vdv_soft_avail_idx;
+    for (i = 0; i < vq->vdv_tx_mbuf_count; i++) {
+        ret = dpdk_virtio_mbuf_to_desc(tx_vq, vq->vdv_tx_mbuf[i], &avail_idx,
+                                       vq_hard_avail_idx);
+        if (ret == -ENOBUFS) {
+            break;
+        } else if (ret) {
+            vr_dpdk_pfree(vq->vdv_tx_mbuf[i], VP_DROP_INTERFACE_DROP);
+        } else {
+            rte_pktmbuf_free(vq->vdv_tx_mbuf[i]);
+        }
     }
 
     /*
@@ -512,24 +1019,108 @@ dpdk_virtio_to_vm_flush(void *arg)
 
     vq->vdv_tx_mbuf_count = 0;
 
-    /*
-     * Now update the used index in the vring.
-     * TODO - need memory barrier + VM kick here.
-     */
-    vq->vdv_soft_avail_idx += num_pkts;
-    vq_hard_used_idx = (*((volatile uint16_t *)&vq->vdv_used->idx));
-    *((volatile uint16_t *) &vq->vdv_used->idx) = vq_hard_used_idx + num_pkts;
+    num_bufs = avail_idx - tx_vq->vdv_soft_avail_idx;
+    if (num_bufs) {
+        /*
+         * Now update the used index in the vring, once the buffers and the
+         * used ring entries are visible to the guest.
+         */
+        rte_wmb();
+        tx_vq->vdv_soft_avail_idx = avail_idx;
+        vq_hard_used_idx = (*((volatile uint16_t *)&tx_vq->vdv_used->idx));
+        *((volatile uint16_t *) &tx_vq->vdv_used->idx) =
+                                    vq_hard_used_idx + num_bufs;
+        /* the used index has to be visible before the used event is read */
+        rte_mb();
+    }
 
-    /*
-     * If the VM did not want to be interrupted (i.e if it uses DPDK), do
-     * not raise an interrupt. Otherwise, use eventfd to raise an interrupt
-     * in the guest.
-     */
-    if (vq->vdv_avail->flags & VRING_AVAIL_F_NO_INTERRUPT) {
+    dpdk_virtio_to_vm_kick(tx_vq);
+    rte_spinlock_unlock(&tx_vq->vdv_lock);
+
+    return 0;
+}
+
+/*
+ * vr_dpdk_virtio_set_features - sets the virtio features negotiated by the
+ * vhost client on all the queues of the interface.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int
+vr_dpdk_virtio_set_features(unsigned int vif_idx, uint64_t features)
+{
+    unsigned int i;
+
+    if (vif_idx >= VR_MAX_INTERFACES) {
+        return -1;
+    }
+
+    for (i = 0; i < RTE_MAX_LCORE; i++) {
+        vr_dpdk_virtio_rxqs[vif_idx][i].vdv_features = features;
+        vr_dpdk_virtio_txqs[vif_idx][i].vdv_features = features;
+    }
+
+    return 0;
+}
+
+/*
+ * vr_dpdk_virtio_features - returns the virtio features negotiated by the
+ * vhost client of the interface, which are the same on all its queues.
+ *
+ * Returns the features, 0 if none were negotiated.
+ */
+uint64_t
+vr_dpdk_virtio_features(unsigned int vif_idx)
+{
+    if (vif_idx >= VR_MAX_INTERFACES) {
         return 0;
     }
 
-    eventfd_write(vq->vdv_callfd, 1);
+    return vr_dpdk_virtio_txqs[vif_idx][0].vdv_features;
+}
+
+/*
+ * vr_dpdk_virtio_set_mem_table - sets the guest memory map sent by the vhost
+ * client on all the queues of the interface, sorted by guest physical
+ * address, so that the queues do not have to look up the client to
+ * translate the addresses in the descriptors.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int
+vr_dpdk_virtio_set_mem_table(unsigned int vif_idx,
+                             vr_uvh_client_mem_region_t *regions,
+                             unsigned int nregions)
+{
+    unsigned int i, j;
+    vr_dpdk_virtio_mem_region_t mem[VR_DPDK_VIRTIO_MAX_MEM_REGIONS], reg;
+
+    if ((vif_idx >= VR_MAX_INTERFACES) ||
+            (nregions > VR_DPDK_VIRTIO_MAX_MEM_REGIONS)) {
+        return -1;
+    }
+
+    memset(mem, 0, sizeof(mem));
+    for (i = 0; i < nregions; i++) {
+        reg.vdm_phys_addr = regions[i].vrucmr_phys_addr;
+        reg.vdm_size = regions[i].vrucmr_size;
+        reg.vdm_host_addr = regions[i].vrucmr_mmap_addr;
+
+        for (j = i; (j > 0) && (mem[j - 1].vdm_phys_addr > reg.vdm_phys_addr);
+                j--) {
+            mem[j] = mem[j - 1];
+        }
+        mem[j] = reg;
+    }
+
+    for (i = 0; i < RTE_MAX_LCORE; i++) {
+        memcpy(vr_dpdk_virtio_rxqs[vif_idx][i].vdv_mem, mem, sizeof(mem));
+        vr_dpdk_virtio_rxqs[vif_idx][i].vdv_nmem = nregions;
+        vr_dpdk_virtio_rxqs[vif_idx][i].vdv_mem_last = 0;
+        memcpy(vr_dpdk_virtio_txqs[vif_idx][i].vdv_mem, mem, sizeof(mem));
+        vr_dpdk_virtio_txqs[vif_idx][i].vdv_nmem = nregions;
+        vr_dpdk_virtio_txqs[vif_idx][i].vdv_mem_last = 0;
+    }
 
     return 0;
 }
@@ -603,6 +1194,8 @@ vr_dpdk_virtio_get_vring_base(unsigned int vif_idx, unsigned int vring_idx,
     vq->vdv_ready_state = VQ_NOT_READY;
     vq->vdv_soft_avail_idx = 0;
     vq->vdv_soft_used_idx = 0;
+    vq->vdv_irq_used_idx = 0;
+    vq->vdv_irq_cycles = 0;
 
     return 0;
 }
@@ -747,6 +1340,39 @@ vr_dpdk_set_virtq_ready(unsigned int vif_idx, unsigned int vring_idx,
     return 0;
 }
 
+/*
+ * vr_dpdk_set_virtq_enabled - enables or disables a virtio queue on request
+ * of the vhost client, e.g. when the guest changes the number of queue
+ * pairs it uses. Queues are enabled until the client says otherwise.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int
+vr_dpdk_set_virtq_enabled(unsigned int vif_idx, unsigned int vring_idx,
+                          int enabled)
+{
+    vr_dpdk_virtioq_t *vq;
+
+    if ((vif_idx >= VR_MAX_INTERFACES) || (vring_idx >= (2 * RTE_MAX_LCORE))) {
+        return -1;
+    }
+
+    /*
+     * RX rings are even numbered and TX rings are odd numbered from the
+     * VM's point of view. From vrouter's point of view, VM's TX ring is
+     * vrouter's RX ring and vice versa.
+     */
+    if (vring_idx & 1) {
+        vq = &vr_dpdk_virtio_rxqs[vif_idx][vring_idx/2];
+    } else {
+        vq = &vr_dpdk_virtio_txqs[vif_idx][vring_idx/2];
+    }
+
+    vq->vdv_enabled_state = enabled;
+
+    return 0;
+}
+
 /*
  * vr_dpdk_virtio_set_vif_client - sets a pointer to per vif state. Currently
  * used to store a pointer to the vhost client structure.
@@ -805,5 +1431,8 @@ vr_dpdk_virtio_enq_pkts_to_phys_lcore(struct vr_dpdk_queue *rx_queue,
     for ( ; nb_enq < npkts; nb_enq++)
         vr_pfree(pkt_arr[nb_enq], VP_DROP_INTERFACE_DROP);
 
+    /* the lcore pushing the ring may sleep idle */
+    vr_dpdk_lcore_wakeup(vr_dpdk.lcores[vq->vdv_pring_dst_lcore_id]);
+
     return;
 }
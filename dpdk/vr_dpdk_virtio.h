@@ -8,6 +8,8 @@
 #ifndef __VR_DPDK_VIRTIO_H__
 #define __VR_DPDK_VIRTIO_H__
 
+#include <rte_spinlock.h>
+
 /*
  * Burst size for packets from a VM
  */
@@ -22,6 +24,54 @@
  */
 #define VR_DPDK_VIRTIO_TX_RING_SZ (64 * VR_DPDK_TX_RING_SZ)
 
+/*
+ * Virtio features offered to the vhost client
+ */
+#define VR_DPDK_VIRTIO_FEATURES ((1ULL << VIRTIO_NET_F_MRG_RXBUF)    \
+                                | (1ULL << VIRTIO_NET_F_CSUM)       \
+                                | (1ULL << VIRTIO_NET_F_GUEST_CSUM) \
+                                | (1ULL << VIRTIO_NET_F_HOST_TSO4)  \
+                                | (1ULL << VIRTIO_NET_F_GUEST_TSO4)  \
+                                | (1ULL << VIRTIO_RING_F_EVENT_IDX)  \
+                                | (1ULL << VIRTIO_NET_F_MQ)         \
+                                | (1ULL << VHOST_USER_F_PROTOCOL_FEATURES))
+/*
+ * Vhost user protocol features offered to the vhost client
+ */
+#define VR_DPDK_VIRTIO_PROTOCOL_FEATURES (1ULL << VHOST_USER_PROTOCOL_F_MQ)
+/*
+ * Maximum number of queue pairs of a virtio interface. Each queue pair is
+ * polled by a forwarding lcore of its own.
+ */
+#define VR_DPDK_VIRTIO_MAX_QUEUES 8
+/*
+ * Features a VM needs to receive TSO packets without segmentation
+ */
+#define VR_DPDK_VIRTIO_GUEST_TSO ((1ULL << VIRTIO_NET_F_GUEST_CSUM)  \
+                                 | (1ULL << VIRTIO_NET_F_GUEST_TSO4))
+
+/*
+ * Maximum number of guest memory regions, the same as VHOST_MEMORY_MAX_NREGIONS
+ */
+#define VR_DPDK_VIRTIO_MAX_MEM_REGIONS 8
+
+/*
+ * Guest memory region, as seen by a virtio queue. The regions of a queue are
+ * sorted by guest physical address.
+ */
+typedef struct vr_dpdk_virtio_mem_region {
+    uint64_t vdm_phys_addr;
+    uint64_t vdm_size;
+    uint64_t vdm_host_addr;
+} vr_dpdk_virtio_mem_region_t;
+
+/*
+ * Interrupts to a guest are raised once so many packets are waiting for it,
+ * or the oldest one has waited so long (unless set per vif)
+ */
+#define VR_DPDK_VIRTIO_IRQ_COALESCE_PKTS    32
+#define VR_DPDK_VIRTIO_IRQ_COALESCE_US      50
+
 typedef enum vq_ready_state {
     VQ_NOT_READY = 1,
     VQ_READY,
@@ -31,12 +81,15 @@ typedef struct vr_dpdk_virtioq {
     volatile vq_ready_state_t vdv_ready_state;
     int vdv_enabled_state;
     unsigned int vdv_vif_idx;
-    int vdv_zero_copy;
     struct vring_desc *vdv_desc;
     struct vring_avail *vdv_avail;
     struct vring_used *vdv_used;
     unsigned int vdv_base_idx;
     struct vhost_vring_state vdv_vvs;
+    uint64_t vdv_features;
+    uint16_t vdv_nmem;
+    uint16_t vdv_mem_last;
+    vr_dpdk_virtio_mem_region_t vdv_mem[VR_DPDK_VIRTIO_MAX_MEM_REGIONS];
     uint16_t vdv_soft_avail_idx;
     uint16_t vdv_soft_used_idx;
     struct rte_mbuf *vdv_tx_mbuf[2 * VR_DPDK_VIRTIO_TX_BURST_SZ];
@@ -44,6 +97,11 @@ typedef struct vr_dpdk_virtioq {
     struct rte_ring *vdv_pring;
     unsigned vdv_pring_dst_lcore_id;
     int vdv_callfd;
+    /* TX to the VM from several lcores shares a vring if not all are enabled */
+    rte_spinlock_t vdv_lock;
+    struct vr_interface *vdv_vif;
+    uint16_t vdv_irq_used_idx;
+    uint64_t vdv_irq_cycles;
     DPDK_DEBUG_VAR(uint32_t vdv_hash);
 } vr_dpdk_virtioq_t;
 
@@ -69,6 +127,13 @@ int vr_dpdk_set_ring_callfd(unsigned int vif_idx, unsigned int vring_idx,
                             int callfd);
 int vr_dpdk_set_virtq_ready(unsigned int vif_idx, unsigned int vring_idx,
                             vq_ready_state_t ready);
+int vr_dpdk_set_virtq_enabled(unsigned int vif_idx, unsigned int vring_idx,
+                              int enabled);
+int vr_dpdk_virtio_set_features(unsigned int vif_idx, uint64_t features);
+uint64_t vr_dpdk_virtio_features(unsigned int vif_idx);
+int vr_dpdk_virtio_set_mem_table(unsigned int vif_idx,
+                                 struct vr_uvh_client_mem_region *regions,
+                                 unsigned int nregions);
 void vr_dpdk_virtio_set_vif_client(unsigned int idx, void *client);
 void *vr_dpdk_virtio_get_vif_client(unsigned int idx);
 void vr_dpdk_virtio_enq_pkts_to_phys_lcore(struct vr_dpdk_queue *rx_queue,
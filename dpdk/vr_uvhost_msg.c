@@ -12,6 +12,7 @@
 #include <errno.h>
 #include <sys/socket.h>
 #include <linux/vhost.h>
+#include <linux/virtio_net.h>
 #include <stdint.h>
 #include <sys/mman.h>
 #include <fcntl.h>
@@ -33,17 +34,22 @@ typedef int (*vr_uvh_msg_handler_fn)(vr_uvh_client_t *vru_cl);
  * Prototypes for user space vhost message handlers
  */
 static int vr_uvmh_get_features(vr_uvh_client_t *vru_cl);
+static int vr_uvmh_set_features(vr_uvh_client_t *vru_cl);
 static int vr_uvhm_set_mem_table(vr_uvh_client_t *vru_cl);
 static int vr_uvhm_set_ring_num_desc(vr_uvh_client_t *vru_cl);
 static int vr_uvhm_set_vring_addr(vr_uvh_client_t *vru_cl);
 static int vr_uvhm_set_vring_base(vr_uvh_client_t *vru_cl);
 static int vr_uvhm_get_vring_base(vr_uvh_client_t *vru_cl);
 static int vr_uvhm_set_call_fd(vr_uvh_client_t *vru_cl);
+static int vr_uvmh_get_protocol_features(vr_uvh_client_t *vru_cl);
+static int vr_uvmh_set_protocol_features(vr_uvh_client_t *vru_cl);
+static int vr_uvmh_get_queue_num(vr_uvh_client_t *vru_cl);
+static int vr_uvmh_set_vring_enable(vr_uvh_client_t *vru_cl);
 
 static vr_uvh_msg_handler_fn vr_uvhost_cl_msg_handlers[] = {
     NULL,
     vr_uvmh_get_features,
-    NULL,
+    vr_uvmh_set_features,
     NULL,
     NULL,
     vr_uvhm_set_mem_table,
@@ -55,7 +61,11 @@ static vr_uvh_msg_handler_fn vr_uvhost_cl_msg_handlers[] = {
     vr_uvhm_get_vring_base,
     NULL,
     vr_uvhm_set_call_fd,
-    NULL
+    NULL,
+    vr_uvmh_get_protocol_features,
+    vr_uvmh_set_protocol_features,
+    vr_uvmh_get_queue_num,
+    vr_uvmh_set_vring_enable,
 };
 
 /*
@@ -67,12 +77,124 @@ static vr_uvh_msg_handler_fn vr_uvhost_cl_msg_handlers[] = {
 static int
 vr_uvmh_get_features(vr_uvh_client_t *vru_cl)
 {
-    vru_cl->vruc_msg.u64 = 0;
+    vru_cl->vruc_msg.u64 = VR_DPDK_VIRTIO_FEATURES;
+    vru_cl->vruc_msg.size = sizeof(vru_cl->vruc_msg.u64);
+
+    return 0;
+}
+
+/*
+ * vr_uvmh_set_features - handle VHOST_USER_SET_FEATURES message from user space
+ * vhost client to learn the features the guest acked.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+static int
+vr_uvmh_set_features(vr_uvh_client_t *vru_cl)
+{
+    uint64_t features = vru_cl->vruc_msg.u64;
+
+    if (features & ~VR_DPDK_VIRTIO_FEATURES) {
+        vr_uvhost_log("Unsupported features 0x%" PRIx64 " set by vhost client"
+                      " %s\n", features & ~VR_DPDK_VIRTIO_FEATURES,
+                      vru_cl->vruc_path);
+        features &= VR_DPDK_VIRTIO_FEATURES;
+    }
+
+    if (vr_dpdk_virtio_set_features(vru_cl->vruc_idx, features)) {
+        vr_uvhost_log("Couldn't set features 0x%" PRIx64 " in vhost server"
+                      " %d\n", features, vru_cl->vruc_idx);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * vr_uvmh_get_protocol_features - handle VHOST_USER_GET_PROTOCOL_FEATURES
+ * message from user space vhost client.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+static int
+vr_uvmh_get_protocol_features(vr_uvh_client_t *vru_cl)
+{
+    vru_cl->vruc_msg.u64 = VR_DPDK_VIRTIO_PROTOCOL_FEATURES;
+    vru_cl->vruc_msg.size = sizeof(vru_cl->vruc_msg.u64);
+
+    return 0;
+}
+
+/*
+ * vr_uvmh_set_protocol_features - handle VHOST_USER_SET_PROTOCOL_FEATURES
+ * message from user space vhost client. There is nothing to set up, the
+ * client only sends the messages of the features it acked.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+static int
+vr_uvmh_set_protocol_features(vr_uvh_client_t *vru_cl)
+{
+    uint64_t features = vru_cl->vruc_msg.u64;
+
+    if (features & ~VR_DPDK_VIRTIO_PROTOCOL_FEATURES) {
+        vr_uvhost_log("Unsupported protocol features 0x%" PRIx64 " set by"
+                      " vhost client %s\n",
+                      features & ~VR_DPDK_VIRTIO_PROTOCOL_FEATURES,
+                      vru_cl->vruc_path);
+    }
+
+    return 0;
+}
+
+/*
+ * vr_uvmh_get_queue_num - handle VHOST_USER_GET_QUEUE_NUM message from user
+ * space vhost client. The client may use as many queue pairs as vrouter
+ * polls queues of the interface.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+static int
+vr_uvmh_get_queue_num(vr_uvh_client_t *vru_cl)
+{
+    vru_cl->vruc_msg.u64 = RTE_MIN(vru_cl->vruc_nrxqs, vru_cl->vruc_ntxqs);
     vru_cl->vruc_msg.size = sizeof(vru_cl->vruc_msg.u64);
 
     return 0;
 }
 
+/*
+ * vr_uvmh_set_vring_enable - handles a VHOST_USER_SET_VRING_ENABLE message
+ * from the vhost user client to enable or disable a vring, e.g. when the
+ * guest changes the number of queue pairs it uses.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+static int
+vr_uvmh_set_vring_enable(vr_uvh_client_t *vru_cl)
+{
+    VhostUserMsg *vum_msg;
+    unsigned int vring_idx;
+
+    vum_msg = &vru_cl->vruc_msg;
+    vring_idx = vum_msg->state.index;
+
+    if (vring_idx >= VHOST_CLIENT_MAX_VRINGS) {
+        vr_uvhost_log("Bad ring index %d received by vhost server\n",
+                      vring_idx);
+        return -1;
+    }
+
+    if (vr_dpdk_set_virtq_enabled(vru_cl->vruc_idx, vring_idx,
+                                  vum_msg->state.num)) {
+        vr_uvhost_log("Couldn't enable vring in vhost server %d %d %d\n",
+                      vru_cl->vruc_idx, vring_idx, vum_msg->state.num);
+        return -1;
+    }
+
+    return 0;
+}
+
 /*
  * vr_uvhm_set_mem_table - handles VHOST_USER_SET_MEM_TABLE message from
  * user space vhost client to learn the memory map of the guest.
@@ -130,6 +252,13 @@ vr_uvhm_set_mem_table(vr_uvh_client_t *vru_cl)
 
     vru_cl->vruc_num_mem_regions = vum_msg->nregions;
 
+    if (vr_dpdk_virtio_set_mem_table(vru_cl->vruc_idx, vru_cl->vruc_mem_regions,
+                                     vru_cl->vruc_num_mem_regions)) {
+        vr_uvhost_log("Couldn't set memory table in vhost server %d\n",
+                      vru_cl->vruc_idx);
+        return -1;
+    }
+
     return 0;
 }
 
@@ -393,6 +522,8 @@ vr_uvh_cl_send_reply(int fd, vr_uvh_client_t *vru_cl)
     switch(msg->request) {
         case VHOST_USER_GET_FEATURES:
         case VHOST_USER_GET_VRING_BASE:
+        case VHOST_USER_GET_PROTOCOL_FEATURES:
+        case VHOST_USER_GET_QUEUE_NUM:
             /*
              * Send reply for these messages only.
              */
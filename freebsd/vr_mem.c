@@ -56,11 +56,16 @@ int flowmmap(struct cdev *kdev, vm_ooffset_t offset, vm_paddr_t *paddr,
     int prot, vm_memattr_t *memattr)
 {
 	struct vrouter *router;
+	void *va;
 
 	/* Support only for one vrouter */
 	router = (struct vrouter *)vrouter_get(0);
 
-	*paddr = vtophys(vr_flow_get_va(router, offset));
+	va = vr_flow_get_va(router, offset);
+	if (va == NULL)
+		return (EINVAL);
+
+	*paddr = vtophys(va);
 	return (0);
 }
 
@@ -13,6 +13,8 @@
 #include "host/vr_host_packet.h"
 #include "host/vr_host_interface.h"
 
+struct vr_hinterface *hif_table[HIF_MAX_INTERFACES];
+
 struct hif_interface_md {
     unsigned short hif_udp_port;
     unsigned short hif_max_ports;
@@ -338,6 +340,25 @@ vr_lib_interface_add(struct vr_interface *vif)
     return 0;
 }
 
+static int
+vr_lib_interface_get_settings(struct vr_interface *vif,
+        struct vr_interface_settings *settings)
+{
+    return -EINVAL;
+}
+
+static unsigned int
+vr_lib_interface_get_mtu(struct vr_interface *vif)
+{
+    return vif->vif_mtu;
+}
+
+static unsigned short
+vr_lib_interface_get_encap(struct vr_interface *vif)
+{
+    return VIF_ENCAP_TYPE_ETHER;
+}
+
 struct vr_host_interface_ops vr_lib_interface_ops = {
     .hif_add            =   vr_lib_interface_add,
     .hif_del            =   vr_lib_interface_del,
@@ -345,6 +366,9 @@ struct vr_host_interface_ops vr_lib_interface_ops = {
     .hif_del_tap        =   vr_lib_interface_del_tap,
     .hif_tx             =   vr_lib_interface_tx,
     .hif_rx             =   vr_lib_interface_rx,
+    .hif_get_settings   =   vr_lib_interface_get_settings,
+    .hif_get_mtu        =   vr_lib_interface_get_mtu,
+    .hif_get_encap      =   vr_lib_interface_get_encap,
 };
 
 void
@@ -62,12 +62,15 @@ vr_hpacket_free(struct vr_hpacket *hpkt)
         }
 
         if (hpkt->hp_pool) {
-            if (hpkt_tail->hp_users) {
+            /*
+             * the buffer goes back to the pool with the packet, unless a
+             * clone still holds it, in which case the pool gets a new one
+             */
+            if (hpkt_tail->hp_users)
                 hpkt->hp_head = malloc(hpkt->hp_end +
                         sizeof(struct vr_hpacket_tail));
-                hpkt_tail = (struct vr_hpacket_tail *)hpkt_end(hpkt);
-                hpkt_tail->hp_users = 1;
-            }
+            hpkt_tail = (struct vr_hpacket_tail *)hpkt_end(hpkt);
+            hpkt_tail->hp_users = 1;
             vr_hpacket_pool_free(hpkt);
         } else {
             free(hpkt->hp_head);
@@ -87,7 +90,7 @@ vr_hpacket_alloc(unsigned int size)
     struct vr_hpacket_tail *hpkt_tail;
     struct vr_packet *pkt;
 
-    hpkt = (struct vr_hpacket *)malloc(sizeof(*hpkt));
+    hpkt = (struct vr_hpacket *)calloc(1, sizeof(*hpkt));
     if (!hpkt)
         return NULL;
 
@@ -105,6 +108,7 @@ vr_hpacket_alloc(unsigned int size)
     pkt = &hpkt->hp_packet;
     pkt->vp_head = hpkt->hp_head;
     pkt->vp_data = hpkt->hp_data;
+    pkt->vp_tail = hpkt->hp_tail;
     pkt->vp_end = hpkt->hp_end;
     pkt->vp_len = 0;
     pkt->vp_if = NULL;
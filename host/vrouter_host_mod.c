@@ -10,6 +10,7 @@
 #include "vr_proto.h"
 #include "vrouter.h"
 #include <sys/time.h>
+#include <time.h>
 #include "vr_message.h"
 #include "vr_sandesh.h"
 #include "host/vr_host_packet.h"
@@ -52,7 +53,7 @@ vr_lib_delete_timer(struct vr_timer *vtimer)
 static void *
 vr_lib_page_alloc(unsigned int size)
 {
-	return malloc(PAGE_SIZE);
+	return calloc(size, 1);
 }
 
 static void
@@ -161,11 +162,135 @@ vr_lib_preset(struct vr_packet *pkt)
 
     pkt->vp_data = hpkt->hp_data;
     pkt->vp_tail = hpkt->hp_tail;
-    pkt->vp_len = pkt->vp_tail - pkt->vp_data + 1;
+    pkt->vp_len = pkt->vp_tail - pkt->vp_data;
 
     return;
 }
 
+/*
+ * move the packet to a private buffer with hspace more bytes of head room.
+ * the old buffer goes away with its last user
+ */
+static struct vr_packet *
+vr_lib_pexpand_head(struct vr_packet *pkt, unsigned int hspace)
+{
+    unsigned char *head;
+    struct vr_hpacket *hpkt;
+    struct vr_hpacket_tail *hpkt_tail;
+
+    hpkt = VR_PACKET_TO_HPACKET(pkt);
+    head = malloc(hspace + hpkt->hp_end + sizeof(struct vr_hpacket_tail));
+    if (!head)
+        return NULL;
+
+    memcpy(head + hspace, hpkt->hp_head, hpkt->hp_end);
+    hpkt_tail = (struct vr_hpacket_tail *)hpkt_end(hpkt);
+    if (!--hpkt_tail->hp_users)
+        free(hpkt->hp_head);
+
+    hpkt->hp_head = head;
+    hpkt->hp_data += hspace;
+    hpkt->hp_tail += hspace;
+    hpkt->hp_end += hspace;
+    hpkt_tail = (struct vr_hpacket_tail *)hpkt_end(hpkt);
+    hpkt_tail->hp_users = 1;
+
+    pkt->vp_head = head;
+    pkt->vp_data += hspace;
+    pkt->vp_tail += hspace;
+    pkt->vp_end = hpkt->hp_end;
+    pkt->vp_network_h += hspace;
+    pkt->vp_inner_network_h += hspace;
+
+    return pkt;
+}
+
+static int
+vr_lib_pcow(struct vr_packet *pkt, unsigned short head_room)
+{
+    unsigned int hspace = 0;
+    struct vr_hpacket *hpkt;
+    struct vr_hpacket_tail *hpkt_tail;
+
+    hpkt = VR_PACKET_TO_HPACKET(pkt);
+    hpkt_tail = (struct vr_hpacket_tail *)hpkt_end(hpkt);
+
+    if (head_room > pkt_head_space(pkt))
+        hspace = head_room - pkt_head_space(pkt);
+
+    if (!hspace && (hpkt_tail->hp_users == 1))
+        return 0;
+
+    if (!vr_lib_pexpand_head(pkt, hspace))
+        return -ENOMEM;
+
+    return 0;
+}
+
+static unsigned short
+vr_lib_phead_len(struct vr_packet *pkt)
+{
+    return hpkt_head_len(VR_PACKET_TO_HPACKET(pkt));
+}
+
+static void
+vr_lib_pset_data(struct vr_packet *pkt, unsigned short offset)
+{
+    struct vr_hpacket *hpkt;
+
+    hpkt = VR_PACKET_TO_HPACKET(pkt);
+    hpkt->hp_data = offset;
+
+    return;
+}
+
+static unsigned int
+vr_lib_pgso_size(struct vr_packet *pkt)
+{
+    return 0;
+}
+
+/* library packets are linear, barring the ones built by palloc_head */
+static void *
+vr_lib_network_header(struct vr_packet *pkt)
+{
+    return pkt->vp_head + pkt->vp_network_h;
+}
+
+static void *
+vr_lib_inner_network_header(struct vr_packet *pkt)
+{
+    return pkt->vp_head + pkt->vp_inner_network_h;
+}
+
+static void *
+vr_lib_data_at_offset(struct vr_packet *pkt, unsigned short off)
+{
+    if (off < pkt->vp_end)
+        return pkt->vp_head + off;
+
+    return NULL;
+}
+
+static void *
+vr_lib_pheader_pointer(struct vr_packet *pkt, unsigned short hdr_len,
+        void *buf)
+{
+    if (hdr_len <= pkt_head_len(pkt))
+        return pkt_data(pkt);
+
+    return NULL;
+}
+
+static int
+vr_lib_pkt_may_pull(struct vr_packet *pkt, unsigned int len)
+{
+    if (len > pkt_head_len(pkt))
+        return -1;
+
+    return 0;
+}
+
 static void
 vr_lib_pfree(struct vr_packet *pkt, unsigned short reason)
 {
@@ -213,6 +338,21 @@ vr_lib_get_time(unsigned int *sec, unsigned int *nsec)
     return;
 }
 
+static void
+vr_lib_get_mono_time(unsigned int *sec, unsigned int *nsec)
+{
+    struct timespec ts;
+
+    *sec = *nsec = 0;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return;
+
+    *sec = ts.tv_sec;
+    *nsec = ts.tv_nsec;
+
+    return;
+}
+
 static unsigned int
 vr_lib_get_cpu(void)
 {
@@ -222,6 +362,8 @@ vr_lib_get_cpu(void)
 static void
 vr_lib_schedule_work(unsigned int cpu, void (*fn)(void *), void *arg)
 {
+    /* there are no other contexts in the library. run it right away */
+    fn(arg);
     return;
 }
 
@@ -231,6 +373,29 @@ vr_lib_delay_op(void)
     return;
 }
 
+static void *
+vr_lib_get_defer_data(unsigned int len)
+{
+    return malloc(len);
+}
+
+static void
+vr_lib_put_defer_data(void *data)
+{
+    free(data);
+    return;
+}
+
+static void
+vr_lib_defer(struct vrouter *router, vr_defer_cb user_cb, void *data)
+{
+    /* no concurrent readers in the library. nothing to wait for */
+    user_cb(router, data);
+    vr_lib_put_defer_data(data);
+
+    return;
+}
+
 struct host_os vr_lib_host = {
     .hos_printf             =       vr_lib_printf,
     .hos_malloc             =       vr_lib_malloc,
@@ -244,15 +409,30 @@ struct host_os vr_lib_host = {
     .hos_pclone             =       vr_lib_pclone,
     .hos_pcopy              =       vr_lib_pcopy,
     .hos_pfrag_len          =       vr_lib_pfrag_len,
+    .hos_phead_len          =       vr_lib_phead_len,
+    .hos_pset_data          =       vr_lib_pset_data,
+    .hos_pgso_size          =       vr_lib_pgso_size,
+    .hos_pexpand_head       =       vr_lib_pexpand_head,
+    .hos_pcow               =       vr_lib_pcow,
 
     .hos_get_cpu            =       vr_lib_get_cpu,
     .hos_schedule_work      =       vr_lib_schedule_work,
     .hos_delay_op           =       vr_lib_delay_op,
+    .hos_defer              =       vr_lib_defer,
+    .hos_get_defer_data     =       vr_lib_get_defer_data,
+    .hos_put_defer_data     =       vr_lib_put_defer_data,
     .hos_get_time           =       vr_lib_get_time,
+    .hos_get_mono_time      =       vr_lib_get_mono_time,
 	.hos_page_alloc			=		vr_lib_page_alloc,
 	.hos_page_free			=		vr_lib_page_free,
 	.hos_create_timer		=		vr_lib_create_timer,
 	.hos_delete_timer		=		vr_lib_delete_timer,
+
+    .hos_network_header     =       vr_lib_network_header,
+    .hos_inner_network_header =     vr_lib_inner_network_header,
+    .hos_data_at_offset     =       vr_lib_data_at_offset,
+    .hos_pheader_pointer    =       vr_lib_pheader_pointer,
+    .hos_pkt_may_pull       =       vr_lib_pkt_may_pull,
 };
 
 struct host_os *
@@ -50,7 +50,7 @@ struct vr_hinterface {
     int (*hif_rx)(void *);
 };
 
-struct vr_hinterface *hif_table[HIF_MAX_INTERFACES];
+extern struct vr_hinterface *hif_table[HIF_MAX_INTERFACES];
 
 struct vr_hinterface *vr_hinterface_create(unsigned int, unsigned int,
                 unsigned int);
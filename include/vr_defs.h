@@ -34,7 +34,8 @@
 #define AGENT_TRAP_ZERO_TTL         12
 #define AGENT_TRAP_ICMP_ERROR       13
 #define AGENT_TRAP_TOR_CONTROL_PKT  14
-#define MAX_AGENT_HDR_COMMANDS      15
+#define AGENT_TRAP_FLOW_MISS_BULK   15
+#define MAX_AGENT_HDR_COMMANDS      16
 
 enum rt_type{
     RT_UCAST = 0,
@@ -61,6 +62,17 @@ struct agent_hdr {
     unsigned int hdr_cmd_param_1;
 } __attribute__((packed));
 
+/*
+ * AGENT_TRAP_FLOW_MISS_BULK carries hdr_cmd_param number of these records
+ * after the agent header, all in network byte order
+ */
+struct agent_flow_miss {
+    unsigned int afm_index;
+    unsigned int afm_nh_index;
+    unsigned short afm_ifindex;
+    unsigned short afm_vrf;
+} __attribute__((packed));
+
 #define CMD_PARAM_PACKET_CTRL       0x1
 #define CMD_PARAM_1_DIAG            0x1
 #define MAX_CMD_PARAMS                3
@@ -18,6 +18,7 @@
 #define _VR_DPDK_H_
 
 #include <net/if.h>
+#include <unistd.h>
 #include <sys/queue.h>
 
 #include "vr_os.h"
@@ -90,15 +91,25 @@
 #define VR_DPDK_MBUF_SZ             (VR_DPDK_MAX_PACKET_SZ      \
                                     + sizeof(struct rte_mbuf)   \
                                     + RTE_PKTMBUF_HEADROOM      \
-                                    + sizeof(struct vr_packet))
+                                    + sizeof(struct vr_packet)  \
+                                    + sizeof(struct vr_dpdk_pkt_md))
 /* How many packets to read/write from/to queue in one go */
 #define VR_DPDK_MAX_BURST_SZ        RTE_PORT_IN_BURST_SIZE_MAX
+/* How many TX queues a forwarding lcore buffers bursts for between flushes */
+#define VR_DPDK_MAX_TX_BURSTS       32
 #define VR_DPDK_ETH_RX_BURST_SZ     32
 #define VR_DPDK_ETH_TX_BURST_SZ     32
 #define VR_DPDK_KNI_RX_BURST_SZ     32
 #define VR_DPDK_KNI_TX_BURST_SZ     32
 #define VR_DPDK_RING_RX_BURST_SZ    32
 #define VR_DPDK_RING_TX_BURST_SZ    32
+/* Number of empty polls in a row before an RX queue is polled less often */
+#define VR_DPDK_RX_SKIP_EMPTY_POLLS 8
+/* Max number of lcore loops to skip polling an idle RX queue for */
+#define VR_DPDK_KNI_RX_MAX_SKIP     64
+#define VR_DPDK_VIRTIO_RX_MAX_SKIP  16
+/* Mask of the first n packets of a burst for the f_tx_bulk() operation */
+#define VR_DPDK_PKTS_MASK(n)        (((n) >= 64) ? ~0ULL : ((1ULL << (n)) - 1))
 /* Number of mbufs in TX ring */
 #define VR_DPDK_TX_RING_SZ          (VR_DPDK_MAX_BURST_SZ*2)
 /* Number of mbufs in virtio mempool */
@@ -125,10 +136,28 @@
 /* Sleep (in US) or yield if no packets received (use 0 to disable) */
 #define VR_DPDK_SLEEP_NO_PACKETS_US 0
 #define VR_DPDK_YIELD_NO_PACKETS    1
+/* Adaptive idle (--adaptive-idle): number of empty loops to spin */
+#define VR_DPDK_IDLE_SPIN_LOOPS     256
+/* Then back off with up to the number of rte_pause() per empty loop */
+#define VR_DPDK_IDLE_MAX_PAUSES     1024
+/* Then sleep after being idle for the time in US... */
+#define VR_DPDK_IDLE_SLEEP_AFTER_US 10000
+/* ...till woken up or for at most the time in US */
+#define VR_DPDK_IDLE_SLEEP_US       100
 /* Timers handling periodicity in US */
 #define VR_DPDK_SLEEP_TIMER_US      100
 /* KNI handling periodicity in US */
 #define VR_DPDK_SLEEP_KNI_US        500
+/* RX queues rebalancing periodicity in US (use 0 to disable) */
+#define VR_DPDK_REBALANCE_US        1000000
+/* Rebalance if the busiest lcore is loaded above the percentage... */
+#define VR_DPDK_REBALANCE_HIGH_LOAD 80
+/* ...more than the idlest lcore by the percentage... */
+#define VR_DPDK_REBALANCE_LOAD_DIFF 30
+/* ...for the number of periods in a row */
+#define VR_DPDK_REBALANCE_PERIODS   3
+/* Minimum load percentage a queue move has to shift */
+#define VR_DPDK_REBALANCE_MIN_SHIFT 5
 /* Sleep time in US for service lcore */
 #define VR_DPDK_SLEEP_SERVICE_US    100
 /* Invalid port ID */
@@ -171,6 +200,16 @@ struct vr_dpdk_queue {
     struct vr_interface *q_vif;
     /* RX burst size */
     uint16_t rxq_burst_size;
+    /* Max number of loops to skip the idle queue for (0 to always poll) */
+    uint16_t rxq_max_skip;
+    /* Number of loops left to skip the queue for */
+    uint16_t rxq_nb_skip;
+    /* Number of empty polls in a row */
+    uint16_t rxq_nb_empty;
+    /* Cycles spent on non-empty RX bursts (for the rebalancer) */
+    uint64_t rxq_busy_cycles;
+    /* Busy cycles at the previous rebalancing */
+    uint64_t rxq_busy_cycles_last;
 };
 
 /* We store the queue params in the separate structure to increase CPU
@@ -195,6 +234,16 @@ struct vr_dpdk_ring_to_push {
     struct vr_dpdk_queue *rtp_tx_queue;
 };
 
+/* Packets sent by vif_tx() to a TX queue, sent to the queue in bulk */
+struct vr_dpdk_tx_burst {
+    /* Interface index of the TX queue */
+    uint16_t txb_vif_idx;
+    /* Number of packets in the burst */
+    uint16_t txb_nb_pkts;
+    /* Packets to send */
+    struct rte_mbuf *txb_pkts[VR_DPDK_MAX_BURST_SZ];
+};
+
 SLIST_HEAD(vr_dpdk_q_slist, vr_dpdk_queue);
 
 /* Lcore commands */
@@ -234,6 +283,38 @@ struct vr_dpdk_lcore {
     rte_atomic16_t lcore_cmd;
     /* Number of RX queues assigned to the lcore (for the scheduler) */
     uint16_t lcore_nb_rx_queues;
+    /* Load percentage over the previous rebalancing period */
+    uint16_t lcore_load;
+    /* Cycles spent on non-empty bursts (for the rebalancer) */
+    uint64_t lcore_busy_cycles;
+    /* Busy cycles at the previous rebalancing */
+    uint64_t lcore_busy_cycles_last;
+    /* Number of RX queues the rebalancer moved to the lcore */
+    uint32_t lcore_nb_rx_queues_in;
+    /* Number of RX queues the rebalancer moved from the lcore */
+    uint32_t lcore_nb_rx_queues_out;
+    /* Cycles spent backing off and sleeping idle (--adaptive-idle) */
+    uint64_t lcore_idle_cycles;
+    /* Number of times the lcore went to sleep */
+    uint64_t lcore_nb_sleeps;
+    /* Cycle counter at the first of the empty loops in a row */
+    uint64_t lcore_idle_since;
+    /* Number of empty loops in a row */
+    uint32_t lcore_idle_loops;
+    /* Number of rte_pause() per empty loop */
+    uint32_t lcore_idle_pauses;
+    /* Eventfd to wake the lcore up from sleep */
+    int lcore_wakeup_fd;
+    /* The lcore sleeps on the eventfd */
+    volatile bool lcore_sleeping;
+    /* Buffer the packets of vif_tx() in bursts (forwarding lcores only) */
+    bool lcore_tx_burst;
+    /* Number of TX bursts in use */
+    uint16_t lcore_nb_tx_bursts;
+    /* Index + 1 of the TX burst of each interface, 0 if none in use */
+    uint8_t lcore_tx_burst_idx[VR_MAX_INTERFACES];
+    /* TX bursts, taken by the first TX queues used between flushes */
+    struct vr_dpdk_tx_burst lcore_tx_bursts[VR_DPDK_MAX_TX_BURSTS];
 };
 
 /* Hardware RX queue state */
@@ -276,6 +357,8 @@ struct vr_dpdk_global {
     struct rte_mempool *free_mempools[VR_DPDK_MAX_VM_MEMPOOLS];
     /* Number of forwarding lcores */
     unsigned nb_fwd_lcores;
+    /* Back off and sleep on forwarding lcores with no packets (--adaptive-idle) */
+    bool adaptive_idle;
     /* Table of pointers to forwarding lcore */
     struct vr_dpdk_lcore *lcores[RTE_MAX_LCORE];
     /* Global stop flag */
@@ -291,6 +374,8 @@ struct vr_dpdk_global {
     pthread_t kni_thread;
     /* Timer thread ID */
     pthread_t timer_thread;
+    /* RX queues rebalancing thread ID */
+    pthread_t rebalance_thread;
     /* User space vhost thread */
     pthread_t uvh_thread;
     /* Table of KNIs */
@@ -312,13 +397,16 @@ extern struct vr_dpdk_global vr_dpdk;
 /*
  * rte_mbuf <=> vr_packet conversion
  *
- * We use the tailroom to store vr_packet structure:
+ * We use the tailroom to store vr_packet structure, followed by the DPDK
+ * specific packet metadata:
  *     struct rte_mbuf + headroom + data + tailroom + struct vr_packet
+ *         + struct vr_dpdk_pkt_md
  *
  * rte_mbuf: *buf_addr(buf_len) + headroom + *pkt.data(data_len) + tailroom
  *
  * rte_mbuf->buf_addr = rte_mbuf + sizeof(rte_mbuf)
  * rte_mbuf->buf_len = elt_size - sizeof(rte_mbuf) - sizeof(vr_packet)
+ *                         - sizeof(vr_dpdk_pkt_md)
  * rte_mbuf->pkt.data = rte_mbuf->buf_addr + RTE_PKTMBUF_HEADROOM
  *
  *
@@ -342,6 +430,22 @@ vr_dpdk_mbuf_to_pkt(struct rte_mbuf *mbuf)
     return (struct vr_packet *)((uintptr_t)mbuf->buf_addr + mbuf->buf_len);
 }
 
+/*
+ * Packet metadata with no place in either rte_mbuf or vr_packet. It is
+ * valid for mbufs of the virtio mempool, which are filled from the virtio
+ * header of the VM, and reset for all the other mbufs on RX.
+ */
+struct vr_dpdk_pkt_md {
+    /* TCP segment size if the packet is to be segmented, 0 otherwise */
+    uint16_t md_gso_size;
+};
+
+static inline struct vr_dpdk_pkt_md *
+vr_dpdk_pkt_to_md(struct vr_packet *pkt)
+{
+    return (struct vr_dpdk_pkt_md *)(pkt + 1);
+}
+
 /*
  * vr_dpdk_mbuf_reset - if the mbuf changes, possibley due to
  * pskb_may_pull, reset fields of the pkt structure that point at
@@ -486,11 +590,63 @@ int vr_dpdk_lcore_mpls_schedule(struct vr_interface *vif, unsigned dst_ip,
 unsigned vr_dpdk_lcore_least_used_get(void);
 /* Returns the least used lcore among the ones that handle physical intf TX */
 unsigned int vr_dpdk_phys_lcore_least_used_get(void);
+/* Move an RX queue from the busiest forwarding lcore to the idlest one */
+void vr_dpdk_lcore_rebalance(void);
+/* Fill in the stats of the first lcore at or after lcore_id */
+int vr_dpdk_lcore_stats_get(unsigned lcore_id, vr_lcore_stats_req *resp);
+/* Wake up a forwarding lcore sleeping idle */
+static inline void
+vr_dpdk_lcore_wakeup(struct vr_dpdk_lcore *lcore)
+{
+    uint64_t event = 1;
+
+    if (unlikely(lcore->lcore_sleeping)) {
+        if (write(lcore->lcore_wakeup_fd, &event, sizeof(event)) < 0) {
+            /* the lcore wakes up on its sleep timeout anyway */
+        }
+    }
+}
+/* Send a burst of packets to a TX queue */
+static inline void
+vr_dpdk_tx_queue_bulk(struct vr_dpdk_queue *tx_queue, struct rte_mbuf **pkts,
+    uint32_t nb_pkts)
+{
+    uint32_t i;
+
+    if (likely(tx_queue->txq_ops.f_tx_bulk != NULL)) {
+        tx_queue->txq_ops.f_tx_bulk(tx_queue->q_queue_h, pkts,
+            VR_DPDK_PKTS_MASK(nb_pkts));
+    } else {
+        for (i = 0; i < nb_pkts; i++)
+            tx_queue->txq_ops.f_tx(tx_queue->q_queue_h, pkts[i]);
+    }
+}
+/* Send the bursts buffered by vif_tx() to the TX queues */
+static inline void
+vr_dpdk_lcore_tx_bursts_flush(struct vr_dpdk_lcore *lcore)
+{
+    unsigned i;
+    struct vr_dpdk_tx_burst *burst;
+    struct vr_dpdk_queue *tx_queue;
+
+    for (i = 0; i < lcore->lcore_nb_tx_bursts; i++) {
+        burst = &lcore->lcore_tx_bursts[i];
+        tx_queue = &lcore->lcore_tx_queues[burst->txb_vif_idx];
+        if (likely(burst->txb_nb_pkts != 0))
+            vr_dpdk_tx_queue_bulk(tx_queue, burst->txb_pkts,
+                burst->txb_nb_pkts);
+        burst->txb_nb_pkts = 0;
+        lcore->lcore_tx_burst_idx[burst->txb_vif_idx] = 0;
+    }
+    lcore->lcore_nb_tx_bursts = 0;
+}
 /* Flush TX queues */
 static inline void
 vr_dpdk_lcore_flush(struct vr_dpdk_lcore *lcore)
 {
     struct vr_dpdk_queue *tx_queue;
+
+    vr_dpdk_lcore_tx_bursts_flush(lcore);
     SLIST_FOREACH(tx_queue, &lcore->lcore_tx_head, q_next) {
         tx_queue->txq_ops.f_flush(tx_queue->q_queue_h);
     }
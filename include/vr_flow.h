@@ -139,7 +139,12 @@ struct vr_flow_stats {
     uint8_t  flow_packets_oflow;
 } __attribute__((packed));
 
-#define VR_MAX_FLOW_QUEUE_ENTRIES   3U
+/*
+ * packets held per flow till agent decides on the flow. the number is
+ * set by vr_flow_queue_limit, and is VR_DEF_FLOW_QUEUE_ENTRIES by default
+ */
+#define VR_DEF_FLOW_QUEUE_ENTRIES   3U
+#define VR_MAX_FLOW_QUEUE_ENTRIES   32U
 
 #define PN_FLAG_LABEL_IS_VNID       0x1
 #define PN_FLAG_TO_ME               0x2
@@ -152,10 +157,50 @@ struct vr_packet_node {
     uint32_t pl_flags;
 };
 
+#define VR_FLOW_QUEUE_FLAG_POOL     0x1
+
 struct vr_flow_queue {
     unsigned int vfq_index;
     unsigned int vfq_entries;
-    struct vr_packet_node vfq_pnodes[VR_MAX_FLOW_QUEUE_ENTRIES];
+    unsigned short vfq_flags;
+    unsigned short vfq_busy;
+    struct vr_packet_node vfq_pnodes[0];
+};
+
+/*
+ * hold queues are preallocated, so that a storm of new flows does not turn
+ * into a storm of allocations. a queue is claimed by a compare and swap
+ * of vfq_busy, starting from where the last claim succeeded. if no queue
+ * is found in VR_FLOW_QUEUE_POOL_PROBES attempts, we go to the heap
+ */
+#define VR_DEF_FLOW_HOLD_QUEUES     8192
+#define VR_FLOW_QUEUE_POOL_PROBES   16
+
+struct vr_flow_queue_pool {
+    struct vr_btable *vfqp_queues;
+    unsigned int vfqp_entries;
+    unsigned int vfqp_hint;
+};
+
+/*
+ * with vr_flow_trap_batch > 1, flow misses are not trapped to agent with a
+ * clone of the packet each, but as records of AGENT_TRAP_FLOW_MISS_BULK
+ * messages. each cpu fills its own message, which is sent when full or by
+ * a timer every VR_FLOW_TRAP_BATCH_MSECS. the held packet still waits in
+ * the hold queue of the flow, and agent finds the key in the flow table
+ */
+#define VR_FLOW_TRAP_BATCH_MAX      64
+#define VR_FLOW_TRAP_BATCH_MSECS    2
+
+struct vr_flow_trap_slot {
+    struct vr_packet *fts_pkt;
+    unsigned char fts_pad[64 - sizeof(struct vr_packet *)];
+};
+
+struct vr_flow_trap_batch {
+    struct vrouter *ftb_router;
+    struct vr_timer *ftb_timer;
+    struct vr_flow_trap_slot ftb_slots[0];
 };
 
 struct vr_dummy_flow_entry {
@@ -174,6 +219,7 @@ struct vr_dummy_flow_entry {
     uint8_t fe_drop_reason;
     unsigned short fe_udp_src_port;
     uint8_t fe_type;
+    uint8_t fe_gen;
 } __attribute__((packed));
 
 #define VR_FLOW_ENTRY_PACK (64 - sizeof(struct vr_dummy_flow_entry))
@@ -195,11 +241,137 @@ struct vr_flow_entry {
     uint8_t fe_drop_reason;
     unsigned short fe_udp_src_port;
     uint8_t fe_type;
+    /* bumped every time the entry is reset, to tell reuses of the index */
+    uint8_t fe_gen;
     unsigned char fe_pack[VR_FLOW_ENTRY_PACK];
 } __attribute__((packed));
 
 #define VR_FLOW_PROTO_SHIFT             16
 
+/*
+ * every cpu caches the indices of the flows it recently looked up, by the
+ * hash of the flow key. a hit is still validated against the key, but
+ * saves the walk of the bucket (a cache line per entry) and of the
+ * overflow buckets, lines that the other cpus keep writing to
+ */
+#define VR_FLOW_CACHE_ENTRIES           256
+
+struct vr_flow_cache_entry {
+    uint32_t fce_hash;
+    uint32_t fce_index;
+};
+
+/*
+ * the key and hash of a received packet, formed when its burst was
+ * prefetched. the flow lookup of the packet reuses the hash if it forms
+ * the same key
+ */
+struct vr_flow_hint {
+    struct vr_packet *fh_pkt;
+    unsigned int fh_hash;
+    struct vr_flow fh_key;
+};
+
+struct vr_flow_cache {
+    struct vr_flow_cache_entry fc_entries[VR_FLOW_CACHE_ENTRIES];
+    struct vr_flow_hint *fc_hint;
+};
+
+/*
+ * per cpu flow stats deltas. the packet path accumulates bytes and packets
+ * of a flow in the active shard of the cpu without atomics, and a timer
+ * swaps the shards every VR_FLOW_STATS_FOLD_MSECS and folds the retired
+ * one into the flow entry (which the agent reads) after a grace period.
+ * flows that collide in a shard fall back to atomic updates of the entry.
+ * a slot is tagged with the generation of the entry, so that the deltas of
+ * a deleted flow are discarded instead of being folded into the next flow
+ * that reuses the index. a delete folds the slots of the flow into the
+ * entry first, and whoever folds a slot claims it by swapping its
+ * generation for VR_FLOW_STATS_GEN_CLAIMED, which no entry has, and then
+ * swaps the deltas out of it.
+ *
+ * the stats in the entry, which agent and the flow utility export, thus
+ * lag the packets by up to VR_FLOW_STATS_FOLD_MSECS plus a grace period.
+ */
+#define VR_FLOW_STATS_SLOTS             512
+#define VR_FLOW_STATS_FOLD_MSECS        1000
+#define VR_FLOW_STATS_GEN_CLAIMED       0x100
+
+#define VR_FLOW_STATS_FOLD_PENDING      0x1
+#define VR_FLOW_STATS_DEAD              0x2
+
+struct vr_flow_stats_slot {
+    /* flow index + 1, 0 for a free slot */
+    uint32_t fss_index;
+    uint32_t fss_gen;
+    uint32_t fss_packets;
+    uint64_t fss_bytes;
+};
+
+struct vr_flow_stats_shard {
+    struct vr_flow_stats_slot fsh_slots[VR_FLOW_STATS_SLOTS];
+};
+
+struct vr_flow_stats_cpu {
+    struct vr_flow_stats_shard *fsc_active;
+    struct vr_flow_stats_shard *fsc_spare;
+};
+
+struct vr_flow_stats_delta {
+    struct vrouter *fsd_router;
+    struct vr_timer *fsd_timer;
+    unsigned int fsd_state;
+    struct vr_flow_stats_cpu fsd_cpu[0];
+};
+
+/*
+ * flow journal. every cpu logs the indices of the flows it changed, and
+ * the event, in its own ring. the rings are mapped by the flow device
+ * right after the flow tables, so that agent and the flow utility read
+ * the changes since their last visit instead of sweeping the tables.
+ *
+ * a writer claims a position by incrementing fjr_head, fills the entry
+ * and stamps it with position + 1 last. a reader that finds a stamp other
+ * than the position it expects has either caught up with a writer or was
+ * lapped by the ring, and in the latter case has to sweep the tables once.
+ * a reset of the flow table bumps fjr_gen before and after it clears the
+ * ring, so a reader that finds the generation odd or changed sweeps too
+ */
+#define VR_FLOW_JOURNAL_CREATE          1
+#define VR_FLOW_JOURNAL_HOLD            2
+/* agent set an action (forward, drop, nat) on the flow */
+#define VR_FLOW_JOURNAL_ACTION          3
+#define VR_FLOW_JOURNAL_DELETE          4
+#define VR_FLOW_JOURNAL_STATS           5
+
+/* packet count of a flow crossed a multiple of 1 << this */
+#define VR_FLOW_JOURNAL_STATS_SHIFT     12
+
+/* a ring is 32K, a factor of VR_SINGLE_ALLOC_LIMIT */
+#define VR_FLOW_JOURNAL_ENTRIES         2044
+#define VR_FLOW_JOURNAL_ALIGN           (32 * 1024)
+
+struct vr_flow_journal_entry {
+    uint64_t fje_seq;
+    uint32_t fje_index;
+    uint16_t fje_event;
+    uint16_t fje_pad;
+};
+
+struct vr_flow_journal_ring {
+    uint64_t fjr_head;
+    uint64_t fjr_gen;
+    unsigned char fjr_pad[48];
+    struct vr_flow_journal_entry fjr_entries[VR_FLOW_JOURNAL_ENTRIES];
+};
+
+#define VR_FLOW_JOURNAL_SIZE        (vr_num_cpus * \
+                sizeof(struct vr_flow_journal_ring))
+
+/* where the journal starts in the mapping, given the size of the tables */
+#define VR_FLOW_JOURNAL_OFFSET(table_size)  \
+    (((table_size) + VR_FLOW_JOURNAL_ALIGN - 1) & ~(VR_FLOW_JOURNAL_ALIGN - 1))
+
 #define VR_UDP_DHCP_SPORT   (17 << 16 | htons(67))
 #define VR_UDP_DHCP_CPORT   (17 << 16 | htons(68))
 #define VR_UDP_DNS_SPORT    (17 << 16 | htons(53))
@@ -211,6 +383,8 @@ struct vr_flow_entry {
 #define VR_DNS_SERVER_PORT  htons(53)
 
 extern unsigned int vr_flow_entries, vr_oflow_entries;
+extern unsigned int vr_flow_hold_queues, vr_flow_queue_limit;
+extern unsigned int vr_flow_trap_batch;
 
 #define VR_FLOW_TABLE_SIZE          (vr_flow_entries * \
                 sizeof(struct vr_flow_entry))
@@ -231,6 +405,7 @@ struct vr_flow_trap_arg {
 };
 
 struct vr_packet;
+struct vr_interface;
 struct vrouter;
 
 extern int vr_flow_init(struct vrouter *);
@@ -242,8 +417,14 @@ extern bool vr_flow_forward(struct vrouter *,
 void *vr_flow_get_va(struct vrouter *, uint64_t);
 unsigned int vr_flow_table_size(struct vrouter *);
 unsigned int vr_oflow_table_size(struct vrouter *);
+unsigned int vr_flow_journal_size(struct vrouter *);
 
 struct vr_flow_entry *vr_get_flow_entry(struct vrouter *, int);
+struct vr_flow_entry *vr_find_flow(struct vrouter *, struct vr_flow *,
+        uint8_t, unsigned int *);
+unsigned int vr_flow_prefetch_burst(struct vrouter *, struct vr_interface *,
+        struct vr_packet **, unsigned int, struct vr_flow_hint *);
+void vr_flow_hint(struct vrouter *, struct vr_flow_hint *);
 flow_result_t vr_flow_lookup(struct vrouter *, struct vr_flow *,
                              struct vr_packet *, struct vr_forwarding_md *);
 
@@ -253,6 +434,8 @@ extern flow_result_t vr_inet_flow_nat(struct vr_flow_entry *,
         struct vr_packet *, struct vr_forwarding_md *);
 extern void vr_inet_fill_flow(struct vr_flow *, unsigned short,
                 uint32_t, uint32_t, uint8_t, uint16_t, uint16_t);
+extern bool vr_inet_flow_rx_key(struct vr_interface *, struct vr_packet *,
+        struct vr_flow *);
 
 extern unsigned int vr_reinject_packet(struct vr_packet *,
         struct vr_forwarding_md *);
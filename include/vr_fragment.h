@@ -7,6 +7,8 @@
 #ifndef __VR_FRAGMENT_H__
 #define __VR_FRAGMENT_H__
 
+#include "vr_flow.h"
+
 struct vr_fragment_key {
     unsigned int fk_sip;
     unsigned int fk_dip;
@@ -14,11 +16,17 @@ struct vr_fragment_key {
     unsigned short fk_vrf;
 } __attribute__((packed));
 
+/*
+ * f_time is the time (in msecs) the entry was last used at. f_next and
+ * f_linked chain the entry into the timing wheel that reaps it
+ */
 struct vr_fragment {
     struct vr_fragment_key f_key;
     unsigned short f_sport;
     unsigned short f_dport;
     uint64_t f_time;
+    unsigned int f_next;
+    unsigned int f_linked;
 } __attribute__((packed));
 
 #define f_sip f_key.fk_sip
@@ -26,6 +34,54 @@ struct vr_fragment {
 #define f_id  f_key.fk_id
 #define f_vrf f_key.fk_vrf
 
+/*
+ * fragment entries are linked into a per-cpu timing wheel when they are
+ * added, in the slot of the tick in which they expire. the reaper hence
+ * looks only at the entries of the slots that have come due, instead of
+ * walking the tables. an entry that was used after it was linked is just
+ * linked again, for its new expiry
+ */
+#define VR_FRAG_TIMEOUT_MSECS           1000
+#define VR_FRAG_WHEEL_TICK_MSECS        100
+#define VR_FRAG_WHEEL_SLOTS             16
+#define VR_FRAG_INDEX_INVALID           ((unsigned int)-1)
+
+struct vr_fragment_wheel {
+    unsigned int fw_slots[VR_FRAG_WHEEL_SLOTS];
+};
+
+/*
+ * fragments that show up ahead of the head fragment can not be classified,
+ * since only the head carries the transport ports. rather than dropping
+ * them, they are parked in a small, preallocated per-cpu queue for up to
+ * VR_FRAG_QUEUE_TIMEOUT_MSECS and are pushed through the flow path when the
+ * head arrives. VR_FRAG_QUEUE_MAX_BYTES caps the total memory that a stream
+ * of orphan fragments can pin down across all cpus.
+ */
+#define VR_FRAG_QUEUE_ENTRIES           64
+#define VR_FRAG_QUEUE_MAX_BYTES         (1024 * 1024)
+#define VR_FRAG_QUEUE_TIMEOUT_MSECS     10
+#define VR_FRAG_QUEUE_SCAN_MSECS        5
+
+#define VR_FRAG_QUEUE_ELEMENT_FREE      0
+#define VR_FRAG_QUEUE_ELEMENT_BUSY      1
+#define VR_FRAG_QUEUE_ELEMENT_HELD      2
+
+struct vr_fragment_queue_element {
+    unsigned int fqe_state;
+    unsigned int fqe_len;
+    struct vr_fragment_key fqe_key;
+    unsigned short fqe_vlan;
+    uint64_t fqe_time;
+    struct vr_packet_node fqe_pnode;
+};
+
+struct vr_fragment_queue {
+    unsigned int vfq_held;
+    unsigned int vfq_hint;
+    struct vr_fragment_queue_element vfq_elements[VR_FRAG_QUEUE_ENTRIES];
+};
+
 int vr_fragment_table_init(struct vrouter *);
 void vr_fragment_table_exit(struct vrouter *);
 struct vr_fragment *vr_fragment_get(struct vrouter *, unsigned short,
@@ -33,5 +89,8 @@ struct vr_fragment *vr_fragment_get(struct vrouter *, unsigned short,
 int vr_fragment_add(struct vrouter *, unsigned short, struct vr_ip *,
                 unsigned short, unsigned short);
 void vr_fragment_del(struct vr_fragment *);
+int vr_fragment_enqueue(struct vrouter *, unsigned short, struct vr_packet *,
+        struct vr_forwarding_md *);
+void vr_fragment_queue_flush(struct vrouter *, unsigned short, struct vr_ip *);
 
 #endif /* __VR_FRAGMENT_H__ */
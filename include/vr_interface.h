@@ -90,6 +90,14 @@
 #define VIF_ENCAP_TYPE_ETHER        1
 #define VIF_ENCAP_TYPE_L3           2
 
+/*
+ * values of vifr_irq_coalesce_pkts and vifr_irq_coalesce_usecs other than
+ * a limit. if either is off, every interrupt the guest wants is raised
+ */
+#define VIF_IRQ_COALESCE_DEFAULT    0
+#define VIF_IRQ_COALESCE_OFF        -1
+#define VIF_IRQ_COALESCE_MAX        0xFFFF
+
 typedef enum {
     MR_DROP,
     MR_FLOOD,
@@ -161,6 +169,13 @@ struct vr_interface {
     unsigned short vif_nh_id;
     unsigned short vif_vrf_table_users;
     uint8_t vif_transport;
+    /*
+     * interrupts to the guest are raised once so many packets are waiting,
+     * or the oldest has waited so long. VIF_IRQ_COALESCE_DEFAULT means the
+     * platform default, VIF_IRQ_COALESCE_OFF no coalescing.
+     */
+    int vif_irq_coalesce_pkts;
+    int vif_irq_coalesce_usecs;
     /*
      * unsigned short does not cut it, because initial value for
      * each entry in the table is -1. negative value of table
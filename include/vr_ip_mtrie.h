@@ -13,14 +13,17 @@ struct ip_bucket;
 
 /*
  * Override the least significant bit of a pointer to indicate whether it
- * points to a bucket or nexthop.
+ * points to a bucket or nexthop. The next bit of a bucket pointer tells
+ * whether the bucket is compressed, so that lookups need not read the
+ * bucket header to find out.
  */
 #define ENTRY_IS_BUCKET(EPtr)        (((EPtr)->entry_long_i) & 0x1ul)
 #define ENTRY_IS_NEXTHOP(EPtr)       !ENTRY_IS_BUCKET(EPtr)
 
 #define PTR_IS_BUCKET(ptr)           ((ptr) & 0x1ul)
 #define PTR_IS_NEXTHOP(ptr)          !PTR_IS_BUCKET(ptr)
-#define PTR_TO_BUCKET(ptr)           ((struct ip_bucket *)((ptr) ^ 0x1ul))
+#define PTR_IS_COMPRESSED(ptr)       ((ptr) & 0x2ul)
+#define PTR_TO_BUCKET(ptr)           ((struct ip_bucket *)((ptr) & ~0x3ul))
 #define PTR_TO_NEXTHOP(ptr)          ((struct vr_nexthop *)(ptr))
 
 struct ip_bucket_entry {
@@ -40,16 +43,39 @@ struct ip_bucket_entry {
 #define entry_bkt_p     entry_data.bucket_p
 #define entry_long_i    entry_data.long_i
 
+/*
+ * a flat bucket holds one entry per index of its level. a bucket whose
+ * entries fall in a handful of runs of identical entries (typically a
+ * less specific route with a few more specifics punched in) is instead
+ * kept compressed: one entry per run, followed by the index at which each
+ * run starts
+ */
 struct ip_bucket {
+    /* number of entries in bkt_data */
+    unsigned int bkt_size;
+    /* number of runs if the bucket is compressed, 0 if it is flat */
+    unsigned short bkt_ranges;
+    unsigned short bkt_flags;
     struct ip_bucket_entry bkt_data[0];
 };
 
+#define IP_BUCKET_RANGE_STARTS(bkt)  \
+    ((unsigned int *)&(bkt)->bkt_data[(bkt)->bkt_size])
+
+/* buckets with more runs than this are kept flat */
+#define IP_BUCKET_MAX_RANGES         8
+
+/* allocated for a batch of updates that is not yet published */
+#define IP_BUCKET_FLAG_SHADOW        0x1
+
 /*
  * IpMtrie
  *
- * IpMtrie ensures that an IPv4 lookup can be performed in 3 data fetches. 
- * IPv6 lookup will require 15 data fetches.
- * 
+ * Every level of the mtrie resolves a configurable number of bits (the
+ * stride of the level) of the address. With the default 8 bit strides,
+ * an IPv4 lookup can be performed in 4 data fetches and an IPv6 lookup
+ * in 16, while 16-8-8 brings IPv4 down to 3 data fetches at the cost of
+ * a bigger root bucket.
  */
 struct ip_mtrie {
     struct ip_bucket_entry root;
@@ -62,16 +88,28 @@ struct ip_mtrie {
 #define IPBUCKET_LEVEL_PFX_LEN      IPBUCKET_LEVEL_BITS
 #define IPBUCKET_LEVEL_SIZE         (1 << IPBUCKET_LEVEL_BITS)
 #define IPBUCKET_LEVEL_MASK         (IPBUCKET_LEVEL_SIZE - 1)
+/* strides are whole bytes, and no wider than this */
+#define IPBUCKET_MAX_LEVEL_BITS     16
 
+#define IP4_BKT_MAX_LEVELS          (IP4_PREFIX_LEN / IPBUCKET_LEVEL_BITS)
+#define IP6_BKT_MAX_LEVELS          (IP6_PREFIX_LEN / IPBUCKET_LEVEL_BITS)
 
 struct mtrie_bkt_info {
     unsigned int            bi_bits;
     unsigned char           bi_shift;
     unsigned char           bi_pfx_len;
+    /* first byte of the address resolved at this level */
+    unsigned char           bi_byte;
     unsigned int            bi_mask;
     unsigned int            bi_size;
 };
 
+/*
+ * strides of the levels of the IPv4 and IPv6 tables, root first. the
+ * strides are used till they add up to the address length.
+ */
+extern unsigned int vr_inet_mtrie_strides[IP4_BKT_MAX_LEVELS];
+extern unsigned int vr_inet6_mtrie_strides[IP6_BKT_MAX_LEVELS];
 
 #ifdef __cplusplus
 }
@@ -35,6 +35,12 @@ extern int vr_mpls_input(struct vrouter *, struct vr_packet *,
                         struct vr_forwarding_md *);
 
 
+/* the label of an mpls header, as it is on the wire */
+static inline unsigned int
+vr_mpls_label(unsigned int mpls_hdr)
+{
+    return ntohl(mpls_hdr) >> VR_MPLS_LABEL_SHIFT;
+}
 
 static inline bool
 vr_mpls_is_label_mcast(unsigned int lbl)
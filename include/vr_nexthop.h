@@ -63,9 +63,26 @@ struct vr_forwarding_md;
 
 struct vr_component_nh {
     int cnh_label;
+    unsigned int cnh_weight;
     struct vr_nexthop *cnh;
 };
 
+/*
+ * an ecmp composite that is added with member weights hashes flows on to
+ * NH_ECMP_BUCKETS buckets, each of which points to a member. members own
+ * buckets in proportion to their weights. when the member list changes,
+ * only the buckets of the members that went away, or that own more than
+ * their new share, are handed over, so that the rest of the flows stay
+ * where they are. flows for which agent has not picked a member, or whose
+ * member is gone, are forwarded using the buckets instead of being trapped.
+ * a flow that hashes to a member which is not valid is rehashed up to
+ * NH_ECMP_PROBES times, so that the flows of a failed member spread over
+ * the others
+ */
+#define NH_ECMP_BUCKETS                 512
+#define NH_ECMP_BUCKET_INVALID          0xFFFF
+#define NH_ECMP_PROBES                  8
+
 struct vr_nexthop {
     uint8_t         nh_type;
     /*
@@ -101,6 +118,7 @@ struct vr_nexthop {
          struct {
             unsigned short cnt;
             struct vr_component_nh *component;
+            uint16_t *buckets;
          } nh_composite;
 
     } nh_u;
@@ -131,6 +149,7 @@ struct vr_nexthop {
 #define nh_udp_tun_encap_len    nh_u.nh_udp_tun.tun_encap_len
 #define nh_component_cnt        nh_u.nh_composite.cnt
 #define nh_component_nh         nh_u.nh_composite.component
+#define nh_component_buckets    nh_u.nh_composite.buckets
 
 static inline bool
 vr_nexthop_is_vcp(struct vr_nexthop *nh)
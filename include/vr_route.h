@@ -12,6 +12,8 @@ extern "C" {
 
 #define VR_NUM_ROUTES_PER_DUMP  20
 #define VR_MAX_VRFS             4096
+/* max requests whose tree walks are interleaved by a burst lookup */
+#define VR_ROUTE_LOOKUP_BURST_SIZE  32
 
 #define METADATA_IP_SUBNET      0xA9FE0000 /* link local subnet (169.254.0.0/16) */
 #define METADATA_IP_MASK        (0xFFFF << 16)
@@ -80,6 +82,8 @@ struct vr_rtable {
     struct vr_vrf_stats *(*algo_stats)(unsigned short, unsigned int);
     int (*algo_stats_get)(vr_vrf_stats_req *, vr_vrf_stats_req *);
     int (*algo_stats_dump)(struct vr_rtable *, vr_vrf_stats_req *);
+    int (*algo_batch_begin)(struct vr_rtable *, unsigned int, unsigned int);
+    int (*algo_batch_end)(struct vr_rtable *, bool);
     unsigned int algo_max_vrfs;
     void *algo_data;
     struct vr_vrf_stats **vrf_stats;
@@ -107,6 +111,9 @@ extern void vr_fib_exit(struct vrouter *, bool);
 extern int vr_route_add(vr_route_req *);
 extern struct vr_nexthop *(*vr_inet_route_lookup)(unsigned int,
                struct vr_route_req *);
+extern unsigned int (*vr_inet_route_lookup_burst)(unsigned int,
+               struct vr_route_req **, unsigned int);
+extern void (*vr_inet_route_hint)(struct vr_route_req *);
 
 #ifdef __cplusplus
 }
@@ -111,6 +111,7 @@ struct host_os {
     int (*hos_gro_process)(struct vr_packet *, struct vr_interface *, bool);
     void (*hos_add_mpls)(struct vrouter *, unsigned);
     void (*hos_del_mpls)(struct vrouter *, unsigned);
+    int (*hos_get_lcore_stats)(unsigned int, vr_lcore_stats_req *);
 };
 
 #define vr_printf                       vrouter_host->hos_printf
@@ -172,6 +173,11 @@ struct vrouter {
     struct vr_btable *vr_oflow_table;
     struct vr_flow_table_info *vr_flow_table_info;
     unsigned int vr_flow_table_info_size;
+    struct vr_flow_cache *vr_flow_cache;
+    struct vr_flow_stats_delta *vr_flow_stats_delta;
+    struct vr_flow_queue_pool *vr_flow_queue_pool;
+    struct vr_flow_trap_batch *vr_flow_trap_batch;
+    struct vr_btable *vr_flow_journal;
 
     unsigned int vr_max_labels;
     struct vr_nexthop **vr_ilm;
@@ -183,8 +189,12 @@ struct vrouter {
 
     struct vr_btable *vr_fragment_table;
     struct vr_btable *vr_fragment_otable;
-    struct vr_timer *vr_fragment_table_scanner;
-    struct vr_timer *vr_fragment_otable_scanner;
+    struct vr_fragment_wheel *vr_fragment_wheel;
+    struct vr_timer *vr_fragment_wheel_timer;
+    uint64_t vr_fragment_wheel_tick;
+    struct vr_fragment_queue *vr_fragment_queue;
+    struct vr_timer *vr_fragment_queue_scanner;
+    unsigned int vr_fragment_queue_bytes;
 
     uint64_t **vr_pdrop_stats;
 
@@ -28,9 +28,15 @@ mem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
     struct vrouter *router = (struct vrouter *)vma->vm_private_data;
     struct page *page;
     pgoff_t offset;
+    void *va;
 
     offset = vmf->pgoff;
-    page = virt_to_page(vr_flow_get_va(router, offset << PAGE_SHIFT));
+    /* the gap between the tables and the journal is not backed */
+    va = vr_flow_get_va(router, offset << PAGE_SHIFT);
+    if (!va)
+        return VM_FAULT_SIGBUS;
+
+    page = virt_to_page(va);
     get_page(page);
     vmf->page = page;
     return 0;
@@ -52,6 +58,10 @@ mem_dev_mmap(struct file *fp, struct vm_area_struct *vma)
     size = vma->vm_end - vma->vm_start;
     flow_table_size = vr_flow_table_size(router) +
         vr_oflow_table_size(router);
+    if (vr_flow_journal_size(router))
+        flow_table_size = VR_FLOW_JOURNAL_OFFSET(flow_table_size) +
+            vr_flow_journal_size(router);
+
     if (size > flow_table_size)
         return -EINVAL;
 
@@ -29,6 +29,7 @@
 #include "vr_fragment.h"
 #include "vr_flow.h"
 #include "vr_bridge.h"
+#include "vr_ip_mtrie.h"
 #include "vr_packet.h"
 
 unsigned int vr_num_cpus = 1;
@@ -2593,10 +2594,21 @@ init_fail:
 
 module_param(vr_flow_entries, int, 0);
 module_param(vr_oflow_entries, int, 0);
+module_param(vr_flow_hold_queues, uint, 0);
+MODULE_PARM_DESC(vr_flow_hold_queues, "Number of preallocated flow hold queues. default is 8192");
+module_param(vr_flow_queue_limit, uint, 0);
+MODULE_PARM_DESC(vr_flow_queue_limit, "Packets held per flow till agent acts on the flow, upto 32. default is 3");
+module_param(vr_flow_trap_batch, uint, 0);
+MODULE_PARM_DESC(vr_flow_trap_batch, "Flow misses per bulk trap to agent, upto 64. 0 traps each miss with its packet");
 
 module_param(vr_bridge_entries, int, 0);
 module_param(vr_bridge_oentries, int, 0);
 
+module_param_array(vr_inet_mtrie_strides, uint, NULL, 0);
+MODULE_PARM_DESC(vr_inet_mtrie_strides, "Bits resolved at each level of the IPv4 mtrie, in multiples of 8 upto 16, e.g. 16,8,8. default is 8,8,8,8");
+module_param_array(vr_inet6_mtrie_strides, uint, NULL, 0);
+MODULE_PARM_DESC(vr_inet6_mtrie_strides, "Bits resolved at each level of the IPv6 mtrie, in multiples of 8 upto 16");
+
 #if (LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,32))
 module_param(vr_use_linux_br, int, 0);
 #endif
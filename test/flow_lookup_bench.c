@@ -0,0 +1,183 @@
+/*
+ * flow_lookup_bench.c -- flow table lookup latency at varying occupancy
+ *
+ * Copyright (c) 2014 Juniper Networks, Inc. All rights reserved.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vr_types.h"
+#include "vr_os.h"
+#include "vrouter.h"
+#include "vr_packet.h"
+#include "vr_message.h"
+#include "vr_flow.h"
+
+#define BENCH_DEF_FLOW_ENTRIES      (64 * 1024)
+#define BENCH_DEF_OFLOW_ENTRIES     (8 * 1024)
+#define BENCH_LOOKUPS               (1024 * 1024)
+/* keys that the timed lookups cycle through, a power of 2 */
+#define BENCH_LOOKUP_KEYS           (64 * 1024)
+
+extern int vrouter_host_init(unsigned int);
+
+static uint32_t bench_seed = 0x2545f491;
+static unsigned int bench_installed, bench_failed;
+static struct vr_flow *bench_keys, *bench_lookup_keys;
+
+static uint32_t
+bench_random(void)
+{
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+
+    return bench_seed;
+}
+
+static void
+bench_random_key(struct vr_flow *key)
+{
+    vr_inet_fill_flow(key, bench_random() & 0xffff, bench_random(),
+            bench_random(), VR_IP_PROTO_TCP, bench_random() & 0xffff,
+            bench_random() & 0xffff);
+
+    return;
+}
+
+static uint64_t
+bench_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+bench_response_cb(void *buf, unsigned int len, void *arg)
+{
+    return 0;
+}
+
+/* install flows through the agent's flow set path till we hit 'target' */
+static void
+bench_fill(struct vrouter *router, unsigned int target)
+{
+    unsigned int fe_index;
+    struct vr_flow *key;
+    vr_flow_req req;
+
+    while (bench_installed < target) {
+        key = &bench_keys[bench_installed];
+        bench_random_key(key);
+
+        memset(&req, 0, sizeof(req));
+        req.fr_op = FLOW_OP_FLOW_SET;
+        req.fr_index = -1;
+        req.fr_flags = VR_FLOW_FLAG_ACTIVE;
+        req.fr_action = VR_FLOW_ACTION_FORWARD;
+        req.fr_src_nh_index = NH_DISCARD_ID;
+        req.fr_ecmp_nh_index = -1;
+        req.fr_flow_nh_id = key->flow4_nh_id;
+        req.fr_flow_sip = key->flow4_sip;
+        req.fr_flow_dip = key->flow4_dip;
+        req.fr_flow_proto = key->flow4_proto;
+        req.fr_flow_sport = key->flow4_sport;
+        req.fr_flow_dport = key->flow4_dport;
+
+        vr_flow_req_process(&req);
+        vr_message_process_response(bench_response_cb, NULL);
+
+        if (vr_find_flow(router, key, VP_TYPE_IP, &fe_index)) {
+            bench_installed++;
+        } else if (++bench_failed > target) {
+            break;
+        }
+    }
+
+    return;
+}
+
+static double
+bench_lookup(struct vrouter *router, bool hit)
+{
+    unsigned int i, fe_index, found = 0;
+    uint64_t start;
+
+    /* keys are drawn before the clock starts, so only lookups are timed */
+    for (i = 0; i < BENCH_LOOKUP_KEYS; i++) {
+        if (hit) {
+            bench_lookup_keys[i] =
+                bench_keys[bench_random() % bench_installed];
+        } else {
+            bench_random_key(&bench_lookup_keys[i]);
+        }
+    }
+
+    start = bench_time_ns();
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        if (vr_find_flow(router,
+                    &bench_lookup_keys[i & (BENCH_LOOKUP_KEYS - 1)],
+                    VP_TYPE_IP, &fe_index))
+            found++;
+    }
+
+    if (hit && (found != BENCH_LOOKUPS))
+        printf("    warning: %u of %u installed flows not found\n",
+                BENCH_LOOKUPS - found, BENCH_LOOKUPS);
+
+    return (double)(bench_time_ns() - start) / BENCH_LOOKUPS;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int ret;
+    unsigned int i, total;
+    unsigned int occupancy[] = { 50, 90, 99 };
+    struct vrouter *router;
+
+    vr_flow_entries = BENCH_DEF_FLOW_ENTRIES;
+    vr_oflow_entries = BENCH_DEF_OFLOW_ENTRIES;
+    if (argc > 1)
+        vr_flow_entries = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+        vr_oflow_entries = strtoul(argv[2], NULL, 0);
+
+    ret = vrouter_host_init(VR_MPROTO_SANDESH);
+    if (ret) {
+        printf("vrouter init failed: %d\n", ret);
+        return ret;
+    }
+
+    router = vrouter_get(0);
+    total = vr_flow_entries + vr_oflow_entries;
+    bench_keys = calloc(total, sizeof(*bench_keys));
+    bench_lookup_keys = calloc(BENCH_LOOKUP_KEYS,
+            sizeof(*bench_lookup_keys));
+    if (!bench_keys || !bench_lookup_keys)
+        return -ENOMEM;
+
+    printf("flow table: %u entries, overflow table: %u entries\n",
+            vr_flow_entries, vr_oflow_entries);
+    printf("%10s %10s %10s %12s %12s\n", "target(%)", "actual(%)",
+            "failed", "hit(ns)", "miss(ns)");
+
+    for (i = 0; i < sizeof(occupancy) / sizeof(occupancy[0]); i++) {
+        bench_fill(router, (unsigned long)total * occupancy[i] / 100);
+        if (!bench_installed)
+            break;
+
+        printf("%10u %10.2f %10u %12.1f %12.1f\n", occupancy[i],
+                (double)bench_installed * 100 / total, bench_failed,
+                bench_lookup(router, true), bench_lookup(router, false));
+    }
+
+    free(bench_lookup_keys);
+    free(bench_keys);
+
+    return 0;
+}
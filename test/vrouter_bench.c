@@ -0,0 +1,916 @@
+/*
+ * vrouter_bench.c -- forwarding performance of the datapath, run on the
+ * host library
+ *
+ * the bench programs a small compute node (agent, fabric and a few VM
+ * interfaces, their nexthops, routes, labels and flows) through the same
+ * request handlers that the agent uses, and then injects synthetic packet
+ * mixes in the receive handler of an interface. packets that make it to
+ * the transmit side of an interface are counted and freed by a sink that
+ * replaces the host interface transmit.
+ *
+ * Copyright (c) 2014 Juniper Networks, Inc. All rights reserved.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vr_types.h"
+#include "vr_os.h"
+#include "vrouter.h"
+#include "vr_packet.h"
+#include "vr_message.h"
+#include "vr_interface.h"
+#include "vr_nexthop.h"
+#include "vr_flow.h"
+#include "vr_mpls.h"
+#include "vr_vxlan.h"
+#include "vr_bridge.h"
+#include "host/vr_host_packet.h"
+#include "host/vr_host_interface.h"
+
+#define BENCH_DEF_PACKETS           (1024 * 1024)
+#define BENCH_POOL_PACKETS          64
+#define BENCH_PACKET_SIZE           2048
+#define BENCH_MAX_FRAME             256
+#define BENCH_FLOWS                 1024
+
+#define BENCH_FABRIC_VRF            0
+#define BENCH_VM_VRF                1
+
+/* interface indices */
+#define BENCH_AGENT_VIF             0
+#define BENCH_FABRIC_VIF            1
+#define BENCH_VM_VIF_START          3
+#define BENCH_NUM_VMS               4
+#define BENCH_VM_VIF(n)             (BENCH_VM_VIF_START + (n))
+#define BENCH_VM_POLICY_START       2
+
+/* nexthop indices */
+#define BENCH_RCV_NH                2
+#define BENCH_L2_RCV_NH             3
+#define BENCH_GRE_NH                5
+#define BENCH_MPLS_UDP_NH           6
+#define BENCH_VXLAN_VRFT_NH         7
+#define BENCH_VM_NH(n)              (10 + (n))
+#define BENCH_VM_L2_NH(n)           (20 + (n))
+
+/* labels */
+#define BENCH_GRE_LABEL             100
+#define BENCH_MPLS_UDP_LABEL        101
+#define BENCH_VM_LABEL(n)           (16 + (n))
+#define BENCH_VNID                  200
+
+#define BENCH_FABRIC_IP             0x0a000001
+#define BENCH_PEER_IP               0x0a000002
+#define BENCH_VM_IP(n)              (0xc0a80000 + 10 + (n))
+#define BENCH_GRE_PREFIX            0xc0a80100
+#define BENCH_MPLS_UDP_PREFIX       0xc0a80200
+#define BENCH_NAT_IP                0xac100001
+
+#define BENCH_SPORT                 10000
+#define BENCH_DPORT                 80
+
+extern int vrouter_host_init(unsigned int);
+
+static unsigned char bench_vrouter_mac[VR_ETHER_ALEN] = {
+    0x00, 0x00, 0x5e, 0x00, 0x01, 0x00 };
+static unsigned char bench_fabric_mac[VR_ETHER_ALEN] = {
+    0x02, 0x00, 0x00, 0x00, 0x00, 0x0a };
+static unsigned char bench_peer_mac[VR_ETHER_ALEN] = {
+    0x02, 0x00, 0x00, 0x00, 0x00, 0x0b };
+
+static struct vrouter *bench_router;
+static struct vr_hpacket_pool *bench_pool;
+
+/*
+ * what the sink saw of the packet in flight. the cycles are split at
+ * the points that the harness sees (packet built, handed to vif_rx,
+ * reached the sink, vif_rx returned), not at datapath stages
+ */
+static unsigned int bench_tx[HIF_MAX_INTERFACES];
+static uint64_t bench_sink_cycles;
+
+struct bench_mix {
+    const char *bm_name;
+    unsigned int bm_in_vif;
+    unsigned int bm_out_vif;
+    unsigned int bm_flows;
+    unsigned int bm_len;
+    /* offset of the inner udp source port that is varied per flow */
+    unsigned int bm_sport_off;
+    int (*bm_build)(struct bench_mix *);
+    unsigned char bm_frame[BENCH_MAX_FRAME];
+};
+
+static uint64_t
+bench_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t
+bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int lo, hi;
+
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return bench_time_ns();
+#endif
+}
+
+static int
+bench_response_cb(void *buf, unsigned int len, void *arg)
+{
+    return 0;
+}
+
+static void
+bench_flush_responses(void)
+{
+    vr_message_process_response(bench_response_cb, NULL);
+    return;
+}
+
+static unsigned int
+bench_hif_tx(struct vr_hinterface *hif, struct vr_hpacket *hpkt)
+{
+    if (!bench_sink_cycles)
+        bench_sink_cycles = bench_cycles();
+
+    bench_tx[hif->hif_index]++;
+    vr_hpacket_free(hpkt);
+
+    return 0;
+}
+
+static int
+bench_hif_create(unsigned int os_idx, unsigned int vif_type)
+{
+    struct vr_hinterface *hif;
+
+    hif = calloc(1, sizeof(*hif));
+    if (!hif)
+        return -ENOMEM;
+
+    hif->hif_index = os_idx;
+    hif->hif_users = 1;
+    hif->hif_vif_type = vif_type;
+    hif->hif_tx = bench_hif_tx;
+    hif_table[os_idx] = hif;
+
+    return 0;
+}
+
+static unsigned int
+bench_vif_os_idx(unsigned int vif_idx)
+{
+    if (vif_idx == BENCH_AGENT_VIF)
+        return HIF_AGENT_INTERFACE_INDEX;
+    else if (vif_idx == BENCH_FABRIC_VIF)
+        return HIF_PHYSICAL_INTERFACE_INDEX;
+
+    return HIF_VIRTUAL_INTERFACE_INDEX_START + vif_idx - BENCH_VM_VIF_START;
+}
+
+static void
+bench_vm_mac(unsigned int vm, unsigned char *mac)
+{
+    mac[0] = 0x02;
+    mac[1] = mac[2] = mac[3] = 0;
+    mac[4] = 0x01;
+    mac[5] = vm;
+
+    return;
+}
+
+static int
+bench_add_vif(unsigned int idx, unsigned int type, unsigned int transport,
+        unsigned int vrf, unsigned char *mac, uint32_t ip, int nh_id,
+        unsigned int flags)
+{
+    int ret;
+    char name[VR_INTERFACE_NAME_LEN];
+    vr_interface_req req;
+
+    ret = bench_hif_create(bench_vif_os_idx(idx), type);
+    if (ret)
+        return ret;
+
+    snprintf(name, sizeof(name), "bench%u", idx);
+
+    memset(&req, 0, sizeof(req));
+    req.h_op = SANDESH_OP_ADD;
+    req.vifr_type = type;
+    req.vifr_transport = transport;
+    req.vifr_flags = flags;
+    req.vifr_vrf = vrf;
+    req.vifr_idx = idx;
+    req.vifr_os_idx = bench_vif_os_idx(idx);
+    req.vifr_mtu = 9000;
+    req.vifr_name = name;
+    req.vifr_mac = (int8_t *)mac;
+    req.vifr_mac_size = VR_ETHER_ALEN;
+    req.vifr_ip = htonl(ip);
+    req.vifr_nh_id = nh_id;
+
+    vr_interface_req_process(&req);
+    bench_flush_responses();
+
+    if (!__vrouter_get_interface(bench_router, idx))
+        return -ENODEV;
+
+    return 0;
+}
+
+static int
+bench_add_nh(unsigned int id, unsigned int type, unsigned int vrf,
+        unsigned int oif, unsigned int flags, unsigned char *encap,
+        unsigned int encap_len, uint32_t sip, uint32_t dip)
+{
+    vr_nexthop_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.h_op = SANDESH_OP_ADD;
+    req.nhr_type = type;
+    req.nhr_family = AF_INET;
+    req.nhr_id = id;
+    req.nhr_vrf = vrf;
+    req.nhr_encap_oif_id = oif;
+    req.nhr_flags = NH_FLAG_VALID | flags;
+    req.nhr_encap = (int8_t *)encap;
+    req.nhr_encap_size = encap_len;
+    req.nhr_tun_sip = htonl(sip);
+    req.nhr_tun_dip = htonl(dip);
+
+    vr_nexthop_req_process(&req);
+    bench_flush_responses();
+
+    if (!__vrouter_get_nexthop(bench_router, id))
+        return -EINVAL;
+
+    return 0;
+}
+
+static void
+bench_add_inet_route(unsigned int vrf, uint32_t prefix, unsigned int plen,
+        unsigned int nh_id, int label)
+{
+    uint32_t prefix_n = htonl(prefix);
+    vr_route_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.h_op = SANDESH_OP_ADD;
+    req.rtr_family = AF_INET;
+    req.rtr_vrf_id = vrf;
+    req.rtr_prefix = (int8_t *)&prefix_n;
+    req.rtr_prefix_size = sizeof(prefix_n);
+    req.rtr_prefix_len = plen;
+    req.rtr_nh_id = nh_id;
+    req.rtr_label = label;
+    if (label >= 0)
+        req.rtr_label_flags = VR_RT_LABEL_VALID_FLAG;
+
+    vr_route_req_process(&req);
+    bench_flush_responses();
+
+    return;
+}
+
+static void
+bench_add_bridge_route(unsigned int vrf, unsigned char *mac,
+        unsigned int nh_id)
+{
+    vr_route_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.h_op = SANDESH_OP_ADD;
+    req.rtr_family = AF_BRIDGE;
+    req.rtr_vrf_id = vrf;
+    req.rtr_mac = (int8_t *)mac;
+    req.rtr_mac_size = VR_ETHER_ALEN;
+    req.rtr_nh_id = nh_id;
+    req.rtr_label = -1;
+
+    vr_route_req_process(&req);
+    bench_flush_responses();
+
+    return;
+}
+
+static void
+bench_add_label(unsigned int label, unsigned int nh_id)
+{
+    vr_mpls_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.h_op = SANDESH_OP_ADD;
+    req.mr_label = label;
+    req.mr_nhid = nh_id;
+
+    vr_mpls_req_process(&req);
+    bench_flush_responses();
+
+    return;
+}
+
+static void
+bench_add_vnid(unsigned int vnid, unsigned int nh_id)
+{
+    vr_vxlan_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.h_op = SANDESH_OP_ADD;
+    req.vxlanr_vnid = vnid;
+    req.vxlanr_nhid = nh_id;
+
+    vr_vxlan_req_process(&req);
+    bench_flush_responses();
+
+    return;
+}
+
+static int
+bench_add_flow(unsigned int nh_id, uint32_t sip, uint32_t dip,
+        unsigned short sport, unsigned short dport, unsigned short action,
+        unsigned short flags, int rindex, unsigned int src_nh)
+{
+    unsigned int fe_index;
+    struct vr_flow key;
+    vr_flow_req req;
+
+    vr_inet_fill_flow(&key, nh_id, htonl(sip), htonl(dip), VR_IP_PROTO_UDP,
+            htons(sport), htons(dport));
+
+    memset(&req, 0, sizeof(req));
+    req.fr_op = FLOW_OP_FLOW_SET;
+    req.fr_index = -1;
+    req.fr_rindex = rindex;
+    req.fr_flags = VR_FLOW_FLAG_ACTIVE | flags;
+    req.fr_action = action;
+    req.fr_src_nh_index = src_nh;
+    req.fr_ecmp_nh_index = -1;
+    req.fr_flow_vrf = BENCH_VM_VRF;
+    req.fr_flow_dvrf = BENCH_VM_VRF;
+    req.fr_flow_nh_id = key.flow4_nh_id;
+    req.fr_flow_sip = key.flow4_sip;
+    req.fr_flow_dip = key.flow4_dip;
+    req.fr_flow_proto = key.flow4_proto;
+    req.fr_flow_sport = key.flow4_sport;
+    req.fr_flow_dport = key.flow4_dport;
+
+    vr_flow_req_process(&req);
+    bench_flush_responses();
+
+    if (!vr_find_flow(bench_router, &key, VP_TYPE_IP, &fe_index))
+        return -1;
+
+    return fe_index;
+}
+
+static int
+bench_setup(void)
+{
+    int ret;
+    unsigned int i, flags;
+    unsigned char mac[VR_ETHER_ALEN];
+    unsigned char encap[2 * VR_ETHER_ALEN + 2];
+
+    ret = bench_add_vif(BENCH_AGENT_VIF, VIF_TYPE_AGENT,
+            VIF_TRANSPORT_SOCKET, BENCH_FABRIC_VRF, bench_fabric_mac, 0, -1, 0);
+    if (ret)
+        return ret;
+
+    ret = bench_add_vif(BENCH_FABRIC_VIF, VIF_TYPE_PHYSICAL,
+            VIF_TRANSPORT_ETH, BENCH_FABRIC_VRF, bench_fabric_mac,
+            BENCH_FABRIC_IP, -1, VIF_FLAG_L3_ENABLED | VIF_FLAG_L2_ENABLED);
+    if (ret)
+        return ret;
+
+    for (i = 0; i < BENCH_NUM_VMS; i++) {
+        flags = VIF_FLAG_L3_ENABLED | VIF_FLAG_L2_ENABLED;
+        if (i >= BENCH_VM_POLICY_START)
+            flags |= VIF_FLAG_POLICY_ENABLED;
+
+        bench_vm_mac(i, mac);
+        ret = bench_add_vif(BENCH_VM_VIF(i), VIF_TYPE_VIRTUAL,
+                VIF_TRANSPORT_VIRTUAL, BENCH_VM_VRF, mac, BENCH_VM_IP(i),
+                BENCH_VM_NH(i), flags);
+        if (ret)
+            return ret;
+    }
+
+    /* receive nexthops */
+    if ((ret = bench_add_nh(BENCH_RCV_NH, NH_RCV, BENCH_FABRIC_VRF,
+                    BENCH_FABRIC_VIF, 0, NULL, 0, 0, 0)))
+        return ret;
+    if ((ret = bench_add_nh(BENCH_L2_RCV_NH, NH_L2_RCV, BENCH_VM_VRF,
+                    0, 0, NULL, 0, 0, 0)))
+        return ret;
+
+    /* tunnels to the peer compute node */
+    memcpy(encap, bench_peer_mac, VR_ETHER_ALEN);
+    memcpy(encap + VR_ETHER_ALEN, bench_fabric_mac, VR_ETHER_ALEN);
+    *(unsigned short *)(encap + 2 * VR_ETHER_ALEN) = htons(VR_ETH_PROTO_IP);
+    if ((ret = bench_add_nh(BENCH_GRE_NH, NH_TUNNEL, BENCH_FABRIC_VRF,
+                    BENCH_FABRIC_VIF, NH_FLAG_TUNNEL_GRE, encap, sizeof(encap),
+                    BENCH_FABRIC_IP, BENCH_PEER_IP)))
+        return ret;
+    if ((ret = bench_add_nh(BENCH_MPLS_UDP_NH, NH_TUNNEL, BENCH_FABRIC_VRF,
+                    BENCH_FABRIC_VIF, NH_FLAG_TUNNEL_UDP_MPLS, encap,
+                    sizeof(encap), BENCH_FABRIC_IP, BENCH_PEER_IP)))
+        return ret;
+    if ((ret = bench_add_nh(BENCH_VXLAN_VRFT_NH, NH_VRF_TRANSLATE,
+                    BENCH_VM_VRF, 0, NH_FLAG_VNID, NULL, 0, 0, 0)))
+        return ret;
+
+    /* l3 and l2 nexthops of the VMs */
+    for (i = 0; i < BENCH_NUM_VMS; i++) {
+        bench_vm_mac(i, encap);
+        memcpy(encap + VR_ETHER_ALEN, bench_vrouter_mac, VR_ETHER_ALEN);
+        flags = (i >= BENCH_VM_POLICY_START) ? NH_FLAG_POLICY_ENABLED : 0;
+        if ((ret = bench_add_nh(BENCH_VM_NH(i), NH_ENCAP, BENCH_VM_VRF,
+                        BENCH_VM_VIF(i), flags, encap, sizeof(encap), 0, 0)))
+            return ret;
+        if ((ret = bench_add_nh(BENCH_VM_L2_NH(i), NH_ENCAP, BENCH_VM_VRF,
+                        BENCH_VM_VIF(i), NH_FLAG_ENCAP_L2, encap,
+                        VR_ETHER_ALEN, 0, 0)))
+            return ret;
+    }
+
+    bench_add_inet_route(BENCH_FABRIC_VRF, BENCH_FABRIC_IP, 32,
+            BENCH_RCV_NH, -1);
+    bench_add_bridge_route(BENCH_VM_VRF, bench_vrouter_mac, BENCH_L2_RCV_NH);
+    for (i = 0; i < BENCH_NUM_VMS; i++) {
+        bench_vm_mac(i, mac);
+        bench_add_bridge_route(BENCH_VM_VRF, mac, BENCH_VM_L2_NH(i));
+        bench_add_inet_route(BENCH_VM_VRF, BENCH_VM_IP(i), 32,
+                BENCH_VM_NH(i), -1);
+        bench_add_label(BENCH_VM_LABEL(i), BENCH_VM_NH(i));
+    }
+
+    bench_add_inet_route(BENCH_VM_VRF, BENCH_GRE_PREFIX, 24,
+            BENCH_GRE_NH, BENCH_GRE_LABEL);
+    bench_add_inet_route(BENCH_VM_VRF, BENCH_MPLS_UDP_PREFIX, 24,
+            BENCH_MPLS_UDP_NH, BENCH_MPLS_UDP_LABEL);
+    bench_add_vnid(BENCH_VNID, BENCH_VXLAN_VRFT_NH);
+
+    return 0;
+}
+
+/*
+ * forward flows between the two policy enabled VMs for the "flow" mix, and
+ * flows to a floating address that are destination NAT-ed to the second
+ * of them for the "nat" mix. the NAT-ed flows need the reverse flow, whose
+ * key holds the translated address
+ */
+static int
+bench_setup_flows(void)
+{
+    int rindex;
+    unsigned int i, src = BENCH_VM_POLICY_START, dst = src + 1;
+
+    for (i = 0; i < BENCH_FLOWS; i++) {
+        if (bench_add_flow(BENCH_VM_NH(src), BENCH_VM_IP(src),
+                    BENCH_VM_IP(dst), BENCH_SPORT + i, BENCH_DPORT,
+                    VR_FLOW_ACTION_FORWARD, 0, -1, BENCH_VM_NH(src)) < 0)
+            return -ENOSPC;
+
+        rindex = bench_add_flow(BENCH_VM_NH(dst), BENCH_VM_IP(dst),
+                BENCH_VM_IP(src), BENCH_DPORT, BENCH_SPORT + BENCH_FLOWS + i,
+                VR_FLOW_ACTION_FORWARD, 0, -1, BENCH_VM_NH(dst));
+        if (rindex < 0)
+            return -ENOSPC;
+
+        if (bench_add_flow(BENCH_VM_NH(src), BENCH_VM_IP(src), BENCH_NAT_IP,
+                    BENCH_SPORT + BENCH_FLOWS + i, BENCH_DPORT,
+                    VR_FLOW_ACTION_NAT, VR_FLOW_FLAG_DNAT | VR_RFLOW_VALID,
+                    rindex, BENCH_VM_NH(src)) < 0)
+            return -ENOSPC;
+    }
+
+    return 0;
+}
+
+static unsigned char *
+bench_put_eth(unsigned char *p, unsigned char *dmac, unsigned char *smac,
+        unsigned short proto)
+{
+    struct vr_eth *eth = (struct vr_eth *)p;
+
+    memcpy(eth->eth_dmac, dmac, VR_ETHER_ALEN);
+    memcpy(eth->eth_smac, smac, VR_ETHER_ALEN);
+    eth->eth_proto = htons(proto);
+
+    return p + sizeof(*eth);
+}
+
+static unsigned char *
+bench_put_ip(unsigned char *p, uint32_t sip, uint32_t dip,
+        unsigned char proto, unsigned short len)
+{
+    struct vr_ip *ip = (struct vr_ip *)p;
+
+    memset(ip, 0, sizeof(*ip));
+    ip->ip_version = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons(len);
+    ip->ip_ttl = 64;
+    ip->ip_proto = proto;
+    ip->ip_saddr = htonl(sip);
+    ip->ip_daddr = htonl(dip);
+    ip->ip_csum = vr_ip_csum(ip);
+
+    return p + sizeof(*ip);
+}
+
+static unsigned char *
+bench_put_udp(unsigned char *p, unsigned short sport, unsigned short dport,
+        unsigned short len)
+{
+    struct vr_udp *udp = (struct vr_udp *)p;
+
+    udp->udp_sport = htons(sport);
+    udp->udp_dport = htons(dport);
+    udp->udp_length = htons(len);
+    udp->udp_csum = 0;
+
+    return p + sizeof(*udp);
+}
+
+static unsigned char *
+bench_put_mpls(unsigned char *p, unsigned int label)
+{
+    unsigned int *lbl = (unsigned int *)p;
+
+    *lbl = htonl((label << VR_MPLS_LABEL_SHIFT) | VR_MPLS_STACK_BIT | 64);
+    return p + VR_MPLS_HDR_LEN;
+}
+
+/* an ip/udp datagram of 'len' bytes, with a zeroed payload */
+static unsigned char *
+bench_put_datagram(unsigned char *p, uint32_t sip, uint32_t dip,
+        unsigned short sport, unsigned short dport, unsigned short len)
+{
+    p = bench_put_ip(p, sip, dip, VR_IP_PROTO_UDP, len);
+    p = bench_put_udp(p, sport, dport, len - sizeof(struct vr_ip));
+    memset(p, 0, len - sizeof(struct vr_ip) - sizeof(struct vr_udp));
+
+    return p + len - sizeof(struct vr_ip) - sizeof(struct vr_udp);
+}
+
+#define BENCH_DATAGRAM_LEN          64
+
+static int
+bench_build_vm(struct bench_mix *mix, uint32_t dip)
+{
+    unsigned int vm = mix->bm_in_vif - BENCH_VM_VIF_START;
+    unsigned char *p = mix->bm_frame, mac[VR_ETHER_ALEN];
+
+    bench_vm_mac(vm, mac);
+    p = bench_put_eth(p, bench_vrouter_mac, mac, VR_ETH_PROTO_IP);
+    mix->bm_sport_off = p - mix->bm_frame + sizeof(struct vr_ip);
+    p = bench_put_datagram(p, BENCH_VM_IP(vm), dip, BENCH_SPORT, BENCH_DPORT,
+            BENCH_DATAGRAM_LEN);
+    mix->bm_len = p - mix->bm_frame;
+
+    return 0;
+}
+
+static int
+bench_build_vm_vm(struct bench_mix *mix)
+{
+    return bench_build_vm(mix, BENCH_VM_IP(1));
+}
+
+static int
+bench_build_vm_gre(struct bench_mix *mix)
+{
+    return bench_build_vm(mix, BENCH_GRE_PREFIX + 1);
+}
+
+static int
+bench_build_vm_mpls_udp(struct bench_mix *mix)
+{
+    return bench_build_vm(mix, BENCH_MPLS_UDP_PREFIX + 1);
+}
+
+static int
+bench_build_vm_flow(struct bench_mix *mix)
+{
+    return bench_build_vm(mix, BENCH_VM_IP(BENCH_VM_POLICY_START + 1));
+}
+
+static int
+bench_build_vm_nat(struct bench_mix *mix)
+{
+    int ret;
+    unsigned short *sport;
+
+    ret = bench_build_vm(mix, BENCH_NAT_IP);
+    sport = (unsigned short *)(mix->bm_frame + mix->bm_sport_off);
+    *sport = htons(BENCH_SPORT + BENCH_FLOWS);
+
+    return ret;
+}
+
+static int
+bench_build_fabric_gre(struct bench_mix *mix)
+{
+    unsigned short len;
+    unsigned char *p = mix->bm_frame;
+    struct vr_gre *gre;
+
+    len = sizeof(struct vr_ip) + sizeof(*gre) + VR_MPLS_HDR_LEN +
+        BENCH_DATAGRAM_LEN;
+    p = bench_put_eth(p, bench_fabric_mac, bench_peer_mac, VR_ETH_PROTO_IP);
+    p = bench_put_ip(p, BENCH_PEER_IP, BENCH_FABRIC_IP, VR_IP_PROTO_GRE, len);
+
+    gre = (struct vr_gre *)p;
+    gre->gre_flags = 0;
+    gre->gre_proto = VR_GRE_PROTO_MPLS_NO;
+    p += sizeof(*gre);
+
+    p = bench_put_mpls(p, BENCH_VM_LABEL(1));
+    mix->bm_sport_off = p - mix->bm_frame + sizeof(struct vr_ip);
+    p = bench_put_datagram(p, BENCH_GRE_PREFIX + 1, BENCH_VM_IP(1),
+            BENCH_SPORT, BENCH_DPORT, BENCH_DATAGRAM_LEN);
+    mix->bm_len = p - mix->bm_frame;
+
+    return 0;
+}
+
+static int
+bench_build_fabric_mpls_udp(struct bench_mix *mix)
+{
+    unsigned short len;
+    unsigned char *p = mix->bm_frame;
+
+    len = sizeof(struct vr_ip) + sizeof(struct vr_udp) + VR_MPLS_HDR_LEN +
+        BENCH_DATAGRAM_LEN;
+    p = bench_put_eth(p, bench_fabric_mac, bench_peer_mac, VR_ETH_PROTO_IP);
+    p = bench_put_ip(p, BENCH_PEER_IP, BENCH_FABRIC_IP, VR_IP_PROTO_UDP, len);
+    p = bench_put_udp(p, VR_MPLS_OVER_UDP_SRC_PORT, VR_MPLS_OVER_UDP_DST_PORT,
+            len - sizeof(struct vr_ip));
+    p = bench_put_mpls(p, BENCH_VM_LABEL(1));
+    mix->bm_sport_off = p - mix->bm_frame + sizeof(struct vr_ip);
+    p = bench_put_datagram(p, BENCH_MPLS_UDP_PREFIX + 1, BENCH_VM_IP(1),
+            BENCH_SPORT, BENCH_DPORT, BENCH_DATAGRAM_LEN);
+    mix->bm_len = p - mix->bm_frame;
+
+    return 0;
+}
+
+static int
+bench_build_fabric_vxlan(struct bench_mix *mix)
+{
+    unsigned short len;
+    unsigned char *p = mix->bm_frame, mac[VR_ETHER_ALEN];
+    struct vr_vxlan *vxlan;
+
+    len = sizeof(struct vr_ip) + sizeof(struct vr_udp) + sizeof(*vxlan) +
+        sizeof(struct vr_eth) + BENCH_DATAGRAM_LEN;
+    p = bench_put_eth(p, bench_fabric_mac, bench_peer_mac, VR_ETH_PROTO_IP);
+    p = bench_put_ip(p, BENCH_PEER_IP, BENCH_FABRIC_IP, VR_IP_PROTO_UDP, len);
+    p = bench_put_udp(p, VR_MPLS_OVER_UDP_SRC_PORT, VR_VXLAN_UDP_DST_PORT,
+            len - sizeof(struct vr_ip));
+
+    vxlan = (struct vr_vxlan *)p;
+    vxlan->vxlan_flags = htonl(VR_VXLAN_IBIT);
+    vxlan->vxlan_vnid = htonl(BENCH_VNID << VR_VXLAN_VNID_SHIFT);
+    p += sizeof(*vxlan);
+
+    bench_vm_mac(1, mac);
+    p = bench_put_eth(p, mac, bench_peer_mac, VR_ETH_PROTO_IP);
+    mix->bm_sport_off = p - mix->bm_frame + sizeof(struct vr_ip);
+    p = bench_put_datagram(p, BENCH_GRE_PREFIX + 1, BENCH_VM_IP(1),
+            BENCH_SPORT, BENCH_DPORT, BENCH_DATAGRAM_LEN);
+    mix->bm_len = p - mix->bm_frame;
+
+    return 0;
+}
+
+static struct bench_mix bench_mixes[] = {
+    {
+        .bm_name        =   "vm-vm",
+        .bm_in_vif      =   BENCH_VM_VIF(0),
+        .bm_out_vif     =   BENCH_VM_VIF(1),
+        .bm_flows       =   1,
+        .bm_build       =   bench_build_vm_vm,
+    },
+    {
+        .bm_name        =   "vm-mplsogre",
+        .bm_in_vif      =   BENCH_VM_VIF(0),
+        .bm_out_vif     =   BENCH_FABRIC_VIF,
+        .bm_flows       =   1,
+        .bm_build       =   bench_build_vm_gre,
+    },
+    {
+        .bm_name        =   "vm-mplsoudp",
+        .bm_in_vif      =   BENCH_VM_VIF(0),
+        .bm_out_vif     =   BENCH_FABRIC_VIF,
+        .bm_flows       =   1,
+        .bm_build       =   bench_build_vm_mpls_udp,
+    },
+    {
+        .bm_name        =   "fabric-mplsogre",
+        .bm_in_vif      =   BENCH_FABRIC_VIF,
+        .bm_out_vif     =   BENCH_VM_VIF(1),
+        .bm_flows       =   1,
+        .bm_build       =   bench_build_fabric_gre,
+    },
+    {
+        .bm_name        =   "fabric-mplsoudp",
+        .bm_in_vif      =   BENCH_FABRIC_VIF,
+        .bm_out_vif     =   BENCH_VM_VIF(1),
+        .bm_flows       =   1,
+        .bm_build       =   bench_build_fabric_mpls_udp,
+    },
+    {
+        .bm_name        =   "fabric-vxlan",
+        .bm_in_vif      =   BENCH_FABRIC_VIF,
+        .bm_out_vif     =   BENCH_VM_VIF(1),
+        .bm_flows       =   1,
+        .bm_build       =   bench_build_fabric_vxlan,
+    },
+    {
+        .bm_name        =   "vm-vm-flow",
+        .bm_in_vif      =   BENCH_VM_VIF(BENCH_VM_POLICY_START),
+        .bm_out_vif     =   BENCH_VM_VIF(BENCH_VM_POLICY_START + 1),
+        .bm_flows       =   BENCH_FLOWS,
+        .bm_build       =   bench_build_vm_flow,
+    },
+    {
+        .bm_name        =   "vm-vm-nat",
+        .bm_in_vif      =   BENCH_VM_VIF(BENCH_VM_POLICY_START),
+        .bm_out_vif     =   BENCH_VM_VIF(BENCH_VM_POLICY_START + 1),
+        .bm_flows       =   BENCH_FLOWS,
+        .bm_build       =   bench_build_vm_nat,
+    },
+};
+
+static uint64_t
+bench_drops(void)
+{
+    unsigned int cpu, i;
+    uint64_t drops = 0;
+
+    for (cpu = 0; cpu < vr_num_cpus; cpu++)
+        for (i = 0; i < VP_DROP_MAX; i++)
+            drops += bench_router->vr_pdrop_stats[cpu][i];
+
+    return drops;
+}
+
+/* the packet that is put in the receive path of the input interface */
+static struct vr_packet *
+bench_packet(struct bench_mix *mix, struct vr_interface *vif, unsigned int n)
+{
+    unsigned short *sport;
+    struct vr_hpacket *hpkt;
+    struct vr_packet *pkt;
+
+    if (!bench_pool->pool_head)
+        return NULL;
+
+    hpkt = vr_hpacket_pool_alloc(bench_pool);
+    hpkt->hp_data = VR_HPACKET_HEAD_SPACE;
+    hpkt->hp_tail = hpkt->hp_data + mix->bm_len;
+    hpkt->hp_len = mix->bm_len;
+    hpkt->hp_flags = 0;
+    memcpy(hpkt_data(hpkt), mix->bm_frame, mix->bm_len);
+    if (mix->bm_flows > 1) {
+        sport = (unsigned short *)(hpkt_data(hpkt) + mix->bm_sport_off);
+        *sport = htons(ntohs(*sport) + (n % mix->bm_flows));
+    }
+
+    pkt = &hpkt->hp_packet;
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->vp_head = hpkt->hp_head;
+    pkt->vp_data = hpkt->hp_data;
+    pkt->vp_tail = hpkt->hp_tail;
+    pkt->vp_end = hpkt->hp_end;
+    pkt->vp_len = mix->bm_len;
+    pkt->vp_if = vif;
+    pkt->vp_ttl = 64;
+    pkt->vp_type = VP_TYPE_NULL;
+
+    return pkt;
+}
+
+static int
+bench_run(struct bench_mix *mix, unsigned int packets)
+{
+    unsigned int i, forwarded, out_hif;
+    uint64_t start, ns, drops, t0, t1, t2;
+    uint64_t build = 0, to_sink = 0, from_sink = 0;
+    struct vr_interface *vif;
+    struct vr_packet *pkt;
+
+    vif = __vrouter_get_interface(bench_router, mix->bm_in_vif);
+    if (!vif)
+        return -ENODEV;
+
+    memset(mix->bm_frame, 0, sizeof(mix->bm_frame));
+    mix->bm_build(mix);
+
+    out_hif = bench_vif_os_idx(mix->bm_out_vif);
+    memset(bench_tx, 0, sizeof(bench_tx));
+    drops = bench_drops();
+
+    start = bench_time_ns();
+    for (i = 0; i < packets; i++) {
+        t0 = bench_cycles();
+        pkt = bench_packet(mix, vif, i);
+        if (!pkt) {
+            printf("%-16s packet pool ran dry after %u packets\n",
+                    mix->bm_name, i);
+            return -ENOMEM;
+        }
+
+        bench_sink_cycles = 0;
+        t1 = bench_cycles();
+        vif->vif_rx(vif, pkt, VLAN_ID_INVALID);
+        t2 = bench_cycles();
+
+        build += t1 - t0;
+        if (bench_sink_cycles) {
+            to_sink += bench_sink_cycles - t1;
+            from_sink += t2 - bench_sink_cycles;
+        } else {
+            to_sink += t2 - t1;
+        }
+    }
+    ns = bench_time_ns() - start;
+
+    forwarded = bench_tx[out_hif];
+    printf("%-16s %10u %10llu %8.2f %8.1f %8.1f %10.1f %10.1f\n",
+            mix->bm_name, forwarded,
+            (unsigned long long)(bench_drops() - drops),
+            (double)packets * 1000 / ns, (double)ns / packets,
+            (double)build / packets, (double)to_sink / packets,
+            (double)from_sink / packets);
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int ret;
+    unsigned int i, packets = BENCH_DEF_PACKETS;
+    char *mix_name = NULL;
+
+    if (argc > 1)
+        packets = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+        mix_name = argv[2];
+
+    ret = vrouter_host_init(VR_MPROTO_SANDESH);
+    if (ret) {
+        printf("vrouter init failed: %d\n", ret);
+        return ret;
+    }
+
+    bench_router = vrouter_get(0);
+    bench_pool = vr_hpacket_pool_create(BENCH_POOL_PACKETS,
+            BENCH_PACKET_SIZE);
+    if (!bench_pool)
+        return -ENOMEM;
+
+    ret = bench_setup();
+    if (ret) {
+        printf("bench setup failed: %d\n", ret);
+        return ret;
+    }
+
+    ret = bench_setup_flows();
+    if (ret) {
+        printf("flow setup failed: %d\n", ret);
+        return ret;
+    }
+
+    printf("%u packets per mix, cycles per packet split into harness"
+            " phases: packet build, vif_rx to sink and sink to return\n",
+            packets);
+    printf("%-16s %10s %10s %8s %8s %8s %10s %10s\n", "mix", "forwarded",
+            "dropped", "mpps", "ns/pkt", "build", "rx->sink", "sink->ret");
+
+    for (i = 0; i < sizeof(bench_mixes) / sizeof(bench_mixes[0]); i++) {
+        if (mix_name && strcmp(mix_name, bench_mixes[i].bm_name))
+            continue;
+
+        ret = bench_run(&bench_mixes[i], packets);
+        if (ret)
+            return ret;
+    }
+
+    return 0;
+}
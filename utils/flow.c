@@ -62,8 +62,28 @@ struct flow_table {
     unsigned int ft_num_entries;
     unsigned int ft_flags;
     char flow_table_path[256];
+    /* per cpu journal rings, and how far we have read each of them */
+    struct vr_flow_journal_ring *ft_journal;
+    unsigned int ft_journal_rings;
+    uint64_t *ft_journal_pos;
+    /* generation of each ring when we last swept the table */
+    uint64_t *ft_journal_gen;
+    /* what we last counted every entry as */
+    unsigned char *ft_class;
 } main_table;
 
+#define FLOW_CLASS_FREE         0
+#define FLOW_CLASS_HOLD         1
+#define FLOW_CLASS_DROP         2
+#define FLOW_CLASS_FWD          3
+#define FLOW_CLASS_NAT          4
+#define FLOW_CLASS_OTHER        5
+#define FLOW_CLASS_MAX          6
+
+struct flow_counts {
+    int fc_count[FLOW_CLASS_MAX];
+};
+
 struct nl_client *cl;
 vr_flow_req flow_req;
 
@@ -271,12 +291,151 @@ flow_list(void)
     return;
 }
 
+static unsigned char
+flow_class(struct vr_flow_entry *fe)
+{
+    if (!(fe->fe_flags & VR_FLOW_FLAG_ACTIVE))
+        return FLOW_CLASS_FREE;
+
+    switch (fe->fe_action) {
+    case VR_FLOW_ACTION_HOLD:
+        return FLOW_CLASS_HOLD;
+
+    case VR_FLOW_ACTION_DROP:
+        return FLOW_CLASS_DROP;
+
+    case VR_FLOW_ACTION_FORWARD:
+        return FLOW_CLASS_FWD;
+
+    case VR_FLOW_ACTION_NAT:
+        return FLOW_CLASS_NAT;
+
+    default:
+        return FLOW_CLASS_OTHER;
+    }
+}
+
+static int
+flow_counts_total(struct flow_counts *fc)
+{
+    unsigned int i;
+    int total = 0;
+
+    for (i = 0; i < FLOW_CLASS_MAX; i++) {
+        if (i != FLOW_CLASS_FREE)
+            total += fc->fc_count[i];
+    }
+
+    return total;
+}
+
+/* sweep the whole table */
+static void
+flow_count_table(struct flow_table *ft, struct flow_counts *fc)
+{
+    unsigned int i;
+    unsigned char class;
+
+    /*
+     * events logged while we sweep are applied again the next time,
+     * which does no harm since an entry is counted by its current state
+     */
+    for (i = 0; i < ft->ft_journal_rings; i++) {
+        ft->ft_journal_gen[i] =
+            *(volatile uint64_t *)&ft->ft_journal[i].fjr_gen;
+        __sync_synchronize();
+        ft->ft_journal_pos[i] =
+            *(volatile uint64_t *)&ft->ft_journal[i].fjr_head;
+    }
+
+    memset(fc, 0, sizeof(*fc));
+    for (i = 0; i < ft->ft_num_entries; i++) {
+        class = flow_class(&ft->ft_entries[i]);
+        if (ft->ft_class)
+            ft->ft_class[i] = class;
+        fc->fc_count[class]++;
+    }
+
+    return;
+}
+
+/*
+ * recount only the entries logged in the journal since the last visit.
+ * returns false if a ring lapped us or was reset, in which case the
+ * table has to be swept
+ */
+static bool
+flow_count_journal(struct flow_table *ft, struct flow_counts *fc)
+{
+    unsigned int i, index;
+    unsigned short event;
+    uint64_t gen, head, pos, seq;
+    unsigned char class;
+    struct vr_flow_journal_ring *ring;
+    volatile struct vr_flow_journal_entry *fje;
+
+    for (i = 0; i < ft->ft_journal_rings; i++) {
+        ring = &ft->ft_journal[i];
+        gen = *(volatile uint64_t *)&ring->fjr_gen;
+        if ((gen & 1) || (gen != ft->ft_journal_gen[i]))
+            return false;
+
+        __sync_synchronize();
+        head = *(volatile uint64_t *)&ring->fjr_head;
+        pos = ft->ft_journal_pos[i];
+        if ((head < pos) || (head - pos > VR_FLOW_JOURNAL_ENTRIES))
+            return false;
+
+        for (; pos < head; pos++) {
+            fje = &ring->fjr_entries[pos % VR_FLOW_JOURNAL_ENTRIES];
+            seq = fje->fje_seq;
+            /* the writer has not finished the entry yet. try later */
+            if (seq < pos + 1)
+                break;
+            if (seq > pos + 1)
+                return false;
+
+            __sync_synchronize();
+            index = fje->fje_index;
+            event = fje->fje_event;
+            __sync_synchronize();
+            if (fje->fje_seq != seq)
+                return false;
+
+            if ((event == VR_FLOW_JOURNAL_STATS) ||
+                    (index >= ft->ft_num_entries))
+                continue;
+
+            class = flow_class(&ft->ft_entries[index]);
+            fc->fc_count[ft->ft_class[index]]--;
+            fc->fc_count[class]++;
+            ft->ft_class[index] = class;
+        }
+
+        /* the ring was reset under us */
+        __sync_synchronize();
+        if (*(volatile uint64_t *)&ring->fjr_gen != gen)
+            return false;
+
+        ft->ft_journal_pos[i] = pos;
+    }
+
+    return true;
+}
+
+static void
+flow_count(struct flow_table *ft, struct flow_counts *fc, bool first)
+{
+    if (first || !ft->ft_class || !flow_count_journal(ft, fc))
+        flow_count_table(ft, fc);
+
+    return;
+}
+
 static void
 flow_stats(void)
 {
     struct flow_table *ft = &main_table;
-    unsigned int i;
-    struct vr_flow_entry *fe;
     struct timeval now;
     struct timeval last_time;
     int active_entries = 0;
@@ -295,35 +454,21 @@ flow_stats(void)
     int flow_action_drop = 0;
     int flow_action_fwd = 0;
     int flow_action_nat = 0;
+    bool first = true;
+    struct flow_counts fc;
 
     gettimeofday(&last_time, NULL);
     while (1) {
-        active_entries = 0;
-        total_entries = 0;
-        hold_entries = 0;
-        flow_action_drop = 0;
-        flow_action_fwd = 0;
-        flow_action_nat = 0;
         usleep(500000);
-        for (i = 0; i < ft->ft_num_entries; i++) {
-            fe = (struct vr_flow_entry *)((char *)ft->ft_entries +
-                                          (i * sizeof(*fe)));
-            if (fe->fe_flags & VR_FLOW_FLAG_ACTIVE) {
-                total_entries++;
-                if (fe->fe_action != VR_FLOW_ACTION_HOLD) {
-                    active_entries++;
-                } else {
-                    hold_entries++;
-                }
-                if (fe->fe_action == VR_FLOW_ACTION_DROP) {
-                    flow_action_drop++;
-                } else if (fe->fe_action == VR_FLOW_ACTION_FORWARD) {
-                    flow_action_fwd++;
-                } else if (fe->fe_action == VR_FLOW_ACTION_NAT) {
-                    flow_action_nat++;
-                }
-            }
-        }
+        flow_count(ft, &fc, first);
+        first = false;
+
+        total_entries = flow_counts_total(&fc);
+        hold_entries = fc.fc_count[FLOW_CLASS_HOLD];
+        active_entries = total_entries - hold_entries;
+        flow_action_drop = fc.fc_count[FLOW_CLASS_DROP];
+        flow_action_fwd = fc.fc_count[FLOW_CLASS_FWD];
+        flow_action_nat = fc.fc_count[FLOW_CLASS_NAT];
         gettimeofday(&now, NULL);
         /* calc time difference and rate */
         diff_ms = (now.tv_sec - last_time.tv_sec) * 1000;
@@ -396,8 +541,6 @@ static void
 flow_rate(void)
 {
     struct flow_table *ft = &main_table;
-    unsigned int i;
-    struct vr_flow_entry *fe;
     struct timeval now;
     struct timeval last_time;
     int active_entries = 0;
@@ -407,20 +550,17 @@ flow_rate(void)
     int diff_ms;
     int rate;
     int total_rate;
+    bool first = true;
+    struct flow_counts fc;
 
     gettimeofday(&last_time, NULL);
     while (1) {
-        active_entries = 0;
-        total_entries = 0;
         usleep(500000);
-        for (i = 0; i < ft->ft_num_entries; i++) {
-            fe = (struct vr_flow_entry *)((char *)ft->ft_entries + (i * sizeof(*fe)));
-            if (fe->fe_flags & VR_FLOW_FLAG_ACTIVE) {
-                total_entries++;
-                if (fe->fe_action != VR_FLOW_ACTION_HOLD)
-                    active_entries++;
-            }
-        }
+        flow_count(ft, &fc, first);
+        first = false;
+
+        total_entries = flow_counts_total(&fc);
+        active_entries = total_entries - fc.fc_count[FLOW_CLASS_HOLD];
         gettimeofday(&now, NULL);
         /* calc time difference and rate */
         diff_ms = (now.tv_sec - last_time.tv_sec) * 1000;
@@ -458,6 +598,7 @@ int
 flow_table_map(vr_flow_req *req)
 {
     int ret;
+    size_t map_size;
     struct flow_table *ft = &main_table;
     const char *flow_path;
 
@@ -484,7 +625,12 @@ flow_table_map(vr_flow_req *req)
         exit(errno);
     }
 
-    ft->ft_entries = (struct vr_flow_entry *)mmap(NULL, req->fr_ftable_size,
+    /* the journal, if the datapath keeps one, follows the tables */
+    map_size = req->fr_ftable_size;
+    if (req->fr_journal_size > 0)
+        map_size = VR_FLOW_JOURNAL_OFFSET(map_size) + req->fr_journal_size;
+
+    ft->ft_entries = (struct vr_flow_entry *)mmap(NULL, map_size,
             PROT_READ, MAP_SHARED, mem_fd, 0);
     /* the file descriptor is no longer needed */
     close(mem_fd);
@@ -495,6 +641,31 @@ flow_table_map(vr_flow_req *req)
 
     ft->ft_span = req->fr_ftable_size;
     ft->ft_num_entries = ft->ft_span / sizeof(struct vr_flow_entry);
+
+    if (req->fr_journal_size > 0) {
+        ft->ft_journal_rings = req->fr_journal_size /
+            sizeof(struct vr_flow_journal_ring);
+        ft->ft_journal_pos = calloc(ft->ft_journal_rings,
+                sizeof(*ft->ft_journal_pos));
+        ft->ft_journal_gen = calloc(ft->ft_journal_rings,
+                sizeof(*ft->ft_journal_gen));
+        ft->ft_class = calloc(ft->ft_num_entries, sizeof(*ft->ft_class));
+        if (!ft->ft_journal_pos || !ft->ft_journal_gen || !ft->ft_class) {
+            /* sweep the table every time, as without a journal */
+            free(ft->ft_journal_pos);
+            free(ft->ft_journal_gen);
+            free(ft->ft_class);
+            ft->ft_journal_pos = NULL;
+            ft->ft_journal_gen = NULL;
+            ft->ft_class = NULL;
+            ft->ft_journal_rings = 0;
+        } else {
+            ft->ft_journal = (struct vr_flow_journal_ring *)
+                ((char *)ft->ft_entries +
+                 VR_FLOW_JOURNAL_OFFSET(req->fr_ftable_size));
+        }
+    }
+
     return ft->ft_num_entries;
 }
 
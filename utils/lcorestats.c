@@ -0,0 +1,242 @@
+/*
+ * lcorestats.c -- utility to dump the stats of the packet processing
+ * lcores of the dpdk vrouter
+ *
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <getopt.h>
+
+#include "vr_os.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#if defined(__linux__)
+#include <asm/types.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_ether.h>
+
+#include <net/if.h>
+#include <netinet/ether.h>
+#elif defined(__FreeBSD__)
+#include <net/if.h>
+#include <net/ethernet.h>
+#endif
+
+#include "vr_types.h"
+#include "vr_message.h"
+#include "vr_genetlink.h"
+#include "nl_util.h"
+#include "ini_parser.h"
+
+static struct nl_client *cl;
+static int resp_code;
+static vr_lcore_stats_req stats_req;
+static int help_set;
+static bool dump_pending = false;
+static bool response_pending = true;
+
+void
+vr_lcore_stats_req_process(void *s_req)
+{
+    vr_lcore_stats_req *stats = (vr_lcore_stats_req *)s_req;
+
+    stats_req.vlsr_marker = stats->vlsr_lcore;
+    printf("%5d %9d %7d%% %10d %10d %12" PRIu64 " %10" PRIu64 "\n",
+            stats->vlsr_lcore, stats->vlsr_nb_rx_queues, stats->vlsr_load,
+            stats->vlsr_rx_queues_in, stats->vlsr_rx_queues_out,
+            stats->vlsr_idle_usecs, stats->vlsr_sleeps);
+
+    response_pending = false;
+    return;
+}
+
+void
+vr_response_process(void *s)
+{
+    vr_response *stats_resp;
+
+    stats_resp = (vr_response *)s;
+    resp_code = stats_resp->resp_code;
+
+    response_pending = false;
+    if (stats_resp->resp_code < 0) {
+        printf("Error %s in kernel operation\n", strerror(-stats_resp->resp_code));
+        exit(-1);
+    }
+
+    if (stats_resp->resp_code > 0)
+        response_pending = true;
+
+    if (resp_code & VR_MESSAGE_DUMP_INCOMPLETE) {
+        dump_pending = true;
+        response_pending = true;
+    } else {
+        dump_pending = false;
+    }
+
+    return;
+}
+
+static vr_lcore_stats_req *
+vr_build_lcore_stats_request(void)
+{
+    stats_req.h_op = SANDESH_OP_DUMP;
+    stats_req.vlsr_rid = 0;
+
+    return &stats_req;
+}
+
+static int
+vr_build_netlink_request(vr_lcore_stats_req *req)
+{
+    int ret, error = 0, attr_len;
+
+    /* nlmsg header */
+    ret = nl_build_nlh(cl, cl->cl_genl_family_id, NLM_F_REQUEST);
+    if (ret)
+        return ret;
+
+    /* Generic nlmsg header */
+    ret = nl_build_genlh(cl, SANDESH_REQUEST, 0);
+    if (ret)
+        return ret;
+
+    attr_len = nl_get_attr_hdr_size();
+    ret = sandesh_encode(req, "vr_lcore_stats_req", vr_find_sandesh_info,
+                             (nl_get_buf_ptr(cl) + attr_len),
+                             (nl_get_buf_len(cl) - attr_len), &error);
+
+    if ((ret <= 0) || error)
+        return -1;
+
+    /* Add sandesh attribute */
+    nl_build_attr(cl, ret, NL_ATTR_VR_MESSAGE_PROTOCOL);
+    nl_update_nlh(cl);
+
+    return 0;
+}
+
+static int
+vr_send_one_message(void)
+{
+    int ret;
+    struct nl_response *resp;
+
+    response_pending = true;
+    ret = nl_sendmsg(cl);
+    if (ret <= 0)
+        return 0;
+
+    while (response_pending) {
+        if ((ret = nl_recvmsg(cl)) > 0) {
+            resp = nl_parse_reply(cl);
+            if (resp->nl_op == SANDESH_REQUEST)
+                sandesh_decode(resp->nl_data, resp->nl_len,
+                               vr_find_sandesh_info, &ret);
+        }
+    }
+    return resp_code;
+}
+
+static int
+vr_stats_dump(void)
+{
+    int ret;
+    vr_lcore_stats_req *req;
+
+    req = vr_build_lcore_stats_request();
+    ret = vr_build_netlink_request(req);
+    if (ret < 0)
+        return ret;
+
+    printf("Lcore RX queues    Load   Moved in  Moved out    Idle (us)     Sleeps\n");
+    while (vr_send_one_message() != 0) {
+        if (!dump_pending)
+            break;
+        req = vr_build_lcore_stats_request();
+        if (vr_build_netlink_request(req) < 0)
+            break;
+    }
+
+    return 0;
+}
+
+enum opt_index {
+    HELP_OPT_INDEX,
+    MAX_OPT_INDEX
+};
+
+static struct option long_options[] = {
+    [HELP_OPT_INDEX]    =   {"help",    no_argument,        &help_set,      1},
+    [MAX_OPT_INDEX]     =   {"NULL",    0,                  0,              0},
+};
+
+static void
+Usage()
+{
+    printf("Usage: lcorestats [--help]\n");
+    printf("\n");
+
+    printf("Displays the RX queues and the load of each lcore of the DPDK\n");
+    printf("vRouter over the last rebalancing period, and the number of\n");
+    printf("RX queues the rebalancer moved to and from it. With\n");
+    printf("--adaptive-idle, also the time it spent idle and the number of\n");
+    printf("times it went to sleep\n");
+
+    exit(-EINVAL);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char opt;
+    int ret, option_index;
+
+    while (((opt = getopt_long(argc, argv, "",
+                        long_options, &option_index)) >= 0)) {
+        switch (opt) {
+        case 0:
+            break;
+
+        default:
+            Usage();
+        }
+    }
+
+    if (help_set)
+        Usage();
+
+    cl = nl_register_client();
+    if (!cl) {
+        exit(1);
+    }
+
+    parse_ini_file();
+
+    ret = nl_socket(cl, get_domain(), get_type(), get_protocol());
+    if (ret <= 0) {
+        exit(1);
+    }
+
+    ret = nl_connect(cl, get_ip(), get_port());
+    if (ret < 0) {
+        exit(1);
+    }
+
+    if (vrouter_get_family_id(cl) <= 0) {
+        return -1;
+    }
+
+    stats_req.vlsr_marker = -1;
+    return vr_stats_dump();
+}
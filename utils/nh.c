@@ -222,11 +222,16 @@ vr_nexthop_req_process(void *s_req)
     }
 
     if (req->nhr_type == NH_COMPOSITE) {
-        printf("\tSub NH(label):");
+        if (req->nhr_weight_list_size)
+            printf("\tSub NH(label)/weight:");
+        else
+            printf("\tSub NH(label):");
         for (i = 0; i < req->nhr_nh_list_size; i++) {
             printf(" %d", req->nhr_nh_list[i]);
             if (req->nhr_label_list[i] >= 0)
                 printf("(%d)", req->nhr_label_list[i]);
+            if (i < req->nhr_weight_list_size)
+                printf("/%d", req->nhr_weight_list[i]);
         }
         printf("\n");
     }
@@ -38,6 +38,8 @@ extern struct nl_response *nl_parse_gen(struct nl_client *);
 extern void vr_ops_process (void *a) __attribute__((weak));
 extern void vr_flow_req_process(void *s_req) __attribute__((weak));
 extern void vr_route_req_process(void *s_req) __attribute__((weak));
+extern void vr_route_batch_req_process(void *s_req) __attribute__((weak));
+extern void vr_lcore_stats_req_process(void *s_req) __attribute__((weak));
 extern void vr_interface_req_process(void *s_req) __attribute__((weak));
 extern void vr_mpls_req_process(void *s_req) __attribute__((weak));
 extern void vr_mirror_req_process(void *s_req) __attribute__((weak));
@@ -73,6 +75,12 @@ vr_route_req_process(void *s_req)
     return;
 }
 
+void
+vr_route_batch_req_process(void *s_req)
+{
+    return;
+}
+
 void
 vr_interface_req_process(void *s_req)
 {
@@ -116,6 +124,12 @@ vr_drop_stats_req_process(void *s_req)
     return;
 }
 
+void
+vr_lcore_stats_req_process(void *s_req)
+{
+    return;
+}
+
 void
 vr_vxlan_req_process(void *s_req)
 {
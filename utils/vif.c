@@ -11,6 +11,7 @@
 #include <getopt.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <limits.h>
 
 #include "vr_os.h"
 
@@ -62,11 +63,12 @@ static int if_xconnect_kindex = -1;
 static int if_vif_index = -1;
 static short vlan_id = -1;
 static int vr_ifflags;
+static int irq_coalesce_pkts, irq_coalesce_usecs;
 
 static int add_set, create_set, get_set, list_set;
 static int kindex_set, type_set, help_set, set_set, vlan_set, dhcp_set;
 static int vrf_set, mac_set, delete_set, policy_set, pmd_set, vindex_set, pci_set;
-static int xconnect_set, vif_set, vhost_phys_set;
+static int xconnect_set, vif_set, vhost_phys_set, coalesce_set;
 
 static unsigned int vr_op, vr_if_type;
 static bool ignore_error = false, dump_pending = false;
@@ -323,6 +325,15 @@ vr_interface_req_process(void *s)
     printf("Vrf:%d Flags:%s MTU:%d Ref:%d\n", req->vifr_vrf,
             req->vifr_flags ? vr_if_flags(req->vifr_flags) : "NULL" ,
             req->vifr_mtu, req->vifr_ref_cnt);
+    if ((req->vifr_irq_coalesce_pkts == VIF_IRQ_COALESCE_OFF) ||
+            (req->vifr_irq_coalesce_usecs == VIF_IRQ_COALESCE_OFF)) {
+        vr_interface_print_head_space();
+        printf("IRQ coalescing: off\n");
+    } else if (req->vifr_irq_coalesce_pkts || req->vifr_irq_coalesce_usecs) {
+        vr_interface_print_head_space();
+        printf("IRQ coalescing: packets:%d usecs:%d\n",
+                req->vifr_irq_coalesce_pkts, req->vifr_irq_coalesce_usecs);
+    }
     vr_interface_print_head_space();
     printf("RX packets:%" PRId64 "  bytes:%" PRId64 " errors:%" PRId64 "\n",
             req->vifr_ipackets,
@@ -586,6 +597,8 @@ op_retry:
             }
         }
         intf_req.vifr_flags = vr_ifflags;
+        intf_req.vifr_irq_coalesce_pkts = irq_coalesce_pkts;
+        intf_req.vifr_irq_coalesce_usecs = irq_coalesce_usecs;
 
         break;
 
@@ -640,6 +653,7 @@ Usage()
     printf("\t   \t--type [vhost|agent|physical|virtual|monitoring]\n");
     printf("\t   \t--xconnect <physical interface name>\n");
     printf("\t   \t--policy, --vhost-phys, --dhcp-enable]\n");
+    printf("\t   \t--coalesce <packets>,<usecs> (0 default, -1 off)]\n");
     printf("\t   \t--vif <vif ID>]\n");
     printf( "[--id <intf_id> --pmd --pci]\n");
     printf("\t   [--delete <intf_id>]\n");
@@ -671,6 +685,7 @@ enum if_opt_index {
     VIF_OPT_INDEX,
     DHCP_OPT_INDEX,
     VHOST_PHYS_OPT_INDEX,
+    COALESCE_OPT_INDEX,
     HELP_OPT_INDEX,
     VINDEX_OPT_INDEX,
     MAX_OPT_INDEX
@@ -695,6 +710,7 @@ static struct option long_options[] = {
     [XCONNECT_OPT_INDEX]    =   {"xconnect",    required_argument,  &xconnect_set,      1},
     [VIF_OPT_INDEX]         =   {"vif",         required_argument,  &vif_set,           1},
     [DHCP_OPT_INDEX]        =   {"dhcp-enable", no_argument,        &dhcp_set,          1},
+    [COALESCE_OPT_INDEX]    =   {"coalesce",    required_argument,  &coalesce_set,      1},
     [HELP_OPT_INDEX]        =   {"help",        no_argument,        &help_set,          1},
     [VINDEX_OPT_INDEX]      =   {"id",          required_argument,  &vindex_set,      1},
     [MAX_OPT_INDEX]         =   { NULL,         0,                  NULL,               0},
@@ -818,6 +834,16 @@ parse_long_opts(int option_index, char *opt_arg)
         vr_ifflags |= VIF_FLAG_VHOST_PHYS;
         break;
 
+    case COALESCE_OPT_INDEX:
+        if ((sscanf(opt_arg, "%d,%d", &irq_coalesce_pkts,
+                        &irq_coalesce_usecs) != 2) ||
+                (irq_coalesce_pkts < VIF_IRQ_COALESCE_OFF) ||
+                (irq_coalesce_pkts > VIF_IRQ_COALESCE_MAX) ||
+                (irq_coalesce_usecs < VIF_IRQ_COALESCE_OFF) ||
+                (irq_coalesce_usecs > VIF_IRQ_COALESCE_MAX))
+            Usage();
+        break;
+
     default:
         break;
     }